@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# bench.sh - runs every wii-bench mode and writes the results as one JSON document.
+#
+#   sudo ./bench.sh [capture] > results.json
+#
+# The driver is rebuilt and reloaded once per ring size (RING_SIZES), and each
+# ring size is run with every read size (READ_SIZES). The driver is left loaded
+# with the default size at the end. Without a capture the decode numbers are
+# skipped. Put the json next to the commit that changes the driver or the client
+# so theres something to compare against.
+#
+# RING_SIZES, READ_SIZES, REPORTS and LATENCY_COUNT can be set in the environment.
+
+set -e
+
+RING_SIZES=${RING_SIZES:-"1024 4096 16384 65536"}
+READ_SIZES=${READ_SIZES:-"64 256 1024 4096"}
+REPORTS=${REPORTS:-100000}
+LATENCY_COUNT=${LATENCY_COUNT:-1000}
+CAPTURE=$1
+MODULE=wii_remote_driver
+
+cd "$(dirname "$0")"
+
+load() {
+    rmmod $MODULE 2>/dev/null || true
+    make RING_SIZE="$1" >&2
+    insmod ./wii-remote-driver.ko
+}
+
+echo "{"
+echo "  \"commit\": \"$(git rev-parse --short HEAD 2>/dev/null || echo unknown)\","
+echo "  \"kernel\": \"$(uname -r)\","
+echo "  \"cpu\": \"$(grep -m1 'model name' /proc/cpuinfo | cut -d: -f2 | sed 's/^ *//')\","
+
+echo "  \"driver\": ["
+first=1
+for ring in $RING_SIZES; do
+    load "$ring"
+    for rs in $READ_SIZES; do
+        [ $first -eq 1 ] || echo ","
+        first=0
+        ./wii-bench driver --reports="$REPORTS" --read-size="$rs"
+    done
+done
+echo "  ],"
+
+load ""
+echo "  \"latency\":"
+./wii-bench latency --count="$LATENCY_COUNT"
+
+if [ -n "$CAPTURE" ]; then
+    echo "  ,\"decode\":"
+    ./wii-bench decode "$CAPTURE"
+fi
+echo "}"
@@ -5,11 +5,23 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <poll.h>
+
+#include "wii-capture.h"
+#include "wii-event.h"
+#include "wii-filter.h"
+#include "wii-gesture.h"
+#include "wii-metrics.h"
+#include "wii-orient.h"
+#include "wii-predict.h"
+#include "wii-shm.h"
 
 #define DEVICE_PATH "/dev/wii_remote"
 #define MAX_READ_SIZE 256
-
-#define WIIMOTE_IOCTL_REQUEST_STATUS _IO('W', 1)
+#define AIR_MOUSE_SCALE 50  // px per radian for each px of move_step, so +/- change it too
 
 
 // Function to simulate mouse movement using xdotool
@@ -47,74 +59,557 @@ void IOCTL_request(int fd){
     }
 }
 
-int main() {
-    int fd = open(DEVICE_PATH, O_RDONLY); // O_RDONLY flag that tells system to opwn in readonly mode
-    if (fd == -1) {
+struct client_state {
+    int fd;
+    int x_pos, y_pos;  // where the buttons say the pointer should be
+    int move_step;  // Number of pixels to move per button press
+    struct wii_filter filter;  // --filter, between x_pos/y_pos and the pointer
+    struct wii_predictor predict[WII_PREDICT_MAPPINGS];  // --predict, after the filter
+    int ptr_x, ptr_y;  // what actually gets sent to xdotool
+    int sent_x, sent_y, sent;  // what xdotool was last run with, once sent is set
+    int can_poll;  // the driver has poll(), otherwise the loop sleeps a fixed time
+    uint64_t dispatch_ns;  // total time spent in actions, so decode timing can leave it out
+    struct wii_capture_writer *recorder;  // NULL unless --record
+    int record_motion;  // the recorder takes motion records off motion_fd, not rebuilt text
+    uint16_t motion_ids;  // bit id - 0x30 set once a record came for that report id
+    int motion_fd;  // -1 unless --air-mouse, --gestures or --record, reads binary records instead of text
+    int air_mouse;
+    struct wii_orient orient;  // --air-mouse, fused from the records
+    int air_have;  // air_last means something
+    double air_last[3];  // orientation the pointer was last moved for
+    struct wii_gesture_bank *gestures;  // NULL unless --gestures
+    struct wii_gesture_segmenter segmenter;
+    struct wii_gesture_params gesture_params;
+    const char *gesture_path;
+    struct wii_gesture_template *gesture_record;  // --gesture-record, what to call the next ones
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int sig)
+{
+    (void)sig;
+    running = 0;  // lets --record flush whats left before we exit
+}
+
+// runs the target through the filter once per sample, t_ns is when the sample happened
+static void update_pointer(struct client_state *cs, uint64_t t_ns)
+{
+    double out[2], vel[2];
+
+    if (!wii_filter_update(&cs->filter, t_ns, 1, cs->x_pos, cs->y_pos, out))
+        return;
+    // the filters velocity is already smoothed, without one the predictor works its own out
+    wii_filter_velocity(&cs->filter, vel);
+    wii_predict_observe(&cs->predict[WII_PREDICT_POINTER], t_ns, out,
+                        cs->filter.p.kind == WII_FILTER_NONE ? NULL : vel);
+}
+
+// where the pointer should be drawn right now, a little ahead if --predict says so
+static void move_pointer(struct client_state *cs)
+{
+    double out[2];
+
+    if (wii_predict_at(&cs->predict[WII_PREDICT_POINTER], wii_now_ns(), out)) {
+        cs->ptr_x = (int)(out[0] + 0.5);
+        cs->ptr_y = (int)(out[1] + 0.5);
+    }
+    // every xdotool is a fork and exec, so only when the pointer has somewhere new to be
+    if (cs->sent && cs->ptr_x == cs->sent_x && cs->ptr_y == cs->sent_y)
+        return;
+    send_mouse_move(cs->ptr_x, cs->ptr_y);
+    cs->sent_x = cs->ptr_x;
+    cs->sent_y = cs->ptr_y;
+    cs->sent = 1;
+}
+
+// the driver makes a record for every report with accel and for reports with a known extension
+static int recorded_as_motion(const struct client_state *cs, const struct wii_event *ev)
+{
+    if (!cs->record_motion || ev->type != WII_EVENT_BUTTONS || ev->report_id < 0x30 || ev->report_id > 0x3f)
+        return 0;
+    return wii_report_has_accel(ev->report_id) || (cs->motion_ids & (1u << (ev->report_id - 0x30)));
+}
+
+// same priority as the old strstr chain, first match wins
+static void handle_event(const struct wii_event *ev, void *ctx)
+{
+    struct client_state *cs = ctx;
+    uint16_t b = ev->buttons;
+    uint64_t start;
+
+    wii_metrics_add(WII_CTR_EVENTS, 1);
+    // gestures arent in the report stream, and reports the records have are taken from there
+    if (cs->recorder && ev->type != WII_EVENT_GESTURE && !recorded_as_motion(cs, ev)) {
+        struct wii_capture_record rec;
+        uint8_t report[WII_CAPTURE_REPORT_MAX];
+        wii_capture_from_event(ev, &rec, report);
+        if (wii_capture_append(cs->recorder, &rec, report) < 0)
+            wii_metrics_add(WII_CTR_DROPS, 1);
+    }
+    if (ev->driver_ns && ev->timestamp_ns > ev->driver_ns)
+        wii_metrics_observe(WII_HIST_EVENT_AGE, ev->timestamp_ns - ev->driver_ns);
+
+    if ((ev->type != WII_EVENT_BUTTONS && ev->type != WII_EVENT_GESTURE) || !(b & WII_BTN_MASK))
+        return;
+    if (ev->type == WII_EVENT_GESTURE)
+        printf("Gesture %s: ", cs->gestures->tpl[ev->gesture].name);  // then does what its button does
+
+    start = wii_now_ns();
+    if (b & WII_BTN_DOWN) {
+        printf("D-Pad Down pressed\n");
+        cs->y_pos += cs->move_step;
+    }
+    else if (b & WII_BTN_UP) {
+        printf("D-Pad Up pressed\n");
+        cs->y_pos -= cs->move_step;
+    }
+    else if (b & WII_BTN_LEFT) {
+        printf("D-Pad Left pressed\n");
+        cs->x_pos -= cs->move_step;
+    }
+    else if (b & WII_BTN_RIGHT) {
+        printf("D-Pad Right pressed\n");
+        cs->x_pos += cs->move_step;
+    }else if (b & WII_BTN_A) {
+        printf("A pressed\n");
+        left_click();
+    }else if (b & WII_BTN_B) {
+        printf("B pressed\n");
+        right_click();
+    }else if(b & WII_BTN_ONE){
+        printf("1 pressed\n");
+        page_up();
+    }else if(b & WII_BTN_TWO){
+        printf("2 pressed\n");
+        page_down();
+    }else if(b & WII_BTN_PLUS){
+        printf("Plus pressed\n");
+        cs->move_step += 5;
+    }else if(b & WII_BTN_MINUS){
+        printf("Minus pressed\n");
+        cs->move_step -= 5;
+    }else if(b & WII_BTN_HOME){
+        printf("Home pressed\n");
+        IOCTL_request(cs->fd);
+    }
+    // driver time when there is one so the filter sees the real spacing between reports
+    update_pointer(cs, ev->driver_ns ? ev->driver_ns : ev->timestamp_ns);
+    uint64_t took = wii_now_ns() - start;
+    cs->dispatch_ns += took;
+    wii_metrics_add(WII_CTR_ACTIONS, 1);
+    wii_metrics_observe(WII_HIST_DISPATCH, took);
+}
+
+// a gesture just ended, either keep it as a template or act on it like a button press
+static void gesture_done(struct client_state *cs, struct wii_gesture_template *g, uint64_t t_ns)
+{
+    struct wii_event ev = { .type = WII_EVENT_GESTURE, .driver_ns = t_ns };
+    uint64_t start = wii_now_ns();
+    float dist;
+    int k;
+
+    if (cs->gesture_record) {
+        memcpy(g->name, cs->gesture_record->name, sizeof(g->name));
+        g->buttons = cs->gesture_record->buttons;
+        if (wii_gesture_save(cs->gesture_path, g) < 0 || wii_gesture_add(cs->gestures, g) < 0)
+            perror("Failed to keep gesture");
+        else
+            printf("Recorded gesture %s (%d templates)\n", g->name, cs->gestures->count);
+        return;
+    }
+
+    k = wii_gesture_match(cs->gestures, g, &cs->gesture_params, &dist);
+    wii_metrics_observe(WII_HIST_GESTURE, wii_now_ns() - start);
+    if (k < 0)
+        return;
+    ev.timestamp_ns = wii_now_ns();
+    ev.buttons = cs->gestures->tpl[k].buttons;
+    ev.gesture = (uint16_t)k;
+    handle_event(&ev, cs);
+}
+
+/*
+ * drains the binary records, one fusion step (--air-mouse) and one segmenter
+ * step (--gestures) per record in the order the driver took them. then the
+ * air mouse moves the pointer target by how much the (predicted) yaw and
+ * pitch changed since last time
+ */
+static void update_motion(struct client_state *cs)
+{
+    struct wii_motion_record recs[32];
+    struct wii_gesture_template g;
+    double angles[3], d;
+    ssize_t n;
+
+    if (cs->motion_fd < 0)
+        return;
+    while ((n = read(cs->motion_fd, recs, sizeof(recs))) > 0) {
+        uint64_t read_ns = wii_now_ns();
+
+        for (size_t i = 0; i < (size_t)n / sizeof(recs[0]); i++) {
+            if (cs->record_motion) {
+                struct wii_capture_record rec;
+
+                if (recs[i].report_id >= 0x30 && recs[i].report_id <= 0x3f)
+                    cs->motion_ids |= 1u << (recs[i].report_id - 0x30);
+                wii_capture_from_motion(&recs[i], read_ns, &rec);
+                if (wii_capture_append(cs->recorder, &rec, (const uint8_t *)&recs[i]) < 0)
+                    wii_metrics_add(WII_CTR_DROPS, 1);
+            }
+            if (cs->gestures && wii_report_has_accel(recs[i].report_id) &&
+                wii_gesture_feed(&cs->segmenter, recs[i].t_ns, recs[i].accel, &g))
+                gesture_done(cs, &g, recs[i].t_ns);
+            if (!cs->air_mouse || !wii_orient_update_record(&cs->orient, &recs[i]))
+                continue;
+            wii_orient_euler(&cs->orient, angles);
+            wii_predict_observe(&cs->predict[WII_PREDICT_ORIENTATION], recs[i].t_ns, angles, NULL);
+            for (int q = 0; q < 4; q++)
+                wii_metrics_set(WII_GAUGE_QUAT_W + q, cs->orient.q[q]);
+            wii_metrics_set(WII_GAUGE_PITCH, angles[0]);
+            wii_metrics_set(WII_GAUGE_ROLL, angles[1]);
+            wii_metrics_set(WII_GAUGE_YAW, angles[2]);
+        }
+        if ((size_t)n < sizeof(recs))
+            break;  // drained
+    }
+
+    if (!cs->air_mouse ||
+        !wii_predict_at(&cs->predict[WII_PREDICT_ORIENTATION], wii_now_ns(), angles))
+        return;
+    if (cs->air_have) {
+        // turning left (yaw up) moves left, tipping the nose up (pitch up) moves up
+        d = remainder(angles[2] - cs->air_last[2], 2.0 * M_PI);
+        cs->x_pos -= (int)lround(d * cs->move_step * AIR_MOUSE_SCALE);
+        d = angles[0] - cs->air_last[0];
+        cs->y_pos -= (int)lround(d * cs->move_step * AIR_MOUSE_SCALE);
+    }
+    cs->air_have = 1;
+    memcpy(cs->air_last, angles, sizeof(angles));
+}
+
+/*
+ * reads events out of wii-daemon's shared ring instead of the device,
+ * so this can run next to other apps that want the remote too
+ */
+static int run_from_daemon(struct client_state *cs, const char *socket_path)
+{
+    const struct wii_shm_ring *ring;
+    struct wii_shm_client *client;
+    struct wii_event ev;
+    uint64_t lost = 0;
+    int sock;
+
+    sock = wii_shm_subscribe(socket_path, 0, &ring, &client);
+    if (sock < 0) {
+        perror("Failed to subscribe to wii-daemon");
+        return 1;
+    }
+
+    while (running && atomic_load(&ring->connected)) {
+        while (wii_shm_next(ring, client, &ev)) {
+            // age at read is when we got it out of the ring, not when the daemon did
+            ev.timestamp_ns = wii_now_ns();
+            handle_event(&ev, cs);
+        }
+        if (atomic_load(&client->lost) != lost) {
+            wii_metrics_add(WII_CTR_DROPS, atomic_load(&client->lost) - lost);
+            lost = atomic_load(&client->lost);
+        }
+        update_motion(cs);
+        update_pointer(cs, wii_now_ns());
+        move_pointer(cs);
+        wii_shm_wait(ring, client, cs->motion_fd >= 0 ? 10 : 100);
+    }
+
+    wii_shm_unsubscribe(sock, ring, client);
+    return 0;
+}
+
+/*
+ * sleeps until the driver has something, or the pointer still has somewhere to
+ * settle and needs its next step. drivers without poll() say readable all the
+ * time so those get the old fixed sleep
+ */
+static void wait_for_input(struct client_state *cs)
+{
+    struct pollfd pfds[2] = { { .fd = cs->fd, .events = POLLIN }, { .fd = cs->motion_fd, .events = POLLIN } };
+    int tick = cs->motion_fd >= 0 ? 10 : 100;  // ms, a frame when motion has to be acted on
+
+    if (!cs->can_poll) {
+        usleep(tick * 1000);
+        return;
+    }
+    // pointer is where the buttons put it, nothing changes until the next event
+    if (cs->sent && cs->sent_x == cs->x_pos && cs->sent_y == cs->y_pos)
+        tick = -1;
+    // a negative fd (no motion_fd) is skipped by poll
+    if (poll(pfds, 2, tick) < 0 && errno != EINTR)
+        usleep(tick > 0 ? tick * 1000 : 100000);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [--daemon[=socket]] [--metrics=socket] [--record=file]\n"
+                    "       [--filter=none|one-euro|kalman[:key=value,...]]\n"
+                    "       [--predict=pointer|orientation:horizon_ms=N[,max_ms=N,smoothing_hz=N]]...\n"
+                    "       [--motionplus[=on|nunchuk|off]]\n"
+                    "       [--air-mouse[=madgwick|mahony[:key=value,...]]]\n"
+                    "       [--gestures=file [--gesture-record=name:button] [--gesture-params=key=value,...]]\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        { "daemon",  optional_argument, NULL, 'd' },
+        { "metrics", required_argument, NULL, 'm' },
+        { "record",  required_argument, NULL, 'r' },
+        { "filter",  required_argument, NULL, 'f' },
+        { "predict", required_argument, NULL, 'p' },
+        { "motionplus", optional_argument, NULL, 'g' },
+        { "air-mouse", optional_argument, NULL, 'a' },
+        { "gestures", required_argument, NULL, 'G' },
+        { "gesture-record", required_argument, NULL, 'R' },
+        { "gesture-params", required_argument, NULL, 'P' },
+        { NULL, 0, NULL, 0 },
+    };
+    struct client_state cs = { .move_step = 20, .motion_fd = -1 };
+    struct wii_filter_params filter;
+    struct wii_predict_params predict[WII_PREDICT_MAPPINGS];
+    struct wii_orient_params orient;
+    struct wii_gesture_template gesture_record;
+    struct wii_line_buf lines = { .len = 0 };
+    struct wii_capture_writer recorder;
+    const char *daemon_socket = NULL;
+    const char *record_path = NULL;
+    int use_daemon = 0, opt, ret = 0;
+    int motionplus = -1;  // -1 leaves it however the driver has it
+    int air_mouse = 0;
+
+    wii_filter_defaults(&filter, WII_FILTER_NONE);
+    wii_orient_defaults(&orient, WII_ORIENT_MADGWICK);
+    wii_gesture_defaults(&cs.gesture_params);
+    for (int m = 0; m < WII_PREDICT_MAPPINGS; m++)
+        wii_predict_defaults(m, &predict[m]);
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            use_daemon = 1;
+            daemon_socket = optarg;
+            break;
+        case 'm':
+            // served from its own thread, scraping never stalls the read loop
+            if (wii_metrics_serve(optarg) < 0) {
+                perror("Failed to start metrics endpoint");
+                return 1;
+            }
+            break;
+        case 'r':
+            record_path = optarg;
+            break;
+        case 'f':
+            if (wii_filter_parse(optarg, &filter) < 0) {
+                fprintf(stderr, "Bad --filter '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'p':
+            // once per mapping, e.g. --predict=pointer:horizon_ms=25
+            if (wii_predict_parse(optarg, predict) < 0) {
+                fprintf(stderr, "Bad --predict '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'g':
+            if (!optarg || strcmp(optarg, "on") == 0)
+                motionplus = WII_MP_ON;
+            else if (strcmp(optarg, "nunchuk") == 0)
+                motionplus = WII_MP_NUNCHUK;
+            else if (strcmp(optarg, "off") == 0)
+                motionplus = WII_MP_OFF;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'a':
+            if (optarg && wii_orient_parse(optarg, &orient) < 0) {
+                fprintf(stderr, "Bad --air-mouse '%s'\n", optarg);
+                return 1;
+            }
+            air_mouse = 1;
+            break;
+        case 'G':
+            cs.gesture_path = optarg;
+            break;
+        case 'R': {
+            // name:button, every gesture from now on is kept as a template for that name
+            char *colon = strchr(optarg, ':');
+            int bit = 16;
+            if (colon && colon != optarg && colon - optarg < WII_GESTURE_NAME_MAX) {
+                memset(&gesture_record, 0, sizeof(gesture_record));
+                memcpy(gesture_record.name, optarg, colon - optarg);
+                for (bit = 0; bit < 16; bit++) {
+                    const char *name = wii_button_name(1u << bit);
+                    if (name && strcmp(name, colon + 1) == 0)
+                        break;
+                }
+            }
+            if (bit == 16) {
+                fprintf(stderr, "Bad --gesture-record '%s', want name:button\n", optarg);
+                return 1;
+            }
+            gesture_record.buttons = 1u << bit;
+            cs.gesture_record = &gesture_record;
+            break;
+        }
+        case 'P':
+            if (wii_gesture_parse(optarg, &cs.gesture_params) < 0) {
+                fprintf(stderr, "Bad --gesture-params '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // the records come off the one record ring, a reader next to the daemon would take half of them off everyone
+    if (use_daemon && air_mouse) {
+        fprintf(stderr, "--air-mouse reads motion records off the device itself, it cant run with --daemon\n");
+        return 1;
+    }
+    if (use_daemon && cs.gesture_path) {
+        fprintf(stderr, "--gestures reads motion records off the device itself, it cant run with --daemon\n");
+        return 1;
+    }
+    if (cs.gesture_record && !cs.gesture_path) {
+        fprintf(stderr, "--gesture-record needs --gestures=file to record into\n");
+        return 1;
+    }
+    if (cs.gesture_path) {
+        cs.gestures = malloc(sizeof(*cs.gestures));
+        if (!cs.gestures)
+            return 1;
+        wii_gesture_bank_init(cs.gestures);
+        if (wii_gesture_load(cs.gestures, cs.gesture_path) < 0) {
+            perror("Failed to load gestures");
+            return 1;
+        }
+        wii_gesture_segmenter_init(&cs.segmenter, &cs.gesture_params);
+        printf("%d gesture templates loaded (%s)\n", cs.gestures->count,
+               wii_gesture_impl_name(wii_gesture_set_impl(WII_GESTURE_AUTO)));
+    }
+
+    // opening without reading doesnt take events off anyone so the daemon mode can still use the ioctl
+    cs.fd = open(DEVICE_PATH, O_RDONLY); // O_RDONLY flag that tells system to opwn in readonly mode
+    if (cs.fd == -1 && !use_daemon) {
         perror("Failed to open device");
         return 1;
     }
+    // what this driver can do, so the records dont get asked of one that only has text
+    struct wii_info info = { .features = WII_FEATURE_TEXT };
+    cs.can_poll = cs.fd != -1 && wii_get_info(cs.fd, &info) == 0 && (info.features & WII_FEATURE_POLL);
+    if (info.abi_version)
+        printf("Driver ABI %u, %u byte text buffer, %u record ring\n",
+               info.abi_version, info.text_buffer_size, info.record_ring_size);
+    if ((air_mouse || cs.gestures) && cs.fd != -1 && !(info.features & WII_FEATURE_RECORDS) && info.abi_version) {
+        fprintf(stderr, "This driver has no motion records, air mouse and gestures need them\n");
+        return 1;
+    }
+    if (air_mouse && motionplus < 0)
+        motionplus = WII_MP_ON;  // no gyro, no air mouse
+    if (motionplus >= 0 && cs.fd != -1 && ioctl(cs.fd, WIIMOTE_IOCTL_SET_MOTIONPLUS, &motionplus) == -1)
+        perror("MotionPlus request failed");  // not fatal, buttons still work without it
+
+    // --record takes the records too when there are any, they have what the text leaves out.
+    // not under --daemon, there is one record ring and a reader of our own would take them off everyone
+    int record_motion = record_path && !use_daemon && cs.fd != -1 && (info.features & WII_FEATURE_RECORDS);
 
+    // the format is per open, so the records get their own fd and the text reader carries on as before
+    if (air_mouse || cs.gestures || record_motion) {
+        int format = WII_FORMAT_RECORDS;
+
+        cs.motion_fd = open(DEVICE_PATH, O_RDONLY);
+        if (cs.motion_fd == -1 || ioctl(cs.motion_fd, WIIMOTE_IOCTL_SET_FORMAT, &format) == -1) {
+            perror("Failed to open motion records");
+            return 1;
+        }
+        cs.air_mouse = air_mouse;
+        wii_orient_init(&cs.orient, &orient);
+    }
+
+
+    if (record_path) {
+        if (wii_capture_open_write(&recorder, record_path) < 0) {
+            perror("Failed to open capture file");
+            return 1;
+        }
+        cs.recorder = &recorder;
+        cs.record_motion = record_motion;
+    }
+
+    wii_filter_init(&cs.filter, &filter);
+    for (int m = 0; m < WII_PREDICT_MAPPINGS; m++)
+        wii_predict_init(&cs.predict[m], m, &predict[m]);
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
 
     printf("Key:\nDpad: move \nA: Left Click \nB: Right Click \n1: Page Up \n2: Page Down \n+: Dpi Up \n-: Dpi Down\nHome: IOCTL Request \n\nReading Wii Remote input...\n");
 
+    if (use_daemon) {
+        ret = run_from_daemon(&cs, daemon_socket);
+        goto out;
+    }
+
     char buffer[MAX_READ_SIZE];
-    int x_pos = 0, y_pos = 0;
-    int move_step = 20;  // Number of pixels to move per button press
+    uint64_t overflows = 0;
 
-    while (1) {
-        ssize_t bytes_read = read(fd, buffer, sizeof(buffer)-1);
+    while (running) {
+        ssize_t bytes_read = read(cs.fd, buffer, sizeof(buffer));
         if (bytes_read < 0) {
+            if (errno == EINTR)
+                continue;
             perror("Error reading from device");
-            close(fd);
+            ret = 1;
             break;
         }
 
-        buffer[bytes_read] = '\0';
-
-
-        // Look for D-pad button presses in the circular buffer      
-        if (strstr(buffer, "Dpad_Down")) {
-            printf("D-Pad Down pressed\n");
-            y_pos += move_step;
-        }
-        else if (strstr(buffer, "Dpad_Up")) {
-            printf("D-Pad Up pressed\n");
-            y_pos -= move_step;
-        }
-        else if (strstr(buffer, "Dpad_Left")) {
-            printf("D-Pad Left pressed\n");
-            x_pos -= move_step;
+        // lines can come across split between reads, the line buffer glues them back together
+        // decode time includes the actions it dispatches so take those back off
+        uint64_t read_ns = wii_now_ns();
+        uint64_t dispatch_before = cs.dispatch_ns;
+        if (bytes_read > 0) {
+            wii_event_feed(&lines, buffer, bytes_read, read_ns, handle_event, &cs);
+            wii_metrics_observe(WII_HIST_DECODE,
+                                wii_now_ns() - read_ns - (cs.dispatch_ns - dispatch_before));
         }
-        else if (strstr(buffer, "Dpad_Right")) {
-            printf("D-Pad Right pressed\n");
-            x_pos += move_step;
-        }else if (strstr(buffer, "A")) {
-            printf("A Right pressed\n");
-            left_click();
-        }else if (strstr(buffer, "B")) {
-            printf("A Right pressed\n");
-            right_click();
-        }else if(strstr(buffer, "1")){
-            printf("1 pressed\n");
-            page_up();
-        }else if(strstr(buffer, "2")){
-            printf("2 pressed");
-            page_down();
-        }else if(strstr(buffer, "Plus")){
-            printf("Plus pressed\n");
-            move_step += 5;
-        }else if(strstr(buffer, "Minus")){
-            printf("Minus pressed");
-            move_step -= 5;
-        }else if(strstr(buffer, "Home")){
-            printf("Home pressed");
-            IOCTL_request(fd);
+        if (lines.overflows != overflows) {
+            wii_metrics_add(WII_CTR_DROPS, lines.overflows - overflows);
+            overflows = lines.overflows;
         }
-        send_mouse_move(x_pos,y_pos);
+        // once per loop too, so the filter keeps settling on the target between presses
+        update_motion(&cs);
+        update_pointer(&cs, wii_now_ns());
+        move_pointer(&cs);
 
-        usleep(100000);  // Sleep for 100ms to avoid overloading CPU
+        wait_for_input(&cs);
     }
 
-    close(fd);
-    return 0;
-}
\ No newline at end of file
+out:
+    if (cs.recorder) {
+        if (wii_capture_close(cs.recorder) < 0)
+            perror("Failed to finish capture file");
+        printf("Recorded %llu events (%llu dropped) to %s\n",
+               (unsigned long long)recorder.records, (unsigned long long)recorder.dropped,
+               record_path);
+    }
+    if (cs.motion_fd != -1)
+        close(cs.motion_fd);
+    free(cs.gestures);
+    if (cs.fd != -1)
+        close(cs.fd);
+    return ret;
+}
@@ -0,0 +1,520 @@
+/*
+ * wii-analyze.c - statistics over lots of archives (wii-pack) at once.
+ *
+ *   wii-analyze [-j threads] [--gap-ms=N] [--json] archive...
+ *
+ * Every block of every archive is its own task. Each worker starts with the
+ * blocks of its share of the files in its own deque, works through them from
+ * the back, and once its out it steals from the front of someone elses deque,
+ * so one huge session doesnt leave the other threads sitting idle.
+ *
+ * Per block it works out button presses, inter-event times, gaps and accel
+ * sums. Holds that start in one block and end in a later one cant be finished
+ * inside a task, so each block also reports the first release of anything held
+ * when it started and the last press still held when it ended, and those get
+ * stitched together per file in block order once all the tasks are done.
+ *
+ * The column loops (press edges, accel sums) are written plain and branch free
+ * so the compiler vectorizes them, this is built with -O3 for that.
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "wii-archive.h"
+#include "wii-event.h"
+#include "wii-metrics.h"
+
+#define DEFAULT_GAP_MS 50
+#define NO_TIME UINT64_MAX
+#define HELD_BEFORE (UINT64_MAX - 1)    /* pressed before this block started */
+
+static const uint16_t button_bits[WII_BTN_COUNT] = {
+    WII_BTN_LEFT, WII_BTN_RIGHT, WII_BTN_DOWN, WII_BTN_UP, WII_BTN_PLUS, WII_BTN_TWO,
+    WII_BTN_ONE, WII_BTN_B, WII_BTN_A, WII_BTN_MINUS, WII_BTN_HOME,
+};
+
+struct axis_stats {
+    uint64_t n;
+    uint64_t sum;
+    uint64_t sumsq;
+    uint16_t min, max;
+};
+
+/* everything that doesnt care about order, one per worker and summed at the end */
+struct stats {
+    uint64_t rows;
+    uint64_t blocks;
+    uint64_t presses[WII_BTN_COUNT];
+    uint64_t holds[WII_BTN_COUNT];
+    uint64_t hold_sum[WII_BTN_COUNT];
+    uint64_t hold_max[WII_BTN_COUNT];
+    uint64_t hold_hist[WII_HIST_BUCKETS];
+    uint64_t delta_hist[WII_HIST_BUCKETS];
+    uint64_t delta_n, delta_sum, delta_max;
+    uint64_t gaps, gap_sum, gap_max;
+    struct axis_stats accel[3];
+};
+
+/* what a block hands on for stitching holds across blocks */
+struct block_result {
+    uint64_t lead_release[WII_BTN_COUNT];   /* first release of a button held at the start */
+    uint64_t tail_press[WII_BTN_COUNT];     /* press still held at the end */
+};
+
+struct file {
+    const char *path;
+    struct wii_archive archive;
+    int ok;
+    struct block_result *blocks;
+};
+
+struct task {
+    uint32_t file;
+    uint64_t block;
+};
+
+struct deque {
+    pthread_mutex_t lock;
+    struct task *tasks;
+    size_t head, tail;  /* owner takes from tail, thieves from head */
+};
+
+struct worker {
+    pthread_t thread;
+    int id;
+    struct deque q;
+    struct stats st;
+    uint64_t stolen;
+};
+
+static struct file *files;
+static int nfiles;
+static struct worker *workers;
+static int nworkers;
+static uint64_t gap_ns = DEFAULT_GAP_MS * 1000000ull;
+
+static int take(struct deque *q, struct task *t, int steal)
+{
+    int ok = 0;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) {
+        *t = steal ? q->tasks[q->head++] : q->tasks[--q->tail];
+        ok = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok;
+}
+
+static void hold_done(struct stats *st, int bit, uint64_t ns)
+{
+    st->holds[bit]++;
+    st->hold_sum[bit] += ns;
+    if (ns > st->hold_max[bit])
+        st->hold_max[bit] = ns;
+    st->hold_hist[wii_hist_bucket(ns)]++;
+}
+
+/* vectorizes: one pass per button over the buttons column */
+static void count_presses(const uint16_t *restrict buttons, uint16_t prev, uint32_t rows,
+                          uint64_t *restrict presses)
+{
+    int bit;
+    uint32_t i;
+
+    for (bit = 0; bit < WII_BTN_COUNT; bit++) {
+        uint16_t mask = button_bits[bit];
+        uint32_t n = (uint32_t)((buttons[0] & ~prev & mask) != 0);
+        for (i = 1; i < rows; i++)
+            n += (uint32_t)((buttons[i] & ~buttons[i - 1] & mask) != 0);
+        presses[bit] += n;
+    }
+}
+
+/* vectorizes: rows without accel get masked out instead of branched around */
+static void accel_stats(const uint16_t *restrict v, const uint8_t *restrict id, uint32_t rows,
+                        struct axis_stats *a)
+{
+    uint64_t n = 0, sum = 0, sumsq = 0;
+    uint16_t mn = 0xffff, mx = 0;
+    uint32_t i;
+
+    for (i = 0; i < rows; i++) {
+        uint32_t has = (id[i] == 0x31) | (id[i] == 0x33) | (id[i] == 0x35) | (id[i] == 0x37);
+        uint32_t x = has ? v[i] : 0;
+        uint16_t lo = has ? v[i] : 0xffff;
+        n += has;
+        sum += x;
+        sumsq += (uint64_t)x * x;
+        mn = lo < mn ? lo : mn;
+        mx = (uint16_t)x > mx ? (uint16_t)x : mx;
+    }
+    if (!n)
+        return;
+    a->n += n;
+    a->sum += sum;
+    a->sumsq += sumsq;
+    if (a->n == n || mn < a->min)
+        a->min = mn;
+    if (mx > a->max)
+        a->max = mx;
+}
+
+static void run_task(struct worker *w, const struct task *t)
+{
+    struct file *f = &files[t->file];
+    struct block_result *res = &f->blocks[t->block];
+    struct stats *st = &w->st;
+    struct wii_archive_block b, prev_b;
+    uint64_t press_t[WII_BTN_COUNT];
+    uint64_t prev_t;
+    uint16_t prev;
+    uint32_t i;
+    int bit, axis;
+
+    wii_archive_block(&f->archive, t->block, &b);
+
+    /* the row before this block, straight out of the previous block's columns */
+    if (t->block > 0) {
+        wii_archive_block(&f->archive, t->block - 1, &prev_b);
+        prev = prev_b.buttons[prev_b.rows - 1];
+        prev_t = prev_b.t_ns[prev_b.rows - 1];
+    } else {
+        prev = b.buttons[0]; /* held at the very start isnt a press we saw */
+        prev_t = b.t_ns[0];
+    }
+
+    st->rows += b.rows;
+    st->blocks++;
+    count_presses(b.buttons, prev, b.rows, st->presses);
+    for (axis = 0; axis < 3; axis++)
+        accel_stats(b.accel[axis], b.report_id, b.rows, &st->accel[axis]);
+
+    for (bit = 0; bit < WII_BTN_COUNT; bit++) {
+        press_t[bit] = (prev & button_bits[bit]) ? HELD_BEFORE : NO_TIME;
+        res->lead_release[bit] = NO_TIME;
+        res->tail_press[bit] = NO_TIME;
+    }
+
+    for (i = 0; i < b.rows; i++) {
+        uint64_t delta = b.t_ns[i] - prev_t;
+        uint16_t changed = b.buttons[i] ^ prev;
+
+        if (i > 0 || t->block > 0) {
+            st->delta_hist[wii_hist_bucket(delta)]++;
+            st->delta_n++;
+            st->delta_sum += delta;
+            if (delta > st->delta_max)
+                st->delta_max = delta;
+            if (delta > gap_ns) {
+                st->gaps++;
+                st->gap_sum += delta;
+                if (delta > st->gap_max)
+                    st->gap_max = delta;
+            }
+        }
+
+        /* holds only need looking at where something changed, which is rare */
+        if (changed) {
+            for (bit = 0; bit < WII_BTN_COUNT; bit++) {
+                if (!(changed & button_bits[bit]))
+                    continue;
+                if (b.buttons[i] & button_bits[bit]) {
+                    press_t[bit] = b.t_ns[i];
+                } else if (press_t[bit] == HELD_BEFORE) {
+                    res->lead_release[bit] = b.t_ns[i];
+                    press_t[bit] = NO_TIME;
+                } else if (press_t[bit] != NO_TIME) {
+                    hold_done(st, bit, b.t_ns[i] - press_t[bit]);
+                    press_t[bit] = NO_TIME;
+                }
+            }
+        }
+        prev = b.buttons[i];
+        prev_t = b.t_ns[i];
+    }
+
+    for (bit = 0; bit < WII_BTN_COUNT; bit++)
+        if (press_t[bit] != NO_TIME && press_t[bit] != HELD_BEFORE)
+            res->tail_press[bit] = press_t[bit];
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct task t;
+    int i;
+
+    for (;;) {
+        if (take(&w->q, &t, 0)) {
+            run_task(w, &t);
+            continue;
+        }
+        /* ours are done, nothing new ever gets queued so if nobody has any left we're finished */
+        for (i = 1; i < nworkers; i++) {
+            if (take(&workers[(w->id + i) % nworkers].q, &t, 1)) {
+                w->stolen++;
+                run_task(w, &t);
+                break;
+            }
+        }
+        if (i == nworkers)
+            break;
+    }
+    return NULL;
+}
+
+/* holds that crossed a block boundary, has to go through each file's blocks in order */
+static void stitch_holds(struct stats *st)
+{
+    int fi, bit;
+    uint64_t b;
+
+    for (fi = 0; fi < nfiles; fi++) {
+        uint64_t open[WII_BTN_COUNT];
+
+        if (!files[fi].ok)
+            continue;
+        for (bit = 0; bit < WII_BTN_COUNT; bit++)
+            open[bit] = NO_TIME;
+
+        for (b = 0; b < wii_archive_block_count(&files[fi].archive); b++) {
+            const struct block_result *res = &files[fi].blocks[b];
+            for (bit = 0; bit < WII_BTN_COUNT; bit++) {
+                if (res->lead_release[bit] != NO_TIME) {
+                    if (open[bit] != NO_TIME)
+                        hold_done(st, bit, res->lead_release[bit] - open[bit]);
+                    open[bit] = NO_TIME;
+                }
+                if (res->tail_press[bit] != NO_TIME)
+                    open[bit] = res->tail_press[bit];
+            }
+        }
+    }
+}
+
+static void stats_add(struct stats *dst, const struct stats *src)
+{
+    int i;
+
+    dst->rows += src->rows;
+    dst->blocks += src->blocks;
+    for (i = 0; i < WII_BTN_COUNT; i++) {
+        dst->presses[i] += src->presses[i];
+        dst->holds[i] += src->holds[i];
+        dst->hold_sum[i] += src->hold_sum[i];
+        if (src->hold_max[i] > dst->hold_max[i])
+            dst->hold_max[i] = src->hold_max[i];
+    }
+    for (i = 0; i < WII_HIST_BUCKETS; i++) {
+        dst->hold_hist[i] += src->hold_hist[i];
+        dst->delta_hist[i] += src->delta_hist[i];
+    }
+    dst->delta_n += src->delta_n;
+    dst->delta_sum += src->delta_sum;
+    if (src->delta_max > dst->delta_max)
+        dst->delta_max = src->delta_max;
+    dst->gaps += src->gaps;
+    dst->gap_sum += src->gap_sum;
+    if (src->gap_max > dst->gap_max)
+        dst->gap_max = src->gap_max;
+    for (i = 0; i < 3; i++) {
+        const struct axis_stats *s = &src->accel[i];
+        struct axis_stats *d = &dst->accel[i];
+        if (!s->n)
+            continue;
+        if (!d->n || s->min < d->min)
+            d->min = s->min;
+        if (s->max > d->max)
+            d->max = s->max;
+        d->n += s->n;
+        d->sum += s->sum;
+        d->sumsq += s->sumsq;
+    }
+}
+
+static double percentile_ms(const uint64_t *hist, uint64_t n, uint64_t max, double p)
+{
+    uint64_t want = (uint64_t)(p * n), seen = 0;
+    int b;
+
+    for (b = 0; b < WII_HIST_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen > want) {
+            uint64_t v = wii_hist_bucket_max(b);
+            return (v < max ? v : max) / 1e6;
+        }
+    }
+    return max / 1e6;
+}
+
+static void print_text(const struct stats *st, double wall_s, uint64_t stolen)
+{
+    int i;
+
+    printf("files: %d  blocks: %llu  rows: %llu  threads: %d  stolen: %llu  wall: %.3f s\n\n",
+           nfiles, (unsigned long long)st->blocks, (unsigned long long)st->rows, nworkers,
+           (unsigned long long)stolen, wall_s);
+
+    printf("%-10s %10s %10s %12s %12s\n", "button", "presses", "holds", "mean_ms", "max_ms");
+    for (i = 0; i < WII_BTN_COUNT; i++)
+        printf("%-10s %10llu %10llu %12.1f %12.1f\n", wii_button_name(button_bits[i]),
+               (unsigned long long)st->presses[i], (unsigned long long)st->holds[i],
+               st->holds[i] ? st->hold_sum[i] / 1e6 / st->holds[i] : 0.0,
+               st->hold_max[i] / 1e6);
+
+    printf("\ninter-event ms: mean %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+           st->delta_n ? st->delta_sum / 1e6 / st->delta_n : 0.0,
+           percentile_ms(st->delta_hist, st->delta_n, st->delta_max, 0.50),
+           percentile_ms(st->delta_hist, st->delta_n, st->delta_max, 0.90),
+           percentile_ms(st->delta_hist, st->delta_n, st->delta_max, 0.99),
+           st->delta_max / 1e6);
+    printf("gaps over %.0f ms: %llu, total %.3f s, longest %.3f s\n", gap_ns / 1e6,
+           (unsigned long long)st->gaps, st->gap_sum / 1e9, st->gap_max / 1e9);
+
+    for (i = 0; i < 3; i++) {
+        const struct axis_stats *a = &st->accel[i];
+        double mean = a->n ? (double)a->sum / a->n : 0;
+        double var = a->n ? (double)a->sumsq / a->n - mean * mean : 0;
+        printf("accel %c: n %llu mean %.1f sd %.1f min %u max %u\n", "xyz"[i],
+               (unsigned long long)a->n, mean, var > 0 ? __builtin_sqrt(var) : 0.0,
+               a->n ? a->min : 0, a->max);
+    }
+}
+
+static void print_json(const struct stats *st, double wall_s)
+{
+    int i;
+
+    printf("{\"files\":%d,\"blocks\":%llu,\"rows\":%llu,\"threads\":%d,\"wall_s\":%.6f,\"buttons\":{",
+           nfiles, (unsigned long long)st->blocks, (unsigned long long)st->rows, nworkers, wall_s);
+    for (i = 0; i < WII_BTN_COUNT; i++)
+        printf("%s\"%s\":{\"presses\":%llu,\"holds\":%llu,\"hold_mean_ms\":%.3f,\"hold_max_ms\":%.3f}",
+               i ? "," : "", wii_button_name(button_bits[i]), (unsigned long long)st->presses[i],
+               (unsigned long long)st->holds[i],
+               st->holds[i] ? st->hold_sum[i] / 1e6 / st->holds[i] : 0.0, st->hold_max[i] / 1e6);
+    printf("},\"inter_event_ms\":{\"mean\":%.6f,\"p50\":%.6f,\"p99\":%.6f,\"max\":%.6f}",
+           st->delta_n ? st->delta_sum / 1e6 / st->delta_n : 0.0,
+           percentile_ms(st->delta_hist, st->delta_n, st->delta_max, 0.50),
+           percentile_ms(st->delta_hist, st->delta_n, st->delta_max, 0.99), st->delta_max / 1e6);
+    printf(",\"gaps\":{\"threshold_ms\":%.3f,\"count\":%llu,\"total_s\":%.6f,\"max_s\":%.6f}",
+           gap_ns / 1e6, (unsigned long long)st->gaps, st->gap_sum / 1e9, st->gap_max / 1e9);
+    printf(",\"accel\":[");
+    for (i = 0; i < 3; i++) {
+        const struct axis_stats *a = &st->accel[i];
+        double mean = a->n ? (double)a->sum / a->n : 0;
+        double var = a->n ? (double)a->sumsq / a->n - mean * mean : 0;
+        printf("%s{\"n\":%llu,\"mean\":%.3f,\"sd\":%.3f,\"min\":%u,\"max\":%u}", i ? "," : "",
+               (unsigned long long)a->n, mean, var > 0 ? __builtin_sqrt(var) : 0.0,
+               a->n ? a->min : 0, a->max);
+    }
+    printf("]}\n");
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "gap-ms", required_argument, NULL, 'g' },
+        { "json",   no_argument,       NULL, 'J' },
+        { NULL, 0, NULL, 0 },
+    };
+    struct stats total;
+    uint64_t start, stolen = 0, tasks = 0;
+    int opt, i, json = 0;
+
+    nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt_long(argc, argv, "j:", options, NULL)) != -1) {
+        switch (opt) {
+        case 'j': nworkers = atoi(optarg); break;
+        case 'g': gap_ns = (uint64_t)(atof(optarg) * 1e6); break;
+        case 'J': json = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-j threads] [--gap-ms=N] [--json] archive...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-j threads] [--gap-ms=N] [--json] archive...\n", argv[0]);
+        return 1;
+    }
+    if (nworkers < 1)
+        nworkers = 1;
+
+    nfiles = argc - optind;
+    files = calloc(nfiles, sizeof(*files));
+    workers = calloc(nworkers, sizeof(*workers));
+    if (!files || !workers) {
+        perror("calloc");
+        return 1;
+    }
+
+    start = wii_now_ns();
+
+    for (i = 0; i < nfiles; i++) {
+        files[i].path = argv[optind + i];
+        if (wii_archive_open(&files[i].archive, files[i].path) < 0) {
+            perror(files[i].path);
+            continue;
+        }
+        files[i].blocks = calloc(wii_archive_block_count(&files[i].archive) + 1,
+                                 sizeof(*files[i].blocks));
+        if (!files[i].blocks) {
+            perror("calloc");
+            return 1;
+        }
+        files[i].ok = 1;
+        tasks += wii_archive_block_count(&files[i].archive);
+    }
+
+    /* each worker gets whole files to start with, stealing evens it out from there */
+    for (i = 0; i < nworkers; i++) {
+        workers[i].id = i;
+        pthread_mutex_init(&workers[i].q.lock, NULL);
+        workers[i].q.tasks = calloc(tasks + 1, sizeof(struct task));
+        if (!workers[i].q.tasks) {
+            perror("calloc");
+            return 1;
+        }
+    }
+    for (i = 0; i < nfiles; i++) {
+        struct deque *q = &workers[i % nworkers].q;
+        uint64_t b;
+        if (!files[i].ok)
+            continue;
+        /* pushed in reverse so the owner (popping from the tail) goes through the file front to back */
+        for (b = wii_archive_block_count(&files[i].archive); b-- > 0;)
+            q->tasks[q->tail++] = (struct task){ .file = (uint32_t)i, .block = b };
+    }
+
+    for (i = 0; i < nworkers; i++)
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < nworkers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        stats_add(&total, &workers[i].st);
+        stolen += workers[i].stolen;
+    }
+    stitch_holds(&total);
+
+    if (json)
+        print_json(&total, (wii_now_ns() - start) / 1e9);
+    else
+        print_text(&total, (wii_now_ns() - start) / 1e9, stolen);
+
+    for (i = 0; i < nfiles; i++) {
+        if (files[i].ok)
+            wii_archive_close(&files[i].archive);
+        free(files[i].blocks);
+    }
+    for (i = 0; i < nworkers; i++)
+        free(workers[i].q.tasks);
+    free(workers);
+    free(files);
+    return 0;
+}
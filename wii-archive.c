@@ -0,0 +1,329 @@
+/*
+ * wii-archive.c - writer and mmap reader for the archive format, see wii-archive.h
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "wii-archive.h"
+
+void wii_archive_layout(uint32_t block_rows, struct wii_archive_layout *l)
+{
+    size_t off = 0;
+    int i;
+
+    l->t_ns = off;     off += (size_t)block_rows * 8;
+    l->buttons = off;  off += (size_t)block_rows * 2;
+    for (i = 0; i < 3; i++) {
+        l->accel[i] = off;
+        off += (size_t)block_rows * 2;
+    }
+    for (i = 0; i < WII_IR_BLOBS; i++) {
+        l->ir_x[i] = off;
+        off += (size_t)block_rows * 2;
+    }
+    for (i = 0; i < WII_IR_BLOBS; i++) {
+        l->ir_y[i] = off;
+        off += (size_t)block_rows * 2;
+    }
+    for (i = 0; i < WII_IR_BLOBS; i++) {
+        l->ir_size[i] = off;
+        off += block_rows;
+    }
+    l->report_id = off; off += block_rows;
+    l->block_size = off;
+}
+
+static int pwrite_all(int fd, const void *data, size_t len, uint64_t offset)
+{
+    const uint8_t *p = data;
+
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+int wii_archive_create(struct wii_archive_writer *w, const char *path, uint32_t block_rows,
+                       uint64_t start_realtime_ns, uint64_t start_monotonic_ns)
+{
+    struct wii_archive_layout l;
+    uint8_t page[WII_ARCHIVE_PAGE] = { 0 };
+    struct wii_archive_header *header = (struct wii_archive_header *)page;
+
+    memset(w, 0, sizeof(*w));
+    if (block_rows == 0)
+        block_rows = WII_ARCHIVE_BLOCK_ROWS;
+    if (block_rows % WII_ARCHIVE_PAGE) { /* keeps every block page aligned */
+        errno = EINVAL;
+        return -1;
+    }
+    wii_archive_layout(block_rows, &l);
+
+    w->block_rows = block_rows;
+    w->t_min = UINT64_MAX;
+    w->block = calloc(1, l.block_size);
+    if (!w->block)
+        return -1;
+
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->fd < 0) {
+        free(w->block);
+        return -1;
+    }
+
+    memcpy(header->magic, WII_ARCHIVE_MAGIC, sizeof(header->magic));
+    header->version = WII_ARCHIVE_VERSION;
+    header->block_rows = block_rows;
+    header->start_realtime_ns = start_realtime_ns;
+    header->start_monotonic_ns = start_monotonic_ns;
+    if (pwrite_all(w->fd, page, sizeof(page), 0) < 0) {
+        close(w->fd);
+        free(w->block);
+        return -1;
+    }
+    w->offset = WII_ARCHIVE_PAGE;
+    return 0;
+}
+
+static int flush_block(struct wii_archive_writer *w)
+{
+    struct wii_archive_layout l;
+    struct wii_archive_index *idx;
+    const uint64_t *t;
+
+    if (w->rows == 0)
+        return 0;
+    wii_archive_layout(w->block_rows, &l);
+
+    if (w->block_count == w->index_cap) {
+        uint64_t cap = w->index_cap ? w->index_cap * 2 : 64;
+        idx = realloc(w->index, cap * sizeof(*idx));
+        if (!idx)
+            return -1;
+        w->index = idx;
+        w->index_cap = cap;
+    }
+
+    /* the whole block goes out, unused rows and all, so the maths stays simple for readers */
+    if (pwrite_all(w->fd, w->block, l.block_size, w->offset) < 0)
+        return -1;
+
+    t = (const uint64_t *)(w->block + l.t_ns);
+    idx = &w->index[w->block_count++];
+    memset(idx, 0, sizeof(*idx));
+    idx->t_first = t[0];
+    idx->t_last = t[w->rows - 1];
+    idx->offset = w->offset;
+    idx->rows = w->rows;
+
+    w->offset += l.block_size;
+    w->rows = 0;
+    memset(w->block, 0, l.block_size);
+    return 0;
+}
+
+int wii_archive_append(struct wii_archive_writer *w, const struct wii_archive_row *row)
+{
+    struct wii_archive_layout l;
+    uint32_t r = w->rows;
+    int i;
+
+    if (w->total_rows && row->t_ns < w->t_max) {
+        errno = EINVAL;
+        return -1;
+    }
+    wii_archive_layout(w->block_rows, &l);
+
+    ((uint64_t *)(w->block + l.t_ns))[r] = row->t_ns;
+    ((uint16_t *)(w->block + l.buttons))[r] = row->buttons;
+    for (i = 0; i < 3; i++)
+        ((uint16_t *)(w->block + l.accel[i]))[r] = row->accel[i];
+    for (i = 0; i < WII_IR_BLOBS; i++) {
+        ((uint16_t *)(w->block + l.ir_x[i]))[r] = row->ir_x[i];
+        ((uint16_t *)(w->block + l.ir_y[i]))[r] = row->ir_y[i];
+        (w->block + l.ir_size[i])[r] = row->ir_size[i];
+    }
+    (w->block + l.report_id)[r] = row->report_id;
+
+    if (row->t_ns < w->t_min)
+        w->t_min = row->t_ns;
+    w->t_max = row->t_ns;
+    w->total_rows++;
+
+    if (++w->rows == w->block_rows)
+        return flush_block(w);
+    return 0;
+}
+
+int wii_archive_finish(struct wii_archive_writer *w)
+{
+    struct wii_archive_footer footer = { .version = WII_ARCHIVE_VERSION };
+    size_t index_size;
+    int ret = -1;
+
+    if (flush_block(w) < 0)
+        goto out;
+
+    index_size = w->block_count * sizeof(*w->index);
+    if (index_size && pwrite_all(w->fd, w->index, index_size, w->offset) < 0)
+        goto out;
+
+    memcpy(footer.magic, WII_ARCHIVE_FOOTER_MAGIC, sizeof(footer.magic));
+    footer.block_rows = w->block_rows;
+    footer.block_count = w->block_count;
+    footer.index_offset = w->offset;
+    footer.total_rows = w->total_rows;
+    footer.t_min = w->total_rows ? w->t_min : 0;
+    footer.t_max = w->t_max;
+    if (pwrite_all(w->fd, &footer, sizeof(footer), w->offset + index_size) < 0)
+        goto out;
+    if (fsync(w->fd) < 0)
+        goto out;
+    ret = 0;
+
+out:
+    if (close(w->fd) < 0)
+        ret = -1;
+    free(w->block);
+    free(w->index);
+    w->block = NULL;
+    w->index = NULL;
+    w->fd = -1;
+    return ret;
+}
+
+int wii_archive_open(struct wii_archive *a, const char *path)
+{
+    struct wii_archive_layout l;
+    struct stat st;
+    uint64_t i;
+    int fd;
+
+    memset(a, 0, sizeof(*a));
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < WII_ARCHIVE_PAGE + sizeof(struct wii_archive_footer)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    a->size = (size_t)st.st_size;
+    a->map = mmap(NULL, a->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); /* the mapping keeps the file alive */
+    if (a->map == MAP_FAILED) {
+        a->map = NULL;
+        return -1;
+    }
+
+    a->header = (const struct wii_archive_header *)a->map;
+    a->footer = (const struct wii_archive_footer *)(a->map + a->size - sizeof(*a->footer));
+    if (memcmp(a->header->magic, WII_ARCHIVE_MAGIC, 8) != 0 ||
+        memcmp(a->footer->magic, WII_ARCHIVE_FOOTER_MAGIC, 8) != 0 ||
+        a->header->version != WII_ARCHIVE_VERSION ||
+        a->footer->block_rows != a->header->block_rows ||
+        a->footer->block_rows == 0 || a->footer->block_rows % WII_ARCHIVE_PAGE)
+        goto invalid;
+
+    /* index has to fit between the blocks and the footer */
+    if (a->footer->index_offset > a->size ||
+        a->footer->block_count > (a->size - a->footer->index_offset) / sizeof(*a->index) ||
+        a->footer->index_offset + a->footer->block_count * sizeof(*a->index) + sizeof(*a->footer)
+            != a->size)
+        goto invalid;
+    a->index = (const struct wii_archive_index *)(a->map + a->footer->index_offset);
+
+    wii_archive_layout(a->footer->block_rows, &l);
+    for (i = 0; i < a->footer->block_count; i++) {
+        const struct wii_archive_index *idx = &a->index[i];
+        if (idx->offset % WII_ARCHIVE_PAGE || idx->offset + l.block_size > a->footer->index_offset ||
+            idx->rows == 0 || idx->rows > a->footer->block_rows || idx->t_first > idx->t_last ||
+            (i > 0 && idx->t_first < a->index[i - 1].t_last))
+            goto invalid;
+    }
+    return 0;
+
+invalid:
+    wii_archive_close(a);
+    errno = EINVAL;
+    return -1;
+}
+
+void wii_archive_close(struct wii_archive *a)
+{
+    if (a->map)
+        munmap((void *)a->map, a->size);
+    memset(a, 0, sizeof(*a));
+}
+
+void wii_archive_block(const struct wii_archive *a, uint64_t i, struct wii_archive_block *b)
+{
+    const uint8_t *base = a->map + a->index[i].offset;
+    struct wii_archive_layout l;
+    int j;
+
+    wii_archive_layout(a->footer->block_rows, &l);
+    b->rows = a->index[i].rows;
+    b->t_ns = (const uint64_t *)(base + l.t_ns);
+    b->buttons = (const uint16_t *)(base + l.buttons);
+    for (j = 0; j < 3; j++)
+        b->accel[j] = (const uint16_t *)(base + l.accel[j]);
+    for (j = 0; j < WII_IR_BLOBS; j++) {
+        b->ir_x[j] = (const uint16_t *)(base + l.ir_x[j]);
+        b->ir_y[j] = (const uint16_t *)(base + l.ir_y[j]);
+        b->ir_size[j] = base + l.ir_size[j];
+    }
+    b->report_id = base + l.report_id;
+}
+
+int wii_archive_seek(const struct wii_archive *a, uint64_t t_ns, uint64_t *block, uint32_t *row)
+{
+    uint64_t lo = 0, hi = a->footer->block_count;
+    struct wii_archive_block b;
+    uint32_t rlo, rhi;
+
+    /* first block that ends at or after t_ns */
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (a->index[mid].t_last < t_ns)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == a->footer->block_count)
+        return -1;
+
+    /* then the first row in it at or after t_ns, only this block's t_ns column gets touched */
+    wii_archive_block(a, lo, &b);
+    rlo = 0;
+    rhi = b.rows;
+    while (rlo < rhi) {
+        uint32_t mid = rlo + (rhi - rlo) / 2;
+        if (b.t_ns[mid] < t_ns)
+            rlo = mid + 1;
+        else
+            rhi = mid;
+    }
+    *block = lo;
+    *row = rlo;
+    return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * wii-archive.h - indexed, mmap-able archive format for recorded sessions.
+ *
+ * Captures from --record are a stream of variable length records, fine for
+ * writing but to find one minute in a month of sessions you have to read the
+ * whole thing. Archives are for keeping: every field is a fixed size column so
+ * the file can be mmapped and jumped around in by time.
+ *
+ * Layout, little endian, every offset a multiple of 4096:
+ *
+ *   header     struct wii_archive_header, padded to 4096 bytes
+ *   block 0    block_rows rows, one column after the other:
+ *                t_ns       u64 [rows]
+ *                buttons    u16 [rows]   WII_BTN_* bits
+ *                accel_x    u16 [rows]   10 bit, 0 if the report had none
+ *                accel_y    u16 [rows]
+ *                accel_z    u16 [rows]
+ *                ir_x[4]    u16 [rows]   each blob is its own column, WII_IR_MISSING if unseen
+ *                ir_y[4]    u16 [rows]
+ *                ir_size[4] u8  [rows]
+ *                report_id  u8  [rows]
+ *   block 1    ...
+ *   index      struct wii_archive_index [block_count], one per block
+ *   footer     struct wii_archive_footer, the last 64 bytes of the file
+ *
+ * Every block is the full size even if its only partly used (the last one
+ * usually is), so finding a column is just arithmetic. Rows are in time order,
+ * so the index gives the time range of each block and a binary search over it
+ * and then over one block's t_ns column finds any moment without touching the
+ * rest of the file.
+ *
+ * The footer goes last so a file that was being written when the machine died
+ * has no footer and is refused instead of being read half finished.
+ */
+
+#ifndef WII_ARCHIVE_H
+#define WII_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wii-event.h"
+
+#define WII_ARCHIVE_MAGIC        "WIIARC01"
+#define WII_ARCHIVE_FOOTER_MAGIC "WIIARCFT"
+#define WII_ARCHIVE_VERSION      1
+#define WII_ARCHIVE_PAGE         4096
+#define WII_ARCHIVE_BLOCK_ROWS   4096   /* default, has to be a multiple of WII_ARCHIVE_PAGE */
+#define WII_ARCHIVE_ROW_BYTES    (8 + 2 + 3 * 2 + WII_IR_BLOBS * (2 + 2 + 1) + 1)
+
+struct wii_archive_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t block_rows;
+    uint64_t start_realtime_ns;     /* wall clock of the first row, from the capture */
+    uint64_t start_monotonic_ns;    /* the same moment on the clock t_ns uses */
+    uint8_t  reserved[32];
+} __attribute__((packed));
+
+struct wii_archive_index {
+    uint64_t t_first;
+    uint64_t t_last;
+    uint64_t offset;                /* of the block from the start of the file */
+    uint32_t rows;
+    uint32_t reserved;
+} __attribute__((packed));
+
+struct wii_archive_footer {
+    char     magic[8];
+    uint32_t version;
+    uint32_t block_rows;
+    uint64_t block_count;
+    uint64_t index_offset;
+    uint64_t total_rows;
+    uint64_t t_min;
+    uint64_t t_max;
+    uint8_t  reserved[8];
+} __attribute__((packed));
+
+/* one row, only used when writing, readers get the columns directly */
+struct wii_archive_row {
+    uint64_t t_ns;
+    uint16_t buttons;
+    uint16_t accel[3];
+    uint16_t ir_x[WII_IR_BLOBS];
+    uint16_t ir_y[WII_IR_BLOBS];
+    uint8_t  ir_size[WII_IR_BLOBS];
+    uint8_t  report_id;
+};
+
+/* pointers straight into the mapping for one block */
+struct wii_archive_block {
+    uint32_t rows;
+    const uint64_t *t_ns;
+    const uint16_t *buttons;
+    const uint16_t *accel[3];
+    const uint16_t *ir_x[WII_IR_BLOBS];
+    const uint16_t *ir_y[WII_IR_BLOBS];
+    const uint8_t  *ir_size[WII_IR_BLOBS];
+    const uint8_t  *report_id;
+};
+
+struct wii_archive_writer {
+    int fd;
+    uint32_t block_rows;
+    uint8_t *block;                 /* the block being filled */
+    uint32_t rows;                  /* rows in it so far */
+    struct wii_archive_index *index;
+    uint64_t block_count;
+    uint64_t index_cap;
+    uint64_t total_rows;
+    uint64_t t_min, t_max;
+    uint64_t offset;                /* where the next block goes */
+};
+
+struct wii_archive {
+    const uint8_t *map;
+    size_t size;
+    const struct wii_archive_header *header;
+    const struct wii_archive_footer *footer;
+    const struct wii_archive_index *index;
+};
+
+/* block_rows 0 means WII_ARCHIVE_BLOCK_ROWS */
+int wii_archive_create(struct wii_archive_writer *w, const char *path, uint32_t block_rows,
+                       uint64_t start_realtime_ns, uint64_t start_monotonic_ns);
+
+/* rows have to come in time order, returns -1 with errno EINVAL if one goes backwards */
+int wii_archive_append(struct wii_archive_writer *w, const struct wii_archive_row *row);
+
+/* writes the last block, the index and the footer, closes the file */
+int wii_archive_finish(struct wii_archive_writer *w);
+
+/* maps the file read only and checks the footer and index make sense */
+int wii_archive_open(struct wii_archive *a, const char *path);
+void wii_archive_close(struct wii_archive *a);
+
+static inline uint64_t wii_archive_block_count(const struct wii_archive *a)
+{
+    return a->footer->block_count;
+}
+
+/* fills in the column pointers for block i */
+void wii_archive_block(const struct wii_archive *a, uint64_t i, struct wii_archive_block *b);
+
+/*
+ * finds the first row at or after t_ns. returns 0 with *block and *row set,
+ * -1 if every row is before t_ns
+ */
+int wii_archive_seek(const struct wii_archive *a, uint64_t t_ns, uint64_t *block, uint32_t *row);
+
+/* byte offset of each column inside a block, shared by the writer and the reader */
+struct wii_archive_layout {
+    size_t t_ns, buttons, accel[3], ir_x[WII_IR_BLOBS], ir_y[WII_IR_BLOBS];
+    size_t ir_size[WII_IR_BLOBS], report_id, block_size;
+};
+void wii_archive_layout(uint32_t block_rows, struct wii_archive_layout *l);
+
+#endif /* WII_ARCHIVE_H */
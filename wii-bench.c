@@ -0,0 +1,702 @@
+/*
+ * wii-bench.c - benchmarks for the driver, the client decoder and the whole pipeline.
+ *
+ *   wii-bench driver  [--reports=N] [--read-size=N] [--rate=HZ]
+ *       a pretend remote on /dev/uhid sends N button reports through the real
+ *       driver while a second thread reads /dev/wii_remote read-size bytes at a
+ *       time. reports/s, cpu per report on each side and how many got dropped.
+ *       the ring size comes from /proc/wii_remote, rebuild with make RING_SIZE=N
+ *       to change it (bench.sh does the sweep)
+ *
+ *   wii-bench decode  [--iterations=N] capture
+ *       how fast the client side decodes a recorded stream: the text lines the
+ *       driver would have printed through wii_event_feed(), the raw reports
+ *       through wii_decode_batch() with every implementation the cpu has, and
+ *       the IR pointer through each wii_filter
+ *
+ *   wii-bench latency [--count=N] [--gap-us=N]
+ *       press to evdev: a report goes in through uhid, comes out of
+ *       /dev/wii_remote, gets decoded and turned into a key on a uinput device,
+ *       and the time is taken when that key arrives on the device's evdev node.
+ *       split into stages with the driver's T= timestamp
+ *
+ * Every mode prints one JSON object on stdout, anything for humans goes to
+ * stderr. Needs root for uhid/uinput and the driver loaded, and nothing else
+ * (mouse_test, wii-daemon) reading /dev/wii_remote at the same time or it
+ * steals the lines.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wii-capture.h"
+#include "wii-decode.h"
+#include "wii-event.h"
+#include "wii-filter.h"
+#include "wii-uhid.h"
+
+#define DEVICE_PATH "/dev/wii_remote"
+#define PROC_PATH "/proc/wii_remote"
+#define UHID_START_TIMEOUT_MS 2000
+#define UHID_DRAIN_EVERY 32
+#define READ_SIZE_MAX 65536
+#define DRAIN_IDLE_NS 200000000ull  /* reader gives up this long after the last report went in */
+#define EVDEV_TIMEOUT_MS 1000
+
+/* --- bits everyone uses --- */
+
+static uint64_t thread_cpu_ns(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_THREAD, &ru);
+    return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ull +
+           (uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ull;
+}
+
+/* pulls "  <key>: <n>" out of /proc/wii_remote, -1 if the driver isnt there or doesnt print it */
+static long long proc_value(const char *key)
+{
+    char line[128];
+    size_t klen = strlen(key);
+    long long v = -1;
+    FILE *f = fopen(PROC_PATH, "r");
+
+    if (!f)
+        return -1;
+    while (fgets(line, sizeof(line), f)) {
+        const char *p = line;
+        while (*p == ' ')
+            p++;
+        if (strncmp(p, key, klen) == 0 && p[klen] == ':') {
+            v = strtoll(p + klen + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return v;
+}
+
+static void sleep_until(uint64_t target)
+{
+    struct timespec ts = {
+        .tv_sec = (time_t)(target / 1000000000ull),
+        .tv_nsec = (long)(target % 1000000000ull),
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/* a button report with a different mix of buttons each time so the lines arent all one length */
+static void make_report(uint8_t report[3], uint64_t i)
+{
+    static const uint16_t patterns[] = {
+        0, WII_BTN_A, WII_BTN_B | WII_BTN_A, WII_BTN_UP, WII_BTN_LEFT | WII_BTN_ONE,
+        WII_BTN_HOME, WII_BTN_MASK, WII_BTN_TWO | WII_BTN_MINUS | WII_BTN_PLUS,
+    };
+    uint16_t b = patterns[i % (sizeof(patterns) / sizeof(patterns[0]))];
+
+    report[0] = 0x30;
+    report[1] = (uint8_t)(b & 0xff);
+    report[2] = (uint8_t)(b >> 8);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* sorts v and prints "name": {mean, p50, p90, p99, max} in us */
+static void json_dist(const char *name, uint64_t *v, size_t n, int last)
+{
+    double sum = 0;
+    size_t i;
+
+    qsort(v, n, sizeof(*v), cmp_u64);
+    for (i = 0; i < n; i++)
+        sum += (double)v[i];
+#define PCT(p) (n ? (double)v[(size_t)((p) * (n - 1))] / 1e3 : 0.0)
+    printf("    \"%s\": {\"mean_us\": %.3f, \"p50_us\": %.3f, \"p90_us\": %.3f, "
+           "\"p99_us\": %.3f, \"max_us\": %.3f}%s\n", name, n ? sum / n / 1e3 : 0.0,
+           PCT(0.50), PCT(0.90), PCT(0.99), PCT(1.0), last ? "" : ",");
+#undef PCT
+}
+
+/* --- driver --- */
+
+struct driver_bench {
+    int dev_fd;
+    size_t read_size;
+    volatile int sending;           /* cleared by the sender once the last report is in */
+    uint64_t last_send_ns;
+
+    /* reader side */
+    struct wii_line_buf lines;
+    uint64_t received;
+    uint64_t reads, empty_reads, bytes;
+    uint64_t read_cpu_ns;
+};
+
+static void count_event(const struct wii_event *ev, void *ctx)
+{
+    struct driver_bench *b = ctx;
+
+    if (ev->type == WII_EVENT_BUTTONS)
+        b->received++;
+}
+
+static void *driver_reader(void *arg)
+{
+    struct driver_bench *b = arg;
+    char *buf = malloc(b->read_size);
+    uint64_t cpu0 = thread_cpu_ns();
+
+    if (!buf)
+        return NULL;
+    for (;;) {
+        ssize_t n = read(b->dev_fd, buf, b->read_size);
+
+        b->reads++;
+        if (n > 0) {
+            b->bytes += (uint64_t)n;
+            wii_event_feed(&b->lines, buf, (size_t)n, 0, count_event, b);
+            continue;
+        }
+        if (n < 0 && errno != EINTR && errno != EAGAIN)
+            break;
+        /* the driver never blocks, empty means 0 */
+        b->empty_reads++;
+        if (!__atomic_load_n(&b->sending, __ATOMIC_ACQUIRE) &&
+            wii_now_ns() - b->last_send_ns > DRAIN_IDLE_NS)
+            break;
+    }
+    b->read_cpu_ns = thread_cpu_ns() - cpu0;
+    free(buf);
+    return NULL;
+}
+
+static int bench_driver(uint64_t reports, size_t read_size, double rate)
+{
+    struct driver_bench b = { .read_size = read_size, .sending = 1 };
+    long long ring = proc_value("Buffer Size");
+    long long dropped0, dropped1;
+    uint64_t i, start_ns, end_ns, send_cpu_ns, send_errors = 0;
+    uint8_t report[3];
+    pthread_t reader;
+    int uhid_fd;
+
+    uhid_fd = wii_uhid_create("Nintendo RVL-CNT-01 (bench)", UHID_START_TIMEOUT_MS);
+    if (uhid_fd < 0) {
+        perror("Failed to create uhid device");
+        return 1;
+    }
+    /* give the driver a moment to bind, then throw away whatever the probe left behind */
+    usleep(200000);
+    b.dev_fd = open(DEVICE_PATH, O_RDONLY);
+    if (b.dev_fd < 0) {
+        perror("Failed to open " DEVICE_PATH);
+        wii_uhid_destroy(uhid_fd);
+        return 1;
+    }
+    while (read(b.dev_fd, report, sizeof(report)) > 0)
+        ;
+
+    dropped0 = proc_value("Dropped Bytes");
+    if (pthread_create(&reader, NULL, driver_reader, &b) != 0) {
+        perror("pthread_create");
+        close(b.dev_fd);
+        wii_uhid_destroy(uhid_fd);
+        return 1;
+    }
+
+    /* the driver does all its work in the sender's write(), so this thread's cpu is the driver's */
+    send_cpu_ns = thread_cpu_ns();
+    start_ns = wii_now_ns();
+    for (i = 0; i < reports; i++) {
+        if (rate > 0)
+            sleep_until(start_ns + (uint64_t)((double)i * 1e9 / rate));
+        make_report(report, i);
+        if (wii_uhid_send(uhid_fd, report, sizeof(report)) < 0)
+            send_errors++;
+        if (i % UHID_DRAIN_EVERY == 0)
+            wii_uhid_drain(uhid_fd);
+    }
+    end_ns = wii_now_ns();
+    send_cpu_ns = thread_cpu_ns() - send_cpu_ns;
+    b.last_send_ns = end_ns;
+    __atomic_store_n(&b.sending, 0, __ATOMIC_RELEASE);
+
+    pthread_join(reader, NULL);
+    dropped1 = proc_value("Dropped Bytes");
+
+    printf("{\n  \"bench\": \"driver\",\n  \"ring_size\": %lld,\n  \"read_size\": %zu,\n"
+           "  \"rate_hz\": %.0f,\n  \"reports_sent\": %llu,\n  \"reports_received\": %llu,\n"
+           "  \"send_errors\": %llu,\n  \"drop_rate\": %.6f,\n  \"dropped_bytes\": %lld,\n"
+           "  \"elapsed_s\": %.6f,\n  \"reports_per_s\": %.0f,\n"
+           "  \"send_cpu_ns_per_report\": %.1f,\n  \"read_cpu_ns_per_report\": %.1f,\n"
+           "  \"reads\": %llu,\n  \"empty_reads\": %llu,\n  \"bytes_per_read\": %.1f\n}\n",
+           ring, read_size, rate, (unsigned long long)reports, (unsigned long long)b.received,
+           (unsigned long long)send_errors,
+           reports ? 1.0 - (double)b.received / (double)reports : 0.0,
+           dropped0 >= 0 && dropped1 >= 0 ? dropped1 - dropped0 : -1,
+           (double)(end_ns - start_ns) / 1e9,
+           end_ns > start_ns ? (double)reports / ((double)(end_ns - start_ns) / 1e9) : 0.0,
+           reports ? (double)send_cpu_ns / (double)reports : 0.0,
+           b.received ? (double)b.read_cpu_ns / (double)b.received : 0.0,
+           (unsigned long long)b.reads, (unsigned long long)b.empty_reads,
+           b.reads > b.empty_reads ? (double)b.bytes / (double)(b.reads - b.empty_reads) : 0.0);
+
+    close(b.dev_fd);
+    wii_uhid_destroy(uhid_fd);
+    return send_errors ? 1 : 0;
+}
+
+/* --- decode --- */
+
+struct recorded {
+    size_t n;
+    uint8_t *reports;               /* n * WII_DECODE_MIN_STRIDE, zero padded */
+    uint64_t *t_ns;
+    char *text;                     /* the same stream as the driver would have printed it */
+    size_t text_len;
+};
+
+static int load_capture(const char *path, struct recorded *r)
+{
+    struct wii_capture_reader reader;
+    struct wii_capture_record rec;
+    uint8_t report[WII_CAPTURE_REPORT_MAX];
+    size_t cap = 0, text_cap = 0;
+    int ret;
+
+    memset(r, 0, sizeof(*r));
+    if (wii_capture_open_read(&reader, path) < 0)
+        return -1;
+    while ((ret = wii_capture_next(&reader, &rec, report)) == 1) {
+        char line[WII_LINE_MAX];
+        int len;
+
+        if (!rec.report_len)
+            continue;
+        if (r->n == cap) {
+            cap = cap ? cap * 2 : 4096;
+            r->reports = realloc(r->reports, cap * WII_DECODE_MIN_STRIDE);
+            r->t_ns = realloc(r->t_ns, cap * sizeof(uint64_t));
+            if (!r->reports || !r->t_ns)
+                goto fail;
+        }
+        memset(r->reports + r->n * WII_DECODE_MIN_STRIDE, 0, WII_DECODE_MIN_STRIDE);
+        memcpy(r->reports + r->n * WII_DECODE_MIN_STRIDE, report, rec.report_len);
+        r->t_ns[r->n] = rec.driver_ns;
+        r->n++;
+
+        len = wii_event_format_report(report, rec.report_len, rec.driver_ns, line, sizeof(line));
+        if (len <= 0)
+            continue;
+        if (len >= (int)sizeof(line))
+            len = sizeof(line) - 1;
+        if (r->text_len + (size_t)len > text_cap) {
+            text_cap = text_cap ? text_cap * 2 : 65536;
+            r->text = realloc(r->text, text_cap);
+            if (!r->text)
+                goto fail;
+        }
+        memcpy(r->text + r->text_len, line, (size_t)len);
+        r->text_len += (size_t)len;
+    }
+    wii_capture_close_read(&reader);
+    if (ret < 0)
+        fprintf(stderr, "%s: truncated or corrupt, using what was readable\n", path);
+    return 0;
+fail:
+    wii_capture_close_read(&reader);
+    free(r->reports);
+    free(r->t_ns);
+    free(r->text);
+    errno = ENOMEM;
+    return -1;
+}
+
+static void count_any(const struct wii_event *ev, void *ctx)
+{
+    (void)ev;
+    (*(uint64_t *)ctx)++;
+}
+
+static int bench_decode(const char *path, int iterations)
+{
+    static const enum wii_decode_impl impls[] = {
+        WII_DECODE_SCALAR, WII_DECODE_SSE41, WII_DECODE_AVX2,
+    };
+    struct recorded r;
+    struct wii_decoded out;
+    uint16_t *u16;
+    uint8_t *u8;
+    uint64_t t0, events = 0;
+    size_t i, off;
+    int it, j, first = 1;
+
+    if (load_capture(path, &r) < 0) {
+        perror(path);
+        return 1;
+    }
+    if (!r.n) {
+        fprintf(stderr, "%s: no reports in it\n", path);
+        return 1;
+    }
+
+    printf("{\n  \"bench\": \"decode\",\n  \"reports\": %zu,\n  \"iterations\": %d,\n", r.n,
+           iterations);
+
+    /* text, fed the way the client reads it, 1024 bytes at a time */
+    t0 = wii_now_ns();
+    for (it = 0; it < iterations; it++) {
+        struct wii_line_buf lines = { .len = 0 };
+        for (off = 0; off < r.text_len; off += 1024)
+            wii_event_feed(&lines, r.text + off, r.text_len - off < 1024 ? r.text_len - off : 1024,
+                           0, count_any, &events);
+    }
+    t0 = wii_now_ns() - t0;
+    printf("  \"text\": {\"events\": %llu, \"ns_per_report\": %.2f, \"reports_per_s\": %.0f, "
+           "\"mb_per_s\": %.1f},\n", (unsigned long long)(events / (uint64_t)iterations),
+           (double)t0 / ((double)r.n * iterations),
+           (double)r.n * iterations / ((double)t0 / 1e9),
+           (double)r.text_len * iterations / ((double)t0 / 1e9) / 1e6);
+
+    /* raw reports, one pass of the whole stream per iteration */
+    u16 = malloc(r.n * sizeof(uint16_t) * (1 + 3 + 2 * WII_IR_BLOBS));
+    u8 = malloc(r.n * WII_IR_BLOBS);
+    if (!u16 || !u8) {
+        perror("malloc");
+        return 1;
+    }
+    out.buttons = u16;
+    for (j = 0; j < 3; j++)
+        out.accel[j] = u16 + r.n * (size_t)(1 + j);
+    for (j = 0; j < WII_IR_BLOBS; j++) {
+        out.ir_x[j] = u16 + r.n * (size_t)(4 + j);
+        out.ir_y[j] = u16 + r.n * (size_t)(4 + WII_IR_BLOBS + j);
+        out.ir_size[j] = u8 + r.n * (size_t)j;
+    }
+
+    printf("  \"batch\": [\n");
+    for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        /* skip the ones the cpu cant do rather than timing the fallback twice */
+        if (wii_decode_set_impl(impls[i]) != impls[i])
+            continue;
+        t0 = wii_now_ns();
+        for (it = 0; it < iterations; it++)
+            wii_decode_batch(r.reports, WII_DECODE_MIN_STRIDE, r.n, &out);
+        t0 = wii_now_ns() - t0;
+        printf("%s    {\"impl\": \"%s\", \"ns_per_report\": %.3f, \"reports_per_s\": %.0f}",
+               first ? "" : ",\n", wii_decode_impl_name(impls[i]),
+               (double)t0 / ((double)r.n * iterations),
+               (double)r.n * iterations / ((double)t0 / 1e9));
+        first = 0;
+    }
+    printf("\n  ],\n");
+
+    /* the pointer the client would get out of that IR, scaled to a 1080p screen */
+    printf("  \"filter\": [\n");
+    for (i = WII_FILTER_NONE; i <= WII_FILTER_KALMAN; i++) {
+        static const char *names[] = { "none", "one-euro", "kalman" };
+        struct wii_filter_params fp;
+        struct wii_filter f;
+        uint64_t valid = 0, shown = 0;
+        size_t k;
+
+        wii_filter_defaults(&fp, (enum wii_filter_kind)i);
+        t0 = wii_now_ns();
+        for (it = 0; it < iterations; it++) {
+            wii_filter_init(&f, &fp);
+            for (k = 0; k < r.n; k++) {
+                uint16_t x[WII_IR_BLOBS], y[WII_IR_BLOBS];
+                double px = 0, py = 0, pos[2];
+                int ok;
+
+                for (j = 0; j < WII_IR_BLOBS; j++) {
+                    x[j] = out.ir_x[j][k];
+                    y[j] = out.ir_y[j][k];
+                }
+                ok = wii_ir_pointer(x, y, &px, &py);
+                valid += (uint64_t)ok;
+                shown += (uint64_t)wii_filter_update(&f, r.t_ns[k], ok, px * 1920, py * 1080, pos);
+            }
+        }
+        t0 = wii_now_ns() - t0;
+        printf("    {\"filter\": \"%s\", \"ns_per_sample\": %.2f, \"valid\": %.4f, "
+               "\"shown\": %.4f}%s\n", names[i], (double)t0 / ((double)r.n * iterations),
+               (double)valid / ((double)r.n * iterations),
+               (double)shown / ((double)r.n * iterations), i < WII_FILTER_KALMAN ? "," : "");
+    }
+    printf("  ]\n}\n");
+
+    free(u16);
+    free(u8);
+    free(r.reports);
+    free(r.t_ns);
+    free(r.text);
+    return 0;
+}
+
+/* --- latency --- */
+
+static int uinput_create(void)
+{
+    struct uinput_setup setup = { .id = { .bustype = BUS_VIRTUAL }, .name = "wii-bench key" };
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+
+    if (fd < 0)
+        return -1;
+    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0 || ioctl(fd, UI_SET_KEYBIT, KEY_A) < 0 ||
+        ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* opens the evdev node behind a uinput device, on CLOCK_MONOTONIC so its times line up with ours */
+static int uinput_open_evdev(int ui_fd)
+{
+    char sysname[64], path[128];
+    int clock = CLOCK_MONOTONIC, fd = -1, i, tries;
+
+    if (ioctl(ui_fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0)
+        return -1;
+    /* udev takes a moment to make the node */
+    for (tries = 0; tries < 100 && fd < 0; tries++) {
+        for (i = 0; i < 64 && fd < 0; i++) {
+            char probe[192];
+            snprintf(probe, sizeof(probe), "/sys/devices/virtual/input/%s/event%d", sysname, i);
+            if (access(probe, F_OK) == 0) {
+                snprintf(path, sizeof(path), "/dev/input/event%d", i);
+                fd = open(path, O_RDONLY | O_NONBLOCK);
+            }
+        }
+        if (fd < 0)
+            usleep(10000);
+    }
+    if (fd >= 0 && ioctl(fd, EVIOCSCLOCKID, &clock) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int uinput_key(int fd, int value)
+{
+    struct input_event ev[2];
+
+    memset(ev, 0, sizeof(ev));
+    ev[0].type = EV_KEY;
+    ev[0].code = KEY_A;
+    ev[0].value = value;
+    ev[1].type = EV_SYN;
+    ev[1].code = SYN_REPORT;
+    return write(fd, ev, sizeof(ev)) == sizeof(ev) ? 0 : -1;
+}
+
+/* time of the next EV_KEY on the evdev node, 0 on timeout */
+static uint64_t evdev_wait_key(int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    struct input_event ev;
+
+    while (poll(&pfd, 1, EVDEV_TIMEOUT_MS) > 0) {
+        while (read(fd, &ev, sizeof(ev)) == sizeof(ev)) {
+            if (ev.type == EV_KEY)
+                return (uint64_t)ev.input_event_sec * 1000000000ull +
+                       (uint64_t)ev.input_event_usec * 1000ull;
+        }
+    }
+    return 0;
+}
+
+struct latency_probe {
+    int got;
+    struct wii_event ev;
+};
+
+static void take_event(const struct wii_event *ev, void *ctx)
+{
+    struct latency_probe *p = ctx;
+
+    if (ev->type == WII_EVENT_BUTTONS) {
+        p->ev = *ev;
+        p->got = 1;
+    }
+}
+
+static int bench_latency(int count, uint64_t gap_ns)
+{
+    uint64_t *to_driver, *to_read, *to_evdev, *total;
+    struct wii_line_buf lines = { .len = 0 };
+    char buf[1024];
+    size_t n = 0;
+    int uhid_fd, dev_fd, ui_fd, ev_fd, i, timeouts = 0;
+
+    to_driver = calloc((size_t)count, sizeof(uint64_t));
+    to_read = calloc((size_t)count, sizeof(uint64_t));
+    to_evdev = calloc((size_t)count, sizeof(uint64_t));
+    total = calloc((size_t)count, sizeof(uint64_t));
+    if (!to_driver || !to_read || !to_evdev || !total) {
+        perror("calloc");
+        return 1;
+    }
+
+    uhid_fd = wii_uhid_create("Nintendo RVL-CNT-01 (bench)", UHID_START_TIMEOUT_MS);
+    if (uhid_fd < 0) {
+        perror("Failed to create uhid device");
+        return 1;
+    }
+    usleep(200000);
+    dev_fd = open(DEVICE_PATH, O_RDONLY);
+    ui_fd = uinput_create();
+    ev_fd = ui_fd >= 0 ? uinput_open_evdev(ui_fd) : -1;
+    if (dev_fd < 0 || ui_fd < 0 || ev_fd < 0) {
+        perror(dev_fd < 0 ? "Failed to open " DEVICE_PATH : "Failed to set up uinput");
+        wii_uhid_destroy(uhid_fd);
+        return 1;
+    }
+    while (read(dev_fd, buf, sizeof(buf)) > 0)
+        ;
+
+    for (i = 0; i < count; i++) {
+        struct latency_probe probe = { .got = 0 };
+        uint8_t report[3] = { 0x30, 0x00, (i & 1) ? 0x00 : 0x08 };  /* A down, A up */
+        uint64_t sent, read_ns, key_ns, deadline;
+
+        sleep_until(wii_now_ns() + gap_ns);
+        wii_uhid_drain(uhid_fd);
+
+        sent = wii_now_ns();
+        if (wii_uhid_send(uhid_fd, report, sizeof(report)) < 0) {
+            perror("uhid send");
+            break;
+        }
+
+        /* no poll on the driver, so spin on read like a client with no sleep would */
+        deadline = sent + (uint64_t)EVDEV_TIMEOUT_MS * 1000000ull;
+        while (!probe.got && wii_now_ns() < deadline) {
+            ssize_t got = read(dev_fd, buf, sizeof(buf));
+            if (got > 0)
+                wii_event_feed(&lines, buf, (size_t)got, wii_now_ns(), take_event, &probe);
+        }
+        if (!probe.got) {
+            timeouts++;
+            continue;
+        }
+        read_ns = probe.ev.timestamp_ns;
+
+        if (uinput_key(ui_fd, (probe.ev.buttons & WII_BTN_A) ? 1 : 0) < 0) {
+            perror("uinput write");
+            break;
+        }
+        key_ns = evdev_wait_key(ev_fd);
+        if (!key_ns) {
+            timeouts++;
+            continue;
+        }
+
+        to_driver[n] = probe.ev.driver_ns > sent ? probe.ev.driver_ns - sent : 0;
+        to_read[n] = probe.ev.driver_ns && read_ns > probe.ev.driver_ns ?
+                     read_ns - probe.ev.driver_ns : 0;
+        to_evdev[n] = key_ns > read_ns ? key_ns - read_ns : 0;
+        total[n] = key_ns > sent ? key_ns - sent : 0;
+        n++;
+    }
+
+    printf("{\n  \"bench\": \"latency\",\n  \"samples\": %zu,\n  \"timeouts\": %d,\n"
+           "  \"stages\": {\n", n, timeouts);
+    json_dist("uhid_to_driver", to_driver, n, 0);
+    json_dist("driver_to_read", to_read, n, 0);
+    json_dist("read_to_evdev", to_evdev, n, 0);
+    json_dist("total", total, n, 1);
+    printf("  }\n}\n");
+
+    close(ev_fd);
+    ioctl(ui_fd, UI_DEV_DESTROY);
+    close(ui_fd);
+    close(dev_fd);
+    wii_uhid_destroy(uhid_fd);
+    free(to_driver);
+    free(to_read);
+    free(to_evdev);
+    free(total);
+    return timeouts == count ? 1 : 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s driver [--reports=N] [--read-size=N] [--rate=HZ]\n"
+                    "       %s decode [--iterations=N] capture\n"
+                    "       %s latency [--count=N] [--gap-us=N]\n", prog, prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "reports",    required_argument, NULL, 'n' },
+        { "read-size",  required_argument, NULL, 'r' },
+        { "rate",       required_argument, NULL, 'h' },
+        { "iterations", required_argument, NULL, 'i' },
+        { "count",      required_argument, NULL, 'c' },
+        { "gap-us",     required_argument, NULL, 'g' },
+        { NULL, 0, NULL, 0 },
+    };
+    uint64_t reports = 100000, gap_ns = 2000000;
+    size_t read_size = 1024;
+    double rate = 0;
+    int iterations = 20, count = 1000, opt;
+    const char *mode;
+
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    mode = argv[1];
+    optind = 2;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'n': reports = strtoull(optarg, NULL, 10); break;
+        case 'r': read_size = strtoul(optarg, NULL, 10); break;
+        case 'h': rate = atof(optarg); break;
+        case 'i': iterations = atoi(optarg); break;
+        case 'c': count = atoi(optarg); break;
+        case 'g': gap_ns = strtoull(optarg, NULL, 10) * 1000ull; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (read_size == 0 || read_size > READ_SIZE_MAX || iterations < 1 || count < 1) {
+        fprintf(stderr, "--read-size has to be 1..%d, --iterations and --count at least 1\n",
+                READ_SIZE_MAX);
+        return 1;
+    }
+
+    if (strcmp(mode, "driver") == 0 && optind == argc)
+        return bench_driver(reports, read_size, rate);
+    if (strcmp(mode, "decode") == 0 && optind == argc - 1)
+        return bench_decode(argv[optind], iterations);
+    if (strcmp(mode, "latency") == 0 && optind == argc)
+        return bench_latency(count, gap_ns);
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * wii-bpf-decimate.bpf.c - keeps 1 in WII_DECIMATE of the reports that carry
+ * accel, see wii-bpf.h.
+ *
+ * For sites that only want the accel for coarse things (tilt, shake) and not
+ * the full 100Hz. A report whose buttons differ from the last one that went
+ * through always goes through, so presses are never late or lost.
+ */
+
+#include "vmlinux.h"
+#include "hid_bpf.h"
+#include "hid_bpf_helpers.h"
+#include <bpf/bpf_tracing.h>
+
+#include "wii-bpf.h"
+
+#define WII_DECIMATE 2      /* 100Hz -> 50Hz */
+
+HID_BPF_CONFIG(
+    HID_DEVICE(BUS_BLUETOOTH, HID_GROUP_GENERIC, WII_BPF_VID, WII_BPF_PID),
+);
+
+struct wii_decimate {
+    __u32 count;            /* accel reports since the last kept one */
+    __u16 buttons;          /* in the last kept one */
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 16);
+    __type(key, __u32);
+    __type(value, struct wii_decimate);
+} wii_decimate_state SEC(".maps");
+
+SEC(HID_BPF_DEVICE_EVENT)
+int BPF_PROG(wii_decimate, struct hid_bpf_ctx *hctx)
+{
+    __u8 *data = hid_bpf_get_data(hctx, 0, WII_BPF_REPORT_MAX);
+    struct wii_decimate *st, fresh = {};
+    __u32 id = hctx->hid->id;
+    __u16 buttons;
+
+    if (!data || !wii_bpf_has_accel(data[0]))
+        return 0;
+
+    st = bpf_map_lookup_elem(&wii_decimate_state, &id);
+    if (!st) {
+        bpf_map_update_elem(&wii_decimate_state, &id, &fresh, BPF_ANY);
+        st = bpf_map_lookup_elem(&wii_decimate_state, &id);
+        if (!st)
+            return 0;
+    }
+
+    buttons = wii_bpf_buttons(data);
+    if (buttons == st->buttons && ++st->count < WII_DECIMATE)
+        return WII_BPF_DROP;
+    st->count = 0;
+    st->buttons = buttons;
+    return 0;
+}
+
+HID_BPF_OPS(wii_decimate_ops) = {
+    .hid_device_event = (void *)wii_decimate,
+};
+
+SEC("syscall")
+int probe(struct hid_bpf_probe_args *ctx)
+{
+    ctx->retval = 0;
+    return 0;
+}
+
+char _license[] SEC("license") = "GPL";
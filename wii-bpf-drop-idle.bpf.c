@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * wii-bpf-drop-idle.bpf.c - drops data reports that say the same as the last
+ * one that went through, see wii-bpf.h.
+ *
+ * Same buttons and every other byte within WII_IDLE_JITTER of the last kept
+ * report counts as the same, accel is never perfectly still. One still goes
+ * through every WII_IDLE_HEARTBEAT_NS so readers can tell the remote is
+ * there, and the driver's MotionPlus bias tracking still gets still samples
+ * (just fewer of them, so it takes longer to settle).
+ */
+
+#include "vmlinux.h"
+#include "hid_bpf.h"
+#include "hid_bpf_helpers.h"
+#include <bpf/bpf_tracing.h>
+
+#include "wii-bpf.h"
+
+#define WII_IDLE_JITTER        2
+#define WII_IDLE_HEARTBEAT_NS  100000000ULL    /* 100ms */
+
+HID_BPF_CONFIG(
+    HID_DEVICE(BUS_BLUETOOTH, HID_GROUP_GENERIC, WII_BPF_VID, WII_BPF_PID),
+);
+
+struct wii_idle {
+    __u64 kept_ns;
+    __u8  last[WII_BPF_REPORT_MAX];
+};
+
+/* per remote, keyed by the hid device id */
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 16);
+    __type(key, __u32);
+    __type(value, struct wii_idle);
+} wii_idle_state SEC(".maps");
+
+SEC(HID_BPF_DEVICE_EVENT)
+int BPF_PROG(wii_drop_idle, struct hid_bpf_ctx *hctx)
+{
+    __u8 *data = hid_bpf_get_data(hctx, 0, WII_BPF_REPORT_MAX);
+    struct wii_idle *st, fresh = {};
+    __u32 id = hctx->hid->id;
+    __u64 now = bpf_ktime_get_ns();
+    int i;
+
+    if (!data || !wii_bpf_is_data(data[0]))
+        return 0;
+
+    st = bpf_map_lookup_elem(&wii_idle_state, &id);
+    if (!st) {
+        bpf_map_update_elem(&wii_idle_state, &id, &fresh, BPF_ANY);
+        st = bpf_map_lookup_elem(&wii_idle_state, &id);
+        if (!st)
+            return 0;
+    }
+
+    if (st->last[0] == data[0] && now - st->kept_ns < WII_IDLE_HEARTBEAT_NS &&
+        wii_bpf_buttons(st->last) == wii_bpf_buttons(data)) {
+        bool idle = true;
+
+        for (i = 3; i < WII_BPF_REPORT_MAX; i++) {
+            int d = (int)data[i] - (int)st->last[i];
+
+            if (i >= hctx->size)
+                break;
+            if (d > WII_IDLE_JITTER || d < -WII_IDLE_JITTER) {
+                idle = false;
+                break;
+            }
+        }
+        if (idle)
+            return WII_BPF_DROP;
+    }
+
+    __builtin_memcpy(st->last, data, WII_BPF_REPORT_MAX);
+    st->kept_ns = now;
+    return 0;
+}
+
+HID_BPF_OPS(wii_drop_idle_ops) = {
+    .hid_device_event = (void *)wii_drop_idle,
+};
+
+/* udev-hid-bpf asks before attaching, HID_BPF_CONFIG already matched the ids */
+SEC("syscall")
+int probe(struct hid_bpf_probe_args *ctx)
+{
+    ctx->retval = 0;
+    return 0;
+}
+
+char _license[] SEC("license") = "GPL";
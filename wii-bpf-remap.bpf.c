@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * wii-bpf-remap.bpf.c - moves button bits around before the driver sees them,
+ * see wii-bpf.h.
+ *
+ * wii_remap[bit] is 0 to leave that button alone or 1 + the bit it should
+ * turn into (bits are byte 1 | byte 2 << 8, A is 11, B is 10). The default
+ * swaps A and B. It lives in the .data map so it can be changed while loaded,
+ * find its id with `bpftool map show` (the one ending in .data) then
+ *
+ *   bpftool map update id <id> key 0 0 0 0 value <16 bytes>
+ *
+ * Everything downstream (text, records, keys, chords, the pointer) sees the
+ * remapped buttons. To only change what keys come out, EVIOCSKEYCODE on the
+ * driver's keymap is cheaper.
+ */
+
+#include "vmlinux.h"
+#include "hid_bpf.h"
+#include "hid_bpf_helpers.h"
+#include <bpf/bpf_tracing.h>
+
+#include "wii-bpf.h"
+
+HID_BPF_CONFIG(
+    HID_DEVICE(BUS_BLUETOOTH, HID_GROUP_GENERIC, WII_BPF_VID, WII_BPF_PID),
+);
+
+volatile __u8 wii_remap[16] = {
+    [10] = 11 + 1,          /* B -> A */
+    [11] = 10 + 1,          /* A -> B */
+};
+
+SEC(HID_BPF_DEVICE_EVENT)
+int BPF_PROG(wii_remap_buttons, struct hid_bpf_ctx *hctx)
+{
+    __u8 *data = hid_bpf_get_data(hctx, 0, WII_BPF_REPORT_MAX);
+    __u16 raw, out;
+    int bit;
+
+    /* every report from 0x20 up has the buttons in bytes 1-2, except 0x3d */
+    if (!data || data[0] < 0x20 || data[0] == 0x3d || hctx->size < 3)
+        return 0;
+
+    raw = data[1] | (data[2] << 8);
+    out = 0;
+    for (bit = 0; bit < 16; bit++) {
+        __u8 to = wii_remap[bit];
+
+        if (!(raw & WII_BPF_BTN_MASK & (1 << bit)))
+            continue;
+        out |= 1 << (to && to <= 16 ? to - 1 : bit);
+    }
+    out = (out & WII_BPF_BTN_MASK) | (raw & ~WII_BPF_BTN_MASK); // the accel bits stay, a remap onto them doesnt count
+    data[1] = out & 0xff;
+    data[2] = out >> 8;
+    return 0;
+}
+
+HID_BPF_OPS(wii_remap_ops) = {
+    .hid_device_event = (void *)wii_remap_buttons,
+};
+
+SEC("syscall")
+int probe(struct hid_bpf_probe_args *ctx)
+{
+    ctx->retval = 0;
+    return 0;
+}
+
+char _license[] SEC("license") = "GPL";
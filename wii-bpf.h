@@ -0,0 +1,59 @@
+/*
+ * wii-bpf.h - shared bits for the HID-BPF samples (wii-bpf-*.bpf.c).
+ *
+ * HID-BPF programs run in hid_input_report(), before the report gets anywhere
+ * near wii_raw_event(), so a dropped report costs the driver nothing and a
+ * rewritten one looks to it like the remote sent it that way. Nothing in the
+ * driver has to change or be rebuilt to use them, they attach to the hid
+ * device (needs CONFIG_HID_BPF, 6.11 or newer for struct_ops).
+ *
+ * The samples are laid out for udev-hid-bpf, build them with `make bpf`
+ * (BPF_INCLUDE=<dir with hid_bpf.h and hid_bpf_helpers.h>) and attach one by
+ * hand with
+ *
+ *   udev-hid-bpf add /sys/bus/hid/devices/0005:057E:0306.* wii-bpf-drop-idle.bpf.o
+ *
+ * `udev-hid-bpf remove` with the same device takes it off again. Or install
+ * them (udev-hid-bpf install wii-bpf-drop-idle.bpf.o) so udev attaches it to
+ * every remote that connects.
+ *
+ *   wii-bpf-drop-idle   continuous mode sends 100 reports a second whether
+ *                       anything changed or not, this drops the ones where
+ *                       nothing did (a heartbeat still goes through)
+ *   wii-bpf-decimate    keeps 1 in WII_DECIMATE accel reports, every button
+ *                       change still goes through
+ *   wii-bpf-remap       rewrites the button bits from a table that can be
+ *                       changed while its loaded
+ *
+ * None of them drop 0x20-0x22 (status, register read answers, acks), the
+ * driver waits on those.
+ */
+
+#ifndef WII_BPF_H
+#define WII_BPF_H
+
+#define WII_BPF_VID         0x057e
+#define WII_BPF_PID         0x0306
+#define WII_BPF_REPORT_MAX  22          /* longest report the remote sends, id included */
+#define WII_BPF_BTN_MASK    0x9f1f      /* same as WII_BTN_MASK, the other bits are accel */
+#define WII_BPF_DROP        (-1)        /* hid_device_event returning < 0 drops the report */
+
+/* byte 1 | byte 2 << 8 like everywhere else, buttons only */
+static __always_inline __u16 wii_bpf_buttons(const __u8 *report)
+{
+    return (report[1] | (report[2] << 8)) & WII_BPF_BTN_MASK;
+}
+
+/* 0x30-0x3f, the data reports. the rest are answers the driver is waiting for */
+static __always_inline bool wii_bpf_is_data(__u8 id)
+{
+    return id >= 0x30 && id <= 0x3f;
+}
+
+/* same as wii_report_has_accel() in wii-event.h */
+static __always_inline bool wii_bpf_has_accel(__u8 id)
+{
+    return id == 0x31 || id == 0x33 || id == 0x35 || id == 0x37;
+}
+
+#endif /* WII_BPF_H */
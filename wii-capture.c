@@ -0,0 +1,287 @@
+/*
+ * wii-capture.c - double buffered capture writer and the matching reader, see wii-capture.h
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wii-capture.h"
+
+#define FLUSH_INTERVAL_S 1  /* a quiet session still hits the disk this often */
+
+static int write_all(int fd, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* hands the active buffer to the writer thread, call with lock held and pending clear */
+static void swap_buffers(struct wii_capture_writer *w)
+{
+    w->active ^= 1;
+    w->pending = 1;
+    pthread_cond_broadcast(&w->cond);
+}
+
+static void *writer_thread(void *arg)
+{
+    struct wii_capture_writer *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        int idx, err;
+        size_t len;
+
+        while (!w->pending && !w->stop) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += FLUSH_INTERVAL_S;
+            if (pthread_cond_timedwait(&w->cond, &w->lock, &deadline) == ETIMEDOUT &&
+                !w->pending && w->len[w->active] > 0)
+                swap_buffers(w);
+        }
+        if (!w->pending)
+            break; /* stopping and nothing left */
+
+        idx = w->active ^ 1;
+        len = w->len[idx];
+
+        /* the disk write happens without the lock, the reader keeps filling the other buffer */
+        pthread_mutex_unlock(&w->lock);
+        err = write_all(w->fd, w->buf[idx], len);
+        pthread_mutex_lock(&w->lock);
+
+        if (err)
+            w->write_errors++;
+        else
+            w->bytes += len;
+        w->len[idx] = 0;
+        w->pending = 0;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+int wii_capture_open_write(struct wii_capture_writer *w, const char *path)
+{
+    struct wii_capture_header header = {
+        .version = WII_CAPTURE_VERSION,
+        .record_size = sizeof(struct wii_capture_record),
+    };
+    struct timespec ts;
+    int err;
+
+    memset(w, 0, sizeof(*w));
+    memcpy(header.magic, WII_CAPTURE_MAGIC, sizeof(header.magic));
+    clock_gettime(CLOCK_REALTIME, &ts);
+    header.start_realtime_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    header.start_monotonic_ns = wii_now_ns();
+
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->fd < 0)
+        return -1;
+    if (write_all(w->fd, (const uint8_t *)&header, sizeof(header)) < 0)
+        goto fail;
+
+    w->buf[0] = malloc(WII_CAPTURE_BUF_SIZE);
+    w->buf[1] = malloc(WII_CAPTURE_BUF_SIZE);
+    if (!w->buf[0] || !w->buf[1]) {
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    err = pthread_create(&w->thread, NULL, writer_thread, w);
+    if (err) {
+        errno = err;
+        goto fail;
+    }
+    return 0;
+
+fail:
+    err = errno;
+    free(w->buf[0]);
+    free(w->buf[1]);
+    close(w->fd);
+    w->fd = -1;
+    errno = err;
+    return -1;
+}
+
+int wii_capture_append(struct wii_capture_writer *w, const struct wii_capture_record *rec,
+                       const uint8_t *report)
+{
+    size_t need = sizeof(*rec) + rec->report_len;
+    uint8_t *dst;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->len[w->active] + need > WII_CAPTURE_BUF_SIZE) {
+        if (w->pending) {
+            /* both buffers full, the disk is way behind. lose this one rather than wait */
+            w->dropped++;
+            pthread_mutex_unlock(&w->lock);
+            return -1;
+        }
+        swap_buffers(w);
+    }
+    dst = w->buf[w->active] + w->len[w->active];
+    memcpy(dst, rec, sizeof(*rec));
+    memcpy(dst + sizeof(*rec), report, rec->report_len);
+    w->len[w->active] += need;
+    w->records++;
+    pthread_mutex_unlock(&w->lock);
+    return 0;
+}
+
+void wii_capture_from_event(const struct wii_event *ev, struct wii_capture_record *rec,
+                            uint8_t *report)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->type = (uint8_t)ev->type;
+    rec->buttons = ev->buttons;
+
+    if (ev->driver_ns) {
+        uint64_t delta = ev->timestamp_ns > ev->driver_ns ? ev->timestamp_ns - ev->driver_ns : 0;
+        rec->driver_ns = ev->driver_ns;
+        rec->read_delta_ns = delta > UINT32_MAX ? UINT32_MAX : (uint32_t)delta;
+    } else {
+        rec->driver_ns = ev->timestamp_ns;
+        rec->type |= WII_CAPTURE_NO_DRIVER_TS;
+    }
+
+    /* rebuild what the driver looked at to print the line */
+    if (ev->type == WII_EVENT_BATTERY) {
+        memset(report, 0, WII_STATUS_LEN);
+        report[0] = 0x20;
+        report[WII_STATUS_BATTERY] = ev->battery;
+        rec->report_len = WII_STATUS_LEN;
+    } else {
+        report[0] = ev->report_id;
+        report[1] = (uint8_t)(ev->buttons & 0xff);
+        report[2] = (uint8_t)(ev->buttons >> 8);
+        rec->report_len = 3;
+    }
+}
+
+void wii_capture_from_motion(const struct wii_motion_record *m, uint64_t read_ns,
+                             struct wii_capture_record *rec)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->type = WII_EVENT_BUTTONS | WII_CAPTURE_MOTION;
+    rec->buttons = m->buttons & WII_BTN_MASK;
+    rec->driver_ns = m->t_ns;
+    if (read_ns > m->t_ns)
+        rec->read_delta_ns = read_ns - m->t_ns > UINT32_MAX ? UINT32_MAX : (uint32_t)(read_ns - m->t_ns);
+    rec->report_len = sizeof(*m);
+}
+
+/* the bytes the driver made m from, as far as m has them. returns how many */
+static uint8_t motion_to_report(const struct wii_motion_record *m, uint8_t *report)
+{
+    int i;
+
+    /* buttons has the accel low bits in it too, so these are exactly what came in */
+    report[0] = m->report_id;
+    report[1] = (uint8_t)(m->buttons & 0xff);
+    report[2] = (uint8_t)(m->buttons >> 8);
+    if (!wii_report_has_accel(m->report_id))
+        return 3;
+    for (i = 0; i < 3; i++)
+        report[3 + i] = (uint8_t)(m->accel[i] >> 2);
+    return 6;
+}
+
+int wii_capture_close(struct wii_capture_writer *w)
+{
+    if (w->fd < 0)
+        return -1;
+
+    pthread_mutex_lock(&w->lock);
+    while (w->pending)
+        pthread_cond_wait(&w->cond, &w->lock);
+    if (w->len[w->active] > 0)
+        swap_buffers(w);
+    w->stop = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_join(w->thread, NULL);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    free(w->buf[0]);
+    free(w->buf[1]);
+    w->buf[0] = w->buf[1] = NULL;
+
+    if (close(w->fd) < 0)
+        w->write_errors++;
+    w->fd = -1;
+    return w->write_errors ? -1 : 0;
+}
+
+int wii_capture_open_read(struct wii_capture_reader *r, const char *path)
+{
+    r->f = fopen(path, "rb");
+    if (!r->f)
+        return -1;
+    if (fread(&r->header, sizeof(r->header), 1, r->f) != 1 ||
+        memcmp(r->header.magic, WII_CAPTURE_MAGIC, sizeof(r->header.magic)) != 0 ||
+        r->header.version < 1 || r->header.version > WII_CAPTURE_VERSION ||
+        r->header.record_size != sizeof(struct wii_capture_record)) {
+        fclose(r->f);
+        r->f = NULL;
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int wii_capture_next(struct wii_capture_reader *r, struct wii_capture_record *rec,
+                     uint8_t *report)
+{
+    size_t n = fread(rec, 1, sizeof(*rec), r->f);
+
+    if (n == 0 && feof(r->f))
+        return 0;
+    if (n != sizeof(*rec))
+        return -1;
+    if (rec->type & WII_CAPTURE_MOTION) {
+        if (rec->report_len != sizeof(r->motion) ||
+            fread(&r->motion, sizeof(r->motion), 1, r->f) != 1)
+            return -1;
+        rec->report_len = motion_to_report(&r->motion, report);
+        return 1;
+    }
+    if (rec->report_len > WII_CAPTURE_REPORT_MAX)
+        return -1;
+    if (fread(report, 1, rec->report_len, r->f) != rec->report_len)
+        return -1; /* cut off mid record, e.g. the recorder got killed */
+    if (rec->report_len == 2 && report[0] == 0x20) {
+        /* older files saved battery as {0x20, level}, make it a real status report */
+        report[WII_STATUS_BATTERY] = report[1];
+        memset(report + 1, 0, WII_STATUS_BATTERY - 1);
+        rec->report_len = WII_STATUS_LEN;
+    }
+    return 1;
+}
+
+void wii_capture_close_read(struct wii_capture_reader *r)
+{
+    if (r->f)
+        fclose(r->f);
+    r->f = NULL;
+}
@@ -0,0 +1,129 @@
+/*
+ * wii-capture.h - binary capture files of a session, written by `mouse_test --record`.
+ *
+ * Layout, all little endian:
+ *
+ *   struct wii_capture_header              once
+ *   struct wii_capture_record + report[]   per event
+ *
+ * A record is 16 bytes plus the report bytes, so a button report costs 19
+ * bytes instead of the ~40 the driver prints for it.
+ *
+ * When the driver has WII_FEATURE_RECORDS every report it makes a struct
+ * wii_motion_record for is saved as that record, straight from read(), flagged
+ * WII_CAPTURE_MOTION. The reader hands back the real report bytes the record
+ * was made from (id, both button bytes and the accel bytes, extension and IR
+ * bytes arent in a record) and the whole record in wii_capture_reader.motion.
+ *
+ * Everything else, and everything from an older driver that only gives text,
+ * is rebuilt from the line: {report id, byte 1, byte 2} for buttons and a
+ * 7 byte 0x20 status report with the level in byte 6 for battery, which is
+ * exactly what the driver looked at to print the line (files from before
+ * that saved {0x20, level}, the reader turns those into the 7 byte one). Feeding either back in through uhid (wii-replay) gives the
+ * same lines again.
+ *
+ * Writing goes through two buffers and a writer thread. The read loop only
+ * ever memcpy's into the buffer it owns, the writer thread does the write()
+ * calls on the other one, so a slow disk can never stall reading
+ * /dev/wii_remote and let the driver's 1KB buffer overflow. If the disk is so
+ * slow that both buffers are full the record is dropped and counted instead.
+ */
+
+#ifndef WII_CAPTURE_H
+#define WII_CAPTURE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "wii-event.h"
+
+#define WII_CAPTURE_MAGIC      "WIICAP01"
+#define WII_CAPTURE_VERSION    2       /* 2: WII_CAPTURE_MOTION records, 1 files still read */
+#define WII_CAPTURE_REPORT_MAX 22       /* biggest report the remote sends, id included */
+#define WII_CAPTURE_BUF_SIZE   (64 * 1024)
+
+/* record flags, stored in the top bits of type */
+#define WII_CAPTURE_NO_DRIVER_TS 0x80   /* driver_ns is really the read time */
+#define WII_CAPTURE_MOTION       0x40   /* a struct wii_motion_record follows, not a report */
+#define WII_CAPTURE_TYPE_MASK    0x3f
+
+struct wii_capture_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;               /* sizeof(struct wii_capture_record) */
+    uint64_t start_realtime_ns;         /* CLOCK_REALTIME when recording started */
+    uint64_t start_monotonic_ns;        /* the same moment on CLOCK_MONOTONIC */
+} __attribute__((packed));
+
+struct wii_capture_record {
+    uint64_t driver_ns;                 /* CLOCK_MONOTONIC the driver got the report */
+    uint32_t read_delta_ns;             /* how long after that we read it (saturates) */
+    uint16_t buttons;                   /* decoded WII_BTN_* state */
+    uint8_t  type;                      /* enum wii_event_type | WII_CAPTURE_* flags */
+    uint8_t  report_len;                /* report bytes that follow */
+} __attribute__((packed));
+
+struct wii_capture_writer {
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    uint8_t *buf[2];
+    size_t len[2];
+    int active;                         /* buffer the reader appends to */
+    int pending;                        /* 1 while the other buffer waits for / is being written */
+    int stop;
+
+    /* stats, read them after wii_capture_close() or under lock */
+    uint64_t records;
+    uint64_t dropped;
+    uint64_t bytes;
+    uint64_t write_errors;
+};
+
+struct wii_capture_reader {
+    FILE *f;
+    struct wii_capture_header header;
+    struct wii_motion_record motion;    /* the last WII_CAPTURE_MOTION record read */
+};
+
+/* creates/truncates path, writes the header and starts the writer thread */
+int wii_capture_open_write(struct wii_capture_writer *w, const char *path);
+
+/*
+ * queues one record, never blocks on the disk.
+ * returns 0, or -1 if it had to be dropped
+ */
+int wii_capture_append(struct wii_capture_writer *w, const struct wii_capture_record *rec,
+                       const uint8_t *report);
+
+/* turns a decoded event into a record + rebuilt report, report needs WII_CAPTURE_REPORT_MAX bytes */
+void wii_capture_from_event(const struct wii_event *ev, struct wii_capture_record *rec,
+                            uint8_t *report);
+
+/*
+ * the record for a driver motion record read at read_ns, append it with the
+ * motion record itself as the report
+ */
+void wii_capture_from_motion(const struct wii_motion_record *m, uint64_t read_ns,
+                             struct wii_capture_record *rec);
+
+/* flushes everything left, stops the writer thread and closes the file */
+int wii_capture_close(struct wii_capture_writer *w);
+
+int wii_capture_open_read(struct wii_capture_reader *r, const char *path);
+
+/*
+ * reads the next record, report needs WII_CAPTURE_REPORT_MAX bytes. for a
+ * WII_CAPTURE_MOTION one report gets the report bytes rebuilt from it and
+ * rec->report_len is their length, r->motion has the record.
+ * returns 1 for a record, 0 at the end of the file, -1 if the file is broken
+ */
+int wii_capture_next(struct wii_capture_reader *r, struct wii_capture_record *rec,
+                     uint8_t *report);
+
+void wii_capture_close_read(struct wii_capture_reader *r);
+
+#endif /* WII_CAPTURE_H */
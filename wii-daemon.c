@@ -0,0 +1,480 @@
+/*
+ * wii-daemon.c - owns /dev/wii_remote and fans the events out to any number
+ * of local processes.
+ *
+ * The driver only has one tail on its circular buffer, so if two apps read
+ * /dev/wii_remote they steal events off each other. This daemon is the one
+ * reader, it decodes the lines into struct wii_event and publishes them into a
+ * ring in a memfd. Apps connect to the control socket, get the memfd and read
+ * the ring themselves (see wii-shm.h). The ring is sealed so only the daemon
+ * can write it, each app gets a small page of its own for its cursor.
+ *
+ * usage: wii-daemon [-d device] [-s socket] [-i poll interval ms]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "wii-event.h"
+#include "wii-shm.h"
+
+#define DEVICE_PATH "/dev/wii_remote"
+#define PROC_PATH "/proc/wii_remote"
+#define MAX_READ_SIZE 256
+#define POLL_INTERVAL_MS 5  /* drivers without WII_FEATURE_POLL get read this often instead */
+#define REOPEN_INTERVAL_MS 1000
+
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010  /* 5.1, older libc headers dont have it */
+#endif
+
+/* pfds[0] is the listening socket, pfds[1] the device (-1 if it cant be polled), the rest are clients */
+#define PFD_LISTEN   0
+#define PFD_DEVICE   1
+#define PFD_CLIENTS  2
+#define MAX_POLL_FDS (PFD_CLIENTS + WII_SHM_MAX_CLIENTS)
+
+struct daemon_state {
+    const char *device_path;
+    int dev_fd;
+    int dev_pollable;           /* the driver has poll(), so no reading on a timer */
+    int memfd;
+    struct wii_shm_ring *ring;
+    struct wii_line_buf lines;
+    uint64_t events;
+    uint64_t read_errors;
+
+    struct pollfd pfds[MAX_POLL_FDS];
+    int slot_of[MAX_POLL_FDS];  /* client slot for each pfd, -1 until SUBSCRIBE */
+    int npfds;
+
+    struct wii_shm_client *clients[WII_SHM_MAX_CLIENTS];   /* our mapping of each client page, NULL if free */
+    int client_pid[WII_SHM_MAX_CLIENTS];
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+static int ring_create(struct daemon_state *st)
+{
+    struct wii_shm_ring *ring;
+    int i;
+
+    st->memfd = memfd_create("wii_remote_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (st->memfd < 0) {
+        perror("memfd_create");
+        return -1;
+    }
+    if (ftruncate(st->memfd, sizeof(*ring)) < 0) {
+        perror("ftruncate");
+        return -1;
+    }
+
+    ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED, st->memfd, 0);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    /*
+     * our mapping stays writable, FUTURE_WRITE only stops new ones, so from
+     * here on clients can map it read only and nobody can resize it
+     */
+    if (fcntl(st->memfd, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0) {
+        perror("sealing the ring");
+        return -1;
+    }
+
+    /* memfd pages start zeroed so only the non zero bits need setting */
+    ring->magic = WII_SHM_MAGIC;
+    ring->version = WII_SHM_VERSION;
+    ring->slots = WII_SHM_SLOTS;
+    ring->max_clients = WII_SHM_MAX_CLIENTS;
+    atomic_store(&ring->battery, -1);
+    for (i = 0; i < WII_SHM_SLOTS; i++)
+        atomic_store(&ring->slot[i].seq, WII_SHM_SEQ_BUSY);
+
+    st->ring = ring;
+    return 0;
+}
+
+static int listen_socket(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int sock;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+    unlink(path); /* left over from a previous run */
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 8) < 0) {
+        perror("bind/listen");
+        close(sock);
+        return -1;
+    }
+    chmod(path, 0666); /* any local user can subscribe, same as reading the ring */
+    return sock;
+}
+
+static void publish_event(const struct wii_event *ev, void *ctx)
+{
+    struct daemon_state *st = ctx;
+
+    if (ev->type == WII_EVENT_BATTERY)
+        atomic_store(&st->ring->battery, ev->battery);
+    wii_shm_publish(st->ring, ev);
+    st->events++;
+}
+
+static void device_close(struct daemon_state *st)
+{
+    if (st->dev_fd >= 0)
+        close(st->dev_fd);
+    st->dev_fd = -1;
+    st->lines.len = 0;
+    st->pfds[PFD_DEVICE].fd = -1;
+    atomic_store(&st->ring->connected, 0);
+}
+
+static int device_open(struct daemon_state *st)
+{
+    struct wii_info info;
+
+    st->dev_fd = open(st->device_path, O_RDONLY | O_CLOEXEC);
+    if (st->dev_fd < 0)
+        return -1;
+    /* without poll() the device always looks readable, so those only get read on the timer */
+    st->dev_pollable = wii_get_info(st->dev_fd, &info) == 0 && (info.features & WII_FEATURE_POLL);
+    st->pfds[PFD_DEVICE].fd = st->dev_pollable ? st->dev_fd : -1;
+    st->pfds[PFD_DEVICE].events = POLLIN;
+    atomic_store(&st->ring->connected, 1);
+    return 0;
+}
+
+/* drains whatever the driver has buffered, one wake for the whole batch */
+static void device_poll(struct daemon_state *st)
+{
+    char buffer[MAX_READ_SIZE];
+    int published = 0;
+
+    for (;;) {
+        ssize_t bytes_read = read(st->dev_fd, buffer, sizeof(buffer));
+        if (bytes_read < 0) {
+            perror("Error reading from device");
+            st->read_errors++;
+            device_close(st);
+            break;
+        }
+        if (bytes_read == 0)
+            break;
+        published += wii_event_feed(&st->lines, buffer, bytes_read, wii_now_ns(),
+                                    publish_event, st);
+    }
+
+    if (published)
+        wii_shm_wake(st->ring, st->clients, WII_SHM_MAX_CLIENTS);
+}
+
+/* pass_fd is nfds fds to send along with msg, NULL for none */
+static void send_reply(int fd, const char *msg, size_t len, const int *pass_fd, int nfds)
+{
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct iovec iov = { .iov_base = (void *)msg, .iov_len = len };
+    struct msghdr hdr = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    if (pass_fd && nfds > 0 && nfds <= 2) {
+        struct cmsghdr *cmsg;
+        memset(control, 0, sizeof(control));
+        hdr.msg_control = control;
+        hdr.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), pass_fd, nfds * sizeof(int));
+    }
+    if (sendmsg(fd, &hdr, MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+        perror("sendmsg");
+}
+
+/*
+ * makes the client page for a new subscriber, *page_fd is the memfd to send
+ * it (close it once sent). returns the slot, -1 if there is none free
+ */
+static int client_slot_alloc(struct daemon_state *st, int fd, uint32_t mask, int *page_fd)
+{
+    struct wii_shm_client *c;
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    int i;
+
+    for (i = 0; i < WII_SHM_MAX_CLIENTS; i++) {
+        if (!st->clients[i])
+            break;
+    }
+    if (i == WII_SHM_MAX_CLIENTS)
+        return -1;
+
+    *page_fd = memfd_create("wii_remote_client", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (*page_fd < 0) {
+        perror("memfd_create");
+        return -1;
+    }
+    if (ftruncate(*page_fd, sizeof(*c)) < 0 ||
+        fcntl(*page_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        perror("client page");
+        goto fail;
+    }
+    c = mmap(NULL, sizeof(*c), PROT_READ | PROT_WRITE, MAP_SHARED, *page_fd, 0);
+    if (c == MAP_FAILED) {
+        perror("mmap");
+        goto fail;
+    }
+
+    st->client_pid[i] = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 ? cred.pid : 0;
+    atomic_store(&c->mask, mask);
+    atomic_store(&c->cursor, atomic_load(&st->ring->head));
+    st->clients[i] = c;
+    return i;
+
+fail:
+    close(*page_fd);
+    *page_fd = -1;
+    return -1;
+}
+
+static void send_status(struct daemon_state *st, int fd)
+{
+    char msg[4096];
+    size_t len = 0;
+    uint64_t head = atomic_load(&st->ring->head);
+    int i, clients = 0;
+    FILE *proc;
+
+    for (i = 0; i < WII_SHM_MAX_CLIENTS; i++)
+        clients += st->clients[i] ? 1 : 0;
+
+    len += snprintf(msg + len, sizeof(msg) - len,
+                    "connected: %u\nevents: %llu\nhead: %llu\nread_errors: %llu\n"
+                    "truncated_lines: %llu\nbattery: %d\nclients: %d\n",
+                    atomic_load(&st->ring->connected), (unsigned long long)st->events,
+                    (unsigned long long)head, (unsigned long long)st->read_errors,
+                    (unsigned long long)st->lines.overflows,
+                    atomic_load(&st->ring->battery), clients);
+
+    for (i = 0; i < WII_SHM_MAX_CLIENTS && len < sizeof(msg); i++) {
+        struct wii_shm_client *c = st->clients[i];
+        if (!c)
+            continue;
+        len += snprintf(msg + len, sizeof(msg) - len,
+                        "client %d: pid=%d mask=%x lag=%llu lost=%llu\n", i, st->client_pid[i],
+                        atomic_load(&c->mask),
+                        (unsigned long long)(head - atomic_load(&c->cursor)),
+                        (unsigned long long)atomic_load(&c->lost));
+    }
+
+    /* pass along what the driver says about itself too */
+    proc = fopen(PROC_PATH, "r");
+    if (proc) {
+        char line[128];
+        while (len < sizeof(msg) && fgets(line, sizeof(line), proc))
+            len += snprintf(msg + len, sizeof(msg) - len, "driver: %s", line);
+        fclose(proc);
+    }
+
+    if (len < sizeof(msg))
+        len += snprintf(msg + len, sizeof(msg) - len, ".\n");
+    if (len > sizeof(msg))
+        len = sizeof(msg);
+    send_reply(fd, msg, len, NULL, 0);
+}
+
+static void client_drop(struct daemon_state *st, int idx)
+{
+    int slot = st->slot_of[idx];
+
+    if (slot >= 0) {
+        munmap(st->clients[slot], sizeof(*st->clients[slot]));
+        st->clients[slot] = NULL;
+    }
+    close(st->pfds[idx].fd);
+
+    st->npfds--;
+    st->pfds[idx] = st->pfds[st->npfds];
+    st->slot_of[idx] = st->slot_of[st->npfds];
+}
+
+/* returns -1 if the client should be dropped */
+static int client_request(struct daemon_state *st, int idx)
+{
+    char line[128];
+    unsigned int mask;
+    int fd = st->pfds[idx].fd;
+    ssize_t n;
+
+    n = recv(fd, line, sizeof(line) - 1, MSG_DONTWAIT);
+    if (n <= 0)
+        return (n < 0 && errno == EAGAIN) ? 0 : -1;
+    line[n] = '\0';
+
+    if (sscanf(line, "SUBSCRIBE %x", &mask) == 1) {
+        char reply[32];
+        int slot = st->slot_of[idx];
+        int fds[2] = { st->memfd, -1 };
+
+        /* a second SUBSCRIBE on the same socket would need the page fd again */
+        if (slot >= 0) {
+            send_reply(fd, "ERR already subscribed\n", 23, NULL, 0);
+            return 0;
+        }
+        slot = client_slot_alloc(st, fd, mask, &fds[1]);
+        if (slot < 0) {
+            send_reply(fd, "ERR no free client slots\n", 25, NULL, 0);
+            return -1;
+        }
+        st->slot_of[idx] = slot;
+        n = snprintf(reply, sizeof(reply), "OK %d\n", slot);
+        send_reply(fd, reply, n, fds, 2);
+        close(fds[1]);
+    } else if (sscanf(line, "MASK %x", &mask) == 1) {
+        if (st->slot_of[idx] < 0) {
+            send_reply(fd, "ERR not subscribed\n", 19, NULL, 0);
+            return 0;
+        }
+        atomic_store(&st->clients[st->slot_of[idx]]->mask, mask);
+        send_reply(fd, "OK\n", 3, NULL, 0);
+    } else if (strncmp(line, "STATUS", 6) == 0) {
+        send_status(st, fd);
+    } else {
+        send_reply(fd, "ERR unknown request\n", 20, NULL, 0);
+    }
+    return 0;
+}
+
+static void accept_clients(struct daemon_state *st)
+{
+    for (;;) {
+        int fd = accept4(st->pfds[PFD_LISTEN].fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd < 0)
+            return;
+        if (st->npfds == MAX_POLL_FDS) {
+            fprintf(stderr, "too many clients, refusing one\n");
+            close(fd);
+            continue;
+        }
+        st->pfds[st->npfds].fd = fd;
+        st->pfds[st->npfds].events = POLLIN;
+        st->slot_of[st->npfds] = -1;
+        st->npfds++;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct daemon_state st = {
+        .device_path = DEVICE_PATH, .dev_fd = -1, .memfd = -1,
+        .pfds[PFD_DEVICE] = { .fd = -1 },
+    };
+    const char *socket_path = WII_DAEMON_SOCKET;
+    int interval = POLL_INTERVAL_MS;
+    uint64_t next_reopen = 0;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "d:s:i:")) != -1) {
+        switch (opt) {
+        case 'd': st.device_path = optarg; break;
+        case 's': socket_path = optarg; break;
+        case 'i': interval = atoi(optarg) > 0 ? atoi(optarg) : POLL_INTERVAL_MS; break;
+        default:
+            fprintf(stderr, "usage: %s [-d device] [-s socket] [-i interval_ms]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (ring_create(&st) < 0)
+        return 1;
+    if (device_open(&st) < 0) {
+        perror("Failed to open device");
+        return 1;
+    }
+
+    st.pfds[PFD_LISTEN].fd = listen_socket(socket_path);
+    if (st.pfds[PFD_LISTEN].fd < 0)
+        return 1;
+    st.pfds[PFD_LISTEN].events = POLLIN;
+    st.slot_of[PFD_LISTEN] = st.slot_of[PFD_DEVICE] = -1;
+    st.npfds = PFD_CLIENTS;
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("wii-daemon: publishing %s on %s\n", st.device_path, socket_path);
+
+    while (running) {
+        /* with poll() the device wakes us, the timeout is only for reopening it */
+        int timeout = st.dev_fd < 0 ? REOPEN_INTERVAL_MS : st.dev_pollable ? -1 : interval;
+
+        if (poll(st.pfds, st.npfds, timeout) < 0) {
+            if (errno != EINTR) {
+                perror("poll");
+                break;
+            }
+            continue;
+        }
+
+        if (st.pfds[PFD_LISTEN].revents & POLLIN)
+            accept_clients(&st);
+
+        /* walk backwards so dropping a client doesnt skip the one swapped into its place */
+        for (i = st.npfds - 1; i >= PFD_CLIENTS; i--) {
+            if (!st.pfds[i].revents)
+                continue;
+            if ((st.pfds[i].revents & (POLLERR | POLLHUP)) || client_request(&st, i) < 0)
+                client_drop(&st, i);
+        }
+
+        if (st.dev_fd >= 0) {
+            if (!st.dev_pollable || st.pfds[PFD_DEVICE].revents)
+                device_poll(&st);
+        } else if (wii_now_ns() >= next_reopen) {
+            next_reopen = wii_now_ns() + REOPEN_INTERVAL_MS * 1000000ull;
+            device_open(&st);
+        }
+    }
+
+    device_close(&st);
+    wii_shm_wake(st.ring, st.clients, WII_SHM_MAX_CLIENTS); /* let sleeping clients notice connected went to 0 */
+    for (i = st.npfds - 1; i >= PFD_CLIENTS; i--)
+        client_drop(&st, i);
+    close(st.pfds[PFD_LISTEN].fd);
+    unlink(socket_path);
+    munmap(st.ring, sizeof(*st.ring));
+    close(st.memfd);
+    return 0;
+}
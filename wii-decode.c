@@ -0,0 +1,301 @@
+/*
+ * wii-decode.c - batch report decoder, see wii-decode.h
+ *
+ * All the SIMD kernels do the same thing: load the same 4 bytes out of every
+ * report in the group into one 32 bit lane each, then pull the fields out with
+ * shifts and masks, which is the same for every lane so theres no branching
+ * per report. The bit positions are the same as in wii_report_accel() and
+ * wii_report_ir() in wii-event.c, check there (and wiibrew) if you touch them.
+ *
+ * With w = bytes [1..4] of a report (byte 1 in the low 8 bits):
+ *   buttons = w & 0x9f1f
+ *   accel x = byte3 << 2 | (byte1 >> 5) & 3 = (w >> 14) & 0x3fc | (w >> 5) & 3
+ *   accel y = byte4 << 2 | (byte2 >> 4) & 2 = (w >> 22) & 0x3fc | (w >> 12) & 2
+ * and with w = bytes [2..5]:
+ *   accel z = byte5 << 2 | (byte2 >> 5) & 2 = (w >> 22) & 0x3fc | (w >> 5) & 2
+ */
+
+#include <immintrin.h>
+#include <string.h>
+
+#include "wii-decode.h"
+
+typedef void (*run_fn)(const uint8_t *r, size_t stride, size_t n, uint8_t id,
+                       const struct wii_decoded *out, size_t at);
+
+static enum wii_decode_impl current_impl;
+static run_fn current_run;
+
+/* where the IR starts in a report, 0 if it has none */
+static int ir_offset(uint8_t id)
+{
+    switch (id) {
+    case 0x33: return 6;
+    case 0x36: return 3;
+    case 0x37: return 6;
+    default:   return 0;
+    }
+}
+
+/* --- scalar, the reference and the tail of every SIMD run --- */
+
+static void scalar_run(const uint8_t *r, size_t stride, size_t n, uint8_t id,
+                       const struct wii_decoded *out, size_t at)
+{
+    size_t i, k;
+    int j;
+
+    for (i = 0; i < n; i++, r += stride) {
+        uint16_t accel[3], x[WII_IR_BLOBS], y[WII_IR_BLOBS];
+        uint8_t size[WII_IR_BLOBS];
+
+        k = at + i;
+        out->buttons[k] = id == 0x3d ? 0 : wii_buttons_from_report(r);
+
+        if (wii_report_accel(r, stride, accel) < 0)
+            accel[0] = accel[1] = accel[2] = 0;
+        for (j = 0; j < 3; j++)
+            out->accel[j][k] = accel[j];
+
+        if (wii_report_ir(r, stride, x, y, size) < 0) {
+            for (j = 0; j < WII_IR_BLOBS; j++) {
+                x[j] = y[j] = WII_IR_MISSING;
+                size[j] = WII_IR_NO_SIZE;
+            }
+        }
+        for (j = 0; j < WII_IR_BLOBS; j++) {
+            out->ir_x[j][k] = x[j];
+            out->ir_y[j][k] = y[j];
+            out->ir_size[j][k] = size[j];
+        }
+    }
+}
+
+/* --- SSE4.1, 4 reports at a time. no gather instruction so the lanes are loaded one by one --- */
+
+__attribute__((target("sse4.1")))
+static inline __m128i sse_load4(const uint8_t *r, size_t stride, int off)
+{
+    uint32_t a, b, c, d;
+    memcpy(&a, r + off, 4);
+    memcpy(&b, r + stride + off, 4);
+    memcpy(&c, r + 2 * stride + off, 4);
+    memcpy(&d, r + 3 * stride + off, 4);
+    return _mm_setr_epi32((int)a, (int)b, (int)c, (int)d);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i sse_field(__m128i w, int shift, uint32_t mask)
+{
+    return _mm_and_si128(_mm_srli_epi32(w, shift), _mm_set1_epi32((int)mask));
+}
+
+__attribute__((target("sse4.1")))
+static inline void sse_store16(uint16_t *dst, __m128i v)
+{
+    _mm_storel_epi64((__m128i *)dst, _mm_packus_epi32(v, v));
+}
+
+__attribute__((target("sse4.1")))
+static inline void sse_store8(uint8_t *dst, __m128i v)
+{
+    int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packus_epi32(v, v), v));
+    memcpy(dst, &packed, 4);
+}
+
+__attribute__((target("sse4.1")))
+static void sse41_run(const uint8_t *r, size_t stride, size_t n, uint8_t id,
+                      const struct wii_decoded *out, size_t at)
+{
+    const int accel = wii_report_has_accel(id);
+    const int ir = ir_offset(id);
+    const __m128i missing = _mm_set1_epi32(WII_IR_MISSING);
+    const __m128i no_size = _mm_set1_epi32(WII_IR_NO_SIZE);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i;
+    int j;
+
+    for (i = 0; i + 4 <= n; i += 4, r += 4 * stride) {
+        size_t k = at + i;
+        __m128i w1 = sse_load4(r, stride, 1);
+
+        sse_store16(out->buttons + k, id == 0x3d ? zero : sse_field(w1, 0, WII_BTN_MASK));
+
+        if (accel) {
+            __m128i w2 = sse_load4(r, stride, 2);
+            sse_store16(out->accel[0] + k, _mm_or_si128(sse_field(w1, 14, 0x3fc), sse_field(w1, 5, 0x3)));
+            sse_store16(out->accel[1] + k, _mm_or_si128(sse_field(w1, 22, 0x3fc), sse_field(w1, 12, 0x2)));
+            sse_store16(out->accel[2] + k, _mm_or_si128(sse_field(w2, 22, 0x3fc), sse_field(w2, 5, 0x2)));
+        } else {
+            for (j = 0; j < 3; j++)
+                sse_store16(out->accel[j] + k, zero);
+        }
+
+        if (id == 0x33) {
+            /* extended: 3 bytes a blob, g = [x lo, y lo, hi bits + size, next] */
+            for (j = 0; j < WII_IR_BLOBS; j++) {
+                __m128i g = sse_load4(r, stride, ir + 3 * j);
+                sse_store16(out->ir_x[j] + k, _mm_or_si128(sse_field(g, 0, 0xff), sse_field(g, 12, 0x300)));
+                sse_store16(out->ir_y[j] + k, _mm_or_si128(sse_field(g, 8, 0xff), sse_field(g, 14, 0x300)));
+                sse_store8(out->ir_size[j] + k, sse_field(g, 16, 0x0f));
+            }
+        } else if (ir) {
+            /* basic: 5 bytes a pair, g = bytes [0..3] of the pair, g2 = bytes [1..4] */
+            for (j = 0; j < WII_IR_BLOBS; j += 2) {
+                __m128i g = sse_load4(r, stride, ir + 5 * (j / 2));
+                __m128i g2 = sse_load4(r, stride, ir + 5 * (j / 2) + 1);
+                sse_store16(out->ir_x[j] + k, _mm_or_si128(sse_field(g, 0, 0xff), sse_field(g, 12, 0x300)));
+                sse_store16(out->ir_y[j] + k, _mm_or_si128(sse_field(g, 8, 0xff), sse_field(g, 14, 0x300)));
+                sse_store16(out->ir_x[j + 1] + k, _mm_or_si128(sse_field(g, 24, 0xff), sse_field(g, 8, 0x300)));
+                sse_store16(out->ir_y[j + 1] + k, _mm_or_si128(sse_field(g2, 24, 0xff), sse_field(g2, 2, 0x300)));
+                sse_store8(out->ir_size[j] + k, no_size);
+                sse_store8(out->ir_size[j + 1] + k, no_size);
+            }
+        } else {
+            for (j = 0; j < WII_IR_BLOBS; j++) {
+                sse_store16(out->ir_x[j] + k, missing);
+                sse_store16(out->ir_y[j] + k, missing);
+                sse_store8(out->ir_size[j] + k, no_size);
+            }
+        }
+    }
+    scalar_run(r, stride, n - i, id, out, at + i);
+}
+
+/* --- AVX2, 8 reports at a time with real gathers --- */
+
+__attribute__((target("avx2")))
+static inline __m256i avx_load8(const uint8_t *r, __m256i lanes, int off)
+{
+    return _mm256_i32gather_epi32((const int *)(r + off), lanes, 1);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx_field(__m256i w, int shift, uint32_t mask)
+{
+    return _mm256_and_si256(_mm256_srli_epi32(w, shift), _mm256_set1_epi32((int)mask));
+}
+
+__attribute__((target("avx2")))
+static inline void avx_store16(uint16_t *dst, __m256i v)
+{
+    __m128i lo = _mm256_castsi256_si128(v), hi = _mm256_extracti128_si256(v, 1);
+    _mm_storeu_si128((__m128i *)dst, _mm_packus_epi32(lo, hi));
+}
+
+__attribute__((target("avx2")))
+static inline void avx_store8(uint8_t *dst, __m256i v)
+{
+    __m128i lo = _mm256_castsi256_si128(v), hi = _mm256_extracti128_si256(v, 1);
+    __m128i w = _mm_packus_epi32(lo, hi);
+    _mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(w, w));
+}
+
+__attribute__((target("avx2")))
+static void avx2_run(const uint8_t *r, size_t stride, size_t n, uint8_t id,
+                     const struct wii_decoded *out, size_t at)
+{
+    const int accel = wii_report_has_accel(id);
+    const int ir = ir_offset(id);
+    const __m256i lanes = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                             _mm256_set1_epi32((int)stride));
+    const __m256i missing = _mm256_set1_epi32(WII_IR_MISSING);
+    const __m256i no_size = _mm256_set1_epi32(WII_IR_NO_SIZE);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i;
+    int j;
+
+    for (i = 0; i + 8 <= n; i += 8, r += 8 * stride) {
+        size_t k = at + i;
+        __m256i w1 = avx_load8(r, lanes, 1);
+
+        avx_store16(out->buttons + k, id == 0x3d ? zero : avx_field(w1, 0, WII_BTN_MASK));
+
+        if (accel) {
+            __m256i w2 = avx_load8(r, lanes, 2);
+            avx_store16(out->accel[0] + k, _mm256_or_si256(avx_field(w1, 14, 0x3fc), avx_field(w1, 5, 0x3)));
+            avx_store16(out->accel[1] + k, _mm256_or_si256(avx_field(w1, 22, 0x3fc), avx_field(w1, 12, 0x2)));
+            avx_store16(out->accel[2] + k, _mm256_or_si256(avx_field(w2, 22, 0x3fc), avx_field(w2, 5, 0x2)));
+        } else {
+            for (j = 0; j < 3; j++)
+                avx_store16(out->accel[j] + k, zero);
+        }
+
+        if (id == 0x33) {
+            for (j = 0; j < WII_IR_BLOBS; j++) {
+                __m256i g = avx_load8(r, lanes, ir + 3 * j);
+                avx_store16(out->ir_x[j] + k, _mm256_or_si256(avx_field(g, 0, 0xff), avx_field(g, 12, 0x300)));
+                avx_store16(out->ir_y[j] + k, _mm256_or_si256(avx_field(g, 8, 0xff), avx_field(g, 14, 0x300)));
+                avx_store8(out->ir_size[j] + k, avx_field(g, 16, 0x0f));
+            }
+        } else if (ir) {
+            for (j = 0; j < WII_IR_BLOBS; j += 2) {
+                __m256i g = avx_load8(r, lanes, ir + 5 * (j / 2));
+                __m256i g2 = avx_load8(r, lanes, ir + 5 * (j / 2) + 1);
+                avx_store16(out->ir_x[j] + k, _mm256_or_si256(avx_field(g, 0, 0xff), avx_field(g, 12, 0x300)));
+                avx_store16(out->ir_y[j] + k, _mm256_or_si256(avx_field(g, 8, 0xff), avx_field(g, 14, 0x300)));
+                avx_store16(out->ir_x[j + 1] + k, _mm256_or_si256(avx_field(g, 24, 0xff), avx_field(g, 8, 0x300)));
+                avx_store16(out->ir_y[j + 1] + k, _mm256_or_si256(avx_field(g2, 24, 0xff), avx_field(g2, 2, 0x300)));
+                avx_store8(out->ir_size[j] + k, no_size);
+                avx_store8(out->ir_size[j + 1] + k, no_size);
+            }
+        } else {
+            for (j = 0; j < WII_IR_BLOBS; j++) {
+                avx_store16(out->ir_x[j] + k, missing);
+                avx_store16(out->ir_y[j] + k, missing);
+                avx_store8(out->ir_size[j] + k, no_size);
+            }
+        }
+    }
+    scalar_run(r, stride, n - i, id, out, at + i);
+}
+
+/* --- dispatch --- */
+
+enum wii_decode_impl wii_decode_set_impl(enum wii_decode_impl impl)
+{
+    __builtin_cpu_init();
+    if (impl == WII_DECODE_AUTO)
+        impl = WII_DECODE_AVX2;
+    if (impl == WII_DECODE_AVX2 && !__builtin_cpu_supports("avx2"))
+        impl = WII_DECODE_SSE41;
+    if (impl == WII_DECODE_SSE41 && !__builtin_cpu_supports("sse4.1"))
+        impl = WII_DECODE_SCALAR;
+
+    switch (impl) {
+    case WII_DECODE_AVX2:  current_run = avx2_run; break;
+    case WII_DECODE_SSE41: current_run = sse41_run; break;
+    default:               current_run = scalar_run; impl = WII_DECODE_SCALAR; break;
+    }
+    current_impl = impl;
+    return impl;
+}
+
+const char *wii_decode_impl_name(enum wii_decode_impl impl)
+{
+    switch (impl) {
+    case WII_DECODE_SCALAR: return "scalar";
+    case WII_DECODE_SSE41:  return "sse4.1";
+    case WII_DECODE_AVX2:   return "avx2";
+    default:                return "auto";
+    }
+}
+
+void wii_decode_batch(const uint8_t *reports, size_t stride, size_t n,
+                      const struct wii_decoded *out)
+{
+    size_t start = 0;
+
+    if (!current_run)
+        wii_decode_set_impl(WII_DECODE_AUTO);
+
+    /* a live stream is nearly always long runs of the same report mode */
+    while (start < n) {
+        uint8_t id = reports[start * stride];
+        size_t end = start + 1;
+        while (end < n && reports[end * stride] == id)
+            end++;
+        current_run(reports + start * stride, stride, end - start, id, out, start);
+        start = end;
+    }
+}
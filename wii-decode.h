@@ -0,0 +1,56 @@
+/*
+ * wii-decode.h - decodes arrays of raw reports in one go.
+ *
+ * wii_report_accel()/wii_report_ir() in wii-event.h do one report at a time,
+ * which is fine for a live remote at 100Hz but not for packing or benchmarking
+ * millions of them. wii_decode_batch() splits the batch into runs of the same
+ * report id and decodes each run 8 (AVX2) or 4 (SSE4.1) reports at a time, with
+ * the scalar code doing whatever is left over and running on anything else.
+ *
+ * Output is structure of arrays, one array per field, so it drops straight
+ * into the archive columns (wii-archive.h) and the analysis loops.
+ */
+
+#ifndef WII_DECODE_H
+#define WII_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wii-event.h"
+
+/*
+ * reports sit stride bytes apart and stride has to be at least this, the
+ * kernels load whole words so every report needs this many readable bytes
+ * even if its shorter (pad with zeros)
+ */
+#define WII_DECODE_MIN_STRIDE 22
+
+/* caller owns the arrays, each one has room for n entries */
+struct wii_decoded {
+    uint16_t *buttons;                  /* WII_BTN_* */
+    uint16_t *accel[3];                 /* 10 bit, 0 if the report has no accel */
+    uint16_t *ir_x[WII_IR_BLOBS];       /* WII_IR_MISSING if no IR or blob unseen */
+    uint16_t *ir_y[WII_IR_BLOBS];
+    uint8_t  *ir_size[WII_IR_BLOBS];    /* WII_IR_NO_SIZE for basic IR and no IR */
+};
+
+enum wii_decode_impl {
+    WII_DECODE_AUTO = 0,                /* best the cpu supports */
+    WII_DECODE_SCALAR,
+    WII_DECODE_SSE41,
+    WII_DECODE_AVX2,
+};
+
+/* decodes n reports into out[0..n) */
+void wii_decode_batch(const uint8_t *reports, size_t stride, size_t n,
+                      const struct wii_decoded *out);
+
+/*
+ * picks the implementation, mostly so benchmarks can compare them.
+ * returns the one actually used (falls back if the cpu cant do what was asked)
+ */
+enum wii_decode_impl wii_decode_set_impl(enum wii_decode_impl impl);
+const char *wii_decode_impl_name(enum wii_decode_impl impl);
+
+#endif /* WII_DECODE_H */
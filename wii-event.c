@@ -0,0 +1,264 @@
+/*
+ * wii-event.c - turns the driver's text output back into struct wii_event.
+ *
+ * Keep the names below in sync with perform_input_mapping() in wii-remote-driver.c,
+ * if the driver prints something new and it isnt in here it just gets skipped.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wii-event.h"
+
+static const struct {
+    uint16_t bit;
+    const char *name;
+} wii_buttons[WII_BTN_COUNT] = {
+    { WII_BTN_LEFT,  "Dpad_Left" },
+    { WII_BTN_RIGHT, "Dpad_Right" },
+    { WII_BTN_DOWN,  "Dpad_Down" },
+    { WII_BTN_UP,    "Dpad_Up" },
+    { WII_BTN_PLUS,  "Plus" },
+    { WII_BTN_MINUS, "Minus" },
+    { WII_BTN_HOME,  "Home" },
+    { WII_BTN_TWO,   "2" },
+    { WII_BTN_ONE,   "1" },
+    { WII_BTN_B,     "B" },
+    { WII_BTN_A,     "A" },
+};
+
+const char *wii_button_name(uint16_t bit)
+{
+    int i;
+    for (i = 0; i < WII_BTN_COUNT; i++)
+        if (wii_buttons[i].bit == bit)
+            return wii_buttons[i].name;
+    return NULL;
+}
+
+uint64_t wii_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int wii_get_info(int fd, struct wii_info *info)
+{
+    memset(info, 0, sizeof(*info));
+    if (ioctl(fd, WIIMOTE_IOCTL_GET_INFO, info) == 0)
+        return 0;
+    if (errno != ENOTTY)
+        return -1;
+    /* older than GET_INFO, the text is all we can count on */
+    info->size = sizeof(*info);
+    info->features = WII_FEATURE_TEXT;
+    info->battery = -1;
+    return 0;
+}
+
+static int has_prefix(const char *s, size_t len, const char *prefix)
+{
+    size_t n = strlen(prefix);
+    return len >= n && memcmp(s, prefix, n) == 0;
+}
+
+/*
+ * the driver doesnt always put a space between names (Dpad_Left has none after it)
+ * so instead of splitting on spaces we just match names from the front of whats left
+ */
+static uint16_t parse_buttons(const char *p, size_t len)
+{
+    uint16_t buttons = 0;
+    int i;
+
+    while (len > 0) {
+        if (*p == ' ' || *p == ',') {
+            p++;
+            len--;
+            continue;
+        }
+        for (i = 0; i < WII_BTN_COUNT; i++) {
+            if (has_prefix(p, len, wii_buttons[i].name)) {
+                size_t n = strlen(wii_buttons[i].name);
+                buttons |= wii_buttons[i].bit;
+                p += n;
+                len -= n;
+                break;
+            }
+        }
+        if (i == WII_BTN_COUNT) { /* not a button name, skip a char */
+            p++;
+            len--;
+        }
+    }
+    return buttons;
+}
+
+int wii_event_parse_line(const char *line, size_t len, struct wii_event *ev)
+{
+    char num[16];
+    size_t i;
+
+    memset(ev, 0, sizeof(*ev));
+
+    if (has_prefix(line, len, "Battery: ")) {
+        size_t off = strlen("Battery: ");
+        for (i = 0; off + i < len && i < sizeof(num) - 1; i++)
+            num[i] = line[off + i];
+        num[i] = '\0';
+        ev->type = WII_EVENT_BATTERY;
+        ev->battery = (uint8_t)strtoul(num, NULL, 10);
+        return 0;
+    }
+
+    if (has_prefix(line, len, "Report: ID=")) {
+        size_t off = strlen("Report: ID=");
+        for (i = 0; off + i < len && i < sizeof(num) - 1 &&
+                    line[off + i] >= '0' && line[off + i] <= '9'; i++)
+            num[i] = line[off + i];
+        num[i] = '\0';
+        ev->type = WII_EVENT_BUTTONS;
+        ev->report_id = (uint8_t)strtoul(num, NULL, 10);
+        off += i;
+
+        /* older drivers dont print T=, so its optional */
+        if (has_prefix(line + off, len - off, ", T=")) {
+            off += strlen(", T=");
+            while (off < len && line[off] >= '0' && line[off] <= '9')
+                ev->driver_ns = ev->driver_ns * 10 + (uint64_t)(line[off++] - '0');
+        }
+        ev->buttons = parse_buttons(line + off, len - off);
+        return 0;
+    }
+
+    return -1;
+}
+
+int wii_event_feed(struct wii_line_buf *lb, const char *data, size_t len,
+                   uint64_t timestamp_ns, wii_event_cb cb, void *ctx)
+{
+    struct wii_event ev;
+    int events = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (data[i] != '\n') {
+            if (lb->len < sizeof(lb->data))
+                lb->data[lb->len++] = data[i];
+            else if (lb->len == sizeof(lb->data)) {
+                /* longer than anything the driver can print, drop it until the next newline */
+                lb->overflows++;
+                lb->len++;
+            }
+            continue;
+        }
+
+        if (lb->len <= sizeof(lb->data) &&
+            wii_event_parse_line(lb->data, lb->len, &ev) == 0) {
+            ev.timestamp_ns = timestamp_ns;
+            cb(&ev, ctx);
+            events++;
+        }
+        lb->len = 0;
+    }
+    return events;
+}
+
+int wii_event_from_report(const uint8_t *report, size_t len, uint64_t driver_ns,
+                          struct wii_event *ev)
+{
+    memset(ev, 0, sizeof(*ev));
+    ev->driver_ns = driver_ns;
+
+    if (len >= WII_STATUS_LEN && report[0] == 0x20) {
+        ev->type = WII_EVENT_BATTERY;
+        ev->battery = report[WII_STATUS_BATTERY];
+        return 0;
+    }
+    if (len < 3)
+        return -1;
+    ev->type = WII_EVENT_BUTTONS;
+    ev->report_id = report[0];
+    ev->buttons = wii_buttons_from_report(report);
+    return 0;
+}
+
+int wii_report_accel(const uint8_t *report, size_t len, uint16_t accel[3])
+{
+    if (len < 6 || !wii_report_has_accel(report[0]))
+        return -1;
+    accel[0] = (uint16_t)((report[3] << 2) | ((report[1] >> 5) & 0x3));
+    accel[1] = (uint16_t)((report[4] << 2) | ((report[2] >> 4) & 0x2));
+    accel[2] = (uint16_t)((report[5] << 2) | ((report[2] >> 5) & 0x2));
+    return 0;
+}
+
+int wii_report_ir(const uint8_t *report, size_t len, uint16_t x[WII_IR_BLOBS],
+                  uint16_t y[WII_IR_BLOBS], uint8_t size[WII_IR_BLOBS])
+{
+    const uint8_t *ir;
+    int i;
+
+    switch (report[0]) {
+    case 0x33: /* extended, after accel */
+        if (len < 18)
+            return -1;
+        ir = report + 6;
+        for (i = 0; i < WII_IR_BLOBS; i++, ir += 3) {
+            x[i] = (uint16_t)(ir[0] | ((ir[2] & 0x30) << 4));
+            y[i] = (uint16_t)(ir[1] | ((ir[2] & 0xc0) << 2));
+            size[i] = ir[2] & 0x0f;
+        }
+        return 0;
+    case 0x36: /* basic, straight after the buttons */
+    case 0x37: /* basic, after accel */
+        ir = report + (report[0] == 0x36 ? 3 : 6);
+        if (len < (size_t)(ir - report) + 10)
+            return -1;
+        for (i = 0; i < WII_IR_BLOBS; i += 2, ir += 5) {
+            x[i]     = (uint16_t)(ir[0] | ((ir[2] & 0x30) << 4));
+            y[i]     = (uint16_t)(ir[1] | ((ir[2] & 0xc0) << 2));
+            x[i + 1] = (uint16_t)(ir[3] | ((ir[2] & 0x03) << 8));
+            y[i + 1] = (uint16_t)(ir[4] | ((ir[2] & 0x0c) << 6));
+            size[i] = size[i + 1] = WII_IR_NO_SIZE;
+        }
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+int wii_event_format_report(const uint8_t *report, size_t len, uint64_t driver_ns,
+                            char *out, size_t size)
+{
+    /* order and spacing straight out of perform_input_mapping(), quirks included */
+    static const struct {
+        uint16_t bit;
+        const char *text;
+    } order[WII_BTN_COUNT] = {
+        { WII_BTN_LEFT, "Dpad_Left" }, { WII_BTN_RIGHT, "Dpad_Right " },
+        { WII_BTN_DOWN, "Dpad_Down " }, { WII_BTN_UP, "Dpad_Up " }, { WII_BTN_PLUS, "Plus " },
+        { WII_BTN_MINUS, "Minus " }, { WII_BTN_HOME, "Home " }, { WII_BTN_TWO, "2 " },
+        { WII_BTN_ONE, "1 " }, { WII_BTN_B, "B " }, { WII_BTN_A, "A" },
+    };
+    uint16_t buttons;
+    int n, i;
+
+    if (len >= WII_STATUS_LEN && report[0] == 0x20)
+        return snprintf(out, size, "Battery: %d\n", report[WII_STATUS_BATTERY]);
+    if (len < 3)
+        return 0;
+
+    buttons = wii_buttons_from_report(report);
+    n = snprintf(out, size, "Report: ID=%u, T=%llu, ", report[0], (unsigned long long)driver_ns);
+    for (i = 0; i < WII_BTN_COUNT && n < (int)size; i++)
+        if (buttons & order[i].bit)
+            n += snprintf(out + n, size - n, "%s", order[i].text);
+    if (n < (int)size)
+        n += snprintf(out + n, size - n, "\n");
+    return n;
+}
@@ -0,0 +1,157 @@
+/*
+ * wii-event.h - decoded Wii remote events shared by the user space tools.
+ *
+ * The driver hands out human readable lines from its circular buffer, e.g.
+ *
+ *   "Report: ID=48, T=5123456789012, Dpad_Up A\n"
+ *   "Battery: 87\n"
+ *
+ * T= is ktime_get_ns() when the report came in, the same clock as CLOCK_MONOTONIC
+ * in user space so wii_now_ns() - driver_ns is how old the event is.
+ *
+ * wii_event_feed() turns those lines back into struct wii_event so the client,
+ * the daemon and anything else can test a bitmask instead of strstr'ing button
+ * names out of a buffer.
+ *
+ * The button bits are laid out exactly like the raw report (byte 1 in the low
+ * half, byte 2 in the high half) so decoding a raw report is just a load and a
+ * mask, see wii_buttons_from_report().
+ */
+
+#ifndef WII_EVENT_H
+#define WII_EVENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+#include "wii-remote-uapi.h"   /* ioctls, records, netlink, io_uring: the driver's side of things */
+
+/* byte 1 of the report */
+#define WII_BTN_LEFT    0x0001
+#define WII_BTN_RIGHT   0x0002
+#define WII_BTN_DOWN    0x0004
+#define WII_BTN_UP      0x0008
+#define WII_BTN_PLUS    0x0010
+/* byte 2 of the report, same bits perform_input_mapping() tests */
+#define WII_BTN_TWO     0x0100
+#define WII_BTN_ONE     0x0200
+#define WII_BTN_B       0x0400
+#define WII_BTN_A       0x0800
+#define WII_BTN_MINUS   0x1000
+#define WII_BTN_HOME    0x8000
+
+#define WII_BTN_MASK    0x9f1f
+#define WII_BTN_COUNT   11
+
+/*
+ * the driver also sends these as keys on its "Nintendo Wii Remote" evdev device.
+ * the scancode is the bit number (A is 11), so a profile is just EVIOCSKEYCODE
+ * with { scancode, keycode } pairs, no translation in between
+ */
+#define WII_BTN_SCANCODE(bit) (__builtin_ctz(bit))
+
+/* 0x20 status report: buttons, flags (bit 1 extension), 2 zero bytes, battery level */
+#define WII_STATUS_LEN      7
+#define WII_STATUS_BATTERY  6
+
+enum wii_event_type {
+    WII_EVENT_NONE = 0,
+    WII_EVENT_BUTTONS,  /* "Report: ..." line */
+    WII_EVENT_BATTERY,  /* "Battery: ..." line */
+    WII_EVENT_GESTURE,  /* recognised by wii-gesture, buttons is what it stands in for */
+};
+
+/* 32 bytes, this is also the slot payload of the daemon's shared ring so keep it packed tight */
+struct wii_event {
+    uint64_t timestamp_ns;  /* CLOCK_MONOTONIC, when the event was read */
+    uint64_t driver_ns;     /* when the driver got the report, 0 if the line had no T= */
+    uint16_t type;          /* enum wii_event_type */
+    uint16_t buttons;       /* WII_BTN_* bits held in this report */
+    uint8_t  report_id;
+    uint8_t  battery;       /* only valid for WII_EVENT_BATTERY */
+    uint16_t gesture;       /* template index for WII_EVENT_GESTURE */
+    uint32_t seq;           /* filled in by whoever publishes the event */
+};
+
+/*
+ * reads from /dev/wii_remote can split a line in half, so the partial tail is
+ * kept here until the rest of it turns up
+ */
+#define WII_LINE_MAX 256
+
+struct wii_line_buf {
+    char     data[WII_LINE_MAX];
+    size_t   len;
+    uint64_t overflows;     /* lines thrown away because they never ended */
+};
+
+typedef void (*wii_event_cb)(const struct wii_event *ev, void *ctx);
+
+/*
+ * feeds raw bytes read from the device, calls cb once per complete line that
+ * parsed to an event. timestamp_ns is stamped on every event produced.
+ * returns the number of events delivered
+ */
+int wii_event_feed(struct wii_line_buf *lb, const char *data, size_t len,
+                   uint64_t timestamp_ns, wii_event_cb cb, void *ctx);
+
+/* parses a single line without the '\n', returns 0 on success, -1 if its not an event */
+int wii_event_parse_line(const char *line, size_t len, struct wii_event *ev);
+
+/* same bit tests as perform_input_mapping() but on the raw report */
+static inline uint16_t wii_buttons_from_report(const uint8_t *report)
+{
+    return (uint16_t)((report[1] | (report[2] << 8)) & WII_BTN_MASK);
+}
+
+/*
+ * where things are in the raw data reports (see wiibrew "Data Reporting Modes").
+ * core buttons are always bytes 1-2, accel is 3 bytes after them and the two
+ * spare low bits live in the button bytes, IR comes basic (10 bytes, 2 blobs
+ * per 5 bytes) or extended (12 bytes, 3 per blob with a size)
+ */
+#define WII_IR_BLOBS      4
+#define WII_IR_MISSING    0x3ff   /* x and y of a blob the camera doesnt see */
+#define WII_IR_NO_SIZE    0xff    /* basic IR doesnt send a size */
+
+static inline int wii_report_has_accel(uint8_t id)
+{
+    return id == 0x31 || id == 0x33 || id == 0x35 || id == 0x37;
+}
+
+/* returns 0 and fills accel (10 bit values) if the report carries accel data */
+int wii_report_accel(const uint8_t *report, size_t len, uint16_t accel[3]);
+
+/* returns 0 and fills the four blobs if the report carries IR data */
+int wii_report_ir(const uint8_t *report, size_t len, uint16_t x[WII_IR_BLOBS],
+                  uint16_t y[WII_IR_BLOBS], uint8_t size[WII_IR_BLOBS]);
+
+/*
+ * decodes a raw report the same way wii_raw_event() does, driver_ns is stamped
+ * on it. returns -1 for reports the driver would ignore (too short)
+ */
+int wii_event_from_report(const uint8_t *report, size_t len, uint64_t driver_ns,
+                          struct wii_event *ev);
+
+/*
+ * prints a raw report the way the driver would into its circular buffer,
+ * newline included. returns the length like snprintf, 0 if the driver would print nothing
+ */
+int wii_event_format_report(const uint8_t *report, size_t len, uint64_t driver_ns,
+                            char *out, size_t size);
+
+/* the name the driver prints for a single WII_BTN_* bit, NULL if its not a button */
+const char *wii_button_name(uint16_t bit);
+
+/* CLOCK_MONOTONIC in nanoseconds */
+uint64_t wii_now_ns(void);
+
+/*
+ * fills info from WIIMOTE_IOCTL_GET_INFO. a driver from before it has only
+ * the text, so on ENOTTY info comes back as just that (abi_version 0) and it
+ * still returns 0. -1 for anything else
+ */
+int wii_get_info(int fd, struct wii_info *info);
+
+#endif /* WII_EVENT_H */
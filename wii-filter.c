@@ -0,0 +1,256 @@
+/*
+ * wii-filter.c - One-Euro and Kalman pointer filters, see wii-filter.h
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wii-filter.h"
+
+#define DEFAULT_DT 0.01     /* the remote reports at 100Hz, used when two samples share a timestamp */
+#define MAX_DT     0.25     /* a longer step than this is a gap, not a sample period */
+#define IR_WIDTH   1024.0
+#define IR_HEIGHT  768.0
+
+void wii_filter_defaults(struct wii_filter_params *p, enum wii_filter_kind kind)
+{
+    memset(p, 0, sizeof(*p));
+    p->kind = kind;
+    p->min_cutoff = 1.0;
+    p->beta = 0.05;
+    p->d_cutoff = 1.0;
+    p->q = 2000.0;
+    p->r = 3.0;
+    p->hold_ms = 100.0;
+    p->reacquire_ms = 250.0;
+    p->jump = 200.0;
+}
+
+int wii_filter_parse(const char *spec, struct wii_filter_params *p)
+{
+    static const struct {
+        const char *name;
+        size_t offset;
+    } keys[] = {
+        { "min_cutoff",   offsetof(struct wii_filter_params, min_cutoff) },
+        { "beta",         offsetof(struct wii_filter_params, beta) },
+        { "d_cutoff",     offsetof(struct wii_filter_params, d_cutoff) },
+        { "q",            offsetof(struct wii_filter_params, q) },
+        { "r",            offsetof(struct wii_filter_params, r) },
+        { "hold_ms",      offsetof(struct wii_filter_params, hold_ms) },
+        { "reacquire_ms", offsetof(struct wii_filter_params, reacquire_ms) },
+        { "jump",         offsetof(struct wii_filter_params, jump) },
+    };
+    const char *colon = strchr(spec, ':');
+    size_t name_len = colon ? (size_t)(colon - spec) : strlen(spec);
+    char *copy, *tok, *save = NULL;
+    int ret = 0;
+
+    if (name_len == 4 && strncmp(spec, "none", 4) == 0)
+        wii_filter_defaults(p, WII_FILTER_NONE);
+    else if (name_len == 8 && strncmp(spec, "one-euro", 8) == 0)
+        wii_filter_defaults(p, WII_FILTER_ONE_EURO);
+    else if (name_len == 6 && strncmp(spec, "kalman", 6) == 0)
+        wii_filter_defaults(p, WII_FILTER_KALMAN);
+    else
+        goto bad;
+    if (!colon)
+        return 0;
+
+    copy = strdup(colon + 1);
+    if (!copy)
+        return -1;
+    for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '='), *end;
+        size_t i;
+        double v;
+
+        if (!eq) {
+            ret = -1;
+            break;
+        }
+        *eq = '\0';
+        v = strtod(eq + 1, &end);
+        for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+            if (strcmp(tok, keys[i].name) == 0)
+                break;
+        if (i == sizeof(keys) / sizeof(keys[0]) || end == eq + 1 || *end || v < 0) {
+            ret = -1;
+            break;
+        }
+        *(double *)((char *)p + keys[i].offset) = v;
+    }
+    free(copy);
+    if (ret == 0)
+        return 0;
+bad:
+    errno = EINVAL;
+    return -1;
+}
+
+void wii_filter_init(struct wii_filter *f, const struct wii_filter_params *p)
+{
+    memset(f, 0, sizeof(*f));
+    f->p = *p;
+}
+
+void wii_filter_reset(struct wii_filter *f)
+{
+    struct wii_filter_params p = f->p;
+    wii_filter_init(f, &p);
+}
+
+/* starts again with the estimate sitting on this sample, not moving */
+static void restart(struct wii_filter *f, uint64_t t_ns, double x, double y)
+{
+    int a;
+
+    f->tracking = 1;
+    f->last_ns = f->valid_ns = t_ns;
+    f->x[0] = f->raw[0] = x;
+    f->x[1] = f->raw[1] = y;
+    f->v[0] = f->v[1] = 0;
+    for (a = 0; a < 2; a++) {
+        /* position as uncertain as a sample, velocity anything it could reach in one long step */
+        f->P[a][0][0] = f->p.r * f->p.r;
+        f->P[a][0][1] = f->P[a][1][0] = 0;
+        f->P[a][1][1] = f->p.q * f->p.q * MAX_DT * MAX_DT;
+    }
+}
+
+/* smoothing factor of a first order low pass with this cutoff over dt */
+static inline double lp_alpha(double cutoff, double dt)
+{
+    double tau = 1.0 / (2.0 * M_PI * cutoff);
+    return 1.0 / (1.0 + tau / dt);
+}
+
+static void one_euro(struct wii_filter *f, double dt, const double z[2])
+{
+    int a;
+
+    for (a = 0; a < 2; a++) {
+        double dz = (z[a] - f->raw[a]) / dt;
+        double cutoff;
+
+        f->v[a] += lp_alpha(f->p.d_cutoff, dt) * (dz - f->v[a]);
+        cutoff = f->p.min_cutoff + f->p.beta * fabs(f->v[a]);
+        f->x[a] += lp_alpha(cutoff, dt) * (z[a] - f->x[a]);
+        f->raw[a] = z[a];
+    }
+}
+
+/* predict step, also what coasting through a dropout does */
+static void kalman_predict(struct wii_filter *f, double dt)
+{
+    double q = f->p.q * f->p.q, dt2 = dt * dt;
+    int a;
+
+    for (a = 0; a < 2; a++) {
+        double (*P)[2] = f->P[a];
+
+        f->x[a] += f->v[a] * dt;
+        P[0][0] += dt * (P[0][1] + P[1][0]) + dt2 * P[1][1] + q * dt2 * dt2 / 4;
+        P[0][1] += dt * P[1][1] + q * dt2 * dt / 2;
+        P[1][0] += dt * P[1][1] + q * dt2 * dt / 2;
+        P[1][1] += q * dt2;
+    }
+}
+
+static void kalman_correct(struct wii_filter *f, const double z[2])
+{
+    int a;
+
+    for (a = 0; a < 2; a++) {
+        double (*P)[2] = f->P[a];
+        double s = P[0][0] + f->p.r * f->p.r;
+        double k0 = P[0][0] / s, k1 = P[1][0] / s;
+        double innov = z[a] - f->x[a];
+        double p00 = P[0][0], p01 = P[0][1];
+
+        f->x[a] += k0 * innov;
+        f->v[a] += k1 * innov;
+        P[0][0] -= k0 * p00;
+        P[0][1] -= k0 * p01;
+        P[1][0] -= k1 * p00;
+        P[1][1] -= k1 * p01;
+    }
+}
+
+int wii_filter_update(struct wii_filter *f, uint64_t t_ns, int valid, double x, double y,
+                      double out[2])
+{
+    double z[2] = { x, y };
+    double dt;
+
+    if (f->p.kind == WII_FILTER_NONE) {
+        if (!valid)
+            return 0;
+        out[0] = x;
+        out[1] = y;
+        return 1;
+    }
+
+    dt = t_ns > f->last_ns ? (double)(t_ns - f->last_ns) / 1e9 : DEFAULT_DT;
+    if (dt > MAX_DT)
+        dt = MAX_DT;
+
+    if (!valid) {
+        double since;
+
+        if (!f->tracking)
+            return 0;
+        since = t_ns > f->valid_ns ? (double)(t_ns - f->valid_ns) / 1e6 : 0;
+        if (since > f->p.hold_ms) {
+            f->last_ns = t_ns;
+            return 0;
+        }
+        /* coast on the last velocity, a lost blob mid swipe keeps going the same way */
+        if (f->p.kind == WII_FILTER_KALMAN) {
+            kalman_predict(f, dt);
+        } else {
+            f->x[0] += f->v[0] * dt;
+            f->x[1] += f->v[1] * dt;
+        }
+        f->last_ns = t_ns;
+        out[0] = f->x[0];
+        out[1] = f->x[1];
+        return 1;
+    }
+
+    if (!f->tracking ||
+        (t_ns > f->valid_ns && (double)(t_ns - f->valid_ns) / 1e6 > f->p.reacquire_ms) ||
+        (f->p.jump > 0 && hypot(x - f->x[0], y - f->x[1]) > f->p.jump)) {
+        restart(f, t_ns, x, y);
+    } else if (f->p.kind == WII_FILTER_KALMAN) {
+        kalman_predict(f, dt);
+        kalman_correct(f, z);
+    } else {
+        /* after a coast raw[] is from before the gap, so dz is over the whole gap */
+        double gap = t_ns > f->valid_ns ? (double)(t_ns - f->valid_ns) / 1e9 : DEFAULT_DT;
+        one_euro(f, gap > dt ? gap : dt, z);
+    }
+    f->last_ns = f->valid_ns = t_ns;
+    out[0] = f->x[0];
+    out[1] = f->x[1];
+    return 1;
+}
+
+int wii_ir_pointer(const uint16_t x[WII_IR_BLOBS], const uint16_t y[WII_IR_BLOBS],
+                   double *px, double *py)
+{
+    int seen[2], n = 0, i;
+
+    for (i = 0; i < WII_IR_BLOBS && n < 2; i++)
+        if (x[i] != WII_IR_MISSING && y[i] != WII_IR_MISSING)
+            seen[n++] = i;
+    if (n < 2)
+        return 0;
+
+    *px = 1.0 - ((x[seen[0]] + x[seen[1]]) / 2.0) / (IR_WIDTH - 1);
+    *py = ((y[seen[0]] + y[seen[1]]) / 2.0) / (IR_HEIGHT - 1);
+    return 1;
+}
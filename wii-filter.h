@@ -0,0 +1,104 @@
+/*
+ * wii-filter.h - smoothing for the pointer, One-Euro or a constant velocity Kalman.
+ *
+ * Raw IR jitters a couple of pixels even with the remote held still, and a
+ * plain moving average fixes that by lagging behind every real movement. Both
+ * filters here adapt instead:
+ *
+ *   one-euro   a low pass whose cutoff goes up with speed, so its heavy when
+ *              the pointer is still and gets out of the way when it moves
+ *              (Casiez et al., "1 Euro Filter", CHI 2012)
+ *   kalman     position + velocity per axis, the pointer is assumed to keep
+ *              its speed and the noise settings say how much to trust that
+ *              over each new sample
+ *
+ * One update per sample, a handful of multiplies per axis, no allocation.
+ *
+ * Samples can be marked invalid (the sensor bar went out of view, a blob got
+ * lost). The filter then coasts on its last velocity for hold_ms and after that
+ * reports nothing until samples come back. When they do after more than
+ * reacquire_ms, or land more than jump px away from where the filter thinks the
+ * pointer is, it starts again from the new sample instead of sliding across the
+ * screen to it.
+ */
+
+#ifndef WII_FILTER_H
+#define WII_FILTER_H
+
+#include <stdint.h>
+
+#include "wii-event.h"
+
+enum wii_filter_kind {
+    WII_FILTER_NONE = 0,        /* passes samples straight through */
+    WII_FILTER_ONE_EURO,
+    WII_FILTER_KALMAN,
+};
+
+struct wii_filter_params {
+    enum wii_filter_kind kind;
+
+    /* one-euro */
+    double min_cutoff;          /* Hz, how smooth it is when still, lower = smoother */
+    double beta;                /* how fast the cutoff rises with speed, higher = less lag */
+    double d_cutoff;            /* Hz, smoothing on the speed estimate itself */
+
+    /* kalman */
+    double q;                   /* px/s^2, how hard the pointer can accelerate */
+    double r;                   /* px, how noisy a sample is */
+
+    /* dropouts */
+    double hold_ms;             /* coast this long after samples stop being valid */
+    double reacquire_ms;        /* gaps longer than this restart the filter */
+    double jump;                /* px, samples this far off restart it too, 0 = never */
+};
+
+struct wii_filter {
+    struct wii_filter_params p;
+    int      tracking;          /* have a position estimate */
+    uint64_t last_ns;           /* time of the last update, valid or not */
+    uint64_t valid_ns;          /* time of the last valid sample */
+    double   x[2];              /* position estimate */
+    double   v[2];              /* velocity estimate, px/s */
+    double   raw[2];            /* last valid sample, one-euro differentiates it */
+    double   P[2][2][2];        /* kalman covariance, one 2x2 per axis */
+};
+
+/* fills in the defaults for kind */
+void wii_filter_defaults(struct wii_filter_params *p, enum wii_filter_kind kind);
+
+/*
+ * "none", "one-euro" or "kalman", optionally followed by :key=value,... with
+ * the field names above, e.g. "one-euro:min_cutoff=0.8,beta=0.02,hold_ms=80".
+ * returns 0 or -1 if something didnt parse
+ */
+int wii_filter_parse(const char *spec, struct wii_filter_params *p);
+
+void wii_filter_init(struct wii_filter *f, const struct wii_filter_params *p);
+void wii_filter_reset(struct wii_filter *f);
+
+/*
+ * one sample at t_ns (CLOCK_MONOTONIC, the driver's timestamp when there is
+ * one). valid = 0 means there was no position this time. returns 1 with the
+ * filtered position in out, 0 if there is nothing to show
+ */
+int wii_filter_update(struct wii_filter *f, uint64_t t_ns, int valid, double x, double y,
+                      double out[2]);
+
+/* the filter's current velocity in px/s, 0 if its not tracking */
+static inline void wii_filter_velocity(const struct wii_filter *f, double v[2])
+{
+    v[0] = f->tracking ? f->v[0] : 0;
+    v[1] = f->tracking ? f->v[1] : 0;
+}
+
+/*
+ * where the remote points, from the IR blobs of one report: the middle of the
+ * two sensor bar blobs, flipped (the camera sees the bar backwards) and scaled
+ * to 0..1 on both axes. returns 0 if fewer than two blobs are visible, which is
+ * what should go into wii_filter_update() as an invalid sample
+ */
+int wii_ir_pointer(const uint16_t x[WII_IR_BLOBS], const uint16_t y[WII_IR_BLOBS],
+                   double *px, double *py);
+
+#endif /* WII_FILTER_H */
@@ -0,0 +1,423 @@
+/*
+ * wii-gesture.c - segmenting and DTW matching, see wii-gesture.h
+ *
+ * Both kernels fill the DTW grid one query sample (row) at a time, only the
+ * cells within band of the diagonal, keeping just the previous row. Cell (i, j)
+ * is the squared distance between query sample i and template sample j plus
+ * the cheapest of its up, left and diagonal neighbours. The scalar kernel does
+ * one template at a time out of tpl[], the AVX2 one a block of eight out of
+ * lanes[] with the query sample broadcast, same sums in the same order so they
+ * give the same answer to the bit.
+ */
+
+#include <errno.h>
+#include <immintrin.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wii-event.h"
+#include "wii-gesture.h"
+
+#define ACCEL_1G  104.0     /* raw counts per g, same as wii-orient.c */
+#define FAR       1e30f     /* a cell outside the band */
+
+typedef void (*block_fn)(const struct wii_gesture_bank *bank, int block,
+                         const float g[WII_GESTURE_LEN][3], int band,
+                         float out[WII_GESTURE_LANES]);
+
+static enum wii_gesture_impl current_impl;
+static block_fn current_block;
+
+void wii_gesture_defaults(struct wii_gesture_params *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->start_g = 0.5;
+    p->end_g = 0.2;
+    p->quiet_ms = 120.0;
+    p->min_ms = 150.0;
+    p->max_ms = 2000.0;
+    p->band = 6.0;
+    p->reject = 0.35;
+    p->accel_zero = 512.0;
+}
+
+int wii_gesture_parse(const char *spec, struct wii_gesture_params *p)
+{
+    static const struct {
+        const char *name;
+        size_t offset;
+    } keys[] = {
+        { "start_g",    offsetof(struct wii_gesture_params, start_g) },
+        { "end_g",      offsetof(struct wii_gesture_params, end_g) },
+        { "quiet_ms",   offsetof(struct wii_gesture_params, quiet_ms) },
+        { "min_ms",     offsetof(struct wii_gesture_params, min_ms) },
+        { "max_ms",     offsetof(struct wii_gesture_params, max_ms) },
+        { "band",       offsetof(struct wii_gesture_params, band) },
+        { "reject",     offsetof(struct wii_gesture_params, reject) },
+        { "accel_zero", offsetof(struct wii_gesture_params, accel_zero) },
+    };
+    char *copy, *tok, *save = NULL;
+    int ret = 0;
+
+    copy = strdup(spec);
+    if (!copy)
+        return -1;
+    for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '='), *end;
+        size_t i;
+        double v;
+
+        if (!eq) {
+            ret = -1;
+            break;
+        }
+        *eq = '\0';
+        v = strtod(eq + 1, &end);
+        for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+            if (strcmp(tok, keys[i].name) == 0)
+                break;
+        if (i == sizeof(keys) / sizeof(keys[0]) || end == eq + 1 || *end || v < 0) {
+            ret = -1;
+            break;
+        }
+        *(double *)((char *)p + keys[i].offset) = v;
+    }
+    free(copy);
+    if (ret == 0)
+        return 0;
+    errno = EINVAL;
+    return -1;
+}
+
+/* --- segmenting --- */
+
+void wii_gesture_segmenter_init(struct wii_gesture_segmenter *sg,
+                                const struct wii_gesture_params *p)
+{
+    memset(sg, 0, sizeof(*sg));
+    sg->p = *p;
+}
+
+/* mean off, then stretched or squashed to WII_GESTURE_LEN samples */
+static void resample(const float (*raw)[3], int n, float s[WII_GESTURE_LEN][3])
+{
+    double mean[3] = { 0, 0, 0 };
+    int a, i, k;
+
+    for (i = 0; i < n; i++)
+        for (a = 0; a < 3; a++)
+            mean[a] += raw[i][a];
+    for (a = 0; a < 3; a++)
+        mean[a] /= n;
+
+    for (k = 0; k < WII_GESTURE_LEN; k++) {
+        double pos = (double)k * (n - 1) / (WII_GESTURE_LEN - 1);
+        double frac;
+
+        i = (int)pos;
+        if (i >= n - 1)
+            i = n - 2;
+        frac = pos - i;
+        for (a = 0; a < 3; a++)
+            s[k][a] = (float)(raw[i][a] + frac * (raw[i + 1][a] - raw[i][a]) - mean[a]);
+    }
+}
+
+int wii_gesture_feed(struct wii_gesture_segmenter *sg, uint64_t t_ns, const uint16_t accel[3],
+                     struct wii_gesture_template *out)
+{
+    float a[3];
+    double dev;
+    int i;
+
+    for (i = 0; i < 3; i++)
+        a[i] = (float)((accel[i] - sg->p.accel_zero) / ACCEL_1G);
+    dev = fabs(sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]) - 1.0);
+
+    if (!sg->active) {
+        /* needs a quiet sample first, so a gesture thrown away for being too long doesnt restart mid way */
+        if (dev < sg->p.end_g)
+            sg->armed = 1;
+        if (!sg->armed || dev <= sg->p.start_g)
+            return 0;
+        sg->active = 1;
+        sg->armed = 0;
+        sg->start_ns = t_ns;
+        sg->n = 0;
+    }
+
+    if (sg->n == WII_GESTURE_SAMPLES ||
+        (double)(t_ns - sg->start_ns) / 1e6 > sg->p.max_ms) {
+        sg->active = 0;
+        return 0;
+    }
+    memcpy(sg->raw[sg->n++], a, sizeof(a));
+    if (dev >= sg->p.end_g) {
+        sg->loud_ns = t_ns;
+        sg->loud_n = sg->n;
+    }
+    if ((double)(t_ns - sg->loud_ns) / 1e6 < sg->p.quiet_ms)
+        return 0;
+
+    /* its over, the quiet tail isnt part of it */
+    sg->active = 0;
+    sg->armed = 1;
+    if ((double)(sg->loud_ns - sg->start_ns) / 1e6 < sg->p.min_ms || sg->loud_n < 2)
+        return 0;
+    resample(sg->raw, sg->loud_n, out->s);
+    return 1;
+}
+
+/* --- the bank --- */
+
+void wii_gesture_bank_init(struct wii_gesture_bank *bank)
+{
+    memset(bank, 0, sizeof(*bank));
+}
+
+int wii_gesture_add(struct wii_gesture_bank *bank, const struct wii_gesture_template *t)
+{
+    int block = bank->count / WII_GESTURE_LANES, lane = bank->count % WII_GESTURE_LANES;
+    int j, a;
+
+    if (bank->count == WII_GESTURE_MAX) {
+        errno = ENOSPC;
+        return -1;
+    }
+    bank->tpl[bank->count++] = *t;
+    for (j = 0; j < WII_GESTURE_LEN; j++)
+        for (a = 0; a < 3; a++)
+            bank->lanes[block][j][a][lane] = t->s[j][a];
+    return 0;
+}
+
+static uint16_t button_from_name(const char *name)
+{
+    int bit;
+
+    for (bit = 0; bit < 16; bit++) {
+        const char *n = wii_button_name(1u << bit);
+        if (n && strcmp(n, name) == 0)
+            return 1u << bit;
+    }
+    return 0;
+}
+
+int wii_gesture_load(struct wii_gesture_bank *bank, const char *path)
+{
+    struct wii_gesture_template t;
+    char line[256], button[32];
+    int added = 0, j = -1, err = 0;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f)
+        return errno == ENOENT ? 0 : -1;
+
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (j < 0) {
+            if (sscanf(line, "gesture %31s %31s", t.name, button) != 2 ||
+                !(t.buttons = button_from_name(button))) {
+                err = EINVAL;
+                break;
+            }
+            j = 0;
+            continue;
+        }
+        if (sscanf(line, "%f %f %f", &t.s[j][0], &t.s[j][1], &t.s[j][2]) != 3) {
+            err = EINVAL;
+            break;
+        }
+        if (++j == WII_GESTURE_LEN) {
+            if (wii_gesture_add(bank, &t) < 0) {
+                err = errno;
+                break;
+            }
+            added++;
+            j = -1;
+        }
+    }
+    if (!err && j >= 0)
+        err = EINVAL;   /* ran out half way through a template */
+    fclose(f);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return added;
+}
+
+int wii_gesture_save(const char *path, const struct wii_gesture_template *t)
+{
+    const char *button = NULL;
+    int bit, j;
+    FILE *f;
+
+    for (bit = 0; bit < 16 && !button; bit++)
+        if (t->buttons & (1u << bit))
+            button = wii_button_name(1u << bit);
+    if (!button) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    f = fopen(path, "a");
+    if (!f)
+        return -1;
+    fprintf(f, "gesture %s %s\n", t->name, button);
+    for (j = 0; j < WII_GESTURE_LEN; j++)
+        fprintf(f, "%.4f %.4f %.4f\n", t->s[j][0], t->s[j][1], t->s[j][2]);
+    if (fclose(f) != 0)
+        return -1;
+    return 0;
+}
+
+/* --- scalar, one template at a time --- */
+
+static float scalar_dtw(const float t[WII_GESTURE_LEN][3], const float g[WII_GESTURE_LEN][3],
+                        int band)
+{
+    float prev[WII_GESTURE_LEN], cur[WII_GESTURE_LEN];
+    int i, j;
+
+    for (j = 0; j < WII_GESTURE_LEN; j++)
+        prev[j] = FAR;
+    for (i = 0; i < WII_GESTURE_LEN; i++) {
+        int lo = i - band > 0 ? i - band : 0;
+        int hi = i + band < WII_GESTURE_LEN - 1 ? i + band : WII_GESTURE_LEN - 1;
+
+        for (j = 0; j < WII_GESTURE_LEN; j++)
+            cur[j] = FAR;
+        for (j = lo; j <= hi; j++) {
+            float dx = g[i][0] - t[j][0], dy = g[i][1] - t[j][1], dz = g[i][2] - t[j][2];
+            float cost = dx * dx + dy * dy + dz * dz;
+            float best = FAR;
+
+            if (i == 0 && j == 0)
+                best = 0;
+            if (i > 0)
+                best = fminf(best, prev[j]);
+            if (j > 0)
+                best = fminf(best, cur[j - 1]);
+            if (i > 0 && j > 0)
+                best = fminf(best, prev[j - 1]);
+            cur[j] = cost + best;
+        }
+        memcpy(prev, cur, sizeof(prev));
+    }
+    return prev[WII_GESTURE_LEN - 1];
+}
+
+static void scalar_block(const struct wii_gesture_bank *bank, int block,
+                         const float g[WII_GESTURE_LEN][3], int band,
+                         float out[WII_GESTURE_LANES])
+{
+    int lane;
+
+    for (lane = 0; lane < WII_GESTURE_LANES; lane++) {
+        int k = block * WII_GESTURE_LANES + lane;
+        out[lane] = k < bank->count ? scalar_dtw(bank->tpl[k].s, g, band) : FAR;
+    }
+}
+
+/* --- AVX2, eight templates at a time --- */
+
+__attribute__((target("avx2")))
+static void avx2_block(const struct wii_gesture_bank *bank, int block,
+                       const float g[WII_GESTURE_LEN][3], int band,
+                       float out[WII_GESTURE_LANES])
+{
+    const float (*t)[3][WII_GESTURE_LANES] = bank->lanes[block];
+    const __m256 far = _mm256_set1_ps(FAR);
+    __m256 prev[WII_GESTURE_LEN], cur[WII_GESTURE_LEN];
+    int i, j;
+
+    for (j = 0; j < WII_GESTURE_LEN; j++)
+        prev[j] = far;
+    for (i = 0; i < WII_GESTURE_LEN; i++) {
+        __m256 gx = _mm256_set1_ps(g[i][0]), gy = _mm256_set1_ps(g[i][1]);
+        __m256 gz = _mm256_set1_ps(g[i][2]);
+        int lo = i - band > 0 ? i - band : 0;
+        int hi = i + band < WII_GESTURE_LEN - 1 ? i + band : WII_GESTURE_LEN - 1;
+
+        for (j = 0; j < WII_GESTURE_LEN; j++)
+            cur[j] = far;
+        for (j = lo; j <= hi; j++) {
+            __m256 dx = _mm256_sub_ps(gx, _mm256_loadu_ps(t[j][0]));
+            __m256 dy = _mm256_sub_ps(gy, _mm256_loadu_ps(t[j][1]));
+            __m256 dz = _mm256_sub_ps(gz, _mm256_loadu_ps(t[j][2]));
+            __m256 cost = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                        _mm256_mul_ps(dz, dz));
+            __m256 best = far;
+
+            if (i == 0 && j == 0)
+                best = _mm256_setzero_ps();
+            if (i > 0)
+                best = _mm256_min_ps(best, prev[j]);
+            if (j > 0)
+                best = _mm256_min_ps(best, cur[j - 1]);
+            if (i > 0 && j > 0)
+                best = _mm256_min_ps(best, prev[j - 1]);
+            cur[j] = _mm256_add_ps(cost, best);
+        }
+        memcpy(prev, cur, sizeof(prev));
+    }
+    _mm256_storeu_ps(out, prev[WII_GESTURE_LEN - 1]);
+}
+
+/* --- dispatch --- */
+
+enum wii_gesture_impl wii_gesture_set_impl(enum wii_gesture_impl impl)
+{
+    __builtin_cpu_init();
+    if (impl == WII_GESTURE_AUTO)
+        impl = WII_GESTURE_AVX2;
+    if (impl == WII_GESTURE_AVX2 && !__builtin_cpu_supports("avx2"))
+        impl = WII_GESTURE_SCALAR;
+
+    switch (impl) {
+    case WII_GESTURE_AVX2: current_block = avx2_block; break;
+    default:               current_block = scalar_block; impl = WII_GESTURE_SCALAR; break;
+    }
+    current_impl = impl;
+    return impl;
+}
+
+const char *wii_gesture_impl_name(enum wii_gesture_impl impl)
+{
+    switch (impl) {
+    case WII_GESTURE_SCALAR: return "scalar";
+    case WII_GESTURE_AVX2:   return "avx2";
+    default:                 return "auto";
+    }
+}
+
+int wii_gesture_match(const struct wii_gesture_bank *bank, const struct wii_gesture_template *g,
+                      const struct wii_gesture_params *p, float *dist)
+{
+    float d[WII_GESTURE_LANES], best = FAR;
+    int block, lane, found = -1;
+
+    if (!current_block)
+        wii_gesture_set_impl(WII_GESTURE_AUTO);
+
+    for (block = 0; block * WII_GESTURE_LANES < bank->count; block++) {
+        current_block(bank, block, g->s, (int)p->band, d);
+        for (lane = 0; lane < WII_GESTURE_LANES; lane++) {
+            int k = block * WII_GESTURE_LANES + lane;
+            if (k < bank->count && d[lane] < best) {
+                best = d[lane];
+                found = k;
+            }
+        }
+    }
+
+    /* per sample, so the threshold doesnt depend on WII_GESTURE_LEN */
+    *dist = found < 0 ? INFINITY : sqrtf(best / WII_GESTURE_LEN);
+    return found >= 0 && *dist <= p->reject ? found : -1;
+}
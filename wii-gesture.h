@@ -0,0 +1,130 @@
+/*
+ * wii-gesture.h - accelerometer gestures (shake, swing, flick, circle...) matched
+ * against templates the user recorded.
+ *
+ * The segmenter watches how far the accel reads from 1g. A gesture starts when
+ * that goes over start_g and ends once its stayed under end_g for quiet_ms,
+ * anything shorter than min_ms or longer than max_ms is thrown away.
+ *
+ * A finished segment is turned into g, has its mean taken off (that is mostly
+ * gravity, so it doesnt matter how the remote was held) and is resampled to
+ * WII_GESTURE_LEN samples. Templates are stored the same way, so every
+ * comparison is a DTW over the same WII_GESTURE_LEN x WII_GESTURE_LEN grid,
+ * limited to a band around the diagonal. The closest template wins if its
+ * closer than reject.
+ *
+ * Because every grid has the same shape the templates can be matched side by
+ * side: the bank keeps them interleaved in blocks of WII_GESTURE_LANES and the
+ * AVX2 kernel runs a whole block through the grid at once, one lane per
+ * template. Dozens of templates come to a handful of blocks, well under a
+ * millisecond.
+ *
+ * Template files are text, one template per gesture line:
+ *
+ *   gesture <name> <button>
+ *   <x> <y> <z>        (WII_GESTURE_LEN of these, in g)
+ *
+ * button is the name the driver prints ("A", "1", "Dpad_Up"...), a recognised
+ * gesture acts as if that button was pressed. A name can have several
+ * templates, recording a few of each helps a lot.
+ */
+
+#ifndef WII_GESTURE_H
+#define WII_GESTURE_H
+
+#include <stdint.h>
+
+#define WII_GESTURE_LEN       32
+#define WII_GESTURE_LANES     8
+#define WII_GESTURE_MAX       128     /* templates per bank */
+#define WII_GESTURE_NAME_MAX  32
+#define WII_GESTURE_SAMPLES   256     /* longest raw segment, 2.5s at 100Hz */
+
+struct wii_gesture_params {
+    double start_g;             /* off 1g by more than this starts a gesture */
+    double end_g;               /* and under this for quiet_ms ends it */
+    double quiet_ms;
+    double min_ms;              /* shorter segments are bumps, not gestures */
+    double max_ms;              /* longer ones are just the remote being carried about */
+    double band;                /* DTW band, samples either side of the diagonal */
+    double reject;              /* g, no match if the best distance is over this */
+    double accel_zero;          /* raw accel counts at 0g */
+};
+
+struct wii_gesture_template {
+    char     name[WII_GESTURE_NAME_MAX];
+    uint16_t buttons;           /* WII_BTN_* it stands in for */
+    float    s[WII_GESTURE_LEN][3];
+};
+
+/* the gesture being segmented, one per remote */
+struct wii_gesture_segmenter {
+    struct wii_gesture_params p;
+    int      active;
+    int      armed;             /* been quiet since the last segment */
+    uint64_t start_ns;
+    uint64_t loud_ns;           /* last sample over end_g */
+    int      n, loud_n;         /* samples so far, and up to the last loud one */
+    float    raw[WII_GESTURE_SAMPLES][3];
+};
+
+struct wii_gesture_bank {
+    int   count;
+    struct wii_gesture_template tpl[WII_GESTURE_MAX];
+    /* the same samples, block / sample / axis / lane, what the kernels read */
+    float lanes[WII_GESTURE_MAX / WII_GESTURE_LANES][WII_GESTURE_LEN][3][WII_GESTURE_LANES]
+        __attribute__((aligned(32)));
+};
+
+enum wii_gesture_impl {
+    WII_GESTURE_AUTO = 0,       /* best the CPU has */
+    WII_GESTURE_SCALAR,
+    WII_GESTURE_AVX2,
+};
+
+void wii_gesture_defaults(struct wii_gesture_params *p);
+
+/* key=value,... with the field names above, e.g. "start_g=0.5,reject=0.4". returns 0 or -1 */
+int wii_gesture_parse(const char *spec, struct wii_gesture_params *p);
+
+void wii_gesture_segmenter_init(struct wii_gesture_segmenter *sg,
+                                const struct wii_gesture_params *p);
+
+/*
+ * one raw accel sample (10 bit, as in a driver record) at t_ns. returns 1 when
+ * a gesture just ended, with it resampled into out->s (name and buttons are
+ * left alone), 0 otherwise
+ */
+int wii_gesture_feed(struct wii_gesture_segmenter *sg, uint64_t t_ns, const uint16_t accel[3],
+                     struct wii_gesture_template *out);
+
+void wii_gesture_bank_init(struct wii_gesture_bank *bank);
+
+/* returns 0, or -1 with errno ENOSPC if the bank is full */
+int wii_gesture_add(struct wii_gesture_bank *bank, const struct wii_gesture_template *t);
+
+/*
+ * appends every template in path to the bank. a missing file is an empty one.
+ * returns the number added or -1 with errno set (EINVAL for a bad file)
+ */
+int wii_gesture_load(struct wii_gesture_bank *bank, const char *path);
+
+/* appends one template to path, returns 0 or -1 with errno set */
+int wii_gesture_save(const char *path, const struct wii_gesture_template *t);
+
+/*
+ * the closest template to g within band, or -1 if the bank is empty or even
+ * the closest is further than reject. dist gets the best distance either way
+ * (rms g along the warp path)
+ */
+int wii_gesture_match(const struct wii_gesture_bank *bank, const struct wii_gesture_template *g,
+                      const struct wii_gesture_params *p, float *dist);
+
+/*
+ * picks the kernel, mostly so benchmarks can compare them. falls back to
+ * scalar if the CPU cant do it, returns the one its using
+ */
+enum wii_gesture_impl wii_gesture_set_impl(enum wii_gesture_impl impl);
+const char *wii_gesture_impl_name(enum wii_gesture_impl impl);
+
+#endif /* WII_GESTURE_H */
@@ -0,0 +1,330 @@
+/*
+ * wii-metrics.c - per thread histograms and the Prometheus endpoint, see wii-metrics.h
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "wii-metrics.h"
+
+#define PROC_PATH "/proc/wii_remote"
+#define METRICS_BUF_SIZE 16384
+
+/* exported "le" buckets, powers of two from ~1us up to ~17s */
+#define EXPORT_FIRST_POW 10
+#define EXPORT_LAST_POW  34
+
+struct wii_metrics_thread {
+    struct wii_metrics_thread *next;
+    _Atomic uint64_t hist[WII_HIST_COUNT][WII_HIST_BUCKETS];
+    _Atomic uint64_t sum[WII_HIST_COUNT];
+    _Atomic uint64_t counter[WII_CTR_COUNT];
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} hist_info[WII_HIST_COUNT] = {
+    [WII_HIST_EVENT_AGE] = { "wii_client_event_age_seconds",
+                             "Time from the driver receiving a report to the client reading it" },
+    [WII_HIST_DECODE]    = { "wii_client_decode_seconds",
+                             "Time spent decoding one read of the device" },
+    [WII_HIST_DISPATCH]  = { "wii_client_dispatch_seconds",
+                             "Time spent running the action for one event" },
+    [WII_HIST_GESTURE]   = { "wii_client_gesture_match_seconds",
+                             "Time spent matching one gesture against the templates" },
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} counter_info[WII_CTR_COUNT] = {
+    [WII_CTR_EVENTS]  = { "wii_client_events_total", "Events decoded" },
+    [WII_CTR_DROPS]   = { "wii_client_drops_total", "Events lost before the client could act on them" },
+    [WII_CTR_ACTIONS] = { "wii_client_actions_total", "Events that triggered an action" },
+};
+
+#define QUAT  "wii_orientation_quaternion", "Remote orientation as a unit quaternion"
+#define EULER "wii_orientation_radians", "Remote orientation as euler angles"
+
+static const struct {
+    const char *name;
+    const char *help;
+    const char *label;
+} gauge_info[WII_GAUGE_COUNT] = {
+    [WII_GAUGE_QUAT_W] = { QUAT,  "component=\"w\"" },
+    [WII_GAUGE_QUAT_X] = { QUAT,  "component=\"x\"" },
+    [WII_GAUGE_QUAT_Y] = { QUAT,  "component=\"y\"" },
+    [WII_GAUGE_QUAT_Z] = { QUAT,  "component=\"z\"" },
+    [WII_GAUGE_PITCH]  = { EULER, "angle=\"pitch\"" },
+    [WII_GAUGE_ROLL]   = { EULER, "angle=\"roll\"" },
+    [WII_GAUGE_YAW]    = { EULER, "angle=\"yaw\"" },
+};
+
+#undef QUAT
+#undef EULER
+
+/* doubles by their bits, there is no atomic double that is guaranteed lock free */
+static _Atomic uint64_t gauges[WII_GAUGE_COUNT];
+static _Atomic uint32_t gauges_set;
+
+/* every thread that ever recorded, pushed on the front and never removed so totals dont go backwards */
+static _Atomic(struct wii_metrics_thread *) all_threads;
+static _Thread_local struct wii_metrics_thread *self;
+
+static struct wii_metrics_thread *this_thread(void)
+{
+    struct wii_metrics_thread *t = self;
+
+    if (t)
+        return t;
+    t = calloc(1, sizeof(*t));
+    if (!t)
+        return NULL;
+    t->next = atomic_load(&all_threads);
+    while (!atomic_compare_exchange_weak(&all_threads, &t->next, t))
+        ;
+    self = t;
+    return t;
+}
+
+/* only the owning thread writes, so a plain load + store is enough (no lock prefix) */
+static inline void bump(_Atomic uint64_t *v, uint64_t n)
+{
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+unsigned int wii_hist_bucket(uint64_t value)
+{
+    unsigned int shift;
+
+    if (value < WII_HIST_SUB_BUCKETS)
+        return (unsigned int)value;
+    shift = 63 - __builtin_clzll(value) - WII_HIST_SUB_BITS;
+    return (shift + 1) * WII_HIST_SUB_BUCKETS +
+           (unsigned int)((value >> shift) & (WII_HIST_SUB_BUCKETS - 1));
+}
+
+uint64_t wii_hist_bucket_max(unsigned int bucket)
+{
+    unsigned int shift, sub;
+
+    if (bucket < WII_HIST_SUB_BUCKETS)
+        return bucket;
+    shift = bucket / WII_HIST_SUB_BUCKETS - 1;
+    sub = bucket % WII_HIST_SUB_BUCKETS;
+    return (((uint64_t)(WII_HIST_SUB_BUCKETS + sub)) << shift) + ((1ull << shift) - 1);
+}
+
+void wii_metrics_observe(enum wii_metric_hist h, uint64_t ns)
+{
+    struct wii_metrics_thread *t = this_thread();
+
+    if (!t)
+        return;
+    bump(&t->hist[h][wii_hist_bucket(ns)], 1);
+    bump(&t->sum[h], ns);
+}
+
+void wii_metrics_add(enum wii_metric_counter c, uint64_t n)
+{
+    struct wii_metrics_thread *t = this_thread();
+
+    if (t)
+        bump(&t->counter[c], n);
+}
+
+void wii_metrics_set(enum wii_metric_gauge g, double value)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    atomic_store_explicit(&gauges[g], bits, memory_order_relaxed);
+    if (!(atomic_load_explicit(&gauges_set, memory_order_relaxed) & (1u << g)))
+        atomic_fetch_or(&gauges_set, 1u << g);
+}
+
+#define APPEND(...) do { \
+        if (len < size) \
+            len += snprintf(buf + len, size - len, __VA_ARGS__); \
+    } while (0)
+
+size_t wii_metrics_format(char *buf, size_t size)
+{
+    static uint64_t hist[WII_HIST_BUCKETS];
+    static pthread_mutex_t format_lock = PTHREAD_MUTEX_INITIALIZER;
+    struct wii_metrics_thread *t;
+    size_t len = 0;
+    int h, c, g, b, e;
+    const char *last;
+    FILE *proc;
+
+    if (size == 0)
+        return 0;
+    buf[0] = '\0';
+
+    pthread_mutex_lock(&format_lock); /* hist[] is shared scratch space */
+
+    for (c = 0; c < WII_CTR_COUNT; c++) {
+        uint64_t total = 0;
+        for (t = atomic_load(&all_threads); t; t = t->next)
+            total += atomic_load_explicit(&t->counter[c], memory_order_relaxed);
+        APPEND("# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counter_info[c].name,
+               counter_info[c].help, counter_info[c].name, counter_info[c].name,
+               (unsigned long long)total);
+    }
+
+    for (h = 0; h < WII_HIST_COUNT; h++) {
+        uint64_t sum = 0, count = 0, cumulative = 0;
+        const char *name = hist_info[h].name;
+
+        memset(hist, 0, sizeof(hist));
+        for (t = atomic_load(&all_threads); t; t = t->next) {
+            for (b = 0; b < WII_HIST_BUCKETS; b++)
+                hist[b] += atomic_load_explicit(&t->hist[h][b], memory_order_relaxed);
+            sum += atomic_load_explicit(&t->sum[h], memory_order_relaxed);
+        }
+        for (b = 0; b < WII_HIST_BUCKETS; b++)
+            count += hist[b];
+
+        APPEND("# HELP %s %s\n# TYPE %s histogram\n", name, hist_info[h].help, name);
+
+        /*
+         * the internal buckets are much finer than anyone wants to scrape, so only
+         * the power of two edges go out. every internal bucket below index
+         * (e - SUB_BITS + 1) * SUB_BUCKETS only holds values under 2^e
+         */
+        b = 0;
+        for (e = EXPORT_FIRST_POW; e <= EXPORT_LAST_POW; e++) {
+            int end = (e - WII_HIST_SUB_BITS + 1) * WII_HIST_SUB_BUCKETS;
+            for (; b < end; b++)
+                cumulative += hist[b];
+            APPEND("%s_bucket{le=\"%.9f\"} %llu\n", name, (double)(1ull << e) / 1e9,
+                   (unsigned long long)cumulative);
+        }
+        APPEND("%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)count);
+        APPEND("%s_sum %.9f\n%s_count %llu\n", name, (double)sum / 1e9, name,
+               (unsigned long long)count);
+    }
+
+    pthread_mutex_unlock(&format_lock);
+
+    /* the help and type lines go out once per name, the labelled series follow them */
+    last = NULL;
+    for (g = 0; g < WII_GAUGE_COUNT; g++) {
+        uint64_t bits = atomic_load_explicit(&gauges[g], memory_order_relaxed);
+        double value;
+
+        if (!(atomic_load(&gauges_set) & (1u << g)))
+            continue;
+        memcpy(&value, &bits, sizeof(value));
+        if (!last || strcmp(last, gauge_info[g].name) != 0)
+            APPEND("# HELP %s %s\n# TYPE %s gauge\n", gauge_info[g].name, gauge_info[g].help,
+                   gauge_info[g].name);
+        last = gauge_info[g].name;
+        APPEND("%s{%s} %.6f\n", gauge_info[g].name, gauge_info[g].label, value);
+    }
+
+    /* the driver counts what it threw away when its buffer filled up, pass that on too */
+    proc = fopen(PROC_PATH, "r");
+    if (proc) {
+        char line[128];
+        unsigned long dropped;
+        while (fgets(line, sizeof(line), proc)) {
+            if (sscanf(line, " Dropped Bytes: %lu", &dropped) == 1)
+                APPEND("# HELP wii_driver_dropped_bytes_total Bytes the driver dropped with its buffer full\n"
+                       "# TYPE wii_driver_dropped_bytes_total counter\n"
+                       "wii_driver_dropped_bytes_total %lu\n", dropped);
+        }
+        fclose(proc);
+    }
+
+    return len < size ? len : size - 1;
+}
+
+static void *serve_thread(void *arg)
+{
+    int sock = (int)(intptr_t)arg;
+    char *body = malloc(METRICS_BUF_SIZE);
+
+    if (!body)
+        return NULL;
+
+    for (;;) {
+        struct pollfd pfd;
+        char request[1024], header[128];
+        size_t body_len;
+        int fd, hlen;
+
+        fd = accept(sock, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("metrics accept");
+            break;
+        }
+
+        /* we dont care what was asked for, but wait a moment for the request so curl is happy */
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 100) > 0)
+            (void)!read(fd, request, sizeof(request));
+
+        body_len = wii_metrics_format(body, METRICS_BUF_SIZE);
+        hlen = snprintf(header, sizeof(header),
+                        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: %zu\r\n\r\n", body_len);
+        if (send(fd, header, hlen, MSG_NOSIGNAL) == hlen)
+            (void)!send(fd, body, body_len, MSG_NOSIGNAL);
+        close(fd);
+    }
+
+    free(body);
+    close(sock);
+    return NULL;
+}
+
+int wii_metrics_serve(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    pthread_t thread;
+    int sock, err;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+    unlink(path);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 4) < 0)
+        goto fail;
+    chmod(path, 0666);
+
+    err = pthread_create(&thread, NULL, serve_thread, (void *)(intptr_t)sock);
+    if (err) {
+        errno = err;
+        goto fail;
+    }
+    pthread_detach(thread);
+    return 0;
+
+fail:
+    err = errno;
+    close(sock);
+    errno = err;
+    return -1;
+}
@@ -0,0 +1,80 @@
+/*
+ * wii-metrics.h - latency histograms and counters for the client side.
+ *
+ * Every thread that records something gets its own set of histograms the first
+ * time it records, and only that thread ever writes to them, so recording is a
+ * couple of plain loads and stores with no locks and no atomic read-modify-writes.
+ * The exporter sums all the threads when something scrapes it.
+ *
+ * The histograms are HDR style (log linear): each power of two is split into
+ * WII_HIST_SUB_BUCKETS linear buckets, so every value is within ~12% of its
+ * bucket no matter if its 2us or 2s, at a fixed 4KB per histogram.
+ *
+ * wii_metrics_serve() puts the lot on a unix socket in Prometheus text format,
+ * it speaks just enough HTTP that `curl --unix-socket <path> http://x/metrics`
+ * and the node exporter textfile/socket scrapers work.
+ */
+
+#ifndef WII_METRICS_H
+#define WII_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WII_HIST_SUB_BITS    3
+#define WII_HIST_SUB_BUCKETS (1 << WII_HIST_SUB_BITS)
+#define WII_HIST_BUCKETS     ((64 - WII_HIST_SUB_BITS + 1) * WII_HIST_SUB_BUCKETS)
+
+enum wii_metric_hist {
+    WII_HIST_EVENT_AGE,     /* driver timestamp -> read() returned it */
+    WII_HIST_DECODE,        /* parsing one read() worth of lines */
+    WII_HIST_DISPATCH,      /* running the action for one event (xdotool etc) */
+    WII_HIST_GESTURE,       /* matching one gesture against every template */
+    WII_HIST_COUNT
+};
+
+enum wii_metric_counter {
+    WII_CTR_EVENTS,         /* events decoded */
+    WII_CTR_DROPS,          /* events we know were lost before we could act on them */
+    WII_CTR_ACTIONS,        /* events that actually triggered an action */
+    WII_CTR_COUNT
+};
+
+/* last value wins, not per thread */
+enum wii_metric_gauge {
+    WII_GAUGE_QUAT_W,       /* orientation quaternion from wii-orient */
+    WII_GAUGE_QUAT_X,
+    WII_GAUGE_QUAT_Y,
+    WII_GAUGE_QUAT_Z,
+    WII_GAUGE_PITCH,        /* and the same as euler angles, radians */
+    WII_GAUGE_ROLL,
+    WII_GAUGE_YAW,
+    WII_GAUGE_COUNT
+};
+
+/* record a value in nanoseconds into the calling thread's histogram */
+void wii_metrics_observe(enum wii_metric_hist h, uint64_t ns);
+
+/* bump a counter in the calling thread's set */
+void wii_metrics_add(enum wii_metric_counter c, uint64_t n);
+
+/* set a gauge, any thread. gauges that were never set are left out of the export */
+void wii_metrics_set(enum wii_metric_gauge g, double value);
+
+/* the bucket a value lands in, and the biggest value that bucket holds */
+unsigned int wii_hist_bucket(uint64_t value);
+uint64_t wii_hist_bucket_max(unsigned int bucket);
+
+/*
+ * writes every metric in Prometheus text format into buf,
+ * returns the length (truncated to size - 1 if it didnt fit)
+ */
+size_t wii_metrics_format(char *buf, size_t size);
+
+/*
+ * starts a thread serving wii_metrics_format() on a unix socket at path.
+ * returns 0 or -1 with errno set
+ */
+int wii_metrics_serve(const char *path);
+
+#endif /* WII_METRICS_H */
@@ -0,0 +1,260 @@
+/*
+ * wii-nlmon.c - prints what the driver multicasts on its generic netlink
+ * family, one line per message.
+ *
+ * Needs nothing but the driver loaded, it never opens /dev/wii_remote so it
+ * can run next to the daemon or mouse_test without stealing their events, and
+ * as many copies as you like. motion is 100 messages a second so its only
+ * joined when asked for.
+ *
+ * usage: wii-nlmon [-g buttons,motion,status,hotplug] [-s]
+ *   -g  groups to join, default buttons,status,hotplug
+ *   -s  ask for the current status first
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "wii-event.h"
+
+#define NL_BUF_SIZE 8192
+#define DEFAULT_GROUPS "buttons,status,hotplug"
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+/* fills tb[type] for every attribute in buf, later ones win */
+static void parse_attrs(const void *buf, int len, const struct nlattr **tb, int max)
+{
+    const struct nlattr *nla = buf;
+
+    memset(tb, 0, sizeof(*tb) * (max + 1));
+    while (len >= (int)NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len) {
+        int type = nla->nla_type & NLA_TYPE_MASK;
+
+        if (type <= max)
+            tb[type] = nla;
+        len -= NLA_ALIGN(nla->nla_len);
+        nla = (const struct nlattr *)((const char *)nla + NLA_ALIGN(nla->nla_len));
+    }
+}
+
+static const void *nla_data(const struct nlattr *nla)
+{
+    return (const char *)nla + NLA_HDRLEN;
+}
+
+static int nla_len(const struct nlattr *nla)
+{
+    return nla->nla_len - NLA_HDRLEN;
+}
+
+/* one genl request with a single attribute (or none if data is NULL) */
+static int genl_send(int fd, uint16_t family, uint8_t cmd, uint16_t attr, const void *data, int len)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct genlmsghdr genl;
+        char attrs[256];
+    } req;
+    struct sockaddr_nl to = { .nl_family = AF_NETLINK };
+    struct nlattr *nla = (struct nlattr *)req.attrs;
+
+    if (len > (int)sizeof(req.attrs) - (int)NLA_HDRLEN)
+        return -1;
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    req.nlh.nlmsg_type = family;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST;
+    req.genl.cmd = cmd;
+    req.genl.version = 1;
+    if (data) {
+        nla->nla_type = attr;
+        nla->nla_len = NLA_HDRLEN + len;
+        memcpy(req.attrs + NLA_HDRLEN, data, len);
+        req.nlh.nlmsg_len += NLA_ALIGN(nla->nla_len);
+    }
+    return sendto(fd, &req, req.nlh.nlmsg_len, 0, (struct sockaddr *)&to, sizeof(to)) < 0 ? -1 : 0;
+}
+
+/*
+ * asks the controller about WII_NL_FAMILY, joins every group named in
+ * groups (comma separated). returns the family id, -1 if the driver isnt loaded
+ */
+static int genl_resolve(int fd, char *groups)
+{
+    char buf[NL_BUF_SIZE];
+    const struct nlattr *tb[CTRL_ATTR_MAX + 1];
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    const struct nlattr *grp;
+    int len, rem, family;
+
+    if (genl_send(fd, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, CTRL_ATTR_FAMILY_NAME,
+                  WII_NL_FAMILY, sizeof(WII_NL_FAMILY)) < 0)
+        return -1;
+    len = recv(fd, buf, sizeof(buf), 0);
+    if (len < 0 || !NLMSG_OK(nlh, (unsigned int)len))
+        return -1;
+    if (nlh->nlmsg_type == NLMSG_ERROR) {
+        errno = -((struct nlmsgerr *)NLMSG_DATA(nlh))->error;
+        return -1;
+    }
+    parse_attrs((char *)NLMSG_DATA(nlh) + GENL_HDRLEN, nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN),
+                tb, CTRL_ATTR_MAX);
+    if (!tb[CTRL_ATTR_FAMILY_ID] || !tb[CTRL_ATTR_MCAST_GROUPS])
+        return -1;
+    family = *(const uint16_t *)nla_data(tb[CTRL_ATTR_FAMILY_ID]);
+
+    /* a nest of nests, each one a name and an id */
+    grp = nla_data(tb[CTRL_ATTR_MCAST_GROUPS]);
+    rem = nla_len(tb[CTRL_ATTR_MCAST_GROUPS]);
+    while (rem >= (int)NLA_HDRLEN && grp->nla_len >= NLA_HDRLEN && grp->nla_len <= rem) {
+        const struct nlattr *g[CTRL_ATTR_MCAST_GRP_MAX + 1];
+        char list[128], *save, *name;
+
+        parse_attrs(nla_data(grp), nla_len(grp), g, CTRL_ATTR_MCAST_GRP_MAX);
+        snprintf(list, sizeof(list), "%s", groups);
+        for (name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+            uint32_t id;
+
+            if (!g[CTRL_ATTR_MCAST_GRP_NAME] || !g[CTRL_ATTR_MCAST_GRP_ID] ||
+                strcmp(nla_data(g[CTRL_ATTR_MCAST_GRP_NAME]), name))
+                continue;
+            id = *(const uint32_t *)nla_data(g[CTRL_ATTR_MCAST_GRP_ID]);
+            if (setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &id, sizeof(id)) < 0)
+                perror(name);
+        }
+        rem -= NLA_ALIGN(grp->nla_len);
+        grp = (const struct nlattr *)((const char *)grp + NLA_ALIGN(grp->nla_len));
+    }
+    return family;
+}
+
+static void print_message(const struct genlmsghdr *genl, int len)
+{
+    const struct nlattr *tb[WII_NL_A_MAX + 1];
+    const char *dev;
+    uint64_t t = 0;
+
+    parse_attrs((const char *)genl + GENL_HDRLEN, len - GENL_HDRLEN, tb, WII_NL_A_MAX);
+    dev = tb[WII_NL_A_DEVICE] ? nla_data(tb[WII_NL_A_DEVICE]) : "?";
+    if (tb[WII_NL_A_TIMESTAMP])
+        memcpy(&t, nla_data(tb[WII_NL_A_TIMESTAMP]), sizeof(t));
+
+    switch (genl->cmd) {
+    case WII_NL_CMD_BUTTONS: {
+        uint16_t buttons = 0, bit;
+
+        if (tb[WII_NL_A_BUTTONS])
+            buttons = *(const uint16_t *)nla_data(tb[WII_NL_A_BUTTONS]);
+        printf("buttons %s T=%" PRIu64, dev, t);
+        for (bit = 1; bit; bit <<= 1)
+            if ((buttons & bit) && wii_button_name(bit))
+                printf(" %s", wii_button_name(bit));
+        printf("\n");
+        break;
+    }
+    case WII_NL_CMD_MOTION: {
+        struct wii_motion_record rec;
+
+        if (!tb[WII_NL_A_RECORD] || nla_len(tb[WII_NL_A_RECORD]) < (int)sizeof(rec))
+            break;
+        memcpy(&rec, nla_data(tb[WII_NL_A_RECORD]), sizeof(rec));
+        printf("motion %s T=%" PRIu64 " id=0x%02x accel=%u,%u,%u gyro=%d,%d,%d flags=0x%02x\n",
+               dev, t, rec.report_id, rec.accel[0], rec.accel[1], rec.accel[2],
+               rec.gyro[0], rec.gyro[1], rec.gyro[2], rec.flags);
+        break;
+    }
+    case WII_NL_CMD_STATUS:
+        printf("status %s T=%" PRIu64, dev, t);
+        if (tb[WII_NL_A_BATTERY])
+            printf(" battery=%u", *(const uint8_t *)nla_data(tb[WII_NL_A_BATTERY]));
+        if (tb[WII_NL_A_EXT])
+            printf(" ext=%u", *(const uint8_t *)nla_data(tb[WII_NL_A_EXT]));
+        printf("\n");
+        break;
+    case WII_NL_CMD_HOTPLUG:
+        printf("hotplug %s T=%" PRIu64 " %s\n", dev, t,
+               tb[WII_NL_A_CONNECTED] && *(const uint8_t *)nla_data(tb[WII_NL_A_CONNECTED]) ?
+               "connected" : "disconnected");
+        break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+    char *groups = DEFAULT_GROUPS;
+    char buf[NL_BUF_SIZE];
+    int ask_status = 0;
+    int fd, family, opt;
+
+    while ((opt = getopt(argc, argv, "g:s")) != -1) {
+        switch (opt) {
+        case 'g': groups = optarg; break;
+        case 's': ask_status = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-g buttons,motion,status,hotplug] [-s]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("netlink socket");
+        return 1;
+    }
+    family = genl_resolve(fd, groups);
+    if (family < 0) {
+        fprintf(stderr, "no %s netlink family, is the driver loaded?\n", WII_NL_FAMILY);
+        return 1;
+    }
+    if (ask_status && genl_send(fd, family, WII_NL_CMD_STATUS, 0, NULL, 0) < 0)
+        perror("status request");
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    while (running) {
+        struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+        int len = recv(fd, buf, sizeof(buf), 0);
+
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == ENOBUFS) {     /* we fell behind and the kernel dropped some, keep going */
+                fprintf(stderr, "wii-nlmon: lost messages\n");
+                continue;
+            }
+            perror("recv");
+            break;
+        }
+        for (; NLMSG_OK(nlh, (unsigned int)len); nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type == NLMSG_ERROR) {
+                int err = ((struct nlmsgerr *)NLMSG_DATA(nlh))->error;
+
+                if (err)
+                    fprintf(stderr, "wii-nlmon: %s\n", strerror(-err));
+            } else if (nlh->nlmsg_type == family) {
+                print_message(NLMSG_DATA(nlh), nlh->nlmsg_len - NLMSG_HDRLEN);
+            }
+        }
+    }
+    close(fd);
+    return 0;
+}
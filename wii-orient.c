@@ -0,0 +1,240 @@
+/*
+ * wii-orient.c - Madgwick and Mahony orientation filters, see wii-orient.h
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wii-orient.h"
+
+#define DEFAULT_DT   0.01   /* the remote reports at 100Hz, used when two samples share a timestamp */
+#define MAX_DT       0.25   /* longer than this is a gap, the motion in it is lost either way */
+#define ACCEL_1G     104.0  /* raw counts per g, near enough for every remote */
+#define ACCEL_TRUST  0.4    /* ignore the accel when it reads further than this many g off 1g */
+
+void wii_orient_defaults(struct wii_orient_params *p, enum wii_orient_algo algo)
+{
+    memset(p, 0, sizeof(*p));
+    p->algo = algo;
+    p->beta = 0.1;
+    p->kp = 1.0;
+    p->ki = 0.0;
+    p->accel_zero = 512.0;
+}
+
+int wii_orient_parse(const char *spec, struct wii_orient_params *p)
+{
+    static const struct {
+        const char *name;
+        size_t offset;
+    } keys[] = {
+        { "beta",       offsetof(struct wii_orient_params, beta) },
+        { "kp",         offsetof(struct wii_orient_params, kp) },
+        { "ki",         offsetof(struct wii_orient_params, ki) },
+        { "accel_zero", offsetof(struct wii_orient_params, accel_zero) },
+    };
+    const char *colon = strchr(spec, ':');
+    size_t name_len = colon ? (size_t)(colon - spec) : strlen(spec);
+    char *copy, *tok, *save = NULL;
+    int ret = 0;
+
+    if (name_len == 8 && strncmp(spec, "madgwick", 8) == 0)
+        wii_orient_defaults(p, WII_ORIENT_MADGWICK);
+    else if (name_len == 6 && strncmp(spec, "mahony", 6) == 0)
+        wii_orient_defaults(p, WII_ORIENT_MAHONY);
+    else
+        goto bad;
+    if (!colon)
+        return 0;
+
+    copy = strdup(colon + 1);
+    if (!copy)
+        return -1;
+    for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '='), *end;
+        size_t i;
+        double v;
+
+        if (!eq) {
+            ret = -1;
+            break;
+        }
+        *eq = '\0';
+        v = strtod(eq + 1, &end);
+        for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+            if (strcmp(tok, keys[i].name) == 0)
+                break;
+        if (i == sizeof(keys) / sizeof(keys[0]) || end == eq + 1 || *end || v < 0) {
+            ret = -1;
+            break;
+        }
+        *(double *)((char *)p + keys[i].offset) = v;
+    }
+    free(copy);
+    if (ret == 0)
+        return 0;
+bad:
+    errno = EINVAL;
+    return -1;
+}
+
+void wii_orient_init(struct wii_orient *o, const struct wii_orient_params *p)
+{
+    memset(o, 0, sizeof(*o));
+    o->p = *p;
+    o->q[0] = 1.0;
+}
+
+static inline int normalize(double *v, int n)
+{
+    double len = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        len += v[i] * v[i];
+    if (len <= 0)
+        return 0;
+    len = 1.0 / sqrt(len);
+    for (i = 0; i < n; i++)
+        v[i] *= len;
+    return 1;
+}
+
+/* up as the remote should be seeing it if q is right, the bottom row of q's rotation */
+static inline void expected_up(const double q[4], double v[3])
+{
+    v[0] = 2.0 * (q[1] * q[3] - q[0] * q[2]);
+    v[1] = 2.0 * (q[0] * q[1] + q[2] * q[3]);
+    v[2] = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+}
+
+/*
+ * straight from the accel with yaw 0, same x-then-y order wii_orient_euler()
+ * takes apart: q = rot_x(pitch) * rot_y(roll)
+ */
+static void from_accel(struct wii_orient *o, const double a[3])
+{
+    double pitch = atan2(a[1], sqrt(a[0] * a[0] + a[2] * a[2]));
+    double roll = atan2(-a[0], a[2]);
+    double cp = cos(pitch / 2), sp = sin(pitch / 2);
+    double cr = cos(roll / 2), sr = sin(roll / 2);
+
+    o->q[0] = cp * cr;
+    o->q[1] = sp * cr;
+    o->q[2] = cp * sr;
+    o->q[3] = sp * sr;
+}
+
+/* the step direction that shrinks the gap between measured and expected up, J^T f */
+static void madgwick_gradient(const double q[4], const double a[3], double s[4])
+{
+    double v[3], f[3];
+    int i;
+
+    expected_up(q, v);
+    for (i = 0; i < 3; i++)
+        f[i] = v[i] - a[i];
+    s[0] = -2.0 * q[2] * f[0] + 2.0 * q[1] * f[1];
+    s[1] =  2.0 * q[3] * f[0] + 2.0 * q[0] * f[1] - 4.0 * q[1] * f[2];
+    s[2] = -2.0 * q[0] * f[0] + 2.0 * q[3] * f[1] - 4.0 * q[2] * f[2];
+    s[3] =  2.0 * q[1] * f[0] + 2.0 * q[2] * f[1];
+}
+
+int wii_orient_update(struct wii_orient *o, uint64_t t_ns, const double gyro[3],
+                      const double accel[3])
+{
+    double a[3], g[3] = { gyro[0], gyro[1], gyro[2] };
+    double qdot[4], *q = o->q, dt;
+    int have_accel = 0, i;
+
+    if (accel) {
+        a[0] = accel[0];
+        a[1] = accel[1];
+        a[2] = accel[2];
+        have_accel = normalize(a, 3);
+    }
+
+    if (!o->init) {
+        /* the gyro says nothing about where we started, wait for an accel reading */
+        if (!have_accel)
+            return 0;
+        from_accel(o, a);
+        o->init = 1;
+        o->t_ns = t_ns;
+        return 1;
+    }
+
+    dt = t_ns > o->t_ns ? (double)(t_ns - o->t_ns) / 1e9 : DEFAULT_DT;
+    if (dt > MAX_DT)
+        dt = DEFAULT_DT;
+    o->t_ns = t_ns;
+
+    if (have_accel && o->p.algo == WII_ORIENT_MAHONY) {
+        double v[3], e[3];
+
+        /* how far off up is, as a rotation (measured x expected), fed back into the rate */
+        expected_up(q, v);
+        e[0] = a[1] * v[2] - a[2] * v[1];
+        e[1] = a[2] * v[0] - a[0] * v[2];
+        e[2] = a[0] * v[1] - a[1] * v[0];
+        for (i = 0; i < 3; i++) {
+            if (o->p.ki > 0)
+                o->e_int[i] += o->p.ki * e[i] * dt;
+            g[i] += o->p.kp * e[i] + o->e_int[i];
+        }
+    }
+
+    /* rate of change of q from the body rates, q * (0, g) / 2 */
+    qdot[0] = 0.5 * (-q[1] * g[0] - q[2] * g[1] - q[3] * g[2]);
+    qdot[1] = 0.5 * ( q[0] * g[0] + q[2] * g[2] - q[3] * g[1]);
+    qdot[2] = 0.5 * ( q[0] * g[1] - q[1] * g[2] + q[3] * g[0]);
+    qdot[3] = 0.5 * ( q[0] * g[2] + q[1] * g[1] - q[2] * g[0]);
+
+    if (have_accel && o->p.algo == WII_ORIENT_MADGWICK) {
+        double s[4];
+
+        madgwick_gradient(q, a, s);
+        if (normalize(s, 4))
+            for (i = 0; i < 4; i++)
+                qdot[i] -= o->p.beta * s[i];
+    }
+
+    for (i = 0; i < 4; i++)
+        q[i] += qdot[i] * dt;
+    if (!normalize(q, 4)) {
+        q[0] = 1.0;
+        q[1] = q[2] = q[3] = 0;
+    }
+    return 1;
+}
+
+int wii_orient_update_record(struct wii_orient *o, const struct wii_motion_record *rec)
+{
+    const double to_rad = M_PI / 180.0 / 1000.0;  /* millidegrees/s -> rad/s */
+    double gyro[3], accel[3], mag;
+    int i;
+
+    if (!(rec->flags & WII_MOTION_GYRO))
+        return 0;
+    for (i = 0; i < 3; i++) {
+        gyro[i] = rec->gyro[i] * to_rad;
+        accel[i] = rec->accel[i] - o->p.accel_zero;
+    }
+    /* shaking the remote adds to gravity, only trust the accel when it reads about 1g */
+    mag = sqrt(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2]) / ACCEL_1G;
+    return wii_orient_update(o, rec->t_ns, gyro, fabs(mag - 1.0) < ACCEL_TRUST ? accel : NULL);
+}
+
+void wii_orient_euler(const struct wii_orient *o, double angles[3])
+{
+    const double *q = o->q;
+    double s = 2.0 * (q[0] * q[1] + q[2] * q[3]);
+
+    /* q = rot_z(yaw) * rot_x(pitch) * rot_y(roll), only pointing straight up or down is singular */
+    angles[0] = asin(s > 1.0 ? 1.0 : s < -1.0 ? -1.0 : s);
+    angles[1] = atan2(2.0 * (q[0] * q[2] - q[1] * q[3]), 1.0 - 2.0 * (q[1] * q[1] + q[2] * q[2]));
+    angles[2] = atan2(2.0 * (q[0] * q[3] - q[1] * q[2]), 1.0 - 2.0 * (q[1] * q[1] + q[3] * q[3]));
+}
@@ -0,0 +1,84 @@
+/*
+ * wii-orient.h - which way the remote is facing, from the gyro and the accelerometer.
+ *
+ * The MotionPlus gyro on its own is smooth but drifts, the accelerometer on its
+ * own knows where down is but shakes with every movement. A complementary filter
+ * integrates the gyro and keeps nudging the result towards the accelerometer's
+ * idea of down, slowly enough that the shake averages out:
+ *
+ *   madgwick   one gradient descent step towards the accel per sample, beta is
+ *              how big the step is (Madgwick, "An efficient orientation filter
+ *              for inertial and inertial/magnetic sensor arrays", 2010)
+ *   mahony     the error between measured and estimated down is fed back into
+ *              the gyro rate through a PI controller, kp/ki are its gains, the
+ *              integral also soaks up gyro bias the driver didnt catch
+ *              (Mahony et al., "Nonlinear complementary filters on the special
+ *              orthogonal group", 2008)
+ *
+ * One fusion step per sample, a few dozen multiplies, no allocation. Keep one
+ * struct wii_orient per remote.
+ *
+ * There is no magnetometer so only roll and pitch are held in place, yaw is the
+ * gyro alone and wanders off slowly. Fine for an air mouse that only ever looks
+ * at how much yaw changed, not for anything that needs to know where north is.
+ */
+
+#ifndef WII_ORIENT_H
+#define WII_ORIENT_H
+
+#include <stdint.h>
+
+#include "wii-event.h"
+
+enum wii_orient_algo {
+    WII_ORIENT_MADGWICK = 0,
+    WII_ORIENT_MAHONY,
+};
+
+struct wii_orient_params {
+    enum wii_orient_algo algo;
+    double beta;                /* madgwick, rad/s, how hard the accel pulls, higher = less drift, more shake */
+    double kp;                  /* mahony, proportional gain on the accel error */
+    double ki;                  /* mahony, integral gain, 0 = no bias estimate */
+    double accel_zero;          /* raw accel counts at 0g */
+};
+
+struct wii_orient {
+    struct wii_orient_params p;
+    int      init;              /* q means something */
+    uint64_t t_ns;              /* time of the last sample */
+    double   q[4];              /* w, x, y, z, remote frame -> world */
+    double   e_int[3];          /* mahony integral term, rad/s */
+};
+
+/* fills in the defaults for algo */
+void wii_orient_defaults(struct wii_orient_params *p, enum wii_orient_algo algo);
+
+/*
+ * "madgwick" or "mahony", optionally followed by :key=value,... with the field
+ * names above, e.g. "mahony:kp=1.5,ki=0.02". returns 0 or -1 if something
+ * didnt parse
+ */
+int wii_orient_parse(const char *spec, struct wii_orient_params *p);
+
+void wii_orient_init(struct wii_orient *o, const struct wii_orient_params *p);
+
+/*
+ * one fusion step at t_ns. gyro in rad/s and accel in any unit (only its
+ * direction is used), both about the remote's x, y, z. accel can be NULL for
+ * a gyro only step. the first sample with accel only sets pitch and roll from
+ * it. returns 1 once there is an orientation
+ */
+int wii_orient_update(struct wii_orient *o, uint64_t t_ns, const double gyro[3],
+                      const double accel[3]);
+
+/* wii_orient_update() straight from a driver record, 0 if the record has no gyro in it */
+int wii_orient_update_record(struct wii_orient *o, const struct wii_motion_record *rec);
+
+/*
+ * euler angles in radians about x (pitch), y (roll) and z (yaw), the same
+ * order as the gyro in a record. roll and yaw wrap at +-pi, pitch is +-pi/2
+ */
+void wii_orient_euler(const struct wii_orient *o, double angles[3]);
+
+#endif /* WII_ORIENT_H */
@@ -0,0 +1,229 @@
+/*
+ * wii-pack.c - turns --record captures into archives and looks inside archives.
+ *
+ *   wii-pack pack <capture> <archive> [block_rows]
+ *   wii-pack info <archive>
+ *   wii-pack dump <archive> [from_s [to_s]]     seconds from the start of the archive
+ *
+ * dump only touches the blocks the time range lands in, see wii-archive.h
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wii-archive.h"
+#include "wii-capture.h"
+#include "wii-decode.h"
+
+/* bytes the decoder reads out of a report of this id */
+static size_t report_needs(uint8_t id)
+{
+    switch (id) {
+    case 0x31:
+    case 0x35: return 6;
+    case 0x33: return 18;
+    case 0x36: return 13;
+    case 0x37: return 16;
+    default:   return 3;
+    }
+}
+
+#define PACK_BATCH 4096
+
+struct pack_batch {
+    uint8_t  reports[PACK_BATCH][WII_DECODE_MIN_STRIDE];
+    uint64_t t_ns[PACK_BATCH];
+    uint16_t buttons[PACK_BATCH];
+    uint8_t  report_id[PACK_BATCH];
+    uint16_t decoded_buttons[PACK_BATCH];
+    uint16_t accel[3][PACK_BATCH];
+    uint16_t ir_x[WII_IR_BLOBS][PACK_BATCH];
+    uint16_t ir_y[WII_IR_BLOBS][PACK_BATCH];
+    uint8_t  ir_size[WII_IR_BLOBS][PACK_BATCH];
+};
+
+/* decodes the batch in one go and appends it row by row */
+static int pack_flush(struct wii_archive_writer *w, struct pack_batch *b, size_t n)
+{
+    struct wii_decoded out = { .buttons = b->decoded_buttons };
+    size_t i;
+    int j;
+
+    for (j = 0; j < 3; j++)
+        out.accel[j] = b->accel[j];
+    for (j = 0; j < WII_IR_BLOBS; j++) {
+        out.ir_x[j] = b->ir_x[j];
+        out.ir_y[j] = b->ir_y[j];
+        out.ir_size[j] = b->ir_size[j];
+    }
+    wii_decode_batch(&b->reports[0][0], WII_DECODE_MIN_STRIDE, n, &out);
+
+    for (i = 0; i < n; i++) {
+        struct wii_archive_row row = {
+            .t_ns = b->t_ns[i], .buttons = b->buttons[i], .report_id = b->report_id[i],
+        };
+        for (j = 0; j < 3; j++)
+            row.accel[j] = b->accel[j][i];
+        for (j = 0; j < WII_IR_BLOBS; j++) {
+            row.ir_x[j] = b->ir_x[j][i];
+            row.ir_y[j] = b->ir_y[j][i];
+            row.ir_size[j] = b->ir_size[j][i];
+        }
+        if (wii_archive_append(w, &row) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int pack(const char *capture_path, const char *archive_path, uint32_t block_rows)
+{
+    struct wii_capture_reader reader;
+    struct wii_capture_record rec;
+    struct wii_archive_writer w;
+    struct pack_batch *b;
+    uint64_t last_t = 0, clamped = 0;
+    size_t n = 0;
+    int ret;
+
+    b = malloc(sizeof(*b));
+    if (!b) {
+        perror("malloc");
+        return 1;
+    }
+    if (wii_capture_open_read(&reader, capture_path) < 0) {
+        perror(capture_path);
+        free(b);
+        return 1;
+    }
+    if (wii_archive_create(&w, archive_path, block_rows, reader.header.start_realtime_ns,
+                           reader.header.start_monotonic_ns) < 0) {
+        perror(archive_path);
+        wii_capture_close_read(&reader);
+        free(b);
+        return 1;
+    }
+
+    while ((ret = wii_capture_next(&reader, &rec, b->reports[n])) == 1) {
+        uint8_t *report = b->reports[n];
+
+        /* the decoder reads the whole stride, so zero whatever the record didnt fill */
+        memset(report + rec.report_len, 0, WII_DECODE_MIN_STRIDE - rec.report_len);
+        b->report_id[n] = rec.report_len ? report[0] : 0;
+        b->buttons[n] = rec.buttons;
+
+        /*
+         * reports rebuilt from text lines are just {id, b1, b2}, the padding isnt
+         * accel or IR so decode those as plain buttons
+         */
+        if (rec.report_len < report_needs(report[0]))
+            report[0] = 0x30;
+
+        /* captures with no driver timestamps can jitter backwards a little, archives cant */
+        b->t_ns[n] = rec.driver_ns;
+        if (b->t_ns[n] < last_t) {
+            b->t_ns[n] = last_t;
+            clamped++;
+        }
+        last_t = b->t_ns[n];
+
+        if (++n == PACK_BATCH) {
+            if (pack_flush(&w, b, n) < 0) {
+                perror("append");
+                n = 0;
+                break;
+            }
+            n = 0;
+        }
+    }
+    if (n && pack_flush(&w, b, n) < 0)
+        perror("append");
+    if (ret < 0)
+        fprintf(stderr, "%s: truncated or corrupt, packed what was readable\n", capture_path);
+    if (clamped)
+        fprintf(stderr, "%llu timestamps went backwards and were clamped\n",
+                (unsigned long long)clamped);
+
+    printf("%llu rows in %llu blocks\n", (unsigned long long)w.total_rows,
+           (unsigned long long)(w.block_count + (w.rows ? 1 : 0)));
+    wii_capture_close_read(&reader);
+    free(b);
+    if (wii_archive_finish(&w) < 0) {
+        perror(archive_path);
+        return 1;
+    }
+    return 0;
+}
+
+static int info(const char *path)
+{
+    struct wii_archive a;
+    uint64_t i;
+
+    if (wii_archive_open(&a, path) < 0) {
+        perror(path);
+        return 1;
+    }
+    printf("rows: %llu\nblocks: %llu x %u rows\nspan: %.3f s\nstart_realtime_ns: %llu\n",
+           (unsigned long long)a.footer->total_rows, (unsigned long long)a.footer->block_count,
+           a.footer->block_rows, (double)(a.footer->t_max - a.footer->t_min) / 1e9,
+           (unsigned long long)a.header->start_realtime_ns);
+    for (i = 0; i < a.footer->block_count; i++)
+        printf("block %llu: rows=%u t=[%.6f, %.6f]\n", (unsigned long long)i, a.index[i].rows,
+               (double)(a.index[i].t_first - a.footer->t_min) / 1e9,
+               (double)(a.index[i].t_last - a.footer->t_min) / 1e9);
+    wii_archive_close(&a);
+    return 0;
+}
+
+static int dump(const char *path, double from_s, double to_s)
+{
+    struct wii_archive a;
+    struct wii_archive_block b;
+    uint64_t block, from, to;
+    uint32_t row;
+
+    if (wii_archive_open(&a, path) < 0) {
+        perror(path);
+        return 1;
+    }
+    from = a.footer->t_min + (uint64_t)(from_s * 1e9);
+    to = to_s < 0 ? UINT64_MAX : a.footer->t_min + (uint64_t)(to_s * 1e9);
+
+    if (wii_archive_seek(&a, from, &block, &row) == 0) {
+        for (; block < wii_archive_block_count(&a); block++, row = 0) {
+            wii_archive_block(&a, block, &b);
+            for (; row < b.rows; row++) {
+                if (b.t_ns[row] > to)
+                    goto done;
+                printf("%.6f id=%02x buttons=%04x accel=%u,%u,%u ir=%u,%u\n",
+                       (double)(b.t_ns[row] - a.footer->t_min) / 1e9, b.report_id[row],
+                       b.buttons[row], b.accel[0][row], b.accel[1][row], b.accel[2][row],
+                       b.ir_x[0][row], b.ir_y[0][row]);
+            }
+        }
+    }
+done:
+    wii_archive_close(&a);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s pack <capture> <archive> [block_rows]\n"
+                    "       %s info <archive>\n"
+                    "       %s dump <archive> [from_s [to_s]]\n", prog, prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 4 && strcmp(argv[1], "pack") == 0)
+        return pack(argv[2], argv[3], argc > 4 ? (uint32_t)strtoul(argv[4], NULL, 10) : 0);
+    if (argc == 3 && strcmp(argv[1], "info") == 0)
+        return info(argv[2]);
+    if (argc >= 3 && argc <= 5 && strcmp(argv[1], "dump") == 0)
+        return dump(argv[2], argc > 3 ? atof(argv[3]) : 0, argc > 4 ? atof(argv[4]) : -1);
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,148 @@
+/*
+ * wii-predict.c - short horizon extrapolation, see wii-predict.h
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wii-predict.h"
+
+void wii_predict_defaults(enum wii_predict_mapping m, struct wii_predict_params *p)
+{
+    memset(p, 0, sizeof(*p));
+    /* orientation is smoother than the pointer so it can be trusted further out */
+    p->max_ms = m == WII_PREDICT_ORIENTATION ? 80.0 : 50.0;
+    p->smoothing_hz = 10.0;
+}
+
+int wii_predict_parse(const char *spec, struct wii_predict_params params[WII_PREDICT_MAPPINGS])
+{
+    static const struct {
+        const char *name;
+        size_t offset;
+    } keys[] = {
+        { "horizon_ms",   offsetof(struct wii_predict_params, horizon_ms) },
+        { "max_ms",       offsetof(struct wii_predict_params, max_ms) },
+        { "smoothing_hz", offsetof(struct wii_predict_params, smoothing_hz) },
+    };
+    const char *colon = strchr(spec, ':');
+    size_t name_len = colon ? (size_t)(colon - spec) : strlen(spec);
+    struct wii_predict_params *p;
+    char *copy, *tok, *save = NULL;
+    int ret = 0;
+
+    if (name_len == 7 && strncmp(spec, "pointer", 7) == 0)
+        p = &params[WII_PREDICT_POINTER];
+    else if (name_len == 11 && strncmp(spec, "orientation", 11) == 0)
+        p = &params[WII_PREDICT_ORIENTATION];
+    else
+        goto bad;
+    if (!colon)
+        goto bad;   /* nothing to set */
+
+    copy = strdup(colon + 1);
+    if (!copy)
+        return -1;
+    for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '='), *end;
+        size_t i;
+        double v;
+
+        if (!eq) {
+            ret = -1;
+            break;
+        }
+        *eq = '\0';
+        v = strtod(eq + 1, &end);
+        for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+            if (strcmp(tok, keys[i].name) == 0)
+                break;
+        if (i == sizeof(keys) / sizeof(keys[0]) || end == eq + 1 || *end || v < 0) {
+            ret = -1;
+            break;
+        }
+        *(double *)((char *)p + keys[i].offset) = v;
+    }
+    free(copy);
+    if (ret == 0)
+        return 0;
+bad:
+    errno = EINVAL;
+    return -1;
+}
+
+void wii_predict_init(struct wii_predictor *pr, enum wii_predict_mapping m,
+                      const struct wii_predict_params *p)
+{
+    memset(pr, 0, sizeof(*pr));
+    pr->p = *p;
+    pr->dims = m == WII_PREDICT_POINTER ? 2 : 3;
+    pr->wrap = m == WII_PREDICT_ORIENTATION;
+}
+
+/* b - a, the short way round for angles */
+static inline double delta(const struct wii_predictor *pr, double a, double b)
+{
+    double d = b - a;
+
+    if (pr->wrap)
+        d = remainder(d, 2.0 * M_PI);
+    return d;
+}
+
+void wii_predict_observe(struct wii_predictor *pr, uint64_t t_ns, const double *value,
+                         const double *vel)
+{
+    double dt = pr->have && t_ns > pr->t_ns ? (double)(t_ns - pr->t_ns) / 1e9 : 0;
+    int i;
+
+    for (i = 0; i < pr->dims; i++) {
+        if (vel) {
+            pr->vel[i] = vel[i];
+        } else if (dt > 0 && dt * 1000.0 <= pr->p.max_ms) {
+            /* low pass on the finite difference, same form as the one-euro speed estimate */
+            double tau = 1.0 / (2.0 * M_PI * pr->p.smoothing_hz);
+            double alpha = 1.0 / (1.0 + tau / dt);
+            double v = delta(pr, pr->value[i], value[i]) / dt;
+            pr->vel[i] = pr->have_vel ? pr->vel[i] + alpha * (v - pr->vel[i]) : v;
+        } else if (dt * 1000.0 > pr->p.max_ms) {
+            /* after a gap the old speed means nothing */
+            pr->vel[i] = 0;
+        }
+        pr->value[i] = value[i];
+    }
+    if (vel)
+        pr->have_vel = 1;
+    else if (pr->have && dt > 0)
+        pr->have_vel = dt * 1000.0 <= pr->p.max_ms;
+    pr->have = 1;
+    pr->t_ns = t_ns;
+}
+
+int wii_predict_at(const struct wii_predictor *pr, uint64_t now_ns, double *out)
+{
+    double age, ahead;
+    int i;
+
+    if (!pr->have)
+        return 0;
+
+    /* time the sample has already spent in the pipeline, plus what is still to come */
+    age = now_ns > pr->t_ns ? (double)(now_ns - pr->t_ns) / 1e6 : 0;
+    ahead = (age + pr->p.horizon_ms) / 1000.0;
+    if (ahead * 1000.0 > pr->p.max_ms)
+        ahead = pr->p.max_ms / 1000.0;
+    /* off, nothing to go on, or the samples stopped coming and its just holding */
+    if (pr->p.horizon_ms <= 0 || !pr->have_vel || age > pr->p.max_ms)
+        ahead = 0;
+
+    for (i = 0; i < pr->dims; i++) {
+        out[i] = pr->value[i] + pr->vel[i] * ahead;
+        if (pr->wrap)
+            out[i] = remainder(out[i], 2.0 * M_PI);
+    }
+    return 1;
+}
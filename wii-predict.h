@@ -0,0 +1,72 @@
+/*
+ * wii-predict.h - short horizon prediction to hide the pipeline's delay.
+ *
+ * By the time a report has gone remote -> bluetooth -> driver -> client ->
+ * xdotool -> screen the pointer is drawn a good few ms behind where the remote
+ * actually is, and that delay is roughly constant. The predictor keeps the last
+ * value and velocity of a channel and extrapolates to "now + horizon", now being
+ * measured against the driver's timestamp of the sample so time already spent
+ * in the pipeline is counted too.
+ *
+ * It only ever extrapolates a little (max_ms past the last sample), if the
+ * samples stop it holds the last value instead of flying off.
+ *
+ * Each mapping has its own settings since a pointer and an orientation want
+ * very different horizons. A horizon of 0 turns prediction off for it.
+ */
+
+#ifndef WII_PREDICT_H
+#define WII_PREDICT_H
+
+#include <stdint.h>
+
+#define WII_PREDICT_MAX_DIM 3
+
+enum wii_predict_mapping {
+    WII_PREDICT_POINTER = 0,    /* x, y in px */
+    WII_PREDICT_ORIENTATION,    /* angles about x, y, z in radians, wrapped at +-pi */
+    WII_PREDICT_MAPPINGS,
+};
+
+struct wii_predict_params {
+    double horizon_ms;          /* how far past now to aim, 0 = off */
+    double max_ms;              /* never extrapolate further than this past the last sample */
+    double smoothing_hz;        /* cutoff on the velocity estimate when the caller doesnt give one */
+};
+
+struct wii_predictor {
+    struct wii_predict_params p;
+    int      dims;
+    int      wrap;              /* values are angles */
+    int      have;              /* seen a sample */
+    int      have_vel;          /* and vel[] means something */
+    uint64_t t_ns;              /* time of the last sample */
+    double   value[WII_PREDICT_MAX_DIM];
+    double   vel[WII_PREDICT_MAX_DIM];     /* units per second */
+};
+
+/* defaults for a mapping, prediction is off until horizon_ms is set */
+void wii_predict_defaults(enum wii_predict_mapping m, struct wii_predict_params *p);
+
+/*
+ * "<mapping>:key=value,..." with mapping "pointer" or "orientation" and the
+ * field names above, e.g. "pointer:horizon_ms=25,max_ms=50". fills in the
+ * params of that mapping, returns 0 or -1 if something didnt parse
+ */
+int wii_predict_parse(const char *spec, struct wii_predict_params params[WII_PREDICT_MAPPINGS]);
+
+void wii_predict_init(struct wii_predictor *pr, enum wii_predict_mapping m,
+                      const struct wii_predict_params *p);
+
+/*
+ * a new sample at t_ns (driver time). vel can be NULL and the predictor works
+ * it out from consecutive samples, or it can come from a filter that already
+ * has a better one (wii_filter_velocity())
+ */
+void wii_predict_observe(struct wii_predictor *pr, uint64_t t_ns, const double *value,
+                         const double *vel);
+
+/* where the channel should be at now_ns + horizon. returns 0 if there are no samples yet */
+int wii_predict_at(const struct wii_predictor *pr, uint64_t now_ns, double *out);
+
+#endif /* WII_PREDICT_H */
@@ -10,6 +10,51 @@
  * a battery/status update, and the corresponding battery level (report ID 0x20) is also
  * written into the buffer. A /proc entry is created to report driver state.
  *
+ * With a MotionPlus (motionplus=1 module param or WIIMOTE_IOCTL_SET_MOTIONPLUS) the
+ * gyro is turned on, decoded and its bias tracked while the remote sits still.
+ * Accel and gyro go out on a "Nintendo Wii Remote Motion" input device and as
+ * binary records for readers that switch to WII_FORMAT_RECORDS.
+ *
+ * Without one, whatever is plugged into the extension port is identified when
+ * the status report says it appeared. A Classic Controller (or Pro) gets its
+ * own gamepad input device and its sticks, triggers and buttons go into the
+ * records too, the remote is put in continuous 0x32 so it comes at the full rate.
+ * A Balance Board is a remote with a four load sensor extension that never comes
+ * out, its calibration is read once and the sensors go out in 10g units along
+ * with the centre of pressure on a "Nintendo Wii Balance Board" input device.
+ *
+ * The speaker is set up with WIIMOTE_IOCTL_SET_SPEAKER, after that anything
+ * written to /dev/wii_remote is played: signed 16 bit mono samples (host
+ * endian) at the configured rate, encoded here to 4 bit ADPCM or 8 bit PCM and
+ * sent as 0x18 reports paced by an hrtimer.
+ *
+ * pointer_mode in the hid device's sysfs directory turns the D-pad, tilt or
+ * the IR camera straight into a pointer input device, no client needed.
+ *
+ * The buttons themselves go out as keys on a "Nintendo Wii Remote" input
+ * device through a keymap indexed by button bit, EVIOCSKEYCODE swaps it.
+ * Chords (B+A, Home held 2s...) from the chords sysfs attribute come out as
+ * one more key on the same device, KEY_MACRO1-30 so the device can say it has
+ * them from the start.
+ *
+ * Buttons, motion records, status and hotplug also go out on the "wii_remote"
+ * generic netlink family, one multicast group each, so any number of monitors
+ * can listen without opening /dev/wii_remote or taking events off its reader.
+ *
+ * io_uring users can do reads, status requests, LEDs, rumble and memory reads
+ * as uring_cmds on /dev/wii_remote (WII_URING_*), all completing on the ring.
+ *
+ * /dev/wii_remote has poll() and read_iter, so a recorder can sleep until
+ * there is something and splice() it straight into a pipe or file.
+ *
+ * Everything user space sees in binary (ioctls, records, netlink, io_uring)
+ * is in wii-remote-uapi.h, and WIIMOTE_IOCTL_GET_INFO says which of it this
+ * build and the connected remote have.
+ *
+ * HID-BPF programs on the hid device (wii-bpf-*.bpf.c) see every report before
+ * wii_raw_event() does and can drop or rewrite it, nothing here assumes a
+ * report follows the one before it.
+ *
  */
 
 #include <linux/module.h> // this module is for module init and module exit
@@ -25,14 +70,68 @@
 #include <linux/ioctl.h> // macros to implement ioctl commands
 #include <linux/proc_fs.h> // for creating enteries in proc
 #include <linux/seq_file.h> // this is for sequential file operations in proc for easy state reporting
+#include <linux/timekeeping.h> // ktime_get_ns for the per event timestamps
+#include <linux/input.h> // the motion input device (accel, gyro, nunchuk stick)
+#include <linux/slab.h> // kmemdup for output reports
+#include <linux/spinlock.h>
+#include <linux/workqueue.h> // output reports can sleep so the MotionPlus init runs from a work item
+#include <linux/delay.h> // msleep between register writes
+#include <linux/completion.h> // waiting for the answer to a register read
+#include <linux/io_uring/cmd.h> // uring_cmd on the char device
+#include <linux/uio.h> // read_iter, splice goes through it too
+#include <linux/poll.h>
+#include <net/genetlink.h> // the multicast groups listeners join instead of reading the char device
+#include <linux/hrtimer.h> // paces the speaker reports
+#include <linux/wait.h> // speaker writers waiting for room
+#include <linux/rcupdate.h> // wii_dev is looked up without a lock
+#include <linux/kref.h> // and stays around while an ioctl or write is still using it
+#include <linux/rwsem.h>
+
+#include "wii-remote-uapi.h" // ioctls, records and everything else user space sees, shared with the tools
 
 #define DRIVER_NAME "wii_remote_driver"
 #define DEVICE_NAME "wii_remote"
-#define CIRC_BUFFER_SIZE 1024 // buffer holds 1024 bytes of our input, you can change this size as needed
+#ifndef CIRC_BUFFER_SIZE
+#define CIRC_BUFFER_SIZE 1024 // buffer holds 1024 bytes of our input, build with make RING_SIZE=N to change it
+#endif
+
+/* group indexes in wii_nl_groups, user space finds them by name */
+#define WII_NL_GRP_BUTTONS 0
+#define WII_NL_GRP_MOTION  1
+#define WII_NL_GRP_STATUS  2
+#define WII_NL_GRP_HOTPLUG 3
+
+/* data reports wii_motion_report and the text know, bit n is 0x30 + n (0x36 and 0x3d-0x3f arent) */
+#define WII_REPORT_MODES 0x00bf
+
+static int motionplus = WII_MP_OFF;
+module_param(motionplus, int, 0444);
+MODULE_PARM_DESC(motionplus, "turn the MotionPlus on when a remote connects: 0 off, 1 on, 2 with nunchuk passthrough");
+
+#define RECORD_RING_SIZE 256 /* records, 2.5 seconds at 100Hz */
+
+#define SPK_BLOCK_BYTES  20        /* audio bytes in one 0x18 report */
+#define SPK_REPORT_BYTES (SPK_BLOCK_BYTES + 2)
+#define SPK_QUEUE_BLOCKS 32        /* power of two (the indexes wrap), about 0.4s of ADPCM at 3000Hz */
+#define SPK_IDLE_TICKS   4         /* empty ticks in a row before the timer decides the sound is over */
+#define SPK_MIN_RATE     1000
+#define SPK_MAX_RATE     6000      /* 150 reports a second in ADPCM, the link starts to struggle past that */
 
-/* IOCTL command to request a battery/status update */
-#define WIIMOTE_IOCTL_REQUEST_STATUS _IO('W', 1) // creates a simple ioctl command that doesnt send or recieve anything,
-// the 'W' is to just specify 'Wii' as the device
+#define WII_KEYMAP_SIZE  16        /* one entry per bit of byte 1 | byte 2 << 8 */
+#define WII_KEYMAP_MASK  0x9f1f    /* the bits that are buttons, the rest are accel */
+
+#define WII_CHORD_MAX    16
+#define CHORD_MAX_HOLD_MS 10000
+/* the keys a chord can send, all declared when the keys device is registered */
+#define CHORD_FIRST_KEY  KEY_MACRO1
+#define CHORD_LAST_KEY   KEY_MACRO30
+
+/* a chord, see wii_chord_update */
+struct wii_chord {
+    u16 buttons;        /* exactly these held, byte 1 | byte 2 << 8 */
+    u16 hold_ms;        /* for this long first, 0 fires on the press */
+    u16 code;           /* key it sends */
+};
 
 /*  circular buffer for mapped output */
 static char circ_buffer[CIRC_BUFFER_SIZE];
@@ -41,23 +140,242 @@ static DEFINE_MUTEX(circ_mutex);
 
 /*
  * the buffer can hold:
- * 20 large inputs: "D-Pad-Left Report: ID=12, Dpad_Left Dpad_Right Dpad_Up Dpad_Down Plus Minus Home 2 1 B A"
- * 1024 / 50 = 20
+ * 10 large inputs: "Report: ID=48, T=12345678901234, Dpad_Left Dpad_Right Dpad_Up Dpad_Down Plus Minus Home 2 1 B A"
+ * 1024 / 97 = 10
+ *
+ * 28 small events: "Report: ID=48, T=12345678901234, A"
+ * 1024 / 36 = 28
  *
- * 51 small events: "A"
- * 1024 / 20 = 51
+ * The smallest possible event without an input is 33 characters
+ * (T= is ktime_get_ns() so its about 14 digits once the machine has been up a day)
  *
- * The smallest possible event without an input is 15 characters
+ * those numbers are for the default 1024, wii-bench driver measures what other sizes do
 */
 
-/* pointer to the HID device instance */
-static struct hid_device *wii_hid_dev = NULL;
+/*
+ * the remote ioctl, write and /proc talk to, the last one connected. read only
+ * needs the rings below so it doesnt look it up at all.
+ * RCU so a lookup never takes a lock, probe and remove (the only writers) take
+ * wii_dev_lock. the struct is freed with kfree_rcu once its last reference
+ * goes, so a reader that got the pointer can always look at it, see wii_get()
+ * only one remote at a time is reachable this way, wii_remotes has all the
+ * connected ones (newest first) so remove can fall back to the next one
+ */
+static struct wii_remote __rcu *wii_dev;
+static LIST_HEAD(wii_remotes);
+static DEFINE_SPINLOCK(wii_dev_lock); /* covers wii_remotes too */
+
+/*
+ * binary records, separate from the text buffer so text readers dont pay for them.
+ * a spinlock not a mutex, nothing in here sleeps and read copies out before copy_to_user
+ */
+static struct wii_motion_record record_ring[RECORD_RING_SIZE];
+static unsigned int record_head = 0, record_tail = 0;
+static DEFINE_SPINLOCK(record_lock);
+static unsigned long wii_dropped_records = 0; /* under record_lock */
+
+/*
+ * WII_URING_READs with nothing to read yet. circ_buffer_write and record_push
+ * hand them all to io_uring task work, which reads for them in the submitter's
+ * context (copy_to_user needs its mm) and parks them again if it lost the race
+ */
+#define URING_PARKED_MAX 32
+static struct io_uring_cmd *uring_parked[URING_PARKED_MAX];
+static DEFINE_SPINLOCK(uring_lock);
+
+/* poll() sleeps on this till there is something to read */
+static DECLARE_WAIT_QUEUE_HEAD(wii_read_wait);
+
+/*
+ * everything we keep per remote, hangs off the hid device with hid_set_drvdata
+ */
+struct wii_remote {
+    struct hid_device *hdev;
+    struct kref ref;                /* probe holds one till remove, so does every wii_get() */
+    struct rcu_head rcu;
+    struct list_head node;          /* on wii_remotes from probe till remove, under wii_dev_lock */
+    struct rw_semaphore io_lock;    /* wii_io_get() holders talk to hdev, remove takes it to set gone */
+    bool gone;                      /* removed, hdev is not ours any more */
+    char name[32];                  /* dev_name(hdev), kept so a wii_get() holder can use it after remove */
+    struct input_dev *motion;       /* accel, gyro, nunchuk stick. NULL if it didnt register */
+    struct input_dev *keys;         /* the buttons through keymap, NULL if it didnt register */
+    u16 keymap[WII_KEYMAP_SIZE];    /* keycode per button bit, the input core reads and writes it */
+    u16 keys_held;                  /* buttons as of the last report keys saw */
+
+    /* chords, chord_lock covers them all, chord_timer takes it */
+    spinlock_t chord_lock;
+    struct hrtimer chord_timer;     /* the hold of chord_pending */
+    struct wii_chord chords[WII_CHORD_MAX];
+    int chord_count;
+    int chord_pending;              /* index held but not for long enough yet, -1 if none */
+    int chord_active;               /* index whose key is down, -1 if none */
+    struct work_struct mp_work;     /* sends the MotionPlus init/teardown */
+    int mp_mode;                    /* WII_MP_*, what was asked for last */
+    u16 last_buttons;               /* continuous reporting only writes text when these change */
+    bool continuous;                /* the report mode we asked for sends whether anything changed or not */
+    u8 report_mode;                 /* and which one it was, 0 before the first */
+    bool sysfs_ok;                  /* wii_attr_group is there */
+    u8 leds;                        /* bits 0-3, LEDs 1-4 as last set */
+    u8 rumble;                      /* 1 while rumbling, every output report carries it in byte 1 */
+    unsigned int status_seq;        /* bumped by every 0x20, status waiters watch it on status_wait */
+    wait_queue_head_t status_wait;
+
+    /* extension port, ext_lock keeps the two work items from talking to the remote at once */
+    struct work_struct ext_work;    /* identifies whatever just got plugged in */
+    struct mutex ext_lock;
+    bool ext_plugged;               /* what the last status report said */
+    int ext_type;                   /* WII_EXT_*, what raw_event decodes the extension bytes as */
+    struct input_dev *classic;      /* registered the first time a classic shows up, kept till remove */
+    struct input_dev *board;        /* same for the balance board */
+    u16 board_cal[4][3];            /* per sensor (BOARD_*) raw reading at 0, 17 and 34kg */
+
+    /*
+     * speaker. the queue is whole 0x18 reports, written by write(), released one
+     * per period by spk_timer and sent by spk_send_work. the indexes run free,
+     * head - tail is whats queued. spk_lock covers them and the config, the
+     * timer takes it so its irqsave everywhere else
+     */
+    struct work_struct spk_work;    /* runs the init sequence when the config changes */
+    struct work_struct spk_send_work;
+    struct hrtimer spk_timer;
+    spinlock_t spk_lock;
+    struct wii_speaker_config spk_cfg; /* what was asked for last */
+    bool spk_ready;                 /* the remote is set up for spk_cfg */
+    bool spk_running;               /* spk_timer is armed */
+    ktime_t spk_period;             /* how long one report plays for */
+    unsigned int spk_gen;           /* bumped every setup, writers reset the encoder when it moves */
+    u8 spk_queue[SPK_QUEUE_BLOCKS][SPK_BLOCK_BYTES];
+    unsigned int spk_head, spk_due, spk_tail; /* written, released by the timer, sent */
+    int spk_starved;                /* ticks in a row with nothing to release */
+    unsigned long spk_underruns;    /* times the queue ran dry and then more came */
+    unsigned long spk_sent;
+    u8 *spk_report;                 /* DMA safe, only spk_send_work touches it */
+    wait_queue_head_t spk_wait;     /* writers waiting for room or the setup */
+
+    /* the encoder, only writers touch it and they hold spk_mutex */
+    struct mutex spk_mutex;
+    unsigned int spk_enc_gen;
+    u8 spk_block[SPK_BLOCK_BYTES];
+    int spk_fill;                   /* samples in spk_block */
+    int spk_pred, spk_step;         /* ADPCM predictor and step size */
+
+    /*
+     * in-kernel pointer. the settings are sysfs attributes, mode changes go
+     * under ext_lock since they can change the report mode. ptr_lock covers
+     * the integrator state, raw_event and ptr_timer both take it
+     */
+    int ptr_mode;                   /* WII_POINTER_* */
+    int ptr_speed;                  /* px/s when a direction is first held or just past the deadzone */
+    int ptr_accel;                  /* px/s^2 a held direction speeds up by */
+    int ptr_max;                    /* px/s, never faster */
+    int ptr_deadzone;               /* accel counts of tilt that dont move anything */
+    int ptr_invert;                 /* tilt, 1 flips x and 2 flips y */
+    struct input_dev *ptr_rel;      /* registered the first time dpad or tilt is picked, kept till remove */
+    struct input_dev *ptr_abs;      /* same for ir */
+    struct hrtimer ptr_timer;
+    spinlock_t ptr_lock;
+    bool ptr_running;               /* ptr_timer is armed */
+    int ptr_dir[2];                 /* dpad, -1 0 or 1 */
+    int ptr_tilt[2];                /* accel counts off 0g */
+    u64 ptr_held_ns;                /* when the dpad direction last changed, the ramp starts there */
+    u64 ptr_last_ns;                /* last integrator step */
+    s64 ptr_frac[2];                /* what didnt make a whole pixel yet, millipixels */
+
+    /* register reads, raw_event fills these from the 0x21 answer */
+    struct completion read_done;
+    u8 read_buf[16];
+    u8 read_err;
+
+    /* gyro bias in slow mode counts, 24.8 fixed point (no floats in here) */
+    s32 bias_q8[3];
+    u16 prev_gyro[3];
+    u16 prev_accel[3];
+    int still;                      /* samples in a row that looked still */
+};
+
+
+static void wii_release(struct kref *ref)
+{
+    struct wii_remote *wr = container_of(ref, struct wii_remote, ref);
+
+    kfree_rcu(wr, rcu); // /proc may still be looking at it under rcu_read_lock
+}
+
+/* wii_dev with a reference, so it can be held across sleeps. NULL if there isnt one */
+static struct wii_remote *wii_get(void)
+{
+    struct wii_remote *wr;
+
+    rcu_read_lock();
+    wr = rcu_dereference(wii_dev);
+    if (wr && !kref_get_unless_zero(&wr->ref))
+        wr = NULL; // remove already let go of it
+    rcu_read_unlock();
+    return wr;
+}
+
+static void wii_put(struct wii_remote *wr)
+{
+    kref_put(&wr->ref, wii_release);
+}
+
+/*
+ * wii_get() for anything that sends to the remote or queues work that does.
+ * io_lock is held for read till wii_io_put(), remove takes it for write to set
+ * gone before it stops the device, so once hid_hw_stop has run nobody is still
+ * in here with the hid_device. NULL if there is no remote or its going
+ */
+static struct wii_remote *wii_io_get(void)
+{
+    struct wii_remote *wr = wii_get();
+
+    if (!wr)
+        return NULL;
+    down_read(&wr->io_lock);
+    if (wr->gone) {
+        up_read(&wr->io_lock);
+        wii_put(wr);
+        return NULL;
+    }
+    return wr;
+}
 
+static void wii_io_put(struct wii_remote *wr)
+{
+    up_read(&wr->io_lock);
+    wii_put(wr);
+}
 
 static int wii_connected = 0;     /* 1 if connected, 0 if not */
 static int wii_last_battery = -1; /* -1 means unknown */
 static struct proc_dir_entry *wii_proc_entry; // pointer to the wii-remote proc entry
+static unsigned long wii_dropped_bytes = 0; /* bytes thrown away because the buffer was full, under circ_mutex */
+
 
+static void wii_uring_read_tw(struct io_uring_cmd *ioucmd, unsigned int issue_flags);
+
+/* something new went into the text buffer or the record ring */
+static void wii_uring_wake(void)
+{
+    unsigned long flags;
+    int i;
+
+    spin_lock_irqsave(&uring_lock, flags);
+    for (i = 0; i < URING_PARKED_MAX; i++) {
+        if (uring_parked[i]) {
+            io_uring_cmd_complete_in_task(uring_parked[i], wii_uring_read_tw);
+            uring_parked[i] = NULL;
+        }
+    }
+    spin_unlock_irqrestore(&uring_lock, flags);
+}
+
+/* raw_event context, wakes poll() and hands parked uring reads to task work */
+static void wii_events_added(void)
+{
+    wake_up_interruptible_poll(&wii_read_wait, EPOLLIN | EPOLLRDNORM);
+    wii_uring_wake();
+}
 
 static void circ_buffer_write(const char *data, size_t len)
 {
@@ -67,13 +385,100 @@ static void circ_buffer_write(const char *data, size_t len)
     for (i = 0; i < len; i++) {
         int next = (head + 1) % CIRC_BUFFER_SIZE;
         if (next == tail) {
-            printk(KERN_WARNING DRIVER_NAME ": circular buffer full, dropping data\n");
+            printk_ratelimited(KERN_WARNING DRIVER_NAME ": circular buffer full, dropping data\n");
+            wii_dropped_bytes += len - i;
             break;
         }
         circ_buffer[head] = data[i];
         head = next;
     }
     mutex_unlock(&circ_mutex);
+    wii_events_added();
+}
+
+/*
+ * netlink. everything here runs from raw_event or work, so GFP_ATOMIC, and
+ * nothing gets built for a group nobody joined. a listener that falls behind
+ * loses messages (ENOBUFS on its socket), nobody else does
+ */
+#define WII_NL_MSG_SIZE 256       /* the biggest is a motion one, about 100 bytes */
+
+static struct genl_family wii_nl_family;
+
+/* NULL if nobody is listening or its out of memory, otherwise the header is on */
+static struct sk_buff *wii_nl_new(struct wii_remote *wr, int group, u8 cmd, u64 t_ns, void **hdr)
+{
+    struct sk_buff *skb;
+
+    if (!genl_has_listeners(&wii_nl_family, &init_net, group))
+        return NULL;
+    skb = genlmsg_new(WII_NL_MSG_SIZE, GFP_ATOMIC);
+    if (!skb)
+        return NULL;
+    *hdr = genlmsg_put(skb, 0, 0, &wii_nl_family, 0, cmd);
+    if (!*hdr || nla_put_string(skb, WII_NL_A_DEVICE, wr->name) ||
+        nla_put_u64_64bit(skb, WII_NL_A_TIMESTAMP, t_ns, WII_NL_A_PAD)) {
+        nlmsg_free(skb);
+        return NULL;
+    }
+    return skb;
+}
+
+/* err is whether filling it in failed, either way the skb is gone after this */
+static void wii_nl_send(struct sk_buff *skb, void *hdr, int group, int err)
+{
+    if (err) {
+        nlmsg_free(skb);
+        return;
+    }
+    genlmsg_end(skb, hdr);
+    genlmsg_multicast(&wii_nl_family, skb, 0, group, GFP_ATOMIC); // -ESRCH if they all left since, fine
+}
+
+static void wii_nl_buttons(struct wii_remote *wr, u16 buttons)
+{
+    void *hdr;
+    struct sk_buff *skb = wii_nl_new(wr, WII_NL_GRP_BUTTONS, WII_NL_CMD_BUTTONS, ktime_get_ns(), &hdr);
+
+    if (skb)
+        wii_nl_send(skb, hdr, WII_NL_GRP_BUTTONS, nla_put_u16(skb, WII_NL_A_BUTTONS, buttons));
+}
+
+static void wii_nl_motion(struct wii_remote *wr, const struct wii_motion_record *rec)
+{
+    void *hdr;
+    struct sk_buff *skb = wii_nl_new(wr, WII_NL_GRP_MOTION, WII_NL_CMD_MOTION, rec->t_ns, &hdr);
+
+    if (skb)
+        wii_nl_send(skb, hdr, WII_NL_GRP_MOTION, nla_put(skb, WII_NL_A_RECORD, sizeof(*rec), rec));
+}
+
+static int wii_nl_put_status(struct sk_buff *skb, struct wii_remote *wr)
+{
+    int battery = READ_ONCE(wii_last_battery); // byte 6 of the status report, see wii_raw_event
+
+    /* no status report yet, say nothing rather than send a made up level */
+    if (battery >= 0 && nla_put_u8(skb, WII_NL_A_BATTERY, battery))
+        return -EMSGSIZE;
+    return nla_put_u8(skb, WII_NL_A_EXT, READ_ONCE(wr->ext_type));
+}
+
+static void wii_nl_status(struct wii_remote *wr)
+{
+    void *hdr;
+    struct sk_buff *skb = wii_nl_new(wr, WII_NL_GRP_STATUS, WII_NL_CMD_STATUS, ktime_get_ns(), &hdr);
+
+    if (skb)
+        wii_nl_send(skb, hdr, WII_NL_GRP_STATUS, wii_nl_put_status(skb, wr));
+}
+
+static void wii_nl_hotplug(struct wii_remote *wr, bool connected)
+{
+    void *hdr;
+    struct sk_buff *skb = wii_nl_new(wr, WII_NL_GRP_HOTPLUG, WII_NL_CMD_HOTPLUG, ktime_get_ns(), &hdr);
+
+    if (skb)
+        wii_nl_send(skb, hdr, WII_NL_GRP_HOTPLUG, nla_put_u8(skb, WII_NL_A_CONNECTED, connected));
 }
 
 /*
@@ -98,77 +503,1639 @@ static void circ_buffer_write(const char *data, size_t len)
  *            Bit 3: Button 2
  *            Bit 5: Minus Button
  */
-static void perform_input_mapping(const u8 *data, int size)
+static void perform_input_mapping(const u8 *data, int size)
+{
+
+    /*
+     * The output is capped at 256 but this is isnt possible in a single event unless,
+     * a macro is used.
+     * Its just large enough to hold every actual event, the result is truncated regardless
+     * be careful changing this pls because report trunucation will f*ck the userspace
+     * 🙏
+    */
+    char mapping_output[256];
+    int len = 0;
+
+    /* Report has to be 3 bytes or its cooked */
+    if (size < 3) {
+        printk(KERN_WARNING DRIVER_NAME ": Report too short for mapping\n");
+        return;
+    }
+
+    u8 report_id = data[0];
+    u8 btn_byte1 = data[1];
+    u8 btn_byte2 = data[2];
+
+    /* using snprintf here as we need to have buffer safety with the circular buffer
+    other wise id be writing edge cases do not change
+    T= is when we got the report, user space uses it to work out how stale an event is */
+    len += snprintf(mapping_output + len, sizeof(mapping_output) - len,
+                    "Report: ID=%u, T=%llu, ", report_id, (unsigned long long)ktime_get_ns());
+
+    if (btn_byte1 & 0x01)
+        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Dpad_Left");
+    if (btn_byte1 & 0x02)
+        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Dpad_Right ");
+    if (btn_byte1 & 0x04)
+        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Dpad_Down ");
+    if (btn_byte1 & 0x08)
+        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Dpad_Up ");
+    if (btn_byte1 & 0x10)
+        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Plus ");
+
+    if (btn_byte2 & 0x10)
+        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Minus ");
+    if (btn_byte2 & 0x80)
+        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Home ");
+    if (btn_byte2 & 0x01)
+        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "2 ");
+    if (btn_byte2 & 0x02)
+        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "1 ");
+    if (btn_byte2 & 0x04)
+        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "B ");
+    if (btn_byte2 & 0x08)
+        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "A");
+
+    if (len == 0)
+        len = snprintf(mapping_output, sizeof(mapping_output), "No buttons pressed");
+
+    if (len < sizeof(mapping_output) - 1) {
+        mapping_output[len++] = '\n';
+        mapping_output[len] = '\0';
+    }
+    circ_buffer_write(mapping_output, len);
+}
+
+/*
+ * MotionPlus
+ *
+ * The gyro is a separate extension that plugs into the bottom of the remote.
+ * Its dormant at 0xA600xx until you write 0x55 to 0xA600F0 then 0x04 (or 0x05
+ * to pass a nunchuk plugged into it through) to 0xA600FE, then it takes over
+ * the extension bytes at the end of the data reports. We ask for report 0x35
+ * (buttons, accel, 16 extension bytes) continuously at 100Hz.
+ *
+ * The 6 extension bytes are (wiibrew):
+ *   0 yaw<7:0>    3 yaw<13:8>   | yaw slow  | pitch slow
+ *   1 roll<7:0>   4 roll<13:8>  | roll slow | extension plugged in
+ *   2 pitch<7:0>  5 pitch<13:8> | 1 (MotionPlus data) | 0
+ * 8192 is no rotation. slow mode is about 20 counts per deg/s, fast mode is
+ * 2000/440 times coarser, same scaling hid-wiimote uses
+ */
+#define MP_ZERO          8192
+#define MP_MDPS_SLOW     50        /* millidegrees/s per count in slow mode */
+#define MP_FAST_NUM      2000
+#define MP_FAST_DEN      440
+#define MP_MAX_MDPS      (MP_ZERO * MP_MDPS_SLOW * MP_FAST_NUM / MP_FAST_DEN)
+#define MP_STILL_GYRO    16        /* counts of change between samples that still counts as still */
+#define MP_STILL_ACCEL   4
+#define MP_STILL_SAMPLES 50        /* half a second of still before the bias starts moving */
+#define MP_BIAS_SHIFT    6         /* bias moves 1/64 of the way each still sample */
+#define MP_WRITE_GAP_MS  50        /* no waiting for the 0x22 ack, just give it time */
+#define READ_TIMEOUT_MS  500       /* a 0x21 should be back in a few ms */
+
+/*
+ * sends an output report. the interrupt channel is what the remote actually
+ * listens on, raw_request (SET_REPORT on the control channel) is only the
+ * fallback for transports that dont have it.
+ * this can sleep, never call it from raw_event
+ */
+static int wii_send_output(struct hid_device *hdev, const u8 *data, size_t len)
+{
+    struct wii_remote *wr = hid_get_drvdata(hdev);
+    u8 *buf = kmemdup(data, len, GFP_KERNEL); // has to be DMA safe, the stack isnt
+    int ret;
+
+    if (!buf)
+        return -ENOMEM;
+    if (len > 1)
+        buf[1] |= READ_ONCE(wr->rumble); // the motor stops on any report without the bit
+    ret = hid_hw_output_report(hdev, buf, len);
+    if (ret == -ENOSYS)
+        ret = hid_hw_raw_request(hdev, buf[0], buf, len, HID_OUTPUT_REPORT, HID_REQ_SET_REPORT);
+    kfree(buf);
+    return ret < 0 ? ret : 0;
+}
+
+/* output report 0x16, writes up to 16 bytes into the remote's register space */
+static int wii_write_registers(struct hid_device *hdev, u32 addr, const u8 *data, u8 len)
+{
+    u8 req[22] = { 0x16, 0x04, (addr >> 16) & 0xff, (addr >> 8) & 0xff, addr & 0xff, len };
+    int ret;
+
+    memcpy(req + 6, data, min_t(u8, len, 16));
+    ret = wii_send_output(hdev, req, sizeof(req));
+    msleep(MP_WRITE_GAP_MS);
+    return ret;
+}
+
+static int wii_write_register(struct hid_device *hdev, u32 addr, u8 value)
+{
+    return wii_write_registers(hdev, addr, &value, 1);
+}
+
+/*
+ * output report 0x17, reads up to 16 bytes of register space (0x04) or the
+ * EEPROM (0x00). the answer is a 0x21 report that raw_event hands over through
+ * read_done, so only one at a time, callers hold ext_lock. sleeps
+ */
+static int wii_read_memory(struct wii_remote *wr, u8 space, u32 addr, u8 *out, u8 len)
+{
+    u8 req[7] = { 0x17, space, (addr >> 16) & 0xff, (addr >> 8) & 0xff, addr & 0xff, 0, len };
+    int ret;
+
+    reinit_completion(&wr->read_done);
+    ret = wii_send_output(wr->hdev, req, sizeof(req));
+    if (ret)
+        return ret;
+    if (!wait_for_completion_timeout(&wr->read_done, msecs_to_jiffies(READ_TIMEOUT_MS)))
+        return -ETIMEDOUT;
+    if (wr->read_err)
+        return -EIO; // 7 is nothing there, 8 is a write only address
+    memcpy(out, wr->read_buf, len);
+    return 0;
+}
+
+static int wii_read_register(struct wii_remote *wr, u32 addr, u8 *out, u8 len)
+{
+    return wii_read_memory(wr, 0x04, addr, out, len);
+}
+
+/* output report 0x12, which data report the remote sends and if it sends it all the time */
+static int wii_set_report_mode(struct hid_device *hdev, u8 mode, bool continuous)
+{
+    struct wii_remote *wr = hid_get_drvdata(hdev);
+    u8 req[3] = { 0x12, continuous ? 0x04 : 0x00, mode };
+
+    WRITE_ONCE(wr->continuous, continuous);
+    WRITE_ONCE(wr->report_mode, mode);
+    return wii_send_output(hdev, req, sizeof(req));
+}
+
+/*
+ * the report mode with nothing in the extension port. the pointer needs accel
+ * (tilt) or the camera (ir) on top of the buttons, continuous so it gets the full rate
+ */
+static int wii_set_base_report_mode(struct hid_device *hdev)
+{
+    struct wii_remote *wr = hid_get_drvdata(hdev);
+
+    switch (READ_ONCE(wr->ptr_mode)) {
+    case WII_POINTER_TILT: return wii_set_report_mode(hdev, 0x31, true);
+    case WII_POINTER_IR:   return wii_set_report_mode(hdev, 0x33, true);
+    default:               return wii_set_report_mode(hdev, 0x30, false);
+    }
+}
+
+static void wii_motionplus_work(struct work_struct *work)
+{
+    struct wii_remote *wr = container_of(work, struct wii_remote, mp_work);
+    struct hid_device *hdev = wr->hdev;
+    int mode = READ_ONCE(wr->mp_mode);
+    int ret;
+
+    mutex_lock(&wr->ext_lock);
+    if (mode == WII_MP_OFF) {
+        /* 0x55 to 0xA400F0 puts an active MotionPlus back to sleep */
+        ret = wii_write_register(hdev, 0xa400f0, 0x55);
+        if (!ret)
+            ret = wii_set_base_report_mode(hdev);
+    } else {
+        ret = wii_write_register(hdev, 0xa600f0, 0x55);
+        if (!ret)
+            ret = wii_write_register(hdev, 0xa600fe, mode == WII_MP_NUNCHUK ? 0x05 : 0x04);
+        if (!ret)
+            ret = wii_set_report_mode(hdev, 0x35, true);
+    }
+    mutex_unlock(&wr->ext_lock);
+    if (ret)
+        hid_err(hdev, "MotionPlus %s failed: %d\n", mode == WII_MP_OFF ? "off" : "init", ret);
+    else
+        hid_info(hdev, "MotionPlus %s\n", mode == WII_MP_OFF ? "off" :
+                 mode == WII_MP_NUNCHUK ? "on with nunchuk passthrough" : "on");
+}
+
+/*
+ * Speaker
+ *
+ * Setup (wiibrew): 0x14 0x04 turns it on, 0x19 0x04 mutes it, 0x01 to 0xA20009,
+ * 0x08 to 0xA20001, then the 7 byte config at 0xA20001:
+ *   00 FF RR RR VV 00 00
+ * FF is 0x00 for ADPCM or 0x40 for 8 bit PCM, RR is 6MHz (ADPCM) or 12MHz
+ * (PCM) over the sample rate, little endian, VV the volume. 0x01 to 0xA20008
+ * and 0x19 0x00 to unmute and its ready. Audio goes out in 0x18 reports, byte
+ * 1 is the length << 3 and 20 bytes of samples follow.
+ *
+ * The remote has next to no buffer, a report has to come every 40 (ADPCM) or
+ * 20 (PCM) samples, no sooner and no later, so writes only fill a queue and an
+ * hrtimer lets one report go per period. Sending can sleep so the timer only
+ * moves spk_due on and spk_send_work does the sending, from the highpri
+ * workqueue so it isnt stuck behind anything. hrtimer_forward_now keeps the
+ * cadence off the clock, a late tick doesnt push the ones after it back.
+ * The timer never touches circ_mutex or anything else that sleeps.
+ */
+static int spk_samples_per_block(int format)
+{
+    return format == WII_SPEAKER_ADPCM ? SPK_BLOCK_BYTES * 2 : SPK_BLOCK_BYTES;
+}
+
+static enum hrtimer_restart wii_speaker_tick(struct hrtimer *timer)
+{
+    struct wii_remote *wr = container_of(timer, struct wii_remote, spk_timer);
+    bool release = false, stop = false;
+
+    spin_lock(&wr->spk_lock);
+    if (wr->spk_due != wr->spk_head) {
+        wr->spk_due++;
+        release = true;
+        if (wr->spk_starved)
+            wr->spk_underruns++; // went dry mid sound, the writer didnt keep up
+        wr->spk_starved = 0;
+    } else if (++wr->spk_starved >= SPK_IDLE_TICKS) {
+        /* nothing for a while, its finished not starved. the next write starts us again */
+        wr->spk_starved = 0;
+        wr->spk_running = false;
+        stop = true;
+    }
+    spin_unlock(&wr->spk_lock);
+
+    if (release)
+        queue_work(system_highpri_wq, &wr->spk_send_work);
+    if (stop)
+        return HRTIMER_NORESTART;
+    hrtimer_forward_now(timer, wr->spk_period);
+    return HRTIMER_RESTART;
+}
+
+static void wii_speaker_send_work(struct work_struct *work)
+{
+    struct wii_remote *wr = container_of(work, struct wii_remote, spk_send_work);
+    int ret;
+
+    for (;;) {
+        spin_lock_irq(&wr->spk_lock);
+        if (wr->spk_tail == wr->spk_due) {
+            spin_unlock_irq(&wr->spk_lock);
+            break;
+        }
+        memcpy(wr->spk_report + 2, wr->spk_queue[wr->spk_tail % SPK_QUEUE_BLOCKS], SPK_BLOCK_BYTES);
+        wr->spk_tail++;
+        wr->spk_sent++;
+        spin_unlock_irq(&wr->spk_lock);
+        wake_up_interruptible(&wr->spk_wait);
+
+        wr->spk_report[0] = 0x18;
+        wr->spk_report[1] = SPK_BLOCK_BYTES << 3 | READ_ONCE(wr->rumble);
+        ret = hid_hw_output_report(wr->hdev, wr->spk_report, SPK_REPORT_BYTES);
+        if (ret < 0)
+            hid_dbg(wr->hdev, "speaker report failed: %d\n", ret);
+    }
+}
+
+/* stops the timer and drops whatever is queued, writers wait until spk_ready again */
+static void wii_speaker_stop(struct wii_remote *wr)
+{
+    /* not ready first, so a write cant start the timer again behind the cancel */
+    spin_lock_irq(&wr->spk_lock);
+    wr->spk_ready = false;
+    spin_unlock_irq(&wr->spk_lock);
+    hrtimer_cancel(&wr->spk_timer);
+    cancel_work_sync(&wr->spk_send_work);
+    spin_lock_irq(&wr->spk_lock);
+    wr->spk_running = false;
+    wr->spk_head = wr->spk_due = wr->spk_tail = 0;
+    wr->spk_starved = 0;
+    spin_unlock_irq(&wr->spk_lock);
+}
+
+static void wii_speaker_work(struct work_struct *work)
+{
+    struct wii_remote *wr = container_of(work, struct wii_remote, spk_work);
+    struct hid_device *hdev = wr->hdev;
+    struct wii_speaker_config cfg;
+    int ret;
+
+    spin_lock_irq(&wr->spk_lock);
+    cfg = wr->spk_cfg;
+    spin_unlock_irq(&wr->spk_lock);
+    wii_speaker_stop(wr);
+
+    mutex_lock(&wr->ext_lock);
+    if (cfg.format == WII_SPEAKER_OFF) {
+        u8 mute[2] = { 0x19, 0x04 }, off[2] = { 0x14, 0x00 };
+
+        ret = wii_send_output(hdev, mute, sizeof(mute));
+        if (!ret)
+            ret = wii_send_output(hdev, off, sizeof(off));
+    } else {
+        u8 on[2] = { 0x14, 0x04 }, mute[2] = { 0x19, 0x04 }, unmute[2] = { 0x19, 0x00 };
+        u16 div = (cfg.format == WII_SPEAKER_ADPCM ? 6000000 : 12000000) / cfg.rate;
+        u8 conf[7] = { 0x00, cfg.format == WII_SPEAKER_ADPCM ? 0x00 : 0x40,
+                       div & 0xff, div >> 8, cfg.volume, 0x00, 0x00 };
+
+        ret = wii_send_output(hdev, on, sizeof(on));
+        if (!ret)
+            ret = wii_send_output(hdev, mute, sizeof(mute));
+        if (!ret)
+            ret = wii_write_register(hdev, 0xa20009, 0x01);
+        if (!ret)
+            ret = wii_write_register(hdev, 0xa20001, 0x08);
+        if (!ret)
+            ret = wii_write_registers(hdev, 0xa20001, conf, sizeof(conf));
+        if (!ret)
+            ret = wii_write_register(hdev, 0xa20008, 0x01);
+        if (!ret)
+            ret = wii_send_output(hdev, unmute, sizeof(unmute));
+    }
+    mutex_unlock(&wr->ext_lock);
+
+    spin_lock_irq(&wr->spk_lock);
+    /* only if nobody asked for something else while we were at it, that ones work is queued */
+    if (!ret && cfg.format != WII_SPEAKER_OFF && !memcmp(&cfg, &wr->spk_cfg, sizeof(cfg))) {
+        wr->spk_period = ns_to_ktime(div_u64((u64)spk_samples_per_block(cfg.format) * NSEC_PER_SEC,
+                                             cfg.rate));
+        wr->spk_head = wr->spk_due = wr->spk_tail = 0; // anything a writer got in during setup is stale
+        wr->spk_gen++;
+        wr->spk_ready = true;
+    }
+    spin_unlock_irq(&wr->spk_lock);
+    wake_up_interruptible(&wr->spk_wait);
+
+    if (ret)
+        hid_err(hdev, "speaker setup failed: %d\n", ret);
+    else
+        hid_info(hdev, "speaker %s\n", cfg.format == WII_SPEAKER_OFF ? "off" :
+                 cfg.format == WII_SPEAKER_ADPCM ? "on, adpcm" : "on, pcm8");
+}
+
+/* Yamaha ADPCM, same tables and rounding as ffmpeg's adpcm_yamaha */
+static const int adpcm_scale[8] = { 230, 230, 230, 230, 307, 409, 512, 614 };
+
+static u8 adpcm_encode(struct wii_remote *wr, int sample)
+{
+    int delta = sample - wr->spk_pred;
+    int nibble = min(7, abs(delta) * 4 / wr->spk_step);
+    int diff = wr->spk_step * (2 * nibble + 1) / 8;
+
+    wr->spk_pred = clamp(wr->spk_pred + (delta < 0 ? -diff : diff), -32768, 32767);
+    wr->spk_step = clamp((wr->spk_step * adpcm_scale[nibble]) >> 8, 127, 24576);
+    return nibble | (delta < 0 ? 0x08 : 0);
+}
+
+/* hands the full spk_block to the queue, the caller made sure there is room */
+static void wii_speaker_push(struct wii_remote *wr)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&wr->spk_lock, flags);
+    memcpy(wr->spk_queue[wr->spk_head % SPK_QUEUE_BLOCKS], wr->spk_block, SPK_BLOCK_BYTES);
+    wr->spk_head++;
+    /*
+     * started under the lock, remove clears spk_ready under it too and then
+     * cancels, so a timer can never be started after that cancel
+     */
+    if (wr->spk_ready && !wr->spk_running) {
+        wr->spk_running = true;
+        hrtimer_start(&wr->spk_timer, wr->spk_period, HRTIMER_MODE_REL);
+    }
+    spin_unlock_irqrestore(&wr->spk_lock, flags);
+    wr->spk_fill = 0;
+}
+
+static unsigned int spk_room(struct wii_remote *wr)
+{
+    return SPK_QUEUE_BLOCKS - (READ_ONCE(wr->spk_head) - READ_ONCE(wr->spk_tail));
+}
+
+/* until the speaker is set up and theres room for a report, 0 or why not */
+static int wii_speaker_wait(struct wii_remote *wr, struct file *file)
+{
+    for (;;) {
+        if (READ_ONCE(wr->spk_cfg.format) == WII_SPEAKER_OFF)
+            return -EIO; // WIIMOTE_IOCTL_SET_SPEAKER first
+        if (READ_ONCE(wr->spk_ready) && spk_room(wr))
+            return 0;
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(wr->spk_wait,
+                                     READ_ONCE(wr->spk_cfg.format) == WII_SPEAKER_OFF ||
+                                     (READ_ONCE(wr->spk_ready) && spk_room(wr))))
+            return -ERESTARTSYS;
+    }
+}
+
+/* write(): 16 bit samples in, encoded into spk_block a chunk at a time, never more than fits */
+static ssize_t wii_speaker_write(struct wii_remote *wr, struct file *file,
+                                 const char __user *buf, size_t count)
+{
+    s16 pcm[64];
+    size_t done = 0;
+    int ret = 0;
+
+    if (mutex_lock_interruptible(&wr->spk_mutex))
+        return -ERESTARTSYS;
+    count &= ~(size_t)1; // whole samples only
+    while (done < count) {
+        int format, per_block, room, i, n;
+
+        ret = wii_speaker_wait(wr, file);
+        if (ret)
+            break;
+        if (wr->spk_enc_gen != READ_ONCE(wr->spk_gen)) {
+            wr->spk_enc_gen = READ_ONCE(wr->spk_gen);
+            wr->spk_fill = 0;
+            wr->spk_pred = 0;
+            wr->spk_step = 127;
+        }
+        format = READ_ONCE(wr->spk_cfg.format);
+        per_block = spk_samples_per_block(format);
+        room = spk_room(wr) * per_block - wr->spk_fill;
+        n = min_t(size_t, (count - done) / 2, min_t(int, room, ARRAY_SIZE(pcm)));
+        if (copy_from_user(pcm, buf + done, n * 2)) {
+            ret = -EFAULT;
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            int f = wr->spk_fill;
+
+            if (format == WII_SPEAKER_ADPCM) {
+                /* two samples a byte, the first in the high nibble */
+                u8 nib = adpcm_encode(wr, pcm[i]);
+                wr->spk_block[f / 2] = f & 1 ? (wr->spk_block[f / 2] | nib) : nib << 4;
+            } else {
+                wr->spk_block[f] = (u8)(pcm[i] >> 8);
+            }
+            if (++wr->spk_fill == per_block)
+                wii_speaker_push(wr);
+        }
+        done += n * 2;
+    }
+    mutex_unlock(&wr->spk_mutex);
+    return done ? done : ret;
+}
+
+/*
+ * Extensions
+ *
+ * Writing 0x55 to 0xA400F0 then 0x00 to 0xA400FB turns on an extension with
+ * its data unencrypted, then the 6 byte id at 0xA400FA says what it is:
+ *   00 00 A4 20 00 00  nunchuk
+ *   00 00 A4 20 01 01  classic controller
+ *   01 00 A4 20 01 01  classic controller pro
+ *   00 00 A4 20 04 02  balance board
+ * The remote sends a status report (0x20) whenever something is plugged in or
+ * pulled out, and stops sending data reports until the report mode is set again.
+ */
+static const char *wii_ext_name(int type)
+{
+    switch (type) {
+    case WII_EXT_NUNCHUK:     return "nunchuk";
+    case WII_EXT_CLASSIC:     return "classic controller";
+    case WII_EXT_CLASSIC_PRO: return "classic controller pro";
+    case WII_EXT_MOTIONPLUS:  return "motionplus";
+    case WII_EXT_BALANCE_BOARD: return "balance board";
+    case WII_EXT_UNKNOWN:     return "unknown";
+    default:                  return "none";
+    }
+}
+
+static int wii_ext_identify(const u8 id[6])
+{
+    if (id[2] != 0xa4 || id[3] != 0x20)
+        return WII_EXT_UNKNOWN;
+    if (id[4] == 0x00 && id[5] == 0x00)
+        return WII_EXT_NUNCHUK;
+    if (id[4] == 0x01 && id[5] == 0x01)
+        return id[0] == 0x01 ? WII_EXT_CLASSIC_PRO : WII_EXT_CLASSIC;
+    if (id[4] == 0x04 && id[5] == 0x02)
+        return WII_EXT_BALANCE_BOARD;
+    return WII_EXT_UNKNOWN;
+}
+
+static struct input_dev *wii_classic_create(struct hid_device *hdev);
+static struct input_dev *wii_board_create(struct hid_device *hdev);
+static int wii_board_calibrate(struct wii_remote *wr);
+
+static void wii_extension_work(struct work_struct *work)
+{
+    struct wii_remote *wr = container_of(work, struct wii_remote, ext_work);
+    struct hid_device *hdev = wr->hdev;
+    int type = WII_EXT_NONE;
+    u8 id[6];
+    int ret = 0;
+
+    mutex_lock(&wr->ext_lock);
+    /* remove already started, dont talk to it or make input devices nobody will tear down */
+    if (READ_ONCE(wr->gone))
+        goto out;
+    if (READ_ONCE(wr->mp_mode) != WII_MP_OFF) {
+        /* the MotionPlus owns the port, but the status report still stopped the data so ask again */
+        ret = wii_set_report_mode(hdev, 0x35, true);
+        goto out;
+    }
+
+    if (READ_ONCE(wr->ext_plugged)) {
+        ret = wii_write_register(hdev, 0xa400f0, 0x55);
+        if (!ret)
+            ret = wii_write_register(hdev, 0xa400fb, 0x00);
+        if (!ret)
+            ret = wii_read_register(wr, 0xa400fa, id, sizeof(id));
+        if (ret)
+            goto out;
+        type = wii_ext_identify(id);
+        if (type == WII_EXT_BALANCE_BOARD)
+            ret = wii_board_calibrate(wr);
+        if (ret)
+            goto out;
+    }
+
+    if ((type == WII_EXT_CLASSIC || type == WII_EXT_CLASSIC_PRO) && !wr->classic) {
+        struct input_dev *in = wii_classic_create(hdev);
+        if (!in)
+            hid_warn(hdev, "no classic controller input device, records still work\n");
+        WRITE_ONCE(wr->classic, in);
+    }
+    if (type == WII_EXT_BALANCE_BOARD && !wr->board) {
+        struct input_dev *in = wii_board_create(hdev);
+        if (!in)
+            hid_warn(hdev, "no balance board input device\n");
+        WRITE_ONCE(wr->board, in);
+    }
+    WRITE_ONCE(wr->ext_type, type);
+
+    /*
+     * the classic and the board have no use for accel, 0x32 is buttons + 8 extension
+     * bytes and nothing else (the board's 4 sensors are exactly 8 bytes)
+     */
+    if (type == WII_EXT_CLASSIC || type == WII_EXT_CLASSIC_PRO || type == WII_EXT_BALANCE_BOARD)
+        ret = wii_set_report_mode(hdev, 0x32, true);
+    else if (type == WII_EXT_NUNCHUK)
+        ret = wii_set_report_mode(hdev, 0x35, true);
+    else
+        ret = wii_set_base_report_mode(hdev);
+    hid_info(hdev, "extension: %s\n", wii_ext_name(type));
+    wii_nl_status(wr);
+out:
+    mutex_unlock(&wr->ext_lock);
+    if (ret)
+        hid_err(hdev, "extension setup failed: %d\n", ret);
+}
+
+/*
+ * the 6 classic bytes (wiibrew, unencrypted):
+ *   0  RX<4:3> LX<5:0>
+ *   1  RX<2:1> LY<5:0>
+ *   2  RX<0> LT<4:3> RY<4:0>
+ *   3  LT<2:0> RT<4:0>
+ *   4, 5 buttons, active low, see WII_CLASSIC_*
+ */
+static void wii_classic_decode(const u8 *ext, struct wii_motion_record *rec)
+{
+    rec->stick[0] = ext[0] & 0x3f;
+    rec->stick[1] = ext[1] & 0x3f;
+    rec->right_stick[0] = ((ext[0] & 0xc0) >> 3) | ((ext[1] & 0xc0) >> 5) | (ext[2] >> 7);
+    rec->right_stick[1] = ext[2] & 0x1f;
+    rec->trigger[0] = ((ext[2] & 0x60) >> 2) | (ext[3] >> 5);
+    rec->trigger[1] = ext[3] & 0x1f;
+    rec->ext_buttons = ~(ext[4] | (ext[5] << 8)) & WII_CLASSIC_MASK;
+}
+
+static const struct {
+    u16 bit;
+    u16 code;
+} classic_keys[] = {
+    { WII_CLASSIC_UP,    BTN_DPAD_UP },
+    { WII_CLASSIC_DOWN,  BTN_DPAD_DOWN },
+    { WII_CLASSIC_LEFT,  BTN_DPAD_LEFT },
+    { WII_CLASSIC_RIGHT, BTN_DPAD_RIGHT },
+    { WII_CLASSIC_A,     BTN_EAST },     // by position, the way Documentation/input/gamepad.rst wants
+    { WII_CLASSIC_B,     BTN_SOUTH },
+    { WII_CLASSIC_X,     BTN_NORTH },
+    { WII_CLASSIC_Y,     BTN_WEST },
+    { WII_CLASSIC_L,     BTN_TL },
+    { WII_CLASSIC_R,     BTN_TR },
+    { WII_CLASSIC_ZL,    BTN_TL2 },
+    { WII_CLASSIC_ZR,    BTN_TR2 },
+    { WII_CLASSIC_PLUS,  BTN_START },
+    { WII_CLASSIC_MINUS, BTN_SELECT },
+    { WII_CLASSIC_HOME,  BTN_MODE },
+};
+
+static void wii_classic_input(struct input_dev *in, const struct wii_motion_record *rec)
+{
+    int i;
+
+    /* the controller has up as high, input wants down as high */
+    input_report_abs(in, ABS_X, rec->stick[0]);
+    input_report_abs(in, ABS_Y, 63 - rec->stick[1]);
+    input_report_abs(in, ABS_RX, rec->right_stick[0]);
+    input_report_abs(in, ABS_RY, 31 - rec->right_stick[1]);
+    input_report_abs(in, ABS_HAT2Y, rec->trigger[0]);
+    input_report_abs(in, ABS_HAT2X, rec->trigger[1]);
+    for (i = 0; i < ARRAY_SIZE(classic_keys); i++)
+        input_report_key(in, classic_keys[i].code, rec->ext_buttons & classic_keys[i].bit);
+    input_event(in, EV_MSC, MSC_TIMESTAMP, (u32)div_u64(rec->t_ns, 1000));
+    input_sync(in);
+}
+
+/*
+ * Balance board
+ *
+ * The extension bytes are four big endian 16 bit load sensor readings, top
+ * right, bottom right, top left, bottom left. Calibration is 24 bytes at
+ * 0xA40024: what each sensor (same order) reads at 0kg, then at 17kg, then at
+ * 34kg. Weights go out in 10g units like hid-wiimote does, straight line
+ * between the two calibration points either side of the reading, integer only.
+ */
+#define BOARD_TR 0
+#define BOARD_BR 1
+#define BOARD_TL 2
+#define BOARD_BL 3
+#define BOARD_17KG       1700      /* 10g units */
+#define BOARD_HALF_X     2165      /* sensor spacing 433 x 238mm, half of it in 0.1mm */
+#define BOARD_HALF_Y     1190
+#define BOARD_MIN_WEIGHT 200       /* under 2kg the centre of pressure is just noise, report 0,0 */
+
+static int wii_board_calibrate(struct wii_remote *wr)
+{
+    u8 cal[24];
+    int ret, s, k;
+
+    ret = wii_read_register(wr, 0xa40024, cal, 16);
+    if (!ret)
+        ret = wii_read_register(wr, 0xa40034, cal + 16, 8);
+    if (ret)
+        return ret;
+    for (k = 0; k < 3; k++)
+        for (s = 0; s < 4; s++)
+            wr->board_cal[s][k] = (cal[k * 8 + s * 2] << 8) | cal[k * 8 + s * 2 + 1];
+    return 0;
+}
+
+static int board_weight(const u16 cal[3], u16 raw)
+{
+    int w;
+
+    if (raw < cal[1])
+        w = cal[1] > cal[0] ? BOARD_17KG * ((int)raw - cal[0]) / (cal[1] - cal[0]) : 0;
+    else
+        w = cal[2] > cal[1] ?
+            BOARD_17KG + BOARD_17KG * ((int)raw - cal[1]) / (cal[2] - cal[1]) : BOARD_17KG;
+    return max(w, 0); // a sensor reading under its 0kg point is still nothing on it
+}
+
+/* raw_event context, straight to input events, no record */
+static void wii_board_report(struct wii_remote *wr, const u8 *ext, u64 t_ns)
+{
+    struct input_dev *in = READ_ONCE(wr->board);
+    int w[4], total, x = 0, y = 0, s;
+
+    if (!in)
+        return;
+    for (s = 0; s < 4; s++)
+        w[s] = board_weight(wr->board_cal[s], (ext[s * 2] << 8) | ext[s * 2 + 1]);
+    total = w[BOARD_TR] + w[BOARD_BR] + w[BOARD_TL] + w[BOARD_BL];
+    if (total >= BOARD_MIN_WEIGHT) {
+        /* right minus left and back minus front, so +y is towards the user like a screen */
+        x = BOARD_HALF_X * (w[BOARD_TR] + w[BOARD_BR] - w[BOARD_TL] - w[BOARD_BL]) / total;
+        y = BOARD_HALF_Y * (w[BOARD_BR] + w[BOARD_BL] - w[BOARD_TR] - w[BOARD_TL]) / total;
+    }
+
+    input_report_abs(in, ABS_HAT0X, w[BOARD_TR]);
+    input_report_abs(in, ABS_HAT0Y, w[BOARD_BR]);
+    input_report_abs(in, ABS_HAT1X, w[BOARD_TL]);
+    input_report_abs(in, ABS_HAT1Y, w[BOARD_BL]);
+    input_report_abs(in, ABS_X, x);
+    input_report_abs(in, ABS_Y, y);
+    input_event(in, EV_MSC, MSC_TIMESTAMP, (u32)div_u64(t_ns, 1000));
+    input_sync(in);
+}
+
+static void record_push(const struct wii_motion_record *rec)
+{
+    unsigned long flags;
+    unsigned int next;
+
+    spin_lock_irqsave(&record_lock, flags);
+    next = (record_head + 1) % RECORD_RING_SIZE;
+    if (next == record_tail) {
+        wii_dropped_records++;
+    } else {
+        record_ring[record_head] = *rec;
+        record_head = next;
+    }
+    spin_unlock_irqrestore(&record_lock, flags);
+    wii_events_added();
+}
+
+/*
+ * the remote isnt moving if neither the gyro nor the accel changed more than
+ * noise for MP_STILL_SAMPLES in a row, and only then does the bias move towards
+ * what the gyro reads. raw has to be slow mode counts
+ */
+static bool mp_track_bias(struct wii_remote *wr, const u16 raw[3], const u16 accel[3])
+{
+    bool still = true;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (abs((int)raw[i] - (int)wr->prev_gyro[i]) > MP_STILL_GYRO ||
+            abs((int)accel[i] - (int)wr->prev_accel[i]) > MP_STILL_ACCEL)
+            still = false;
+        wr->prev_gyro[i] = raw[i];
+        wr->prev_accel[i] = accel[i];
+    }
+    if (!still) {
+        wr->still = 0;
+        return false;
+    }
+    if (++wr->still < MP_STILL_SAMPLES)
+        return false;
+
+    for (i = 0; i < 3; i++)
+        wr->bias_q8[i] += (((s32)raw[i] << 8) - wr->bias_q8[i]) >> MP_BIAS_SHIFT;
+    return true;
+}
+
+/* raw counts to millidegrees/s with the bias off, fast mode bias is the slow one scaled down */
+static s32 mp_rate(const struct wii_remote *wr, int axis, u16 raw, bool slow)
+{
+    s32 bias = wr->bias_q8[axis] >> 8;
+
+    if (slow)
+        return ((s32)raw - bias) * MP_MDPS_SLOW;
+    bias = MP_ZERO + (bias - MP_ZERO) * MP_FAST_DEN / MP_FAST_NUM;
+    return ((s32)raw - bias) * MP_MDPS_SLOW * MP_FAST_NUM / MP_FAST_DEN;
+}
+
+/*
+ * anything with accel or a known extension in it turns into a record and
+ * input events. raw_event context, no sleeping
+ */
+static void wii_motion_report(struct wii_remote *wr, const u8 *data, int size)
+{
+    struct wii_motion_record rec = { .t_ns = ktime_get_ns(), .report_id = data[0] };
+    int ext_type = READ_ONCE(wr->ext_type);
+    struct input_dev *classic;
+    const u8 *ext = NULL;
+    bool accel = true;
+    int i;
+
+    switch (data[0]) {
+    case 0x31: case 0x33: /* accel, accel + IR, no extension bytes */
+        if (size < 6)
+            return;
+        break;
+    case 0x32: /* buttons + 8 extension bytes, what the classic controller runs on */
+        if (size < 11) /* the board reads all 8 */
+            return;
+        ext = data + 3;
+        accel = false;
+        break;
+    case 0x34: /* buttons + 19 extension bytes */
+        if (size < 22)
+            return;
+        ext = data + 3;
+        accel = false;
+        break;
+    case 0x35: /* accel + 16 extension bytes */
+        if (size < 12)
+            return;
+        ext = data + 6;
+        break;
+    case 0x37: /* accel + 10 IR + 6 extension bytes */
+        if (size < 22)
+            return;
+        ext = data + 16;
+        break;
+    default:
+        return;
+    }
+
+    if (ext && wr->mp_mode == WII_MP_OFF && ext_type == WII_EXT_BALANCE_BOARD) {
+        /* nothing in a board report a record reader could use, keep it short */
+        wii_board_report(wr, ext, rec.t_ns);
+        return;
+    }
+
+    rec.buttons = data[1] | (data[2] << 8);
+    if (accel) {
+        /* same bits as wii_report_accel() in user space */
+        rec.accel[0] = (data[3] << 2) | ((data[1] >> 5) & 0x3);
+        rec.accel[1] = (data[4] << 2) | ((data[2] >> 4) & 0x2);
+        rec.accel[2] = (data[5] << 2) | ((data[2] >> 5) & 0x2);
+    }
+
+    if (ext && wr->mp_mode != WII_MP_OFF && (ext[5] & 0x02)) {
+        /* MotionPlus data. wiibrew order is yaw, roll, pitch, ours is x pitch, y roll, z yaw */
+        u16 yaw = ext[0] | ((ext[3] & 0xfc) << 6);
+        u16 roll = ext[1] | ((ext[4] & 0xfc) << 6);
+        u16 pitch = ext[2] | ((ext[5] & 0xfc) << 6);
+        u16 raw[3] = { pitch, roll, yaw };
+        bool slow[3] = { ext[3] & 0x01, ext[4] & 0x02, ext[3] & 0x02 };
+
+        rec.flags |= WII_MOTION_GYRO;
+        rec.ext = WII_EXT_MOTIONPLUS;
+        /* fast mode on any axis means its being swung about, not still */
+        if (slow[0] && slow[1] && slow[2]) {
+            if (mp_track_bias(wr, raw, rec.accel))
+                rec.flags |= WII_MOTION_STILL;
+        } else {
+            wr->still = 0;
+        }
+        for (i = 0; i < 3; i++) {
+            rec.gyro[i] = mp_rate(wr, i, raw[i], slow[i]);
+            if (slow[i])
+                rec.flags |= WII_MOTION_SLOW_X << i;
+        }
+    } else if (ext && wr->mp_mode == WII_MP_NUNCHUK) {
+        /* passthrough nunchuk: stick in 0/1, C and Z are active low in byte 5 */
+        rec.flags |= WII_MOTION_NUNCHUK;
+        rec.ext = WII_EXT_NUNCHUK;
+        rec.stick[0] = ext[0];
+        rec.stick[1] = ext[1];
+        if (!(ext[5] & 0x08))
+            rec.flags |= WII_MOTION_C;
+        if (!(ext[5] & 0x04))
+            rec.flags |= WII_MOTION_Z;
+    } else if (ext && wr->mp_mode == WII_MP_OFF &&
+               (ext_type == WII_EXT_CLASSIC || ext_type == WII_EXT_CLASSIC_PRO)) {
+        wii_classic_decode(ext, &rec);
+        rec.ext = ext_type;
+    } else if (ext && wr->mp_mode == WII_MP_OFF && ext_type == WII_EXT_NUNCHUK) {
+        /* nunchuk on its own: C and Z are the low two bits of byte 5, still active low */
+        rec.flags |= WII_MOTION_NUNCHUK;
+        rec.ext = WII_EXT_NUNCHUK;
+        rec.stick[0] = ext[0];
+        rec.stick[1] = ext[1];
+        if (!(ext[5] & 0x02))
+            rec.flags |= WII_MOTION_C;
+        if (!(ext[5] & 0x01))
+            rec.flags |= WII_MOTION_Z;
+    }
+
+    if (!accel && rec.ext == WII_EXT_NONE)
+        return; // nothing in it a record reader could use
+    record_push(&rec);
+    wii_nl_motion(wr, &rec);
+
+    classic = READ_ONCE(wr->classic);
+    if (classic && (rec.ext == WII_EXT_CLASSIC || rec.ext == WII_EXT_CLASSIC_PRO))
+        wii_classic_input(classic, &rec);
+
+    if (!wr->motion || !accel)
+        return;
+    input_report_abs(wr->motion, ABS_X, rec.accel[0]);
+    input_report_abs(wr->motion, ABS_Y, rec.accel[1]);
+    input_report_abs(wr->motion, ABS_Z, rec.accel[2]);
+    if (rec.flags & WII_MOTION_GYRO) {
+        input_report_abs(wr->motion, ABS_RX, rec.gyro[0]);
+        input_report_abs(wr->motion, ABS_RY, rec.gyro[1]);
+        input_report_abs(wr->motion, ABS_RZ, rec.gyro[2]);
+    }
+    if (rec.flags & WII_MOTION_NUNCHUK) {
+        input_report_abs(wr->motion, ABS_HAT0X, rec.stick[0]);
+        input_report_abs(wr->motion, ABS_HAT0Y, rec.stick[1]);
+        input_report_key(wr->motion, BTN_C, !!(rec.flags & WII_MOTION_C));
+        input_report_key(wr->motion, BTN_Z, !!(rec.flags & WII_MOTION_Z));
+    }
+    /* us, wraps every 71 minutes, readers only care about the difference */
+    input_event(wr->motion, EV_MSC, MSC_TIMESTAMP, (u32)div_u64(rec.t_ns, 1000));
+    input_sync(wr->motion);
+}
+
+/*
+ * what each button bit is until someone changes it, the same codes hid-wiimote
+ * uses. scancode is the bit, so EVIOCSKEYCODE with 11 remaps A. the spare bits
+ * are accel, KEY_RESERVED and nothing goes out for them
+ */
+static const u16 wii_default_keymap[WII_KEYMAP_SIZE] = {
+    [0]  = KEY_LEFT,
+    [1]  = KEY_RIGHT,
+    [2]  = KEY_DOWN,
+    [3]  = KEY_UP,
+    [4]  = KEY_NEXT,            /* plus */
+    [8]  = BTN_2,
+    [9]  = BTN_1,
+    [10] = BTN_B,
+    [11] = BTN_A,
+    [12] = KEY_PREVIOUS,        /* minus */
+    [15] = BTN_MODE,            /* home */
+};
+
+/*
+ * Chords
+ *
+ * A chord matches when exactly its buttons are held, no more, so one compare
+ * per chord on a button change and never two matching at once. That means one
+ * hrtimer covers every hold: it is started when a chord with hold_ms starts
+ * matching and if the buttons change before it fires chord_pending is cleared
+ * and it does nothing. The key goes down when the chord fires and up as soon
+ * as the buttons stop matching. The buttons keep sending their own keys too.
+ */
+static void wii_chord_update(struct wii_remote *wr, struct input_dev *in, u16 buttons)
+{
+    unsigned long flags;
+    int i, match = -1;
+    u16 hold = 0;
+
+    spin_lock_irqsave(&wr->chord_lock, flags);
+    for (i = 0; i < wr->chord_count; i++) {
+        if (wr->chords[i].buttons == buttons) {
+            match = i;
+            break;
+        }
+    }
+    if (wr->chord_active >= 0 && wr->chord_active != match) {
+        input_report_key(in, wr->chords[wr->chord_active].code, 0);
+        wr->chord_active = -1;
+    }
+    if (wr->chord_pending != match)
+        wr->chord_pending = -1; // let go too early, the timer finds nothing
+    if (match >= 0 && match != wr->chord_active && match != wr->chord_pending) {
+        hold = wr->chords[match].hold_ms;
+        if (hold) {
+            wr->chord_pending = match;
+        } else {
+            input_report_key(in, wr->chords[match].code, 1);
+            wr->chord_active = match;
+        }
+    }
+    spin_unlock_irqrestore(&wr->chord_lock, flags);
+    if (hold)
+        hrtimer_start(&wr->chord_timer, ms_to_ktime(hold), HRTIMER_MODE_REL);
+}
+
+static enum hrtimer_restart wii_chord_tick(struct hrtimer *timer)
+{
+    struct wii_remote *wr = container_of(timer, struct wii_remote, chord_timer);
+
+    spin_lock(&wr->chord_lock);
+    if (wr->chord_pending >= 0 && wr->keys) {
+        wr->chord_active = wr->chord_pending;
+        wr->chord_pending = -1;
+        input_report_key(wr->keys, wr->chords[wr->chord_active].code, 1);
+        input_sync(wr->keys);
+    }
+    spin_unlock(&wr->chord_lock);
+    return HRTIMER_NORESTART;
+}
+
+/* swaps the whole table, whatever the old one had down goes up first */
+static void wii_chord_set(struct wii_remote *wr, const struct wii_chord *table, int count)
+{
+    struct input_dev *in = wr->keys;
+
+    hrtimer_cancel(&wr->chord_timer);
+    spin_lock_irq(&wr->chord_lock);
+    if (wr->chord_active >= 0) {
+        input_report_key(in, wr->chords[wr->chord_active].code, 0);
+        input_sync(in);
+    }
+    memcpy(wr->chords, table, count * sizeof(*table));
+    wr->chord_count = count;
+    wr->chord_pending = wr->chord_active = -1;
+    spin_unlock_irq(&wr->chord_lock);
+}
+
+/*
+ * raw_event context, any report with the buttons in it. only the bits that
+ * changed go out, with MSC_SCAN first so evtest and udev hwdb can see which
+ * bit it was
+ */
+static void wii_keys_report(struct wii_remote *wr, u16 buttons)
+{
+    struct input_dev *in = wr->keys;
+    u16 changed;
+    int bit;
+
+    buttons &= WII_KEYMAP_MASK;
+    changed = buttons ^ wr->keys_held;
+    wr->keys_held = buttons;
+    if (changed)
+        wii_nl_buttons(wr, buttons);
+    if (!in || !changed)
+        return;
+    for (bit = 0; bit < WII_KEYMAP_SIZE; bit++) {
+        u16 code = READ_ONCE(wr->keymap[bit]);
+
+        if (!(changed & (1 << bit)) || code == KEY_RESERVED)
+            continue;
+        input_event(in, EV_MSC, MSC_SCAN, bit);
+        input_report_key(in, code, buttons & (1 << bit));
+    }
+    wii_chord_update(wr, in, buttons);
+    input_sync(in);
+}
+
+/* every extra input device looks like the remote it hangs off, only the name differs */
+static struct input_dev *wii_input_alloc(struct hid_device *hdev, const char *name)
+{
+    struct input_dev *in = devm_input_allocate_device(&hdev->dev);
+
+    if (!in)
+        return NULL;
+    in->name = name;
+    in->phys = hdev->phys;
+    in->uniq = hdev->uniq;
+    in->id.bustype = hdev->bus;
+    in->id.vendor = hdev->vendor;
+    in->id.product = hdev->product;
+    in->id.version = hdev->version;
+    return in;
+}
+
+/* the motion half of the remote as its own input device, like hid-wiimote does */
+static struct input_dev *wii_motion_create(struct hid_device *hdev)
+{
+    struct input_dev *in = wii_input_alloc(hdev, "Nintendo Wii Remote Motion");
+
+    if (!in)
+        return NULL;
+
+    __set_bit(INPUT_PROP_ACCELEROMETER, in->propbit);
+    input_set_abs_params(in, ABS_X, 0, 1023, 2, 4);
+    input_set_abs_params(in, ABS_Y, 0, 1023, 2, 4);
+    input_set_abs_params(in, ABS_Z, 0, 1023, 2, 4);
+    input_set_abs_params(in, ABS_RX, -MP_MAX_MDPS, MP_MAX_MDPS, 0, 0);
+    input_set_abs_params(in, ABS_RY, -MP_MAX_MDPS, MP_MAX_MDPS, 0, 0);
+    input_set_abs_params(in, ABS_RZ, -MP_MAX_MDPS, MP_MAX_MDPS, 0, 0);
+    input_set_abs_params(in, ABS_HAT0X, 0, 255, 2, 4);
+    input_set_abs_params(in, ABS_HAT0Y, 0, 255, 2, 4);
+    input_set_capability(in, EV_KEY, BTN_C);
+    input_set_capability(in, EV_KEY, BTN_Z);
+    input_set_capability(in, EV_MSC, MSC_TIMESTAMP);
+
+    if (input_register_device(in))
+        return NULL; // devm frees it
+    return in;
+}
+
+/*
+ * EVIOCSKEYCODE. the input core's own one clears the old code's keybit once
+ * no keymap entry has it, which would take a chord key off the device if an
+ * entry had been mapped to one, so keybit is rebuilt from the keymap plus
+ * every chord key instead. the core releases a held key that got remapped
+ */
+static int wii_keys_setkeycode(struct input_dev *in, const struct input_keymap_entry *ke,
+                               unsigned int *old_keycode)
+{
+    u16 *keymap = in->keycode;
+    unsigned int index;
+    int i;
+
+    if (ke->flags & INPUT_KEYMAP_BY_INDEX)
+        index = ke->index;
+    else if (input_scancode_to_scalar(ke, &index))
+        return -EINVAL;
+    if (index >= in->keycodemax)
+        return -EINVAL;
+
+    *old_keycode = keymap[index];
+    WRITE_ONCE(keymap[index], ke->keycode); // raw_event reads it without the input lock
+    __clear_bit(*old_keycode, in->keybit);
+    for (i = 0; i < in->keycodemax; i++)
+        __set_bit(keymap[i], in->keybit);
+    for (i = CHORD_FIRST_KEY; i <= CHORD_LAST_KEY; i++)
+        __set_bit(i, in->keybit);
+    __clear_bit(KEY_RESERVED, in->keybit);
+    return 0;
+}
+
+/*
+ * keycode/keycodemax/keycodesize is all the input core needs, its default
+ * getkeycode does EVIOCGKEYCODE against wr->keymap directly and
+ * wii_keys_setkeycode does EVIOCSKEYCODE
+ */
+static struct input_dev *wii_keys_create(struct hid_device *hdev, struct wii_remote *wr)
+{
+    struct input_dev *in = wii_input_alloc(hdev, "Nintendo Wii Remote");
+    int i;
+
+    if (!in)
+        return NULL;
+    memcpy(wr->keymap, wii_default_keymap, sizeof(wr->keymap));
+    in->keycode = wr->keymap;
+    in->keycodemax = ARRAY_SIZE(wr->keymap);
+    in->keycodesize = sizeof(wr->keymap[0]);
+    in->setkeycode = wii_keys_setkeycode;
+    __set_bit(EV_KEY, in->evbit);
+    for (i = 0; i < ARRAY_SIZE(wr->keymap); i++)
+        if (wr->keymap[i] != KEY_RESERVED)
+            __set_bit(wr->keymap[i], in->keybit);
+    /* keybit cant change once its registered without userspace missing it, so every chord key now */
+    for (i = CHORD_FIRST_KEY; i <= CHORD_LAST_KEY; i++)
+        __set_bit(i, in->keybit);
+    input_set_capability(in, EV_MSC, MSC_SCAN);
+
+    if (input_register_device(in))
+        return NULL;
+    return in;
+}
+
+static struct input_dev *wii_classic_create(struct hid_device *hdev)
+{
+    struct input_dev *in = wii_input_alloc(hdev, "Nintendo Wii Remote Classic Controller");
+    int i;
+
+    if (!in)
+        return NULL;
+
+    input_set_abs_params(in, ABS_X, 0, 63, 1, 4);
+    input_set_abs_params(in, ABS_Y, 0, 63, 1, 4);
+    input_set_abs_params(in, ABS_RX, 0, 31, 1, 2);
+    input_set_abs_params(in, ABS_RY, 0, 31, 1, 2);
+    input_set_abs_params(in, ABS_HAT2X, 0, 31, 1, 0);
+    input_set_abs_params(in, ABS_HAT2Y, 0, 31, 1, 0);
+    for (i = 0; i < ARRAY_SIZE(classic_keys); i++)
+        input_set_capability(in, EV_KEY, classic_keys[i].code);
+    input_set_capability(in, EV_MSC, MSC_TIMESTAMP);
+
+    if (input_register_device(in))
+        return NULL;
+    return in;
+}
+
+/*
+ * HAT0X/0Y/1X/1Y are the top right, bottom right, top left and bottom left
+ * sensors in 10g units, same as hid-wiimote. X/Y is the centre of pressure in
+ * 0.1mm from the middle of the board, +x right and +y towards the user
+ */
+static struct input_dev *wii_board_create(struct hid_device *hdev)
+{
+    struct input_dev *in = wii_input_alloc(hdev, "Nintendo Wii Balance Board");
+
+    if (!in)
+        return NULL;
+    input_set_abs_params(in, ABS_HAT0X, 0, 65535, 2, 4);
+    input_set_abs_params(in, ABS_HAT0Y, 0, 65535, 2, 4);
+    input_set_abs_params(in, ABS_HAT1X, 0, 65535, 2, 4);
+    input_set_abs_params(in, ABS_HAT1Y, 0, 65535, 2, 4);
+    input_set_abs_params(in, ABS_X, -BOARD_HALF_X, BOARD_HALF_X, 0, 0);
+    input_set_abs_params(in, ABS_Y, -BOARD_HALF_Y, BOARD_HALF_Y, 0, 0);
+    input_set_capability(in, EV_MSC, MSC_TIMESTAMP);
+
+    if (input_register_device(in))
+        return NULL;
+    return in;
+}
+
+/*
+ * In-kernel pointer
+ *
+ * user-space.c moves the pointer by shelling out to xdotool ten times a second,
+ * this does it from raw_event at the report rate. dpad and tilt are turned into
+ * a velocity, ptr_timer integrates it every POINTER_TICK_NS and sends whole
+ * pixels as REL_X/REL_Y, so a held direction glides instead of stepping once a
+ * report. A held dpad direction starts at ptr_speed and speeds up by ptr_accel
+ * a second up to ptr_max, tilt goes from ptr_speed just past the deadzone to
+ * ptr_max at POINTER_TILT_RANGE past it along a square curve, fine control near
+ * the middle. The timer only runs while something is moving.
+ *
+ * ir needs report 0x33 with the camera on, so only with nothing in the extension
+ * port and the MotionPlus off. The middle of the dots it sees is the pointer.
+ * A and B are the left and right buttons in every mode.
+ */
+#define POINTER_TICK_NS     (5 * NSEC_PER_MSEC)   /* 200Hz, twice the report rate */
+#define POINTER_MAX_DT_NS   (4 * POINTER_TICK_NS) /* a late tick doesnt get to jump the pointer */
+#define POINTER_TILT_RANGE  30                    /* counts past the deadzone for full speed, about 0.3g */
+#define POINTER_ACCEL_ZERO  512
+#define POINTER_BTN_A       0x0800                /* byte 1 | byte 2 << 8 like the records */
+#define POINTER_BTN_B       0x0400
+#define POINTER_DPAD_LEFT   0x0001
+#define POINTER_DPAD_RIGHT  0x0002
+#define POINTER_DPAD_DOWN   0x0004
+#define POINTER_DPAD_UP     0x0008
+
+static const char * const pointer_modes[] = { "off", "dpad", "tilt", "ir" };
+
+/* same as wii_report_has_accel() in user space */
+static bool report_has_accel(u8 id)
+{
+    return id == 0x31 || id == 0x33 || id == 0x35 || id == 0x37;
+}
+
+/* px/s on each axis right now, under ptr_lock */
+static void wii_pointer_velocity(struct wii_remote *wr, u64 now, int v[2])
+{
+    int speed = READ_ONCE(wr->ptr_speed), top = max(READ_ONCE(wr->ptr_max), speed);
+    int i;
+
+    if (READ_ONCE(wr->ptr_mode) == WII_POINTER_DPAD) {
+        u64 held_ms = div_u64(now - wr->ptr_held_ns, NSEC_PER_MSEC);
+        int s = min_t(u64, speed + div_u64(held_ms * READ_ONCE(wr->ptr_accel), 1000), top);
+
+        for (i = 0; i < 2; i++)
+            v[i] = wr->ptr_dir[i] * s;
+        return;
+    }
+    for (i = 0; i < 2; i++) {
+        int off = abs(wr->ptr_tilt[i]) - READ_ONCE(wr->ptr_deadzone);
+        int n = min(off, POINTER_TILT_RANGE);
+
+        v[i] = off <= 0 ? 0 :
+            speed + (top - speed) * n * n / (POINTER_TILT_RANGE * POINTER_TILT_RANGE);
+        if (wr->ptr_tilt[i] < 0)
+            v[i] = -v[i];
+        if (READ_ONCE(wr->ptr_invert) & (1 << i))
+            v[i] = -v[i];
+    }
+}
+
+static enum hrtimer_restart wii_pointer_tick(struct hrtimer *timer)
+{
+    struct wii_remote *wr = container_of(timer, struct wii_remote, ptr_timer);
+    struct input_dev *in = READ_ONCE(wr->ptr_rel);
+    u64 now = ktime_get_ns(), dt;
+    int v[2], move[2], i;
+    bool idle;
+
+    spin_lock(&wr->ptr_lock);
+    wii_pointer_velocity(wr, now, v);
+    dt = min_t(u64, now - wr->ptr_last_ns, POINTER_MAX_DT_NS);
+    wr->ptr_last_ns = now;
+    for (i = 0; i < 2; i++) {
+        /* px/s * ns is nanopixels, /1e6 leaves millipixels */
+        wr->ptr_frac[i] += div_s64((s64)v[i] * (s64)dt, 1000000);
+        move[i] = (int)div_s64(wr->ptr_frac[i], 1000);
+        wr->ptr_frac[i] -= (s64)move[i] * 1000;
+    }
+    idle = !v[0] && !v[1];
+    if (idle) {
+        wr->ptr_running = false;
+        wr->ptr_frac[0] = wr->ptr_frac[1] = 0;
+    }
+    spin_unlock(&wr->ptr_lock);
+
+    if (in && (move[0] || move[1])) {
+        input_report_rel(in, REL_X, move[0]);
+        input_report_rel(in, REL_Y, move[1]);
+        input_sync(in);
+    }
+    if (idle)
+        return HRTIMER_NORESTART;
+    hrtimer_forward_now(timer, ns_to_ktime(POINTER_TICK_NS));
+    return HRTIMER_RESTART;
+}
+
+/* extended IR, 4 dots of 3 bytes. the camera sees the room mirrored so x is flipped */
+static bool wii_pointer_ir(const u8 *ir, int *x, int *y)
+{
+    int sx = 0, sy = 0, n = 0, i;
+
+    for (i = 0; i < 4 && n < 2; i++, ir += 3) {
+        int bx = ir[0] | ((ir[2] & 0x30) << 4);
+        int by = ir[1] | ((ir[2] & 0xc0) << 2);
+
+        if (by == 0x3ff)
+            continue; // all ones is a dot it doesnt see
+        sx += bx;
+        sy += by;
+        n++;
+    }
+    if (!n)
+        return false;
+    *x = 1023 - sx / n;
+    *y = min(sy / n, 767);
+    return true;
+}
+
+/* raw_event context, every data report while a pointer mode is on */
+static void wii_pointer_report(struct wii_remote *wr, const u8 *data, int size)
+{
+    int mode = READ_ONCE(wr->ptr_mode);
+    struct input_dev *in;
+    unsigned long flags;
+    bool moving = false, start = false;
+    u16 buttons;
+    int x, y, i;
+
+    if (mode == WII_POINTER_OFF || size < 3)
+        return;
+    in = mode == WII_POINTER_IR ? READ_ONCE(wr->ptr_abs) : READ_ONCE(wr->ptr_rel);
+    if (!in)
+        return;
+    buttons = data[1] | (data[2] << 8);
+
+    if (mode == WII_POINTER_IR) {
+        if (data[0] == 0x33 && size >= 18 && wii_pointer_ir(data + 6, &x, &y)) {
+            input_report_abs(in, ABS_X, x);
+            input_report_abs(in, ABS_Y, y);
+        }
+    } else if (mode == WII_POINTER_DPAD || (report_has_accel(data[0]) && size >= 6)) {
+        u64 now = ktime_get_ns();
+
+        spin_lock_irqsave(&wr->ptr_lock, flags);
+        if (mode == WII_POINTER_DPAD) {
+            int dir[2] = {
+                !!(buttons & POINTER_DPAD_RIGHT) - !!(buttons & POINTER_DPAD_LEFT),
+                !!(buttons & POINTER_DPAD_DOWN) - !!(buttons & POINTER_DPAD_UP),
+            };
+
+            if (dir[0] != wr->ptr_dir[0] || dir[1] != wr->ptr_dir[1])
+                wr->ptr_held_ns = now; // a new direction starts slow again
+            wr->ptr_dir[0] = dir[0];
+            wr->ptr_dir[1] = dir[1];
+            moving = dir[0] || dir[1];
+        } else {
+            /* accel in bytes 3-5, same bits as the records */
+            wr->ptr_tilt[0] = ((data[3] << 2) | ((data[1] >> 5) & 0x3)) - POINTER_ACCEL_ZERO;
+            wr->ptr_tilt[1] = ((data[4] << 2) | ((data[2] >> 4) & 0x2)) - POINTER_ACCEL_ZERO;
+            for (i = 0; i < 2; i++)
+                if (abs(wr->ptr_tilt[i]) > READ_ONCE(wr->ptr_deadzone))
+                    moving = true;
+        }
+        if (moving && !wr->ptr_running) {
+            wr->ptr_running = true;
+            wr->ptr_last_ns = now;
+            start = true;
+        }
+        spin_unlock_irqrestore(&wr->ptr_lock, flags);
+        if (start)
+            hrtimer_start(&wr->ptr_timer, ns_to_ktime(POINTER_TICK_NS), HRTIMER_MODE_REL);
+    }
+
+    /* the input core drops values that didnt change, this only goes out when something did */
+    input_report_key(in, BTN_LEFT, buttons & POINTER_BTN_A);
+    input_report_key(in, BTN_RIGHT, buttons & POINTER_BTN_B);
+    input_sync(in);
+}
+
+static struct input_dev *wii_pointer_create(struct hid_device *hdev, bool absolute)
+{
+    struct input_dev *in = wii_input_alloc(hdev, absolute ? "Nintendo Wii Remote IR Pointer" :
+                                                            "Nintendo Wii Remote Pointer");
+
+    if (!in)
+        return NULL;
+    if (absolute) {
+        input_set_abs_params(in, ABS_X, 0, 1023, 0, 0);
+        input_set_abs_params(in, ABS_Y, 0, 767, 0, 0);
+    } else {
+        input_set_capability(in, EV_REL, REL_X);
+        input_set_capability(in, EV_REL, REL_Y);
+    }
+    __set_bit(INPUT_PROP_POINTER, in->propbit);
+    input_set_capability(in, EV_KEY, BTN_LEFT);
+    input_set_capability(in, EV_KEY, BTN_RIGHT);
+
+    if (input_register_device(in))
+        return NULL;
+    return in;
+}
+
+/*
+ * camera on (wiibrew): 0x13 and 0x1a with 0x04, 0x08 to 0xB00030, the two
+ * sensitivity blocks (this is the "level 3" one everyone uses), 3 for extended
+ * mode at 0xB00033, 0x08 to 0xB00030 again. off is just 0x13 and 0x1a with 0
+ */
+static int wii_ir_camera(struct hid_device *hdev, bool on)
 {
+    static const u8 sens1[9] = { 0x02, 0x00, 0x00, 0x71, 0x01, 0x00, 0xaa, 0x00, 0x64 };
+    static const u8 sens2[2] = { 0x63, 0x03 };
+    u8 cam1[2] = { 0x13, on ? 0x04 : 0x00 }, cam2[2] = { 0x1a, on ? 0x04 : 0x00 };
+    int ret;
 
-    /*
-     * The output is capped at 256 but this is isnt possible in a single event unless,
-     * a macro is used.
-     * Its just large enough to hold every actual event, the result is truncated regardless
-     * be careful changing this pls because report trunucation will f*ck the userspace
-     * 🙏
-    */
-    char mapping_output[256];
-    int len = 0;
+    ret = wii_send_output(hdev, cam1, sizeof(cam1));
+    if (!ret)
+        ret = wii_send_output(hdev, cam2, sizeof(cam2));
+    if (ret || !on)
+        return ret;
+    ret = wii_write_register(hdev, 0xb00030, 0x08);
+    if (!ret)
+        ret = wii_write_registers(hdev, 0xb00000, sens1, sizeof(sens1));
+    if (!ret)
+        ret = wii_write_registers(hdev, 0xb0001a, sens2, sizeof(sens2));
+    if (!ret)
+        ret = wii_write_register(hdev, 0xb00033, 0x03);
+    if (!ret)
+        ret = wii_write_register(hdev, 0xb00030, 0x08);
+    return ret;
+}
 
-    /* Report has to be 3 bytes or its cooked */
-    if (size < 3) {
-        printk(KERN_WARNING DRIVER_NAME ": Report too short for mapping\n");
-        return;
+/* stops the integrator and lets go of anything the old mode had held */
+static void wii_pointer_stop(struct wii_remote *wr, int mode)
+{
+    struct input_dev *in = mode == WII_POINTER_IR ? wr->ptr_abs : wr->ptr_rel;
+
+    hrtimer_cancel(&wr->ptr_timer);
+    spin_lock_irq(&wr->ptr_lock);
+    wr->ptr_running = false;
+    memset(wr->ptr_dir, 0, sizeof(wr->ptr_dir));
+    memset(wr->ptr_tilt, 0, sizeof(wr->ptr_tilt));
+    wr->ptr_frac[0] = wr->ptr_frac[1] = 0;
+    spin_unlock_irq(&wr->ptr_lock);
+    if (mode != WII_POINTER_OFF && in) {
+        input_report_key(in, BTN_LEFT, 0);
+        input_report_key(in, BTN_RIGHT, 0);
+        input_sync(in);
     }
+}
 
-    u8 report_id = data[0];
-    u8 btn_byte1 = data[1];
-    u8 btn_byte2 = data[2];
+static ssize_t pointer_mode_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct wii_remote *wr = hid_get_drvdata(to_hid_device(dev));
 
-    /* using snprintf here as we need to have buffer safety with the circular buffer
-    other wise id be writing edge cases do not change  */
-    len += snprintf(mapping_output + len, sizeof(mapping_output) - len,
-                    "Report: ID=%u, ", report_id);
+    return sysfs_emit(buf, "%s\n", pointer_modes[READ_ONCE(wr->ptr_mode)]);
+}
 
-    if (btn_byte1 & 0x01)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Dpad_Left");
-    if (btn_byte1 & 0x02)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Dpad_Right ");
-    if (btn_byte1 & 0x04)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Dpad_Down ");
-    if (btn_byte1 & 0x08)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Dpad_Up ");
-    if (btn_byte1 & 0x10)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Plus ");
+static ssize_t pointer_mode_store(struct device *dev, struct device_attribute *attr,
+                                  const char *buf, size_t count)
+{
+    struct hid_device *hdev = to_hid_device(dev);
+    struct wii_remote *wr = hid_get_drvdata(hdev);
+    int mode, old, ret = 0;
 
-    if (btn_byte2 & 0x10)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Minus ");
-    if (btn_byte2 & 0x80)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Home ");
-    if (btn_byte2 & 0x01)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "2 ");
-    if (btn_byte2 & 0x02)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "1 ");
-    if (btn_byte2 & 0x04)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "B ");
-    if (btn_byte2 & 0x08)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "A");
+    for (mode = 0; mode < ARRAY_SIZE(pointer_modes); mode++)
+        if (sysfs_streq(buf, pointer_modes[mode]))
+            break;
+    if (mode == ARRAY_SIZE(pointer_modes))
+        return -EINVAL;
 
-    if (len == 0)
-        len = snprintf(mapping_output, sizeof(mapping_output), "No buttons pressed");
+    mutex_lock(&wr->ext_lock);
+    old = wr->ptr_mode;
+    if (mode == old)
+        goto out;
+    if (mode == WII_POINTER_IR &&
+        (READ_ONCE(wr->ext_type) != WII_EXT_NONE || READ_ONCE(wr->mp_mode) != WII_MP_OFF)) {
+        ret = -EBUSY; // 0x33 has no room for extension bytes
+        goto out;
+    }
+    if (mode == WII_POINTER_IR && !wr->ptr_abs)
+        WRITE_ONCE(wr->ptr_abs, wii_pointer_create(hdev, true));
+    else if ((mode == WII_POINTER_DPAD || mode == WII_POINTER_TILT) && !wr->ptr_rel)
+        WRITE_ONCE(wr->ptr_rel, wii_pointer_create(hdev, false));
+    if ((mode == WII_POINTER_IR && !wr->ptr_abs) ||
+        ((mode == WII_POINTER_DPAD || mode == WII_POINTER_TILT) && !wr->ptr_rel)) {
+        ret = -ENOMEM;
+        goto out;
+    }
 
-    if (len < sizeof(mapping_output) - 1) {
-        mapping_output[len++] = '\n';
-        mapping_output[len] = '\0';
+    WRITE_ONCE(wr->ptr_mode, WII_POINTER_OFF); // raw_event leaves it alone while we switch
+    wii_pointer_stop(wr, old);
+    if (old == WII_POINTER_IR)
+        ret = wii_ir_camera(hdev, false);
+    if (!ret && mode == WII_POINTER_IR)
+        ret = wii_ir_camera(hdev, true);
+    if (!ret)
+        WRITE_ONCE(wr->ptr_mode, mode);
+    /* with an extension or the MotionPlus their mode stays, both already have accel in them */
+    if (!ret && READ_ONCE(wr->ext_type) == WII_EXT_NONE && READ_ONCE(wr->mp_mode) == WII_MP_OFF)
+        ret = wii_set_base_report_mode(hdev);
+out:
+    mutex_unlock(&wr->ext_lock);
+    return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(pointer_mode);
+
+#define POINTER_ATTR(_name, _field, _min, _max)                                         \
+static ssize_t _name##_show(struct device *dev, struct device_attribute *attr, char *buf) \
+{                                                                                       \
+    struct wii_remote *wr = hid_get_drvdata(to_hid_device(dev));                        \
+    return sysfs_emit(buf, "%d\n", READ_ONCE(wr->_field));                              \
+}                                                                                       \
+static ssize_t _name##_store(struct device *dev, struct device_attribute *attr,         \
+                             const char *buf, size_t count)                             \
+{                                                                                       \
+    struct wii_remote *wr = hid_get_drvdata(to_hid_device(dev));                        \
+    int v, ret = kstrtoint(buf, 0, &v);                                                 \
+    if (ret)                                                                            \
+        return ret;                                                                     \
+    if (v < (_min) || v > (_max))                                                       \
+        return -EINVAL;                                                                 \
+    WRITE_ONCE(wr->_field, v);                                                          \
+    return count;                                                                       \
+}                                                                                       \
+static DEVICE_ATTR_RW(_name)
+
+POINTER_ATTR(pointer_speed, ptr_speed, 0, 10000);
+POINTER_ATTR(pointer_accel, ptr_accel, 0, 100000);
+POINTER_ATTR(pointer_max, ptr_max, 1, 20000);
+POINTER_ATTR(pointer_deadzone, ptr_deadzone, 0, 200);
+POINTER_ATTR(pointer_invert, ptr_invert, 0, 3);
+
+/* the names the chords attribute takes, joined with + */
+static const struct {
+    const char *name;
+    u16 bit;
+} chord_buttons[] = {
+    { "Left", 0x0001 }, { "Right", 0x0002 }, { "Down", 0x0004 }, { "Up", 0x0008 },
+    { "Plus", 0x0010 }, { "2", 0x0100 }, { "1", 0x0200 }, { "B", 0x0400 },
+    { "A", 0x0800 }, { "Minus", 0x1000 }, { "Home", 0x8000 },
+};
+
+/* one chord a line, <buttons> <hold_ms> <keycode>, e.g. "Home 2000 656" (KEY_MACRO1) */
+static ssize_t chords_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct wii_remote *wr = hid_get_drvdata(to_hid_device(dev));
+    struct wii_chord table[WII_CHORD_MAX];
+    int count, len = 0, i, b;
+
+    spin_lock_irq(&wr->chord_lock);
+    count = wr->chord_count;
+    memcpy(table, wr->chords, count * sizeof(table[0]));
+    spin_unlock_irq(&wr->chord_lock);
+
+    for (i = 0; i < count; i++) {
+        const char *sep = "";
+
+        for (b = 0; b < ARRAY_SIZE(chord_buttons); b++) {
+            if (table[i].buttons & chord_buttons[b].bit) {
+                len += sysfs_emit_at(buf, len, "%s%s", sep, chord_buttons[b].name);
+                sep = "+";
+            }
+        }
+        len += sysfs_emit_at(buf, len, " %u %u\n", table[i].hold_ms, table[i].code);
     }
-    printk(KERN_INFO "Mapped Output: %s\n", mapping_output);
-    circ_buffer_write(mapping_output, len);
+    return len;
+}
+
+static int chord_parse_buttons(char *names, u16 *mask)
+{
+    char *name;
+    int i;
+
+    *mask = 0;
+    while ((name = strsep(&names, "+"))) {
+        for (i = 0; i < ARRAY_SIZE(chord_buttons); i++)
+            if (!strcasecmp(name, chord_buttons[i].name))
+                break;
+        if (i == ARRAY_SIZE(chord_buttons))
+            return -EINVAL;
+        *mask |= chord_buttons[i].bit;
+    }
+    return *mask ? 0 : -EINVAL;
+}
+
+/* the whole table in one write, so a profile switch is one write. empty clears it */
+static ssize_t chords_store(struct device *dev, struct device_attribute *attr,
+                            const char *buf, size_t count)
+{
+    struct wii_remote *wr = hid_get_drvdata(to_hid_device(dev));
+    struct wii_chord table[WII_CHORD_MAX];
+    char *copy, *cur, *line;
+    int n = 0, ret = 0;
+
+    if (!wr->keys)
+        return -ENODEV; // chords go out on it
+    copy = kstrndup(buf, count, GFP_KERNEL);
+    if (!copy)
+        return -ENOMEM;
+    cur = copy;
+    while ((line = strsep(&cur, "\n"))) {
+        char names[64];
+        unsigned int hold, code;
+
+        line = strim(line);
+        if (!*line)
+            continue;
+        if (n == WII_CHORD_MAX) {
+            ret = -ENOSPC;
+            break;
+        }
+        if (sscanf(line, "%63s %u %u", names, &hold, &code) != 3 ||
+            hold > CHORD_MAX_HOLD_MS || code < CHORD_FIRST_KEY || code > CHORD_LAST_KEY) {
+            ret = -EINVAL;
+            break;
+        }
+        ret = chord_parse_buttons(names, &table[n].buttons);
+        if (ret)
+            break;
+        table[n].hold_ms = hold;
+        table[n].code = code;
+        n++;
+    }
+    kfree(copy);
+    if (ret)
+        return ret;
+    wii_chord_set(wr, table, n);
+    return count;
 }
+static DEVICE_ATTR_RW(chords);
+
+static struct attribute *wii_attrs[] = {
+    &dev_attr_pointer_mode.attr,
+    &dev_attr_pointer_speed.attr,
+    &dev_attr_pointer_accel.attr,
+    &dev_attr_pointer_max.attr,
+    &dev_attr_pointer_deadzone.attr,
+    &dev_attr_pointer_invert.attr,
+    &dev_attr_chords.attr,
+    NULL,
+};
+
+static const struct attribute_group wii_attr_group = {
+    .attrs = wii_attrs,
+};
 
 /* Character device file operations */
 static int device_open(struct inode *inode, struct file *file)
 {
     /*
-     * these do nothing but return success, they are simply just place holders
-
-     * they just allow the device to successfully be opened / released
+     * the only per open state is the read format, it lives in private_data
+     * and starts as text so old readers dont notice anything
     */
+    file->private_data = (void *)(uintptr_t)WII_FORMAT_TEXT;
     return 0;
 }
 
@@ -177,46 +2144,214 @@ static int device_release(struct inode *inode, struct file *file)
     return 0;
 }
 
+/* whether a read in this format would get anything right now */
+static bool wii_events_ready(int format)
+{
+    if (format == WII_FORMAT_RECORDS)
+        return READ_ONCE(record_head) != READ_ONCE(record_tail);
+    return READ_ONCE(head) != READ_ONCE(tail);
+}
+
+/*
+ * WII_FORMAT_RECORDS read, whole records only so a short buffer gets 0.
+ * copied out under the spinlock a few at a time since copying to the iter can fault
+ */
+static ssize_t device_read_records(struct iov_iter *to)
+{
+    struct wii_motion_record chunk[8];
+    size_t copied = 0;
+
+    while (iov_iter_count(to) >= sizeof(chunk[0])) {
+        size_t want = min_t(size_t, iov_iter_count(to) / sizeof(chunk[0]), ARRAY_SIZE(chunk));
+        size_t n = 0;
+        unsigned long flags;
+
+        spin_lock_irqsave(&record_lock, flags);
+        while (n < want && record_tail != record_head) {
+            chunk[n++] = record_ring[record_tail];
+            record_tail = (record_tail + 1) % RECORD_RING_SIZE;
+        }
+        spin_unlock_irqrestore(&record_lock, flags);
+
+        if (n == 0)
+            break;
+        if (copy_to_iter(chunk, n * sizeof(chunk[0]), to) != n * sizeof(chunk[0]))
+            return copied ? copied : -EFAULT;
+        copied += n * sizeof(chunk[0]);
+    }
+    return copied;
+}
+
 /*
- * this is where the circular buffer is read
+ * this is where the circular buffer is read, read(), splice() and
+ * WII_URING_READ all come through here. never waits, 0 is nothing there
+ * (poll() says when there is). what is queued is at most two runs, tail to
+ * the end of the buffer and then the start up to head, each one goes in a
+ * single copy_to_iter
 */
-static ssize_t device_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+static ssize_t wii_read_events(int format, struct iov_iter *to)
 {
     size_t bytes_copied = 0;
 
-    /*
-     * *(pointer)buf is what the user passes to read so,
-     * in user space app you need to pass a poiner to buf
-     * the same size as whatever the circ_buff is which I have set to
-     * 1024 bytes
-    */
+    if (format == WII_FORMAT_RECORDS)
+        return device_read_records(to);
 
     mutex_lock(&circ_mutex);
-    while (bytes_copied < count && tail != head) {
-        if (copy_to_user(buf + bytes_copied, &circ_buffer[tail], 1)){ // this is what copies to user space, Ciaran - Ryan  {
-            mutex_unlock(&circ_mutex);
-            return -EFAULT; // error code for "Bad Address"
-            /*
-             * this handles;
-             * invalid user space pointers
-             * or if the kernel tries to access restricted memory
-            */
-        }
-        tail = (tail + 1) % CIRC_BUFFER_SIZE;
-        bytes_copied++;
+    while (iov_iter_count(to) && tail != head) {
+        size_t run = (head > tail ? head : CIRC_BUFFER_SIZE) - tail;
+        size_t want = min(run, iov_iter_count(to));
+        size_t n = copy_to_iter(&circ_buffer[tail], want, to);
+
+        tail = (tail + n) % CIRC_BUFFER_SIZE;
+        bytes_copied += n;
+        if (n < want)
+            break; // bad user address part way through
     }
     mutex_unlock(&circ_mutex);
-    return bytes_copied; // this is just the number of bytes not the actual data
-                         // actual data is transferred to uspace through the function
+    if (!bytes_copied && iov_iter_count(to) && head != tail)
+        return -EFAULT; // error code for "Bad Address"
+    return bytes_copied;
+}
+
+/* read() comes here too, the VFS wraps the user buffer in an iter for us */
+static ssize_t device_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    return wii_read_events((uintptr_t)iocb->ki_filp->private_data, to);
+}
+
+/*
+ * readers sleep in poll() instead of spinning on reads that come back 0,
+ * circ_buffer_write and record_push wake them. writes block in
+ * wii_speaker_write like they always did, so always writable here
+ */
+static __poll_t device_poll(struct file *file, poll_table *wait)
+{
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(file, &wii_read_wait, wait);
+    if (wii_events_ready((uintptr_t)file->private_data))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    return mask;
+}
+
+/*
+ * the speaker, see wii_speaker_write. it only fills the queue, never touches
+ * hdev, so a plain reference is enough. remove turns the speaker off which
+ * wakes anyone waiting in here
+ */
+static ssize_t device_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+    struct wii_remote *wr = wii_get();
+    ssize_t ret;
+
+    if (!wr)
+        return -ENODEV;
+    ret = wii_speaker_write(wr, file, buf, count);
+    wii_put(wr);
+    return ret;
+}
+
+/*
+ * WIIMOTE_IOCTL_GET_INFO with whatever struct wii_info size the caller was
+ * built with, usize is from the ioctl number
+ */
+static long wii_ioctl_get_info(void __user *arg, size_t usize)
+{
+    struct wii_info info = {
+        .abi_version      = WII_ABI_VERSION,
+        .features         = WII_FEATURE_TEXT | WII_FEATURE_RECORDS | WII_FEATURE_MOTIONPLUS |
+                            WII_FEATURE_SPEAKER | WII_FEATURE_NETLINK | WII_FEATURE_URING |
+                            WII_FEATURE_POLL,
+        .report_modes     = WII_REPORT_MODES,
+        .text_buffer_size = CIRC_BUFFER_SIZE,
+        .record_ring_size = RECORD_RING_SIZE,
+        .record_size      = sizeof(struct wii_motion_record),
+        .battery          = READ_ONCE(wii_last_battery), // byte 6 of the status report or -1
+    };
+    struct wii_remote *wr;
+
+    if (usize < offsetofend(struct wii_info, abi_version))
+        return -EINVAL;
+    info.size = min(usize, sizeof(info)); // what the caller actually gets, not what we have
+    wr = wii_get();
+    if (wr) {
+        info.connected = 1;
+        info.ext_type = READ_ONCE(wr->ext_type);
+        info.mp_mode = READ_ONCE(wr->mp_mode);
+        info.pointer_mode = READ_ONCE(wr->ptr_mode);
+        info.report_mode = READ_ONCE(wr->report_mode);
+        info.leds = READ_ONCE(wr->leds);
+        if (wr->keys)
+            info.features |= WII_FEATURE_KEYS;
+        if (wr->motion)
+            info.features |= WII_FEATURE_MOTION_DEV;
+        if (wr->sysfs_ok)
+            info.features |= WII_FEATURE_SYSFS;
+        wii_put(wr);
+    }
+    if (copy_to_user(arg, &info, min(usize, sizeof(info))))
+        return -EFAULT;
+    if (usize > sizeof(info) && clear_user(arg + sizeof(info), usize - sizeof(info)))
+        return -EFAULT; // a newer caller's fields we dont know read as 0
+    return 0;
 }
 
 static long device_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
     int ret = 0;
+    int value;
+    struct wii_remote *wr;
+    struct wii_speaker_config spk;
+
+    /* matched on everything but the size, see struct wii_info */
+    if (_IOC_TYPE(cmd) == _IOC_TYPE(WIIMOTE_IOCTL_GET_INFO) && _IOC_NR(cmd) == _IOC_NR(WIIMOTE_IOCTL_GET_INFO) &&
+        _IOC_DIR(cmd) == _IOC_READ)
+        return wii_ioctl_get_info((void __user *)arg, _IOC_SIZE(cmd));
+
     switch (cmd) // purpose of this will just check if the command is availiable
     {
+    case WIIMOTE_IOCTL_SET_FORMAT:
+        if (get_user(value, (int __user *)arg))
+            return -EFAULT;
+        if (value != WII_FORMAT_TEXT && value != WII_FORMAT_RECORDS)
+            return -EINVAL;
+        file->private_data = (void *)(uintptr_t)value;
+        break;
+    case WIIMOTE_IOCTL_SET_MOTIONPLUS:
+        if (get_user(value, (int __user *)arg))
+            return -EFAULT;
+        if (value < WII_MP_OFF || value > WII_MP_NUNCHUK)
+            return -EINVAL;
+        wr = wii_io_get();
+        if (!wr)
+            return -ENODEV;
+        WRITE_ONCE(wr->mp_mode, value);
+        schedule_work(&wr->mp_work); // register writes sleep, the work item does them
+        wii_io_put(wr);
+        break;
+    case WIIMOTE_IOCTL_SET_SPEAKER:
+        if (copy_from_user(&spk, (void __user *)arg, sizeof(spk)))
+            return -EFAULT;
+        if (spk.format > WII_SPEAKER_PCM8)
+            return -EINVAL;
+        if (spk.format != WII_SPEAKER_OFF &&
+            (spk.rate < SPK_MIN_RATE || spk.rate > SPK_MAX_RATE ||
+             (spk.format == WII_SPEAKER_ADPCM && spk.volume > 0x40)))
+            return -EINVAL;
+        wr = wii_io_get();
+        if (!wr)
+            return -ENODEV;
+        spin_lock_irq(&wr->spk_lock);
+        wr->spk_cfg = spk;
+        wr->spk_ready = false; // writers wait for the work item to finish the setup
+        spin_unlock_irq(&wr->spk_lock);
+        wake_up_interruptible(&wr->spk_wait);
+        schedule_work(&wr->spk_work);
+        wii_io_put(wr);
+        break;
     case WIIMOTE_IOCTL_REQUEST_STATUS: // defined as _IO('W', 1), for battery request
-        if (wii_hid_dev) {
+        wr = wii_io_get(); // a racing remove waits for us, so hdev cant go mid send
+        if (wr) {
             /*
              * 0x15 is the status code for wii remote battery
              * no additional param is needed after status code
@@ -225,20 +2360,14 @@ static long device_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
             printk(KERN_INFO "Sending battery status request (output report 0x15)\n");
 
             /*
-             * this is just a function from HID it just sends a report to the device
-             * HID_OUTPUT_REPORT just a flag to indicate we are sending raw
-             * HID_REW_SET_REPORT its a request type. Means we are writing a report with the data it gives us
+             * wii_send_output sends it on the interrupt channel like the remote wants,
+             * falling back to a SET_REPORT (hid_hw_raw_request) if the transport cant
             */
-            ret = hid_hw_raw_request(
-                                    wii_hid_dev,
-                                     status_request[0],
-                                     status_request,
-                                     sizeof(status_request),
-                                     HID_OUTPUT_REPORT,
-                                     HID_REQ_SET_REPORT);
+            ret = wii_send_output(wr->hdev, status_request, sizeof(status_request));
             printk(KERN_INFO "Battery status request returned: %d\n", ret);
             if (ret < 0)
                 printk(KERN_ERR DRIVER_NAME ": failed to send status request, error %d\n", ret);
+            wii_io_put(wr);
         } else {
             printk(KERN_ERR DRIVER_NAME ": HID device not available for status request\n");
             ret = -ENODEV; // this just means no such device
@@ -250,6 +2379,205 @@ static long device_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
     return ret;
 }
 
+/*
+ * uring_cmd. WII_URING_READ never sleeps, with nothing to read it parks (see
+ * uring_parked) and completes from task work when raw_event has something.
+ * the rest talk to the remote and sleep, so when io_uring asks without
+ * blocking they say -EAGAIN and io_uring reissues them from one of its
+ * workers, the submitter never waits either way
+ */
+struct wii_uring_pdu {
+    char __user *buf;   /* WII_URING_READ's, kept for the task work */
+    u32 len;
+};
+
+static int wii_uring_park(struct io_uring_cmd *ioucmd)
+{
+    int format = (uintptr_t)ioucmd->file->private_data;
+    int i;
+
+    spin_lock_irq(&uring_lock);
+    for (i = 0; i < URING_PARKED_MAX && uring_parked[i]; i++)
+        ;
+    if (i < URING_PARKED_MAX)
+        uring_parked[i] = ioucmd;
+    spin_unlock_irq(&uring_lock);
+    if (i == URING_PARKED_MAX)
+        return -EBUSY;
+    /* something may have come in between the read that found nothing and here */
+    if (wii_events_ready(format))
+        wii_uring_wake();
+    return 0;
+}
+
+static void wii_uring_read_tw(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+    struct wii_uring_pdu *pdu = io_uring_cmd_to_pdu(ioucmd, struct wii_uring_pdu);
+    ssize_t ret = -ECANCELED;
+
+    if (!(issue_flags & IO_URING_F_TASK_DEAD)) {
+        struct iov_iter to;
+
+        ret = import_ubuf(ITER_DEST, pdu->buf, pdu->len, &to);
+        if (!ret)
+            ret = wii_read_events((uintptr_t)ioucmd->file->private_data, &to);
+        if (!ret)
+            ret = wii_uring_park(ioucmd); // another reader got there first
+        if (!ret)
+            return;
+    }
+    io_uring_cmd_done(ioucmd, ret, 0, issue_flags);
+}
+
+/* io_uring is tearing down or cancelling, a parked read goes now, one in task work finishes there */
+static int wii_uring_cancel(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+    bool found = false;
+    int i;
+
+    spin_lock_irq(&uring_lock);
+    for (i = 0; i < URING_PARKED_MAX; i++) {
+        if (uring_parked[i] == ioucmd) {
+            uring_parked[i] = NULL;
+            found = true;
+        }
+    }
+    spin_unlock_irq(&uring_lock);
+    if (found)
+        io_uring_cmd_done(ioucmd, -ECANCELED, 0, issue_flags);
+    return 0;
+}
+
+static int wii_uring_read(struct io_uring_cmd *ioucmd, u64 addr, u32 len, unsigned int issue_flags)
+{
+    struct wii_uring_pdu *pdu = io_uring_cmd_to_pdu(ioucmd, struct wii_uring_pdu);
+    int format = (uintptr_t)ioucmd->file->private_data;
+    struct iov_iter to;
+    ssize_t ret;
+
+    /* a records read smaller than one record would never get anything */
+    if (!len || (format == WII_FORMAT_RECORDS && len < sizeof(struct wii_motion_record)))
+        return -EINVAL;
+    pdu->buf = u64_to_user_ptr(addr);
+    pdu->len = len;
+    ret = import_ubuf(ITER_DEST, pdu->buf, len, &to);
+    if (!ret)
+        ret = wii_read_events(format, &to);
+    if (ret)
+        return ret;
+    io_uring_cmd_mark_cancelable(ioucmd, issue_flags);
+    ret = wii_uring_park(ioucmd);
+    if (ret)
+        io_uring_cmd_done(ioucmd, ret, 0, issue_flags); // marked now, only done takes it off the cancel list
+    return -EIOCBQUEUED;
+}
+
+/* sends the 0x15 and waits for the 0x20 it brings back, returns the battery level */
+static int wii_uring_status(struct wii_remote *wr)
+{
+    u8 status_request[2] = { 0x15, 0x00 };
+    unsigned int seq = READ_ONCE(wr->status_seq);
+    long left;
+    int ret;
+
+    ret = wii_send_output(wr->hdev, status_request, sizeof(status_request));
+    if (ret)
+        return ret;
+    left = wait_event_interruptible_timeout(wr->status_wait, READ_ONCE(wr->status_seq) != seq,
+                                            msecs_to_jiffies(READ_TIMEOUT_MS));
+    if (left < 0)
+        return -EINTR;
+    if (!left)
+        return -ETIMEDOUT;
+    return READ_ONCE(wii_last_battery);
+}
+
+/* 16 bytes a 0x17, ext_lock so it doesnt get the extension work's answers. returns bytes read */
+static int wii_uring_read_mem(struct wii_remote *wr, u8 __user *buf, u32 len, u32 arg)
+{
+    u8 space = arg & WII_URING_MEM_EEPROM ? 0x00 : 0x04;
+    u32 addr = arg & 0xffffff;
+    u32 done = 0;
+    u8 chunk[16];
+    int ret = 0;
+
+    if (!len || len > WII_URING_MEM_MAX || addr + len > 0x1000000)
+        return -EINVAL;
+    if (mutex_lock_interruptible(&wr->ext_lock))
+        return -EINTR;
+    while (done < len) {
+        u8 n = min_t(u32, len - done, sizeof(chunk));
+
+        ret = wii_read_memory(wr, space, addr + done, chunk, n);
+        if (!ret && copy_to_user(buf + done, chunk, n))
+            ret = -EFAULT;
+        if (ret)
+            break;
+        done += n;
+    }
+    mutex_unlock(&wr->ext_lock);
+    return done ? done : ret;
+}
+
+static int wii_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+    const struct wii_uring_cmd *c;
+    struct wii_remote *wr;
+    u64 addr;
+    u32 len, arg;
+    int ret;
+
+    if (issue_flags & IO_URING_F_CANCEL)
+        return wii_uring_cancel(ioucmd, issue_flags);
+
+    c = io_uring_sqe_cmd(ioucmd->sqe);
+    addr = READ_ONCE(c->addr);
+    len = READ_ONCE(c->len);
+    arg = READ_ONCE(c->arg);
+
+    switch (ioucmd->cmd_op) {
+    case WII_URING_READ:
+        return wii_uring_read(ioucmd, addr, len, issue_flags);
+    case WII_URING_STATUS:
+    case WII_URING_LEDS:
+    case WII_URING_RUMBLE:
+    case WII_URING_READ_MEM:
+        break;
+    default:
+        return -ENOTTY;
+    }
+
+    if (issue_flags & IO_URING_F_NONBLOCK)
+        return -EAGAIN; // these sleep, io_uring reissues them from a worker
+    wr = wii_io_get();
+    if (!wr)
+        return -ENODEV;
+    switch (ioucmd->cmd_op) {
+    case WII_URING_STATUS:
+        ret = wii_uring_status(wr);
+        break;
+    case WII_URING_LEDS: {
+        u8 req[2] = { 0x11, (arg & 0x0f) << 4 };
+
+        WRITE_ONCE(wr->leds, arg & 0x0f);
+        ret = wii_send_output(wr->hdev, req, sizeof(req));
+        break;
+    }
+    case WII_URING_RUMBLE: {
+        u8 req[2] = { 0x10, 0x00 }; // wii_send_output puts the bit in
+
+        WRITE_ONCE(wr->rumble, !!arg);
+        ret = wii_send_output(wr->hdev, req, sizeof(req));
+        break;
+    }
+    default:
+        ret = wii_uring_read_mem(wr, u64_to_user_ptr(addr), len, arg);
+        break;
+    }
+    wii_io_put(wr);
+    return ret;
+}
+
 /*
  * this is the structure for the file ops with the char device
  * basically the kernel calls these commands when the userspace app
@@ -259,8 +2587,12 @@ static struct file_operations fops = {
     .owner          = THIS_MODULE,
     .open           = device_open,
     .release        = device_release,
-    .read           = device_read,
+    .read_iter      = device_read_iter,
+    .splice_read    = copy_splice_read, // the pipe pages are filled straight from the buffer, no user copy in between
+    .poll           = device_poll,
+    .write          = device_write,
     .unlocked_ioctl = device_ioctl,
+    .uring_cmd      = wii_uring_cmd,
 };
 
 /*
@@ -272,9 +2604,40 @@ static struct file_operations fops = {
 */
 static int wii_proc_show(struct seq_file *m, void *v)
 {
+    struct wii_remote *wr;
+
     seq_printf(m, "Wii Remote Driver State:\n");
     seq_printf(m, "  Connected: %s\n", wii_connected ? "Yes" : "No");
     seq_printf(m, "  Last Battery: %d\n", wii_last_battery);
+    seq_printf(m, "  Buffer Size: %d\n", CIRC_BUFFER_SIZE);
+    mutex_lock(&circ_mutex);
+    seq_printf(m, "  Dropped Bytes: %lu\n", wii_dropped_bytes);
+    mutex_unlock(&circ_mutex);
+    spin_lock_irq(&record_lock);
+    seq_printf(m, "  Dropped Records: %lu\n", wii_dropped_records);
+    spin_unlock_irq(&record_lock);
+    /* no reference needed, nothing in here sleeps and kfree_rcu waits for us */
+    rcu_read_lock();
+    wr = rcu_dereference(wii_dev);
+    if (wr) {
+        seq_printf(m, "  MotionPlus: %s\n", wr->mp_mode == WII_MP_OFF ? "off" :
+                   wr->mp_mode == WII_MP_NUNCHUK ? "nunchuk passthrough" : "on");
+        seq_printf(m, "  Extension: %s\n", wii_ext_name(READ_ONCE(wr->ext_type)));
+        seq_printf(m, "  LEDs: %x, Rumble: %s\n", READ_ONCE(wr->leds), READ_ONCE(wr->rumble) ? "on" : "off");
+        spin_lock_irq(&wr->spk_lock);
+        if (wr->spk_cfg.format == WII_SPEAKER_OFF)
+            seq_printf(m, "  Speaker: off\n");
+        else
+            seq_printf(m, "  Speaker: %s %uHz%s, queued %u, sent %lu, underruns %lu\n",
+                       wr->spk_cfg.format == WII_SPEAKER_ADPCM ? "adpcm" : "pcm8",
+                       wr->spk_cfg.rate, wr->spk_ready ? "" : " (setting up)",
+                       wr->spk_head - wr->spk_tail, wr->spk_sent, wr->spk_underruns);
+        spin_unlock_irq(&wr->spk_lock);
+        /* bias as counts off 8192, in 1/256ths */
+        seq_printf(m, "  Gyro Bias: %d %d %d\n", wr->bias_q8[0] - (MP_ZERO << 8),
+                   wr->bias_q8[1] - (MP_ZERO << 8), wr->bias_q8[2] - (MP_ZERO << 8));
+    }
+    rcu_read_unlock();
     return 0;
 }
 
@@ -304,6 +2667,62 @@ static const struct proc_ops wii_proc_ops = {
 };
 
 /* Character device variables */
+/* WII_NL_CMD_STATUS asked for, so a listener that just joined doesnt have to wait for news */
+static int wii_nl_get_status(struct sk_buff *skb, struct genl_info *info)
+{
+    struct wii_remote *wr = wii_get();
+    struct sk_buff *msg;
+    void *hdr;
+    int ret = -ENOMEM;
+
+    if (!wr)
+        return -ENODEV;
+    msg = genlmsg_new(WII_NL_MSG_SIZE, GFP_KERNEL);
+    if (!msg)
+        goto out;
+    hdr = genlmsg_put_reply(msg, info, &wii_nl_family, 0, WII_NL_CMD_STATUS);
+    if (!hdr || nla_put_string(msg, WII_NL_A_DEVICE, wr->name) ||
+        nla_put_u64_64bit(msg, WII_NL_A_TIMESTAMP, ktime_get_ns(), WII_NL_A_PAD) ||
+        wii_nl_put_status(msg, wr)) {
+        nlmsg_free(msg);
+        ret = -EMSGSIZE;
+        goto out;
+    }
+    genlmsg_end(msg, hdr);
+    ret = genlmsg_reply(msg, info);
+out:
+    wii_put(wr);
+    return ret;
+}
+
+static const struct nla_policy wii_nl_policy[WII_NL_A_MAX + 1] = {
+    [WII_NL_A_DEVICE] = { .type = NLA_NUL_STRING },
+};
+
+static const struct genl_small_ops wii_nl_ops[] = {
+    { .cmd = WII_NL_CMD_STATUS, .doit = wii_nl_get_status },
+};
+
+/* the index is the WII_NL_GRP_* */
+static const struct genl_multicast_group wii_nl_groups[] = {
+    [WII_NL_GRP_BUTTONS] = { .name = "buttons" },
+    [WII_NL_GRP_MOTION]  = { .name = "motion" },
+    [WII_NL_GRP_STATUS]  = { .name = "status" },
+    [WII_NL_GRP_HOTPLUG] = { .name = "hotplug" },
+};
+
+static struct genl_family wii_nl_family = {
+    .name       = WII_NL_FAMILY,
+    .version    = WII_NL_VERSION,
+    .maxattr    = WII_NL_A_MAX,
+    .policy     = wii_nl_policy,
+    .module     = THIS_MODULE,
+    .small_ops  = wii_nl_ops,
+    .n_small_ops = ARRAY_SIZE(wii_nl_ops),
+    .mcgrps     = wii_nl_groups,
+    .n_mcgrps   = ARRAY_SIZE(wii_nl_groups),
+};
+
 static int major;
 static struct class *wii_class; // the devices class
 static struct cdev wii_cdev; // struct to register device
@@ -316,29 +2735,59 @@ static struct cdev wii_cdev; // struct to register device
  */
 static int wii_raw_event(struct hid_device *hdev, struct hid_report *report, u8 *data, int size)
 {
-    int i;
-    printk(KERN_INFO "wii_raw_event: received report: ");
-    for (i = 0; i < size; i++)
-        printk(KERN_CONT "%02x ", data[i]);
-    printk(KERN_CONT "\n");
+    struct wii_remote *wr = hid_get_drvdata(hdev);
+
+    /* 100 of these a second in continuous mode, so only with dynamic debug on */
+    hid_dbg(hdev, "report: %*ph\n", min(size, 22), data);
+
+    /* everything from 0x20 up has the buttons in bytes 1-2, except 0x3d which is all extension */
+    if (size >= 3 && data[0] >= 0x20 && data[0] != 0x3d)
+        wii_keys_report(wr, data[1] | (data[2] << 8));
 
     if (size > 0 && data[0] == 0x20) {
         /*
          * this is the check for the battery report
         */
-        printk(KERN_INFO "Battery status report detected.\n");
-        if (size >= 2) {
+        hid_dbg(hdev, "battery status report\n");
+        if (size >= 7) {
             char battery_output[64];
-            int len = snprintf(battery_output, sizeof(battery_output), "Battery: %d\n", data[1]);
-            /* cache the battery level */
-            wii_last_battery = data[1];
+            int len = snprintf(battery_output, sizeof(battery_output), "Battery: %d\n", data[6]);
+            /* cache the battery level, byte 6. bytes 1-2 are the buttons like every other report */
+            wii_last_battery = data[6];
             circ_buffer_write(battery_output, len);
+            wii_nl_status(wr);
+            WRITE_ONCE(wr->status_seq, wr->status_seq + 1);
+            wake_up_interruptible(&wr->status_wait);
+        }
+        /*
+         * bit 1 of byte 3 is the extension port. the remote sends one of these by itself
+         * whenever that changes and then stops reporting until the mode is set again,
+         * the work item sorts both out. asked for ones (battery) dont need anything
+        */
+        if (size >= 4 && !!(data[3] & 0x02) != wr->ext_plugged) {
+            wr->ext_plugged = data[3] & 0x02;
+            if (!READ_ONCE(wr->gone))
+                schedule_work(&wr->ext_work);
         }
     } else {
+        /* the answer to wii_read_register, byte 3 is size-1 << 4 | error */
+        if (size >= 22 && data[0] == 0x21) {
+            wr->read_err = data[3] & 0x0f;
+            memcpy(wr->read_buf, data + 6, sizeof(wr->read_buf));
+            complete(&wr->read_done);
+        }
         /*
          * then if its anything else just perform input mapping
+         * in continuous mode (MotionPlus, extensions) reports come 100 a second whether anything
+         * changed or not, text readers only care about buttons so they only get a line when those change
         */
-        perform_input_mapping(data, size);
+        u16 buttons = size >= 3 ? (data[1] | (data[2] << 8)) : 0;
+        if (!READ_ONCE(wr->continuous) || buttons != wr->last_buttons)
+            perform_input_mapping(data, size);
+        wr->last_buttons = buttons;
+        if (size > 0)
+            wii_motion_report(wr, data, size);
+        wii_pointer_report(wr, data, size);
     }
     return 0;
 }
@@ -346,29 +2795,135 @@ static int wii_raw_event(struct hid_device *hdev, struct hid_report *report, u8
 /* HID probe: called when a matching device is connected */
 static int wii_probe(struct hid_device *hdev, const struct hid_device_id *id)
 {
-    int ret;
+    struct wii_remote *wr;
+    int ret, i;
+
+    // not devm, an ioctl or write can still hold it after remove. the last wii_put frees it
+    wr = kzalloc(sizeof(*wr), GFP_KERNEL);
+    if (!wr)
+        return -ENOMEM;
+    wr->hdev = hdev;
+    strscpy(wr->name, dev_name(&hdev->dev), sizeof(wr->name));
+    kref_init(&wr->ref);
+    init_rwsem(&wr->io_lock);
+    wr->mp_mode = motionplus;
+    for (i = 0; i < 3; i++)
+        wr->bias_q8[i] = MP_ZERO << 8;
+    INIT_WORK(&wr->mp_work, wii_motionplus_work);
+    INIT_WORK(&wr->ext_work, wii_extension_work);
+    mutex_init(&wr->ext_lock);
+    init_completion(&wr->read_done);
+    init_waitqueue_head(&wr->status_wait);
+    INIT_WORK(&wr->spk_work, wii_speaker_work);
+    INIT_WORK(&wr->spk_send_work, wii_speaker_send_work);
+    hrtimer_setup(&wr->spk_timer, wii_speaker_tick, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    spin_lock_init(&wr->spk_lock);
+    mutex_init(&wr->spk_mutex);
+    init_waitqueue_head(&wr->spk_wait);
+    hrtimer_setup(&wr->ptr_timer, wii_pointer_tick, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    spin_lock_init(&wr->ptr_lock);
+    hrtimer_setup(&wr->chord_timer, wii_chord_tick, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    spin_lock_init(&wr->chord_lock);
+    wr->chord_pending = wr->chord_active = -1;
+    wr->ptr_speed = 200;
+    wr->ptr_accel = 800;
+    wr->ptr_max = 1500;
+    wr->ptr_deadzone = 8;
+    wr->spk_report = devm_kmalloc(&hdev->dev, SPK_REPORT_BYTES, GFP_KERNEL);
+    if (!wr->spk_report) {
+        ret = -ENOMEM;
+        goto err;
+    }
+    hid_set_drvdata(hdev, wr); // raw_event can fire as soon as hid_hw_start returns
 
     ret = hid_parse(hdev); // parses the report descriptor
     if (ret) // checks if the result is malformed
-        return ret;
+        goto err;
 
     ret = hid_hw_start(hdev, HID_CONNECT_DEFAULT); // this just initialises the device
                                                    // tells it to start sending reports
     if (ret) // same check as above pretty much if the init fails error
-        return ret;
+        goto err;
+
+    wr->keys = wii_keys_create(hdev, wr);
+    if (!wr->keys)
+        hid_warn(hdev, "no button input device, the text still has them\n");
+    wr->motion = wii_motion_create(hdev);
+    if (!wr->motion)
+        hid_warn(hdev, "no motion input device, records still work\n");
+
+    wr->sysfs_ok = !sysfs_create_group(&hdev->dev.kobj, &wii_attr_group);
+    if (!wr->sysfs_ok)
+        hid_warn(hdev, "no pointer_* or chords sysfs attributes\n");
 
-    wii_hid_dev = hdev; // sets our HID device global variab to hdev which is the device
+    spin_lock(&wii_dev_lock);
+    list_add(&wr->node, &wii_remotes);
+    rcu_assign_pointer(wii_dev, wr); // the char device and proc talk to this one now
+    spin_unlock(&wii_dev_lock);
     wii_connected = 1; // for proc
+    wii_nl_hotplug(wr, true);
+    if (wr->mp_mode != WII_MP_OFF) {
+        schedule_work(&wr->mp_work);
+    } else {
+        /* the answer says if anything is in the extension port, raw_event takes it from there */
+        u8 status_request[2] = { 0x15, 0x00 };
+        if (wii_send_output(hdev, status_request, sizeof(status_request)) < 0)
+            hid_warn(hdev, "no status report, extensions wont be found until one comes\n");
+    }
     printk(KERN_INFO DRIVER_NAME ": Wii remote connected\n");
     return 0;
+
+err:
+    kfree(wr); // nobody else has seen it yet
+    return ret;
 }
 
 /* HID remove: called when the device is disconnected */
 static void wii_remove(struct hid_device *hdev)
 {
-    wii_hid_dev = NULL;
-    wii_connected = 0;
+    struct wii_remote *wr = hid_get_drvdata(hdev);
+    bool connected;
+
+    wii_nl_hotplug(wr, false);
+    /*
+     * new lookups miss it, ones that already have it hold a reference.
+     * if it was the current one the next newest takes over, its still on the
+     * list so its remove hasnt started and probe's reference keeps it alive
+     */
+    spin_lock(&wii_dev_lock);
+    list_del(&wr->node);
+    if (rcu_dereference_protected(wii_dev, lockdep_is_held(&wii_dev_lock)) == wr)
+        rcu_assign_pointer(wii_dev, list_first_entry_or_null(&wii_remotes, struct wii_remote, node));
+    connected = !list_empty(&wii_remotes);
+    spin_unlock(&wii_dev_lock);
+    /* waits for any ioctl in the middle of talking to it, the rest see gone */
+    down_write(&wr->io_lock);
+    wr->gone = true;
+    up_write(&wr->io_lock);
+
+    sysfs_remove_group(&hdev->dev.kobj, &wii_attr_group); // waits out any store still running
+    cancel_work_sync(&wr->mp_work); // it uses hdev, has to be done before the device goes
+    cancel_work_sync(&wr->ext_work);
+    /* writers still waiting give up with -EIO, then nothing can start the timer again */
+    spin_lock_irq(&wr->spk_lock);
+    wr->spk_cfg.format = WII_SPEAKER_OFF;
+    wr->spk_ready = false;
+    spin_unlock_irq(&wr->spk_lock);
+    wake_up_interruptible(&wr->spk_wait);
+    cancel_work_sync(&wr->spk_work);
+    hrtimer_cancel(&wr->spk_timer);
+    cancel_work_sync(&wr->spk_send_work);
+    hid_hw_stop(hdev); // no more raw_event after this
+    /*
+     * a 0x20 that came in before the stop can have queued it again after the
+     * cancel above, it sees gone and does nothing but it cant outlive wr
+     */
+    cancel_work_sync(&wr->ext_work);
+    hrtimer_cancel(&wr->ptr_timer); // only raw_event starts it, so it stays stopped
+    hrtimer_cancel(&wr->chord_timer); // same
+    wii_connected = connected; // another one may still be there
     printk(KERN_INFO DRIVER_NAME ": Wii remote disconnected\n");
+    wii_put(wr); // probe's reference, freed now unless an ioctl, write or /proc still has it
 }
 
 /* HID device ID table for the Wii remote.
@@ -435,9 +2990,21 @@ static int __init wii_init(void)
     device_create(wii_class, NULL, dev, NULL, DEVICE_NAME); // creates a device node
     // ^ NULL - no parent device, NULL 2 just means no device specific data
 
+    // before the HID driver so the first probe already has somewhere to send hotplug
+    ret = genl_register_family(&wii_nl_family);
+    if (ret) {
+        device_destroy(wii_class, dev);
+        class_destroy(wii_class);
+        cdev_del(&wii_cdev);
+        unregister_chrdev_region(dev, 1);
+        printk(KERN_ERR DRIVER_NAME ": failed to register netlink family\n");
+        return ret;
+    }
+
     // registers a HID device
     ret = hid_register_driver(&wii_driver);
     if (ret) {
+        genl_unregister_family(&wii_nl_family);
         device_destroy(wii_class, dev);
         class_destroy(wii_class);
         cdev_del(&wii_cdev);
@@ -461,6 +3028,7 @@ static void __exit wii_exit(void)
     }
 
     hid_unregister_driver(&wii_driver);
+    genl_unregister_family(&wii_nl_family);
     device_destroy(wii_class, dev);
     class_destroy(wii_class);
     cdev_del(&wii_cdev);
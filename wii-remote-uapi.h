@@ -0,0 +1,212 @@
+/*
+ * wii-remote-uapi.h - the driver's binary interface, shared by
+ * wii-remote-driver.c and the user space tools so there is one copy of it.
+ *
+ * Everything a program can see without parsing text lives here: ioctl numbers,
+ * the record read() hands out in WII_FORMAT_RECORDS, the netlink family and the
+ * io_uring commands. WIIMOTE_IOCTL_GET_INFO says which of them the running
+ * driver has, so a client can pick the best one at startup instead of trying
+ * each and seeing what fails.
+ *
+ * With more than one remote connected the ioctls, write(), the io_uring
+ * commands and WII_NL_CMD_STATUS go to one of them, the newest. When it goes
+ * away the next newest takes over. read() and the netlink events carry every
+ * remote's reports.
+ *
+ * Only ever add to it: new fields go at the end of a struct, new values get new
+ * numbers, and WII_ABI_VERSION goes up when something is added.
+ */
+
+#ifndef WII_REMOTE_UAPI_H
+#define WII_REMOTE_UAPI_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* 1: first versioned one, everything up to GET_INFO */
+#define WII_ABI_VERSION 1
+
+/* asks the remote for a status report, the battery level comes back as a "Battery: N" line */
+#define WIIMOTE_IOCTL_REQUEST_STATUS _IO('W', 1)
+/* picks what read() gives this open file, WII_FORMAT_TEXT (the default) or WII_FORMAT_RECORDS */
+#define WIIMOTE_IOCTL_SET_FORMAT     _IOW('W', 2, int)
+/* turns the MotionPlus on/off, WII_MP_* */
+#define WIIMOTE_IOCTL_SET_MOTIONPLUS _IOW('W', 3, int)
+/* sets the speaker up (or turns it off), see struct wii_speaker_config */
+#define WIIMOTE_IOCTL_SET_SPEAKER    _IOW('W', 4, struct wii_speaker_config)
+/* fills in a struct wii_info, works with a shorter or longer one too (see there) */
+#define WIIMOTE_IOCTL_GET_INFO       _IOR('W', 5, struct wii_info)
+
+#define WII_FORMAT_TEXT    0
+#define WII_FORMAT_RECORDS 1
+
+#define WII_MP_OFF     0
+#define WII_MP_ON      1
+#define WII_MP_NUNCHUK 2    /* MotionPlus with a nunchuk passed through it */
+
+/*
+ * the speaker. once its set, write() signed 16 bit host endian mono samples
+ * at rate to the device and they play, a write blocks while the driver's
+ * queue is full
+ */
+#define WII_SPEAKER_OFF   0
+#define WII_SPEAKER_ADPCM 1     /* 4 bit Yamaha ADPCM, 40 samples a report, volume 0-64 */
+#define WII_SPEAKER_PCM8  2     /* signed 8 bit, 20 samples a report, volume 0-255 */
+
+struct wii_speaker_config {
+    __u8  format;       /* WII_SPEAKER_* */
+    __u8  volume;
+    __u16 rate;         /* samples a second, 1000-6000, 3000 is the usual for ADPCM */
+};
+
+/* the pointer_mode sysfs attribute, by name there and by number in struct wii_info */
+#define WII_POINTER_OFF  0
+#define WII_POINTER_DPAD 1      /* held directions move a relative pointer */
+#define WII_POINTER_TILT 2      /* so does tilting the remote, further = faster */
+#define WII_POINTER_IR   3      /* the camera, absolute */
+
+/*
+ * binary records, what read() gives after WIIMOTE_IOCTL_SET_FORMAT with
+ * WII_FORMAT_RECORDS. one per report that has accel or a known extension in
+ * it (so 100 a second with the MotionPlus or a classic controller on), accel
+ * is 0 in the ones that dont carry it (0x32/0x34). read() only hands out
+ * whole ones, so a buffer smaller than one gets 0
+ */
+struct wii_motion_record {
+    __u64 t_ns;         /* ktime_get_ns() when the report came in, same as T= and CLOCK_MONOTONIC */
+    __s32 gyro[3];      /* millidegrees/s about x (pitch), y (roll), z (yaw), bias taken off */
+    __u16 accel[3];     /* raw 10 bit, about 512 is 0g */
+    __u16 buttons;      /* byte 1 | byte 2 << 8, same as the text (mask it, the spare bits are accel) */
+    __u8  report_id;
+    __u8  flags;        /* WII_MOTION_* */
+    __u8  stick[2];     /* nunchuk stick when WII_MOTION_NUNCHUK, classic left stick (0-63) */
+    __u8  ext;          /* WII_EXT_*, what the extension bytes of this report came from */
+    __u8  trigger[2];   /* classic L, R (0-31) */
+    __u8  right_stick[2]; /* classic (0-31) */
+    __u8  reserved;
+    __u16 ext_buttons;  /* WII_CLASSIC_* held */
+};
+
+#define WII_MOTION_GYRO    0x01 /* gyro[] is real, the MotionPlus sent this one */
+#define WII_MOTION_SLOW_X  0x02 /* that axis was in slow (precise) mode */
+#define WII_MOTION_SLOW_Y  0x04
+#define WII_MOTION_SLOW_Z  0x08
+#define WII_MOTION_STILL   0x10 /* remote looked still, the bias was updated from this one */
+#define WII_MOTION_NUNCHUK 0x20 /* passthrough nunchuk data, stick[] and the C/Z bits are real */
+#define WII_MOTION_C       0x40
+#define WII_MOTION_Z       0x80
+
+#define WII_EXT_NONE        0
+#define WII_EXT_NUNCHUK     1
+#define WII_EXT_CLASSIC     2
+#define WII_EXT_CLASSIC_PRO 3
+#define WII_EXT_MOTIONPLUS  4
+#define WII_EXT_UNKNOWN     5   /* something answered but its not one we know */
+#define WII_EXT_BALANCE_BOARD 6 /* never in a record, the board only goes out as input events */
+
+/*
+ * classic buttons, laid out like extension bytes 4 and 5 (byte 5 in the high
+ * half) but set when pressed, the controller sends them active low
+ */
+#define WII_CLASSIC_RIGHT 0x0080
+#define WII_CLASSIC_DOWN  0x0040
+#define WII_CLASSIC_L     0x0020 /* the click at the bottom of the analog trigger */
+#define WII_CLASSIC_MINUS 0x0010
+#define WII_CLASSIC_HOME  0x0008
+#define WII_CLASSIC_PLUS  0x0004
+#define WII_CLASSIC_R     0x0002
+#define WII_CLASSIC_ZL    0x8000
+#define WII_CLASSIC_B     0x4000
+#define WII_CLASSIC_Y     0x2000
+#define WII_CLASSIC_A     0x1000
+#define WII_CLASSIC_X     0x0800
+#define WII_CLASSIC_ZR    0x0400
+#define WII_CLASSIC_LEFT  0x0200
+#define WII_CLASSIC_UP    0x0100
+#define WII_CLASSIC_MASK  0xfffe
+
+/*
+ * generic netlink, family WII_NL_FAMILY with the multicast groups "buttons",
+ * "motion", "status" and "hotplug" (resolve them through the genl controller,
+ * wii-nlmon does). every message has WII_NL_A_DEVICE and WII_NL_A_TIMESTAMP,
+ * then whatever its command carries. WII_NL_CMD_STATUS sent to the family
+ * answers with a status message
+ */
+#define WII_NL_FAMILY  "wii_remote"
+#define WII_NL_VERSION 1
+
+#define WII_NL_CMD_BUTTONS 1    /* the buttons changed, WII_NL_A_BUTTONS */
+#define WII_NL_CMD_MOTION  2    /* WII_NL_A_RECORD */
+#define WII_NL_CMD_STATUS  3    /* battery or extension news, WII_NL_A_BATTERY (if known), WII_NL_A_EXT */
+#define WII_NL_CMD_HOTPLUG 4    /* a remote came or went, WII_NL_A_CONNECTED */
+
+#define WII_NL_A_DEVICE    1    /* string, the hid device (0005:057E:0306.000N) */
+#define WII_NL_A_TIMESTAMP 2    /* u64, ktime_get_ns() same as T= */
+#define WII_NL_A_BUTTONS   3    /* u16, byte 1 | byte 2 << 8 buttons only */
+#define WII_NL_A_RECORD    4    /* struct wii_motion_record */
+#define WII_NL_A_BATTERY   5    /* u8, raw level from byte 6 of the last 0x20 status report, left out till one came */
+#define WII_NL_A_EXT       6    /* u8, WII_EXT_* */
+#define WII_NL_A_CONNECTED 7    /* u8, 1 on probe, 0 on remove */
+#define WII_NL_A_PAD       8
+#define WII_NL_A_MAX       8
+
+/*
+ * io_uring, an IORING_OP_URING_CMD on the open device with cmd_op one of these
+ * and a struct wii_uring_cmd in the SQE's command area. res in the CQE is what
+ * read() / the request would have returned. WII_URING_READ completes as soon
+ * as there is at least one event in the file's format, so a few of them in
+ * flight is a batched reader
+ */
+#define WII_URING_READ     1    /* up to len bytes into addr, res is bytes read */
+#define WII_URING_STATUS   2    /* asks for a status report, res is the battery level once it comes */
+#define WII_URING_LEDS     3    /* arg bits 0-3 are LEDs 1-4 */
+#define WII_URING_RUMBLE   4    /* arg 0 stops it, anything else starts it */
+#define WII_URING_READ_MEM 5    /* len (up to WII_URING_MEM_MAX) bytes from the remote address in arg into addr */
+
+#define WII_URING_MEM_EEPROM 0x80000000u    /* or into arg to read the EEPROM, not register space */
+#define WII_URING_MEM_MAX    256
+
+/* has to fit the 16 bytes a normal (not SQE128) SQE has for the command */
+struct wii_uring_cmd {
+    __u64 addr;         /* user buffer for READ and READ_MEM */
+    __u32 len;
+    __u32 arg;
+};
+
+/* what the driver can do, WII_FEATURE_* in struct wii_info */
+#define WII_FEATURE_TEXT       (1ull << 0)  /* text lines from read() */
+#define WII_FEATURE_RECORDS    (1ull << 1)  /* WII_FORMAT_RECORDS */
+#define WII_FEATURE_MOTIONPLUS (1ull << 2)  /* WIIMOTE_IOCTL_SET_MOTIONPLUS */
+#define WII_FEATURE_SPEAKER    (1ull << 3)  /* WIIMOTE_IOCTL_SET_SPEAKER and write() */
+#define WII_FEATURE_NETLINK    (1ull << 4)  /* the WII_NL_FAMILY generic netlink family */
+#define WII_FEATURE_URING      (1ull << 5)  /* WII_URING_* commands */
+#define WII_FEATURE_POLL       (1ull << 6)  /* poll(), read_iter and splice() on the device */
+/* and what the connected remote has right now */
+#define WII_FEATURE_KEYS       (1ull << 16) /* the "Nintendo Wii Remote" evdev device with the keymap */
+#define WII_FEATURE_MOTION_DEV (1ull << 17) /* the "Nintendo Wii Remote Motion" evdev device */
+#define WII_FEATURE_SYSFS      (1ull << 18) /* pointer_* and chords attributes on the hid device */
+
+/*
+ * WIIMOTE_IOCTL_GET_INFO. fields only ever get added at the end and the
+ * ioctl number carries the caller's sizeof, so the driver fills in as much
+ * as both sides know about and zeroes the rest, size says how much was its.
+ * a driver older than this gives ENOTTY, treat that as text only
+ */
+struct wii_info {
+    __u32 size;             /* bytes the driver filled in, never more than the caller's struct */
+    __u32 abi_version;      /* WII_ABI_VERSION the driver was built with */
+    __u64 features;         /* WII_FEATURE_* */
+    __u32 report_modes;     /* bit n set: the driver decodes data report 0x30 + n */
+    __u32 text_buffer_size; /* bytes in the text circular buffer */
+    __u32 record_ring_size; /* slots in the record ring, one less than that can be queued */
+    __u32 record_size;      /* sizeof(struct wii_motion_record) */
+    __u8  connected;        /* a remote is there now, the rest below is about it */
+    __u8  ext_type;         /* WII_EXT_* */
+    __u8  mp_mode;          /* WII_MP_* */
+    __u8  pointer_mode;     /* WII_POINTER_* */
+    __u8  report_mode;      /* data report the remote was last asked for, 0 before the first */
+    __u8  leds;             /* bits 0-3, LEDs 1-4 */
+    __s16 battery;          /* raw level, byte 6 of the last 0x20 status report. -1 till one came */
+};
+
+#endif /* WII_REMOTE_UAPI_H */
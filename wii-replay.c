@@ -0,0 +1,251 @@
+/*
+ * wii-replay.c - plays a capture file (mouse_test --record) back with its original timing.
+ *
+ * Two places to send it:
+ *   --sink=uhid    a pretend remote on /dev/uhid, so the reports go through the
+ *                  real driver and anything reading /dev/wii_remote (the client,
+ *                  wii-daemon) sees them like a real session
+ *   --sink=decode  straight into the client's decoder (the line is printed the
+ *                  way the driver would and parsed back with wii_event_feed()),
+ *                  every decoded event is checked against what was recorded
+ *
+ * Timing is absolute deadlines on CLOCK_MONOTONIC with clock_nanosleep, the
+ * last --spin-us of each wait is a busy loop since the scheduler wakeup alone
+ * is usually 50us+ late. --speed=N plays N times faster, --fast doesnt wait at all.
+ * At the end it prints how late each report went out compared to its deadline.
+ *
+ * usage: wii-replay [--sink=uhid|decode] [--speed=N] [--fast] [--spin-us=N] [--verbose] capture
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wii-capture.h"
+#include "wii-event.h"
+#include "wii-metrics.h"
+#include "wii-uhid.h"
+
+#define DEFAULT_SPIN_US 50
+#define UHID_DRAIN_EVERY 32
+#define UHID_START_TIMEOUT_MS 2000
+
+enum sink { SINK_UHID, SINK_DECODE };
+
+struct replay {
+    enum sink sink;
+    double speed;       /* 0 = as fast as possible */
+    uint64_t spin_ns;
+    int verbose;
+
+    int uhid_fd;
+    struct wii_line_buf lines;
+    uint16_t expect_buttons;
+    int expect_type;
+    uint64_t mismatches;
+
+    uint64_t records;
+    uint64_t send_errors;
+    uint64_t late_hist[WII_HIST_BUCKETS];
+    uint64_t late_sum;
+    uint64_t late_max;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+static void sleep_until(uint64_t target, uint64_t spin_ns)
+{
+    if (target > spin_ns && wii_now_ns() < target - spin_ns) {
+        struct timespec ts = {
+            .tv_sec = (time_t)((target - spin_ns) / 1000000000ull),
+            .tv_nsec = (long)((target - spin_ns) % 1000000000ull),
+        };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && running)
+            ;
+    }
+    while (wii_now_ns() < target)
+        ;
+}
+
+static void check_event(const struct wii_event *ev, void *ctx)
+{
+    struct replay *r = ctx;
+
+    if (ev->type != r->expect_type ||
+        (ev->type == WII_EVENT_BUTTONS && ev->buttons != r->expect_buttons))
+        r->mismatches++;
+}
+
+static void sink_decode(struct replay *r, const struct wii_capture_record *rec,
+                        const uint8_t *report)
+{
+    char line[WII_LINE_MAX];
+    int n = wii_event_format_report(report, rec->report_len, rec->driver_ns, line, sizeof(line));
+
+    if (n <= 0)
+        return;
+    if (n >= (int)sizeof(line))
+        n = sizeof(line) - 1;
+    if (r->verbose)
+        fwrite(line, 1, n, stdout);
+
+    r->expect_type = rec->type & WII_CAPTURE_TYPE_MASK;
+    r->expect_buttons = rec->buttons;
+    if (wii_event_feed(&r->lines, line, n, wii_now_ns(), check_event, r) != 1)
+        r->mismatches++;
+}
+
+static void sink_uhid(struct replay *r, const uint8_t *report, size_t len)
+{
+    if (wii_uhid_send(r->uhid_fd, report, len) < 0)
+        r->send_errors++;
+    if (r->records % UHID_DRAIN_EVERY == 0)
+        wii_uhid_drain(r->uhid_fd);
+}
+
+static uint64_t late_percentile(const struct replay *r, double p)
+{
+    uint64_t want = (uint64_t)(p * r->records), seen = 0;
+    int b;
+
+    for (b = 0; b < WII_HIST_BUCKETS; b++) {
+        seen += r->late_hist[b];
+        if (seen > want) /* top of the bucket, but never past what was really seen */
+            return wii_hist_bucket_max(b) < r->late_max ? wii_hist_bucket_max(b) : r->late_max;
+    }
+    return r->late_max;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [--sink=uhid|decode] [--speed=N] [--fast] [--spin-us=N] "
+                    "[--verbose] capture\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "sink",    required_argument, NULL, 's' },
+        { "speed",   required_argument, NULL, 'x' },
+        { "fast",    no_argument,       NULL, 'f' },
+        { "spin-us", required_argument, NULL, 'p' },
+        { "verbose", no_argument,       NULL, 'v' },
+        { NULL, 0, NULL, 0 },
+    };
+    struct replay r = { .sink = SINK_UHID, .speed = 1.0, .spin_ns = DEFAULT_SPIN_US * 1000ull,
+                        .uhid_fd = -1 };
+    struct wii_capture_reader reader;
+    struct wii_capture_record rec;
+    uint8_t report[WII_CAPTURE_REPORT_MAX];
+    uint64_t first_ns = 0, start_ns = 0, end_ns;
+    int opt, ret = 0;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            if (strcmp(optarg, "uhid") == 0)
+                r.sink = SINK_UHID;
+            else if (strcmp(optarg, "decode") == 0)
+                r.sink = SINK_DECODE;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'x':
+            r.speed = atof(optarg);
+            if (r.speed <= 0) {
+                fprintf(stderr, "--speed has to be > 0, use --fast for no waiting\n");
+                return 1;
+            }
+            break;
+        case 'f': r.speed = 0; break;
+        case 'p': r.spin_ns = strtoull(optarg, NULL, 10) * 1000ull; break;
+        case 'v': r.verbose = 1; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (wii_capture_open_read(&reader, argv[optind]) < 0) {
+        perror("Failed to open capture");
+        return 1;
+    }
+
+    if (r.sink == SINK_UHID) {
+        r.uhid_fd = wii_uhid_create("Nintendo RVL-CNT-01 (replay)", UHID_START_TIMEOUT_MS);
+        if (r.uhid_fd < 0) {
+            perror("Failed to create uhid device");
+            return 1;
+        }
+    }
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    while (running && (ret = wii_capture_next(&reader, &rec, report)) == 1) {
+        uint64_t target, now;
+
+        if (r.records == 0) {
+            first_ns = rec.driver_ns;
+            start_ns = wii_now_ns() + 1000000ull; /* 1ms head start so the first one isnt late */
+        }
+
+        target = start_ns;
+        if (r.speed > 0 && rec.driver_ns > first_ns)
+            target += (uint64_t)((double)(rec.driver_ns - first_ns) / r.speed);
+        if (r.speed > 0)
+            sleep_until(target, r.spin_ns);
+
+        if (r.sink == SINK_UHID)
+            sink_uhid(&r, report, rec.report_len);
+        else
+            sink_decode(&r, &rec, report);
+        r.records++;
+
+        if (r.speed > 0) {
+            now = wii_now_ns();
+            now = now > target ? now - target : 0;
+            r.late_hist[wii_hist_bucket(now)]++;
+            r.late_sum += now;
+            if (now > r.late_max)
+                r.late_max = now;
+        }
+    }
+    end_ns = wii_now_ns();
+
+    if (ret < 0)
+        fprintf(stderr, "capture is truncated or corrupt after %llu records\n",
+                (unsigned long long)r.records);
+
+    printf("replayed %llu records in %.3f s (%.0f/s)\n", (unsigned long long)r.records,
+           (double)(end_ns - start_ns) / 1e9,
+           end_ns > start_ns ? r.records / ((double)(end_ns - start_ns) / 1e9) : 0.0);
+    if (r.speed > 0 && r.records)
+        printf("lateness: mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+               (double)r.late_sum / r.records / 1e3, late_percentile(&r, 0.50) / 1e3,
+               late_percentile(&r, 0.99) / 1e3, r.late_max / 1e3);
+    if (r.sink == SINK_DECODE)
+        printf("decode mismatches: %llu\n", (unsigned long long)r.mismatches);
+    if (r.send_errors)
+        printf("uhid send errors: %llu\n", (unsigned long long)r.send_errors);
+
+    wii_uhid_destroy(r.uhid_fd);
+    wii_capture_close_read(&reader);
+    return (ret < 0 || r.mismatches || r.send_errors) ? 1 : 0;
+}
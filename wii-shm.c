@@ -0,0 +1,178 @@
+/*
+ * wii-shm.c - client side of the wii-daemon control socket.
+ *
+ * Link this into anything that wants to read the shared ring, see wii-shm.h
+ * for the protocol.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wii-shm.h"
+
+static long futex(const _Atomic uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, (uint32_t *)uaddr, op, val, timeout, NULL, 0);
+}
+
+/* reads one reply line and the fds that came with it, unused ones are -1 */
+static int recv_reply(int sock, char *line, size_t size, int fd[2])
+{
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct iovec iov = { .iov_base = line, .iov_len = size - 1 };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    struct cmsghdr *cmsg;
+    ssize_t n;
+
+    n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0) {
+        if (n == 0)
+            errno = ECONNRESET;
+        return -1;
+    }
+    line[n] = '\0';
+
+    fd[0] = fd[1] = -1;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        size_t n_fds;
+
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fd, CMSG_DATA(cmsg), (n_fds < 2 ? n_fds : 2) * sizeof(int));
+    }
+    return 0;
+}
+
+int wii_shm_subscribe(const char *socket_path, uint32_t mask,
+                      const struct wii_shm_ring **ring, struct wii_shm_client **client)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    char line[128];
+    struct wii_shm_ring *r = MAP_FAILED;
+    struct wii_shm_client *c;
+    int sock, memfd[2] = { -1, -1 }, slot;
+
+    if (!socket_path)
+        socket_path = WII_DAEMON_SOCKET;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        goto fail;
+
+    snprintf(line, sizeof(line), "SUBSCRIBE %x\n", mask);
+    if (send(sock, line, strlen(line), MSG_NOSIGNAL) < 0)
+        goto fail;
+    if (recv_reply(sock, line, sizeof(line), memfd) < 0)
+        goto fail;
+    if (sscanf(line, "OK %d", &slot) != 1 || memfd[0] < 0 || memfd[1] < 0 ||
+        slot < 0 || slot >= WII_SHM_MAX_CLIENTS) {
+        errno = EPROTO;
+        goto fail;
+    }
+
+    /* the ring is sealed, asking for PROT_WRITE here would just get EPERM */
+    r = mmap(NULL, sizeof(*r), PROT_READ, MAP_SHARED, memfd[0], 0);
+    if (r == MAP_FAILED)
+        goto fail;
+    if (r->magic != WII_SHM_MAGIC || r->version != WII_SHM_VERSION ||
+        r->slots != WII_SHM_SLOTS) {
+        errno = EPROTO;
+        goto fail;
+    }
+    c = mmap(NULL, sizeof(*c), PROT_READ | PROT_WRITE, MAP_SHARED, memfd[1], 0);
+    if (c == MAP_FAILED)
+        goto fail;
+    close(memfd[0]);
+    close(memfd[1]);
+
+    *ring = r;
+    *client = c;
+    return sock;
+
+fail:
+    {
+        int err = errno;
+        if (r != MAP_FAILED)
+            munmap(r, sizeof(*r));
+        if (memfd[0] >= 0)
+            close(memfd[0]);
+        if (memfd[1] >= 0)
+            close(memfd[1]);
+        close(sock);
+        errno = err;
+    }
+    return -1;
+}
+
+void wii_shm_unsubscribe(int sock, const struct wii_shm_ring *ring, struct wii_shm_client *client)
+{
+    if (ring)
+        munmap((void *)ring, sizeof(*ring));
+    if (client)
+        munmap(client, sizeof(*client));
+    if (sock >= 0)
+        close(sock);
+}
+
+int wii_shm_wait(const struct wii_shm_ring *ring, struct wii_shm_client *client, int timeout_ms)
+{
+    struct timespec ts, *tp = NULL;
+    uint32_t val;
+    long ret;
+
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+        tp = &ts;
+    }
+
+    atomic_store(&client->waiting, 1);
+    val = atomic_load(&ring->futex);
+    /* check after setting waiting so a publish in between cant be missed */
+    if (atomic_load(&ring->head) != atomic_load_explicit(&client->cursor, memory_order_relaxed)) {
+        atomic_store(&client->waiting, 0);
+        return 0;
+    }
+    ret = futex(&ring->futex, FUTEX_WAIT, val, tp);
+    atomic_store(&client->waiting, 0);
+    if (ret < 0 && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT)
+        return -1;
+    return 0;
+}
+
+void wii_shm_wake(struct wii_shm_ring *ring, struct wii_shm_client *const *clients, int n)
+{
+    int i;
+
+    atomic_fetch_add(&ring->futex, 1);
+    /* only look after the bump, a client that sets waiting later sees the new value */
+    for (i = 0; i < n; i++) {
+        if (clients[i] && atomic_load(&clients[i]->waiting)) {
+            futex(&ring->futex, FUTEX_WAKE, INT_MAX, NULL);
+            return;
+        }
+    }
+}
@@ -0,0 +1,169 @@
+/*
+ * wii-shm.h - shared memory event ring published by wii-daemon.
+ *
+ * The daemon is the only reader of /dev/wii_remote, it decodes the lines into
+ * struct wii_event and drops them into a ring that lives in a memfd. Clients
+ * get the memfd over the daemon's unix socket (SCM_RIGHTS), mmap it, and from
+ * then on read events straight out of shared memory, no copies through the
+ * kernel and no syscalls per event.
+ *
+ * The ring is sealed against writes once the daemon has mapped it, so clients
+ * can only map it read only and one bad client cant scribble over what every
+ * other one reads. What a client does write (its cursor, lost count, if its
+ * asleep) lives in a page of its own, a second memfd that only it and the
+ * daemon have.
+ *
+ * There is one writer (the daemon) and any number of readers, each reader just
+ * keeps its own cursor. Every slot carries the sequence number of the event in
+ * it, written last, so a reader can tell if the daemon lapped it while it was
+ * copying (like a seqlock per slot).
+ *
+ * Control socket protocol, one text line per request:
+ *   "SUBSCRIBE <hex button mask>"  -> "OK <client slot>\n" + the ring memfd
+ *                                     and the client page memfd, in that order
+ *   "MASK <hex button mask>"       -> "OK\n"
+ *   "STATUS"                       -> "key: value" lines ending with ".\n"
+ * Keep the socket open for as long as you read the ring, the daemon frees
+ * your client slot when it closes.
+ */
+
+#ifndef WII_SHM_H
+#define WII_SHM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "wii-event.h"
+
+#define WII_SHM_MAGIC       0x57494953u /* "WIIS" */
+#define WII_SHM_VERSION     3
+#define WII_SHM_SLOTS       4096        /* must be a power of two */
+#define WII_SHM_MAX_CLIENTS 32
+#define WII_DAEMON_SOCKET   "/run/wii_remote.sock"
+
+/* a slot that is being rewritten reads as this so readers never trust it */
+#define WII_SHM_SEQ_BUSY    UINT64_MAX
+
+struct wii_shm_slot {
+    _Atomic uint64_t seq;
+    struct wii_event ev;
+};
+
+/*
+ * one per subscribed process in its own memfd, the daemon sets it up and the
+ * client keeps cursor up to date so STATUS can report how far behind everyone
+ * is. the daemon only ever prints what is in here, apart from waiting
+ */
+struct wii_shm_client {
+    _Atomic uint32_t mask;      /* WII_BTN_* the client cares about, 0 = everything */
+    _Atomic uint32_t waiting;   /* client is sleeping on ring->futex, daemon only wakes if set */
+    _Atomic uint64_t cursor;    /* next sequence number the client will read */
+    _Atomic uint64_t lost;      /* events the client was lapped on */
+};
+
+struct wii_shm_ring {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t max_clients;
+
+    _Atomic uint64_t head;      /* sequence number the next event gets */
+    _Atomic uint32_t futex;     /* bumped after every publish, wait on this to sleep */
+    _Atomic uint32_t connected; /* 1 while the daemon has the device open */
+    _Atomic int32_t  battery;   /* last battery level seen, -1 unknown */
+    uint32_t reserved;
+
+    struct wii_shm_slot slot[WII_SHM_SLOTS];
+};
+
+/* --- writer side, daemon only --- */
+
+static inline void wii_shm_publish(struct wii_shm_ring *ring, const struct wii_event *ev)
+{
+    uint64_t seq = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct wii_shm_slot *s = &ring->slot[seq & (WII_SHM_SLOTS - 1)];
+
+    atomic_store_explicit(&s->seq, WII_SHM_SEQ_BUSY, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    s->ev = *ev;
+    s->ev.seq = (uint32_t)seq;
+    atomic_store_explicit(&s->seq, seq, memory_order_release);
+    atomic_store_explicit(&ring->head, seq + 1, memory_order_release);
+}
+
+/* --- reader side --- */
+
+/*
+ * grabs the next event the client subscribed to
+ * returns 1 if ev was filled in, 0 if there is nothing new yet.
+ * if the daemon lapped the client the cursor jumps to the oldest event still
+ * in the ring and the skipped events are counted in client->lost
+ */
+static inline int wii_shm_next(const struct wii_shm_ring *ring, struct wii_shm_client *client,
+                               struct wii_event *ev)
+{
+    uint64_t cursor = atomic_load_explicit(&client->cursor, memory_order_relaxed);
+    uint32_t mask = atomic_load_explicit(&client->mask, memory_order_relaxed);
+
+    for (;;) {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        const struct wii_shm_slot *s;
+        uint64_t seq;
+
+        if (cursor == head)
+            break;
+
+        if (head - cursor > WII_SHM_SLOTS) {
+            atomic_fetch_add_explicit(&client->lost, head - cursor - WII_SHM_SLOTS,
+                                      memory_order_relaxed);
+            cursor = head - WII_SHM_SLOTS;
+        }
+
+        s = &ring->slot[cursor & (WII_SHM_SLOTS - 1)];
+        seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if (seq == WII_SHM_SEQ_BUSY) /* daemon is lapping us right now, try again later */
+            break;
+        if (seq != cursor) /* already rewritten, go around and catch up */
+            continue;
+        *ev = s->ev;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&s->seq, memory_order_relaxed) != cursor)
+            continue;
+
+        cursor++;
+        if (mask && ev->type == WII_EVENT_BUTTONS && !(ev->buttons & mask))
+            continue;
+        atomic_store_explicit(&client->cursor, cursor, memory_order_relaxed);
+        return 1;
+    }
+
+    atomic_store_explicit(&client->cursor, cursor, memory_order_relaxed);
+    return 0;
+}
+
+/*
+ * connects to the daemon, subscribes with mask and maps the ring (read only)
+ * and the client page. on success *ring and *client are set and the control
+ * socket fd is returned (keep it open), -1 on failure with errno set
+ */
+int wii_shm_subscribe(const char *socket_path, uint32_t mask,
+                      const struct wii_shm_ring **ring, struct wii_shm_client **client);
+
+/* unmaps the ring and the client page and closes the control socket */
+void wii_shm_unsubscribe(int sock, const struct wii_shm_ring *ring, struct wii_shm_client *client);
+
+/*
+ * sleeps until the daemon publishes something past what the client has read
+ * or timeout_ms passes (-1 to wait forever). this is the only syscall a client
+ * makes and only when it has run out of events
+ */
+int wii_shm_wait(const struct wii_shm_ring *ring, struct wii_shm_client *client, int timeout_ms);
+
+/*
+ * daemon side, wakes anyone in wii_shm_wait(). clients is the daemon's
+ * mapping of every client page (NULL for free slots), the futex syscall is
+ * skipped when none of them are waiting
+ */
+void wii_shm_wake(struct wii_shm_ring *ring, struct wii_shm_client *const *clients, int n);
+
+#endif /* WII_SHM_H */
@@ -0,0 +1,136 @@
+/*
+ * wii-uhid.c - pretend Wii remote on /dev/uhid, see wii-uhid.h
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <linux/uhid.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "wii-event.h"
+#include "wii-uhid.h"
+
+#define UHID_PATH "/dev/uhid"
+
+/*
+ * the real remote's descriptor is just a list of vendor reports with their
+ * sizes, the driver never looks at the fields. hid core does need every report
+ * id we send to be in here though or it throws the report away before
+ * wii_raw_event() sees it
+ */
+#define IN(id, n)  0x85, id, 0x09, 0x01, 0x95, n, 0x81, 0x02
+#define OUT(id, n) 0x85, id, 0x09, 0x01, 0x95, n, 0x91, 0x02
+
+static const uint8_t wii_rdesc[] = {
+    0x06, 0x00, 0xff,   /* Usage Page (Vendor Defined) */
+    0x09, 0x01,         /* Usage (Vendor Usage 1) */
+    0xa1, 0x01,         /* Collection (Application) */
+    0x15, 0x00,         /*   Logical Minimum (0) */
+    0x26, 0xff, 0x00,   /*   Logical Maximum (255) */
+    0x75, 0x08,         /*   Report Size (8) */
+    /* output reports: rumble, leds, report mode, ir, speaker, status, write/read memory ... */
+    OUT(0x10, 1), OUT(0x11, 1), OUT(0x12, 2), OUT(0x13, 1), OUT(0x14, 1), OUT(0x15, 1),
+    OUT(0x16, 21), OUT(0x17, 6), OUT(0x18, 21), OUT(0x19, 1), OUT(0x1a, 1),
+    /* input reports: status, read data, ack, then the data reporting modes */
+    IN(0x20, 6), IN(0x21, 21), IN(0x22, 4),
+    IN(0x30, 2), IN(0x31, 5), IN(0x32, 10), IN(0x33, 17), IN(0x34, 21), IN(0x35, 21),
+    IN(0x36, 21), IN(0x37, 21), IN(0x3d, 21), IN(0x3e, 21), IN(0x3f, 21),
+    0xc0                /* End Collection */
+};
+
+static int uhid_write(int fd, const struct uhid_event *ev)
+{
+    ssize_t n = write(fd, ev, sizeof(*ev));
+    if (n < 0)
+        return -1;
+    if (n != sizeof(*ev)) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+int wii_uhid_create(const char *name, int timeout_ms)
+{
+    struct uhid_event ev;
+    uint64_t deadline = wii_now_ns() + (uint64_t)timeout_ms * 1000000ull;
+    int fd, err;
+
+    fd = open(UHID_PATH, O_RDWR | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0)
+        return -1;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_CREATE2;
+    strncpy((char *)ev.u.create2.name, name, sizeof(ev.u.create2.name) - 1);
+    memcpy(ev.u.create2.rd_data, wii_rdesc, sizeof(wii_rdesc));
+    ev.u.create2.rd_size = sizeof(wii_rdesc);
+    ev.u.create2.bus = BUS_BLUETOOTH;
+    ev.u.create2.vendor = WII_UHID_VENDOR;
+    ev.u.create2.product = WII_UHID_PRODUCT;
+    if (uhid_write(fd, &ev) < 0)
+        goto fail;
+
+    /* input gets rejected until whatever driver bound to us has called hid_hw_start() */
+    for (;;) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        uint64_t now = wii_now_ns();
+
+        if (now >= deadline) {
+            errno = ETIMEDOUT;
+            goto fail;
+        }
+        if (poll(&pfd, 1, (int)((deadline - now) / 1000000ull) + 1) < 0 && errno != EINTR)
+            goto fail;
+        if (read(fd, &ev, sizeof(ev)) > 0 && ev.type == UHID_START)
+            return fd;
+    }
+
+fail:
+    err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+}
+
+int wii_uhid_send(int fd, const uint8_t *report, size_t len)
+{
+    struct uhid_event ev;
+
+    if (len > sizeof(ev.u.input2.data)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    ev.type = UHID_INPUT2;
+    ev.u.input2.size = (uint16_t)len;
+    memcpy(ev.u.input2.data, report, len);
+    /* only write the part of the event that is used, its a 4KB struct otherwise */
+    if (write(fd, &ev, offsetof(struct uhid_event, u.input2.data) + len) < 0)
+        return -1;
+    return 0;
+}
+
+int wii_uhid_drain(int fd)
+{
+    struct uhid_event ev;
+    int n = 0;
+
+    while (read(fd, &ev, sizeof(ev)) > 0)
+        n++;
+    return n;
+}
+
+void wii_uhid_destroy(int fd)
+{
+    struct uhid_event ev;
+
+    if (fd < 0)
+        return;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_DESTROY;
+    uhid_write(fd, &ev);
+    close(fd);
+}
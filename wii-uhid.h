@@ -0,0 +1,37 @@
+/*
+ * wii-uhid.h - a pretend Wii remote made with /dev/uhid.
+ *
+ * The device gets the Nintendo vendor/product ids on the bluetooth bus so the
+ * real wii_remote_driver binds to it, then every report sent through here goes
+ * through wii_raw_event() exactly like one from a real remote would.
+ * Used by wii-replay to play captures back and by the benchmarks.
+ */
+
+#ifndef WII_UHID_H
+#define WII_UHID_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WII_UHID_VENDOR  0x057e
+#define WII_UHID_PRODUCT 0x0306
+
+/*
+ * creates the device and waits (up to timeout_ms) for the kernel to start it.
+ * returns the uhid fd or -1 with errno set
+ */
+int wii_uhid_create(const char *name, int timeout_ms);
+
+/* sends one input report (report id in byte 0). returns 0 or -1 with errno set */
+int wii_uhid_send(int fd, const uint8_t *report, size_t len);
+
+/*
+ * reads and throws away anything the kernel sent us (output reports like the
+ * 0x15 status request), so uhid's queue never fills up. returns how many
+ */
+int wii_uhid_drain(int fd);
+
+/* removes the device, the driver sees a disconnect */
+void wii_uhid_destroy(int fd);
+
+#endif /* WII_UHID_H */